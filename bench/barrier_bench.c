@@ -0,0 +1,133 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../system/memzone.h"
+#include "../system/threads.h"
+#include "bench.h"
+
+// Barrier round trips: every thread does nothing but wait on the barrier, so each phase costs
+//     whatever it takes for the last arrival to get everyone else going again.
+//     park:   waiters go straight to the condition variable (the old mutex and cnd_wait barrier),
+//     hybrid: waiters spin with pause first and only park if the phase takes too long.
+// Threads are pinned one per CPU when there are enough CPUs for them. With more threads than CPUs the
+//     hybrid barrier turns its spin off, so both rows should come out about the same there.
+
+#define MAX_THREADS 16
+#define MIN_ROUNDS 10000
+
+typedef struct
+{
+	uint32_t index;
+	uint32_t rounds;
+	bool pin;
+	bool failed;
+} Worker_t;
+
+static Worker_t workers[MAX_THREADS];
+static ThreadBarrier_t barrier;
+static atomic_uint arrivals;
+
+static int BarrierThread(void *arg)
+{
+	Worker_t *worker=(Worker_t *)arg;
+
+	if(worker->pin)
+		Thread_SetAffinity(thrd_current(), Thread_GetCPU(worker->index));
+
+	for(uint32_t i=0;i<worker->rounds;i++)
+	{
+		atomic_fetch_add(&arrivals, 1);
+		ThreadBarrier_Wait(&barrier);
+
+		// Nobody gets through until everyone has arrived, and nobody can have arrived twice yet
+		const uint32_t seen=atomic_load(&arrivals);
+		const uint32_t numThreads=barrier.initCount;
+
+		if(seen<numThreads*(i+1)||seen>numThreads*(i+2))
+			worker->failed=true;
+	}
+
+	return 0;
+}
+
+// Returns average nanoseconds per phase, negative if the barrier let anyone through early
+static double RunBarrier(uint32_t numThreads, bool spin, uint32_t rounds)
+{
+	thrd_t threads[MAX_THREADS];
+
+	ThreadBarrier_Init(&barrier, numThreads);
+
+	if(!spin)
+		ThreadBarrier_SetSpin(&barrier, 0);
+
+	atomic_store(&arrivals, 0);
+
+	const bool pin=numThreads<=Thread_GetCPUCount();
+
+	for(uint32_t i=0;i<numThreads;i++)
+		workers[i]=(Worker_t){ i, rounds, pin, false };
+
+	const double start=GetClock();
+
+	// This thread is worker 0
+	for(uint32_t i=1;i<numThreads;i++)
+		thrd_create(&threads[i], BarrierThread, &workers[i]);
+
+	BarrierThread(&workers[0]);
+
+	const double elapsed=GetClock()-start;
+	bool failed=false;
+
+	for(uint32_t i=1;i<numThreads;i++)
+		thrd_join(threads[i], NULL);
+
+	for(uint32_t i=0;i<numThreads;i++)
+		failed|=workers[i].failed;
+
+	ThreadBarrier_Destroy(&barrier);
+
+	return failed?-1.0:elapsed*1e9/rounds;
+}
+
+int main(int argc, char **argv)
+{
+	uint32_t maxThreads=argc>1?(uint32_t)atoi(argv[1]):4;
+
+	if(maxThreads<2||maxThreads>MAX_THREADS)
+		maxThreads=MAX_THREADS;
+
+	zone=Zone_Init(1024*1024);
+
+	if(zone==NULL)
+		return 1;
+
+	bool valid=true;
+
+	DBGPRINTF(DEBUG_INFO, "Barrier round trips, %d CPUs:\n", Thread_GetCPUCount());
+
+	for(uint32_t numThreads=2;numThreads<=maxThreads;numThreads*=2)
+	{
+		for(uint32_t spin=0;spin<2;spin++)
+		{
+			// Keep going until the phase has had enough time, first run sizes the real one
+			uint32_t rounds=MIN_ROUNDS;
+			double perPhase=RunBarrier(numThreads, spin, rounds);
+
+			if(perPhase>0.0&&perPhase*rounds*1e-9<BENCH_MIN_TIME)
+			{
+				rounds=(uint32_t)(BENCH_MIN_TIME/(perPhase*1e-9));
+				perPhase=RunBarrier(numThreads, spin, rounds);
+			}
+
+			valid&=perPhase>0.0;
+			DBGPRINTF(DEBUG_INFO, "\t%-6s %2d threads: %9.1f ns/phase\n", spin?"hybrid":"park", numThreads, perPhase);
+		}
+	}
+
+	if(!valid)
+		DBGPRINTF(DEBUG_ERROR, "Barrier let a thread through before everyone arrived.\n");
+
+	Zone_Destroy(zone);
+
+	return valid?0:1;
+}
@@ -0,0 +1,60 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "bench.h"
+
+// Benchmarks don't link the server main, so supply the globals it normally provides
+MemZone_t *zone=NULL;
+
+double GetClock(void)
+{
+	struct timespec ts;
+
+	if(timespec_get(&ts, TIME_UTC))
+		return ts.tv_sec+(double)ts.tv_nsec/1000000000.0;
+
+	return 0.0;
+}
+
+uint8_t *Bench_LoadFile(const char *filename, size_t padding, size_t *size)
+{
+	FILE *stream=fopen(filename, "rb");
+
+	if(stream==NULL)
+	{
+		DBGPRINTF(DEBUG_ERROR, "Bench_LoadFile: Unable to open %s.\n", filename);
+		return NULL;
+	}
+
+	fseek(stream, 0, SEEK_END);
+	long length=ftell(stream);
+	fseek(stream, 0, SEEK_SET);
+
+	if(length<=0)
+	{
+		fclose(stream);
+		return NULL;
+	}
+
+	uint8_t *buffer=(uint8_t *)calloc(1, length+padding);
+
+	if(buffer==NULL)
+	{
+		fclose(stream);
+		return NULL;
+	}
+
+	if(fread(buffer, 1, length, stream)!=(size_t)length)
+	{
+		free(buffer);
+		fclose(stream);
+		return NULL;
+	}
+
+	fclose(stream);
+
+	*size=(size_t)length;
+
+	return buffer;
+}
@@ -0,0 +1,14 @@
+#ifndef __BENCH_H__
+#define __BENCH_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "../system/system.h"
+
+// Minimum wall time each benchmark phase runs for, in seconds
+#define BENCH_MIN_TIME 0.5
+
+// Read a whole file into a malloc'd buffer, with some zeroed padding past the end for over-reads
+uint8_t *Bench_LoadFile(const char *filename, size_t padding, size_t *size);
+
+#endif
@@ -0,0 +1,225 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../math/math.h"
+#include "../physics/physics.h"
+#include "../utils/serial.h"
+#include "../utils/lz4.h"
+#include "../netpacket.h"
+#include "bench.h"
+
+// Snapshot layout matches the server's field packet for a client that can see the whole field
+#define NUM_ASTEROIDS 1000
+#define NUM_FRAMES 60
+#define SNAPSHOT_PADDING 64
+
+typedef struct
+{
+	uint8_t *data;
+	size_t size;
+} Snapshot_t;
+
+// Build a run of field snapshots the same way the server does, stepping physics between frames
+static uint32_t SynthesizeSnapshots(Snapshot_t *snapshots, uint32_t numFrames)
+{
+	static RigidBody_t asteroids[NUM_ASTEROIDS];
+	const size_t size=FieldHeader_SIZE+(FieldEntry_SIZE*NUM_ASTEROIDS);
+
+	RandomSeed(12345);
+
+	for(uint32_t i=0;i<NUM_ASTEROIDS;i++)
+	{
+		vec3 randomDirection=Vec3(RandFloatRange(-1.0f, 1.0f), RandFloatRange(-1.0f, 1.0f), RandFloatRange(-1.0f, 1.0f));
+		Vec3_Normalize(&randomDirection);
+
+		asteroids[i]=(RigidBody_t){ 0 };
+		asteroids[i].position=Vec3_Muls(randomDirection, RandFloatRange(50.0f, 1000.0f));
+		asteroids[i].velocity=Vec3_Muls(randomDirection, RandFloat());
+		asteroids[i].orientation=Vec4(0.0f, 0.0f, 0.0f, 1.0f);
+		asteroids[i].angularVelocity=Vec3_Muls(randomDirection, RandFloat());
+		asteroids[i].radius=RandFloatRange(0.05f, 40.0f);
+		asteroids[i].mass=(1.0f/3000.0f)*(1.33333333f*PI*asteroids[i].radius);
+		asteroids[i].invMass=1.0f/asteroids[i].mass;
+		asteroids[i].inertia=0.4f*asteroids[i].mass*(asteroids[i].radius*asteroids[i].radius);
+		asteroids[i].invInertia=1.0f/asteroids[i].inertia;
+	}
+
+	for(uint32_t frame=0;frame<numFrames;frame++)
+	{
+		snapshots[frame].data=(uint8_t *)calloc(1, size+SNAPSHOT_PADDING);
+		snapshots[frame].size=size;
+
+		if(snapshots[frame].data==NULL)
+			return frame;
+
+		uint8_t *pBuffer=snapshots[frame].data;
+
+		FieldHeader_t header={ FIELD_PACKETMAGIC, frame, NUM_ASTEROIDS };
+		FieldHeader_Encode(&pBuffer, &header);
+
+		for(uint32_t i=0;i<NUM_ASTEROIDS;i++)
+		{
+			FieldEntry_t entry={ i, asteroids[i].position, asteroids[i].velocity, asteroids[i].orientation, asteroids[i].radius };
+			FieldEntry_Encode(&pBuffer, &entry);
+
+			PhysicsIntegrate(&asteroids[i], 1.0f/60.0f);
+		}
+	}
+
+	return numFrames;
+}
+
+int main(int argc, char **argv)
+{
+	Snapshot_t *snapshots=NULL;
+	uint32_t numSnapshots=0;
+
+	// Use recorded snapshots if any were given, otherwise make some
+	if(argc>1)
+	{
+		snapshots=(Snapshot_t *)calloc(argc-1, sizeof(Snapshot_t));
+
+		for(int i=1;i<argc;i++)
+		{
+			size_t size=0;
+			uint8_t *data=Bench_LoadFile(argv[i], SNAPSHOT_PADDING, &size);
+
+			if(data)
+				snapshots[numSnapshots++]=(Snapshot_t){ data, size };
+		}
+	}
+	else
+	{
+		snapshots=(Snapshot_t *)calloc(NUM_FRAMES, sizeof(Snapshot_t));
+		numSnapshots=SynthesizeSnapshots(snapshots, NUM_FRAMES);
+	}
+
+	if(numSnapshots==0)
+	{
+		DBGPRINTF(DEBUG_ERROR, "No snapshots to benchmark.\n");
+		return 1;
+	}
+
+	size_t maxSize=0, totalSize=0;
+
+	for(uint32_t i=0;i<numSnapshots;i++)
+	{
+		maxSize=snapshots[i].size>maxSize?snapshots[i].size:maxSize;
+		totalSize+=snapshots[i].size;
+	}
+
+	// Worst case expansion is one length byte per 255 literals plus the token, pad for the 4 byte literal copies
+	const size_t compressedCapacity=maxSize+(maxSize/255)+SNAPSHOT_PADDING;
+
+	uint8_t **compressed=(uint8_t **)calloc(numSnapshots, sizeof(uint8_t *));
+	size_t *compressedSize=(size_t *)calloc(numSnapshots, sizeof(size_t));
+	uint8_t *decompressed=(uint8_t *)malloc(maxSize);
+
+	for(uint32_t i=0;i<numSnapshots;i++)
+		compressed[i]=(uint8_t *)calloc(1, compressedCapacity);
+
+	// Compression
+	size_t totalCompressed=0;
+	uint64_t bytes=0;
+	double start=GetClock(), elapsed=0.0;
+
+	do
+	{
+		totalCompressed=0;
+
+		for(uint32_t i=0;i<numSnapshots;i++)
+		{
+			compressedSize[i]=lz4_compress(snapshots[i].data, snapshots[i].size, compressed[i]);
+			totalCompressed+=compressedSize[i];
+		}
+
+		bytes+=totalSize;
+		elapsed=GetClock()-start;
+	} while(elapsed<BENCH_MIN_TIME);
+
+	const double compressRate=(double)bytes/elapsed/1000.0/1000.0;
+
+	// Decompression, also verifies the round trip
+	for(uint32_t i=0;i<numSnapshots;i++)
+	{
+		size_t size=lz4_decompress(compressed[i], compressedSize[i], decompressed, maxSize);
+
+		if(size!=snapshots[i].size||memcmp(decompressed, snapshots[i].data, size))
+		{
+			DBGPRINTF(DEBUG_ERROR, "Snapshot %d failed round trip (%zu != %zu).\n", i, size, snapshots[i].size);
+			return 1;
+		}
+
+		if(lz4_decompress(compressed[i], compressedSize[i], NULL, 0)!=size)
+		{
+			DBGPRINTF(DEBUG_ERROR, "Snapshot %d size query mismatch.\n", i);
+			return 1;
+		}
+	}
+
+	bytes=0;
+	start=GetClock();
+
+	do
+	{
+		for(uint32_t i=0;i<numSnapshots;i++)
+			lz4_decompress(compressed[i], compressedSize[i], decompressed, maxSize);
+
+		bytes+=totalSize;
+		elapsed=GetClock()-start;
+	} while(elapsed<BENCH_MIN_TIME);
+
+	const double decompressRate=(double)bytes/elapsed/1000.0/1000.0;
+
+	// Truncated and corrupted streams must decode without touching memory out of bounds
+	uint32_t rejected=0, trials=0;
+
+	RandomSeed(54321);
+
+	for(uint32_t i=0;i<numSnapshots;i++)
+	{
+		// Nothing to truncate or corrupt
+		if(compressedSize[i]==0)
+			continue;
+
+		for(uint32_t j=0;j<64;j++, trials++)
+		{
+			uint8_t *corrupt=(uint8_t *)malloc(compressedSize[i]);
+			size_t corruptSize=compressedSize[i];
+
+			memcpy(corrupt, compressed[i], corruptSize);
+
+			// Odd trials truncate anywhere from empty to one byte short, even ones flip bytes
+			if(j&1)
+				corruptSize=Random()%corruptSize;
+			else
+			{
+				for(uint32_t k=0;k<8;k++)
+					corrupt[Random()%corruptSize]=(uint8_t)Random();
+			}
+
+			if(lz4_decompress(corrupt, corruptSize, decompressed, maxSize)==0)
+				rejected++;
+
+			free(corrupt);
+		}
+	}
+
+	DBGPRINTF(DEBUG_INFO, "%d snapshots, %0.1fKB -> %0.1fKB (ratio %0.3f)\n", numSnapshots, (float)totalSize/1000.0f, (float)totalCompressed/1000.0f, (float)totalCompressed/(float)totalSize);
+	DBGPRINTF(DEBUG_INFO, "Compress:   %0.1f MB/s\n", compressRate);
+	DBGPRINTF(DEBUG_INFO, "Decompress: %0.1f MB/s\n", decompressRate);
+	DBGPRINTF(DEBUG_INFO, "Corrupt input: %d trials decoded in bounds, %d rejected.\n", trials, rejected);
+
+	for(uint32_t i=0;i<numSnapshots;i++)
+	{
+		free(snapshots[i].data);
+		free(compressed[i]);
+	}
+
+	free(snapshots);
+	free(compressed);
+	free(compressedSize);
+	free(decompressed);
+
+	return 0;
+}
@@ -0,0 +1,446 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../system/memzone.h"
+#include "../system/threads.h"
+#include "../utils/ring.h"
+#include "../utils/queue.h"
+#include "bench.h"
+
+// Cross-thread handoff of 64 bit items:
+//     throughput: producers push a run of items as fast as they can while consumers drain them,
+//                 SPSC ring (single and batched), MPMC queue and a mutex protected ring for comparison,
+//     latency:    two threads bounce one item back and forth over a pair of channels, reported per round trip.
+// Waiting sides yield instead of spinning flat out, so this stays meaningful with fewer cores than threads.
+
+#define MAX_THREADS 8
+#define CAPACITY 1024
+#define BATCH_SIZE 32
+#define THROUGHPUT_ITEMS 4000000
+#define LATENCY_ROUNDS 200000
+
+typedef bool (*PushFunc_t)(void *channel, const uint64_t *item);
+typedef bool (*PopFunc_t)(void *channel, uint64_t *item);
+
+typedef struct
+{
+	const char *name;
+	PushFunc_t push;
+	PopFunc_t pop;
+	bool multi;						// Safe with more than one producer or consumer
+} Channel_t;
+
+// Baseline, what a handoff looks like without the lock-free structures
+typedef struct
+{
+	mtx_t mutex;
+	uint64_t buffer[CAPACITY];
+	uint32_t head, tail;
+} LockedRing_t;
+
+typedef struct
+{
+	const Channel_t *channel;
+	void *object;
+	uint32_t index;
+	uint64_t first, count;			// Producer's run of item values
+	uint64_t sum, received;			// What a consumer saw
+	atomic_ullong *remaining;		// Items left for all consumers
+	bool batch;
+	bool ordered;					// Single producer, items must arrive in order
+} Worker_t;
+
+static ThreadBarrier_t barrier;
+
+static bool RingPush(void *channel, const uint64_t *item) { return Ring_Push((Ring_t *)channel, item); }
+static bool RingPop(void *channel, uint64_t *item) { return Ring_Pop((Ring_t *)channel, item); }
+static bool QueuePush(void *channel, const uint64_t *item) { return Queue_Push((Queue_t *)channel, item); }
+static bool QueuePop(void *channel, uint64_t *item) { return Queue_Pop((Queue_t *)channel, item); }
+
+static bool LockedPush(void *channel, const uint64_t *item)
+{
+	LockedRing_t *ring=(LockedRing_t *)channel;
+	bool pushed=false;
+
+	mtx_lock(&ring->mutex);
+
+	if(ring->head-ring->tail<CAPACITY)
+	{
+		ring->buffer[ring->head++%CAPACITY]=*item;
+		pushed=true;
+	}
+
+	mtx_unlock(&ring->mutex);
+
+	return pushed;
+}
+
+static bool LockedPop(void *channel, uint64_t *item)
+{
+	LockedRing_t *ring=(LockedRing_t *)channel;
+	bool popped=false;
+
+	mtx_lock(&ring->mutex);
+
+	if(ring->head!=ring->tail)
+	{
+		*item=ring->buffer[ring->tail++%CAPACITY];
+		popped=true;
+	}
+
+	mtx_unlock(&ring->mutex);
+
+	return popped;
+}
+
+static const Channel_t channels[]=
+{
+	{ "spsc",   RingPush,   RingPop,   false },
+	{ "mpmc",   QueuePush,  QueuePop,  true },
+	{ "mutex",  LockedPush, LockedPop, true },
+};
+
+static void *CreateChannel(const Channel_t *channel)
+{
+	if(channel->push==RingPush)
+	{
+		Ring_t *ring=(Ring_t *)Zone_Malloc(zone, sizeof(Ring_t));
+
+		if(ring&&Ring_Init(ring, sizeof(uint64_t), CAPACITY))
+			return ring;
+
+		Zone_Free(zone, ring);
+	}
+	else if(channel->push==QueuePush)
+	{
+		Queue_t *queue=(Queue_t *)Zone_Malloc(zone, sizeof(Queue_t));
+
+		if(queue&&Queue_Init(queue, sizeof(uint64_t), CAPACITY))
+			return queue;
+
+		Zone_Free(zone, queue);
+	}
+	else
+	{
+		LockedRing_t *ring=(LockedRing_t *)Zone_Malloc(zone, sizeof(LockedRing_t));
+
+		if(ring)
+		{
+			memset(ring, 0, sizeof(LockedRing_t));
+			mtx_init(&ring->mutex, mtx_plain);
+			return ring;
+		}
+	}
+
+	return NULL;
+}
+
+static void DestroyChannel(const Channel_t *channel, void *object)
+{
+	if(channel->push==RingPush)
+		Ring_Destroy((Ring_t *)object);
+	else if(channel->push==QueuePush)
+		Queue_Destroy((Queue_t *)object);
+	else
+		mtx_destroy(&((LockedRing_t *)object)->mutex);
+
+	Zone_Free(zone, object);
+}
+
+static int ProducerThread(void *arg)
+{
+	Worker_t *worker=(Worker_t *)arg;
+
+	ThreadBarrier_Wait(&barrier);
+
+	if(worker->batch)
+	{
+		uint64_t items[BATCH_SIZE];
+		uint64_t next=worker->first;
+		const uint64_t end=worker->first+worker->count;
+
+		while(next<end)
+		{
+			const uint32_t count=(end-next)<BATCH_SIZE?(uint32_t)(end-next):BATCH_SIZE;
+
+			for(uint32_t i=0;i<count;i++)
+				items[i]=next+i;
+
+			uint32_t pushed=0;
+
+			while(pushed<count)
+			{
+				const uint32_t n=Ring_PushBatch((Ring_t *)worker->object, items+pushed, count-pushed);
+
+				if(n==0)
+					thrd_yield();
+
+				pushed+=n;
+			}
+
+			next+=count;
+		}
+
+		return 0;
+	}
+
+	for(uint64_t i=0;i<worker->count;i++)
+	{
+		const uint64_t item=worker->first+i;
+
+		while(!worker->channel->push(worker->object, &item))
+			thrd_yield();
+	}
+
+	return 0;
+}
+
+static int ConsumerThread(void *arg)
+{
+	Worker_t *worker=(Worker_t *)arg;
+	uint64_t expected=0;
+	bool inOrder=true;
+
+	ThreadBarrier_Wait(&barrier);
+
+	if(worker->batch)
+	{
+		uint64_t items[BATCH_SIZE];
+
+		while(atomic_load_explicit(worker->remaining, memory_order_relaxed))
+		{
+			const uint32_t count=Ring_PopBatch((Ring_t *)worker->object, items, BATCH_SIZE);
+
+			if(count==0)
+			{
+				thrd_yield();
+				continue;
+			}
+
+			for(uint32_t i=0;i<count;i++)
+			{
+				inOrder&=items[i]==expected++;
+				worker->sum+=items[i];
+			}
+
+			worker->received+=count;
+			atomic_fetch_sub_explicit(worker->remaining, count, memory_order_relaxed);
+		}
+	}
+	else
+	{
+		uint64_t item;
+
+		// Claim an item before popping it, so consumers know when to stop without a sentinel
+		while(atomic_load_explicit(worker->remaining, memory_order_relaxed))
+		{
+			uint64_t left=atomic_load_explicit(worker->remaining, memory_order_relaxed);
+
+			if(left==0||!atomic_compare_exchange_weak_explicit(worker->remaining, &left, left-1, memory_order_relaxed, memory_order_relaxed))
+				continue;
+
+			while(!worker->channel->pop(worker->object, &item))
+				thrd_yield();
+
+			inOrder&=!worker->ordered||item==expected++;
+			worker->sum+=item;
+			worker->received++;
+		}
+	}
+
+	if(!inOrder)
+		worker->received=0;
+
+	return 0;
+}
+
+// Returns items per second, zero if anything went missing or arrived out of order
+static double RunThroughput(const Channel_t *channel, uint32_t numProducers, uint32_t numConsumers, bool batch)
+{
+	Worker_t producers[MAX_THREADS], consumers[MAX_THREADS];
+	thrd_t threads[MAX_THREADS*2];
+	atomic_ullong remaining;
+	void *object=CreateChannel(channel);
+
+	if(object==NULL)
+		return 0.0;
+
+	const uint64_t perProducer=THROUGHPUT_ITEMS/numProducers;
+	const uint64_t total=perProducer*numProducers;
+
+	atomic_init(&remaining, total);
+	ThreadBarrier_Init(&barrier, numProducers+numConsumers+1);
+
+	for(uint32_t i=0;i<numProducers;i++)
+	{
+		memset(&producers[i], 0, sizeof(Worker_t));
+		producers[i].channel=channel;
+		producers[i].object=object;
+		producers[i].index=i;
+		producers[i].first=perProducer*i;
+		producers[i].count=perProducer;
+		producers[i].batch=batch;
+		thrd_create(&threads[i], ProducerThread, &producers[i]);
+	}
+
+	for(uint32_t i=0;i<numConsumers;i++)
+	{
+		memset(&consumers[i], 0, sizeof(Worker_t));
+		consumers[i].channel=channel;
+		consumers[i].object=object;
+		consumers[i].index=i;
+		consumers[i].remaining=&remaining;
+		consumers[i].batch=batch;
+		consumers[i].ordered=numProducers==1&&numConsumers==1;
+		thrd_create(&threads[numProducers+i], ConsumerThread, &consumers[i]);
+	}
+
+	ThreadBarrier_Wait(&barrier);
+
+	const double start=GetClock();
+
+	for(uint32_t i=0;i<numProducers+numConsumers;i++)
+		thrd_join(threads[i], NULL);
+
+	const double elapsed=GetClock()-start;
+
+	uint64_t sum=0, received=0;
+
+	for(uint32_t i=0;i<numConsumers;i++)
+	{
+		sum+=consumers[i].sum;
+		received+=consumers[i].received;
+	}
+
+	DestroyChannel(channel, object);
+
+	// Items are 0..total-1, each exactly once
+	if(received!=total||sum!=total*(total-1)/2)
+	{
+		DBGPRINTF(DEBUG_ERROR, "\t%s: received %llu of %llu items, checksum %s.\n", channel->name, (unsigned long long)received, (unsigned long long)total, sum==total*(total-1)/2?"ok":"wrong");
+		return 0.0;
+	}
+
+	return (double)total/elapsed;
+}
+
+typedef struct
+{
+	const Channel_t *channel;
+	void *ping, *pong;
+	uint32_t rounds;
+} PingPong_t;
+
+static int EchoThread(void *arg)
+{
+	PingPong_t *pingPong=(PingPong_t *)arg;
+	uint64_t item;
+
+	ThreadBarrier_Wait(&barrier);
+
+	for(uint32_t i=0;i<pingPong->rounds;i++)
+	{
+		while(!pingPong->channel->pop(pingPong->ping, &item))
+			thrd_yield();
+
+		while(!pingPong->channel->push(pingPong->pong, &item))
+			thrd_yield();
+	}
+
+	return 0;
+}
+
+// Returns average nanoseconds per round trip
+static double RunLatency(const Channel_t *channel)
+{
+	PingPong_t pingPong={ channel, CreateChannel(channel), CreateChannel(channel), LATENCY_ROUNDS };
+	thrd_t thread;
+	double elapsed=0.0;
+
+	if(pingPong.ping&&pingPong.pong)
+	{
+		ThreadBarrier_Init(&barrier, 2);
+		thrd_create(&thread, EchoThread, &pingPong);
+		ThreadBarrier_Wait(&barrier);
+
+		const double start=GetClock();
+
+		for(uint64_t i=0;i<LATENCY_ROUNDS;i++)
+		{
+			uint64_t item=i;
+
+			while(!channel->push(pingPong.ping, &item))
+				thrd_yield();
+
+			while(!channel->pop(pingPong.pong, &item))
+				thrd_yield();
+		}
+
+		elapsed=GetClock()-start;
+		thrd_join(thread, NULL);
+	}
+
+	if(pingPong.ping)
+		DestroyChannel(channel, pingPong.ping);
+
+	if(pingPong.pong)
+		DestroyChannel(channel, pingPong.pong);
+
+	return elapsed*1e9/LATENCY_ROUNDS;
+}
+
+int main(int argc, char **argv)
+{
+	uint32_t maxThreads=argc>1?(uint32_t)atoi(argv[1]):4;
+
+	if(maxThreads<1||maxThreads>MAX_THREADS)
+		maxThreads=MAX_THREADS;
+
+	zone=Zone_Init(16*1024*1024);
+
+	if(zone==NULL)
+		return 1;
+
+	bool valid=true;
+
+	DBGPRINTF(DEBUG_INFO, "Throughput, %d items, capacity %d:\n", THROUGHPUT_ITEMS, CAPACITY);
+
+	for(uint32_t c=0;c<sizeof(channels)/sizeof(channels[0]);c++)
+	{
+		const double rate=RunThroughput(&channels[c], 1, 1, false);
+
+		valid&=rate>0.0;
+		DBGPRINTF(DEBUG_INFO, "\t%-6s 1P/1C: %7.2f Mitems/s\n", channels[c].name, rate/1e6);
+
+		if(channels[c].push==RingPush)
+		{
+			const double batchRate=RunThroughput(&channels[c], 1, 1, true);
+
+			valid&=batchRate>0.0;
+			DBGPRINTF(DEBUG_INFO, "\t%-6s 1P/1C: %7.2f Mitems/s (batches of %d)\n", channels[c].name, batchRate/1e6, BATCH_SIZE);
+		}
+
+		if(!channels[c].multi)
+			continue;
+
+		for(uint32_t numThreads=2;numThreads<=maxThreads;numThreads*=2)
+		{
+			const double multiRate=RunThroughput(&channels[c], numThreads, numThreads, false);
+
+			valid&=multiRate>0.0;
+			DBGPRINTF(DEBUG_INFO, "\t%-6s %dP/%dC: %7.2f Mitems/s\n", channels[c].name, numThreads, numThreads, multiRate/1e6);
+		}
+	}
+
+	DBGPRINTF(DEBUG_INFO, "Latency, %d round trips:\n", LATENCY_ROUNDS);
+
+	for(uint32_t c=0;c<sizeof(channels)/sizeof(channels[0]);c++)
+		DBGPRINTF(DEBUG_INFO, "\t%-6s %8.1f ns/round trip\n", channels[c].name, RunLatency(&channels[c]));
+
+	if(!valid)
+		DBGPRINTF(DEBUG_ERROR, "Items were lost, duplicated or reordered.\n");
+
+	Zone_Destroy(zone);
+
+	return valid?0:1;
+}
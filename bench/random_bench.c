@@ -0,0 +1,95 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../math/math.h"
+#include "bench.h"
+
+// Uniform float generation, in blocks the size of a typical batch consumer:
+//     shared:  the old global Random()/RandFloat() generator,
+//     scalar:  Random_Float one at a time on a Random_t,
+//     batched: Random_FillFloats (eight lanes at a time with AVX2).
+// Scalar and batched have to produce the same floats from the same seed, that's checked first.
+
+#define BLOCK_SIZE 4096
+
+static float block[BLOCK_SIZE];
+static volatile float sink;
+
+// Generator the scalar and batched fills draw from, reseeded for each run
+static Random_t rng;
+
+static void FillShared(float *out, uint32_t count)
+{
+	for(uint32_t i=0;i<count;i++)
+		out[i]=RandFloat();
+}
+
+static void FillScalar(float *out, uint32_t count)
+{
+	for(uint32_t i=0;i<count;i++)
+		out[i]=Random_Float(&rng);
+}
+
+static void FillBatched(float *out, uint32_t count)
+{
+	Random_FillFloats(&rng, out, count);
+}
+
+typedef void (*FillFunc_t)(float *out, uint32_t count);
+
+// Returns floats per second
+static double RunFill(FillFunc_t fill)
+{
+	Random_Init(&rng, 12345, 0);
+	RandomSeed(12345);
+
+	uint64_t count=0;
+	const double start=GetClock();
+	double elapsed=0.0;
+
+	do
+	{
+		for(uint32_t i=0;i<64;i++)
+		{
+			fill(block, BLOCK_SIZE);
+			sink=block[i];
+		}
+
+		count+=64*BLOCK_SIZE;
+		elapsed=GetClock()-start;
+	} while(elapsed<BENCH_MIN_TIME);
+
+	return (double)count/elapsed;
+}
+
+int main(void)
+{
+	// Odd sizes so the scalar tail after the eight wide blocks gets checked too
+	bool valid=true;
+
+	for(uint32_t count=0;count<100;count+=7)
+	{
+		Random_t a, b;
+		float scalar[100], batched[100];
+
+		Random_Init(&a, count, count);
+		b=a;
+
+		for(uint32_t i=0;i<count;i++)
+			scalar[i]=Random_Float(&a);
+
+		Random_FillFloats(&b, batched, count);
+
+		valid&=memcmp(scalar, batched, count*sizeof(float))==0&&a.state==b.state;
+	}
+
+	DBGPRINTF(DEBUG_INFO, "Uniform floats, blocks of %d:\n", BLOCK_SIZE);
+	DBGPRINTF(DEBUG_INFO, "\tshared  %8.1f Mfloats/s\n", RunFill(FillShared)/1e6);
+	DBGPRINTF(DEBUG_INFO, "\tscalar  %8.1f Mfloats/s\n", RunFill(FillScalar)/1e6);
+	DBGPRINTF(DEBUG_INFO, "\tbatched %8.1f Mfloats/s\n", RunFill(FillBatched)/1e6);
+
+	if(!valid)
+		DBGPRINTF(DEBUG_ERROR, "Batched floats don't match the scalar sequence.\n");
+
+	return valid?0:1;
+}
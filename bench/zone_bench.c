@@ -0,0 +1,147 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../math/math.h"
+#include "../system/memzone.h"
+#include "bench.h"
+
+// Allocation heavy workload on the zone allocator:
+//     fill:  allocate N live blocks of random size,
+//     churn: free a random live block and allocate a new one in its place,
+//     free:  free every block in random order.
+// Built twice, once against system/memzone.c and once against the old first-fit allocator (zone_bench_firstfit).
+
+#define MIN_BLOCK_SIZE 8
+#define MAX_BLOCK_SIZE 256
+
+// First-fit is quadratic, so cap each phase and report how far it got
+#define PHASE_TIME_LIMIT 5.0
+
+static const uint32_t liveCounts[]={ 10000, 100000, 1000000 };
+
+static uint32_t RandomBlockSize(void)
+{
+	return MIN_BLOCK_SIZE+(Random()%(MAX_BLOCK_SIZE-MIN_BLOCK_SIZE+1));
+}
+
+static void ReportPhase(const char *name, uint32_t ops, uint32_t target, double elapsed)
+{
+	if(ops<target)
+		DBGPRINTF(DEBUG_WARNING, "\t%-6s %8d/%-8d ops in %0.2fs (hit time limit), %8.1f ns/op\n", name, ops, target, elapsed, elapsed*1e9/(ops?ops:1));
+	else
+		DBGPRINTF(DEBUG_INFO, "\t%-6s %8d ops in %0.3fs, %8.1f ns/op\n", name, ops, elapsed, elapsed*1e9/(ops?ops:1));
+}
+
+static bool RunWorkload(uint32_t numLive)
+{
+	// Worst case per block is the largest request plus header and alignment, leave room for fragmentation
+	const size_t zoneSize=(size_t)numLive*(MAX_BLOCK_SIZE+64)*2;
+
+	zone=Zone_Init(zoneSize);
+
+	if(zone==NULL)
+		return false;
+
+	void **blocks=(void **)calloc(numLive, sizeof(void *));
+
+	if(blocks==NULL)
+	{
+		Zone_Destroy(zone);
+		return false;
+	}
+
+	DBGPRINTF(DEBUG_INFO, "%d live blocks, %d-%d bytes, %0.1fMB zone:\n", numLive, MIN_BLOCK_SIZE, MAX_BLOCK_SIZE, (float)zoneSize/1000.0f/1000.0f);
+
+	RandomSeed(numLive);
+
+	// Fill
+	uint32_t numFilled=0;
+	double start=GetClock(), elapsed=0.0;
+
+	while(numFilled<numLive)
+	{
+		blocks[numFilled]=Zone_Malloc(zone, RandomBlockSize());
+
+		if(blocks[numFilled]==NULL)
+			break;
+
+		numFilled++;
+
+		if((numFilled&255)==0&&(elapsed=GetClock()-start)>PHASE_TIME_LIMIT)
+			break;
+	}
+
+	elapsed=GetClock()-start;
+	ReportPhase("fill", numFilled, numLive, elapsed);
+
+	// Churn over whatever was filled, same number of operations as live blocks
+	uint32_t numChurned=0;
+	start=GetClock();
+
+	while(numFilled&&numChurned<numLive)
+	{
+		const uint32_t index=Random()%numFilled;
+
+		Zone_Free(zone, blocks[index]);
+		blocks[index]=Zone_Malloc(zone, RandomBlockSize());
+
+		if(blocks[index]==NULL)
+			break;
+
+		numChurned++;
+
+		if((numChurned&255)==0&&(elapsed=GetClock()-start)>PHASE_TIME_LIMIT)
+			break;
+	}
+
+	elapsed=GetClock()-start;
+	ReportPhase("churn", numChurned, numLive, elapsed);
+
+	bool valid=Zone_VerifyHeap(zone);
+
+	// Free all in random order
+	for(uint32_t i=numFilled;i>1;i--)
+	{
+		const uint32_t j=Random()%i;
+		void *temp=blocks[i-1];
+
+		blocks[i-1]=blocks[j];
+		blocks[j]=temp;
+	}
+
+	uint32_t numFreed=0;
+	start=GetClock();
+
+	while(numFreed<numFilled)
+	{
+		Zone_Free(zone, blocks[numFreed++]);
+
+		if((numFreed&255)==0&&(elapsed=GetClock()-start)>PHASE_TIME_LIMIT)
+			break;
+	}
+
+	elapsed=GetClock()-start;
+	ReportPhase("free", numFreed, numFilled, elapsed);
+
+	if(numFreed==numFilled)
+		valid&=Zone_VerifyHeap(zone);
+
+	if(!valid)
+		DBGPRINTF(DEBUG_ERROR, "\tHeap failed verification.\n");
+
+	free(blocks);
+	Zone_Destroy(zone);
+	zone=NULL;
+
+	return valid;
+}
+
+int main(void)
+{
+	bool valid=true;
+
+	for(uint32_t i=0;i<sizeof(liveCounts)/sizeof(liveCounts[0]);i++)
+		valid&=RunWorkload(liveCounts[i]);
+
+	return valid?0:1;
+}
@@ -0,0 +1,184 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../system/memzone.h"
+#include "../system/threads.h"
+#include "bench.h"
+
+// Multithreaded allocation on one shared zone:
+//     local:  each thread churns its own working set of blocks,
+//     remote: each thread frees the blocks its neighbour allocated (exercises the deferred return lists).
+// Run with small (thread cached) and large (zone mutex) sizes, at 1 up to MAX_THREADS threads.
+
+#define MAX_THREADS 16
+#define WORKING_SET 4096
+#define LOCAL_OPS 1000000
+#define REMOTE_ROUNDS 200
+
+typedef struct
+{
+	uint32_t index;
+	uint32_t numThreads;
+	uint32_t minSize, maxSize;
+	uint32_t seed;
+	bool failed;
+	void *blocks[WORKING_SET];
+} Worker_t;
+
+static Worker_t workers[MAX_THREADS];
+static ThreadBarrier_t barrier;
+
+// Per thread xorshift, the math library's generator is shared state
+static inline uint32_t NextRandom(uint32_t *state)
+{
+	uint32_t x=*state;
+
+	x^=x<<13;
+	x^=x>>17;
+	x^=x<<5;
+
+	return *state=x;
+}
+
+static inline uint32_t RandomBlockSize(Worker_t *worker)
+{
+	return worker->minSize+(NextRandom(&worker->seed)%(worker->maxSize-worker->minSize+1));
+}
+
+static int LocalThread(void *arg)
+{
+	Worker_t *worker=(Worker_t *)arg;
+
+	for(uint32_t i=0;i<WORKING_SET;i++)
+		worker->blocks[i]=Zone_Malloc(zone, RandomBlockSize(worker));
+
+	for(uint32_t i=0;i<LOCAL_OPS;i++)
+	{
+		const uint32_t index=NextRandom(&worker->seed)%WORKING_SET;
+
+		Zone_Free(zone, worker->blocks[index]);
+
+		if((worker->blocks[index]=Zone_Malloc(zone, RandomBlockSize(worker)))==NULL)
+		{
+			worker->failed=true;
+			break;
+		}
+	}
+
+	for(uint32_t i=0;i<WORKING_SET;i++)
+		Zone_Free(zone, worker->blocks[i]);
+
+	return 0;
+}
+
+static int RemoteThread(void *arg)
+{
+	Worker_t *worker=(Worker_t *)arg;
+	Worker_t *neighbour=&workers[(worker->index+1)%worker->numThreads];
+
+	for(uint32_t round=0;round<REMOTE_ROUNDS;round++)
+	{
+		for(uint32_t i=0;i<WORKING_SET;i++)
+		{
+			if((worker->blocks[i]=Zone_Malloc(zone, RandomBlockSize(worker)))==NULL)
+				worker->failed=true;
+		}
+
+		ThreadBarrier_Wait(&barrier);
+
+		for(uint32_t i=0;i<WORKING_SET;i++)
+			Zone_Free(zone, neighbour->blocks[i]);
+
+		ThreadBarrier_Wait(&barrier);
+	}
+
+	return 0;
+}
+
+// Returns operations (malloc+free pairs) per second
+static double RunThreads(thrd_start_t function, uint32_t numThreads, uint32_t minSize, uint32_t maxSize, uint64_t opsPerThread, bool *valid)
+{
+	thrd_t threads[MAX_THREADS];
+
+	ThreadBarrier_Init(&barrier, numThreads);
+
+	for(uint32_t i=0;i<numThreads;i++)
+	{
+		memset(&workers[i], 0, sizeof(Worker_t));
+		workers[i].index=i;
+		workers[i].numThreads=numThreads;
+		workers[i].minSize=minSize;
+		workers[i].maxSize=maxSize;
+		workers[i].seed=0x9E3779B9u*(i+1);
+	}
+
+	const double start=GetClock();
+
+	for(uint32_t i=0;i<numThreads;i++)
+		thrd_create(&threads[i], function, &workers[i]);
+
+	for(uint32_t i=0;i<numThreads;i++)
+	{
+		thrd_join(threads[i], NULL);
+		*valid&=!workers[i].failed;
+	}
+
+	const double elapsed=GetClock()-start;
+
+	*valid&=Zone_VerifyHeap(zone);
+
+	return (double)(opsPerThread*numThreads)/elapsed;
+}
+
+int main(int argc, char **argv)
+{
+	const struct
+	{
+		const char *name;
+		uint32_t minSize, maxSize;
+	} sizes[]=
+	{
+		{ "small", 16, 256 },
+		{ "large", 600, 2048 },
+	};
+
+	uint32_t maxThreads=argc>1?(uint32_t)atoi(argv[1]):8;
+
+	if(maxThreads<1||maxThreads>MAX_THREADS)
+		maxThreads=MAX_THREADS;
+
+	zone=Zone_Init((size_t)MAX_THREADS*WORKING_SET*2048*2);
+
+	if(zone==NULL)
+		return 1;
+
+	bool valid=true;
+
+	for(uint32_t s=0;s<sizeof(sizes)/sizeof(sizes[0]);s++)
+	{
+		double localBase=0.0, remoteBase=0.0;
+
+		DBGPRINTF(DEBUG_INFO, "%s blocks (%d-%d bytes):\n", sizes[s].name, sizes[s].minSize, sizes[s].maxSize);
+
+		for(uint32_t numThreads=1;numThreads<=maxThreads;numThreads*=2)
+		{
+			const double local=RunThreads(LocalThread, numThreads, sizes[s].minSize, sizes[s].maxSize, LOCAL_OPS+WORKING_SET, &valid);
+			const double remote=RunThreads(RemoteThread, numThreads, sizes[s].minSize, sizes[s].maxSize, (uint64_t)REMOTE_ROUNDS*WORKING_SET, &valid);
+
+			if(numThreads==1)
+			{
+				localBase=local;
+				remoteBase=remote;
+			}
+
+			DBGPRINTF(DEBUG_INFO, "\t%2d threads: local %7.2f Mops/s (x%0.2f), remote %7.2f Mops/s (x%0.2f)\n", numThreads, local/1e6, local/localBase, remote/1e6, remote/remoteBase);
+		}
+	}
+
+	if(!valid)
+		DBGPRINTF(DEBUG_ERROR, "Allocation failed or heap failed verification.\n");
+
+	Zone_Destroy(zone);
+
+	return valid?0:1;
+}
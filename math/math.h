@@ -189,6 +189,25 @@ inline static float rad2deg(const float x)
 
 float fact(const int32_t n);
 
+// PCG32 generator state, one per thread or task so parallel code gets the same numbers as serial code.
+// Streams from the same seed are independent sequences, Random_Advance jumps ahead within one.
+typedef struct
+{
+	uint64_t state;
+	uint64_t increment;			// Selects the stream, always odd
+} Random_t;
+
+void Random_Init(Random_t *rng, uint64_t seed, uint64_t stream);
+uint32_t Random_Next(Random_t *rng);
+uint32_t Random_Bounded(Random_t *rng, uint32_t bound);
+int32_t Random_Range(Random_t *rng, int32_t min, int32_t max);
+float Random_Float(Random_t *rng);
+float Random_FloatRange(Random_t *rng, float min, float max);
+void Random_Advance(Random_t *rng, uint64_t delta);
+void Random_FillFloats(Random_t *rng, float *out, uint32_t count);
+
+// Shared generator, not thread safe. Anything that might run in parallel, or needs to come out the
+//     same for a given seed, should use its own Random_t instead.
 void RandomSeed(uint32_t seed);
 uint32_t Random(void);
 int32_t RandRange(int32_t min, int32_t max);
@@ -0,0 +1,220 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <threads.h>
+#if defined(__x86_64__)||defined(_M_X64)
+#include <immintrin.h>
+#endif
+#include "math.h"
+
+// PCG32 (XSH-RR), 64 bit LCG state with a permuted 32 bit output.
+// Advancing the LCG n steps is itself an LCG step with multiplier A^n and increment C*(A^(n-1)+...+1),
+//     which is how jump-ahead works and how the SIMD fill runs eight consecutive outputs side by side.
+
+#define PCG_MULTIPLIER 6364136223846793005ull
+
+static inline uint32_t pcgOutput(uint64_t state)
+{
+	const uint32_t xorShifted=(uint32_t)(((state>>18u)^state)>>27u);
+	const uint32_t rotate=(uint32_t)(state>>59u);
+
+	return (xorShifted>>rotate)|(xorShifted<<((32u-rotate)&31u));
+}
+
+// Multiplier and increment that advance the state delta steps in one go
+static void pcgAdvanceCoefficients(uint64_t delta, uint64_t increment, uint64_t *multiplier, uint64_t *plus)
+{
+	uint64_t accMultiplier=1, accPlus=0;
+	uint64_t curMultiplier=PCG_MULTIPLIER, curPlus=increment;
+
+	while(delta)
+	{
+		if(delta&1)
+		{
+			accMultiplier*=curMultiplier;
+			accPlus=accPlus*curMultiplier+curPlus;
+		}
+
+		curPlus=(curMultiplier+1)*curPlus;
+		curMultiplier*=curMultiplier;
+		delta>>=1;
+	}
+
+	*multiplier=accMultiplier;
+	*plus=accPlus;
+}
+
+// Same seed and stream always give the same sequence, different streams from one seed don't overlap
+void Random_Init(Random_t *rng, uint64_t seed, uint64_t stream)
+{
+	rng->state=0;
+	rng->increment=(stream<<1u)|1u;
+
+	Random_Next(rng);
+	rng->state+=seed;
+	Random_Next(rng);
+}
+
+uint32_t Random_Next(Random_t *rng)
+{
+	const uint64_t state=rng->state;
+
+	rng->state=state*PCG_MULTIPLIER+rng->increment;
+
+	return pcgOutput(state);
+}
+
+// Uniform in [0, bound) without modulo bias (Lemire's multiply and reject)
+uint32_t Random_Bounded(Random_t *rng, uint32_t bound)
+{
+	if(bound==0)
+		return 0;
+
+	uint64_t m=(uint64_t)Random_Next(rng)*bound;
+
+	if((uint32_t)m<bound)
+	{
+		const uint32_t threshold=(0u-bound)%bound;
+
+		while((uint32_t)m<threshold)
+			m=(uint64_t)Random_Next(rng)*bound;
+	}
+
+	return (uint32_t)(m>>32);
+}
+
+// Uniform in [min, max], inclusive
+int32_t Random_Range(Random_t *rng, int32_t min, int32_t max)
+{
+	const uint32_t span=(uint32_t)((int64_t)max-(int64_t)min)+1u;
+
+	// Whole 32 bit range
+	if(span==0)
+		return (int32_t)Random_Next(rng);
+
+	return (int32_t)((int64_t)min+Random_Bounded(rng, span));
+}
+
+// Uniform in [0, 1), 24 bits so every value is exactly representable
+float Random_Float(Random_t *rng)
+{
+	return (float)(Random_Next(rng)>>8)*(1.0f/16777216.0f);
+}
+
+float Random_FloatRange(Random_t *rng, float min, float max)
+{
+	return ((max-min)*Random_Float(rng))+min;
+}
+
+// Skip delta outputs ahead in O(log delta), so a range of work items can each start where a serial run would be
+void Random_Advance(Random_t *rng, uint64_t delta)
+{
+	uint64_t multiplier, plus;
+
+	pcgAdvanceCoefficients(delta, rng->increment, &multiplier, &plus);
+	rng->state=rng->state*multiplier+plus;
+}
+
+#if defined(__x86_64__)||defined(_M_X64)
+#if defined(__GNUC__)||defined(__clang__)
+#define RANDOM_AVX2 __attribute__((target("avx2")))
+#define RANDOM_HAS_AVX2() __builtin_cpu_supports("avx2")
+#elif defined(__AVX2__)
+#define RANDOM_AVX2
+#define RANDOM_HAS_AVX2() 1
+#endif
+#endif
+
+#ifdef RANDOM_AVX2
+// CPU check is done once, before any thread can be in the fill
+static once_flag avx2Once=ONCE_FLAG_INIT;
+static bool hasAVX2=false;
+
+static void detectAVX2(void)
+{
+	hasAVX2=RANDOM_HAS_AVX2();
+}
+
+// Low 64 bits of a 64x64 multiply per lane, AVX2 only has 32x32->64
+static inline RANDOM_AVX2 __m256i mul64(__m256i a, __m256i b)
+{
+	const __m256i low=_mm256_mul_epu32(a, b);
+	const __m256i cross=_mm256_add_epi64(_mm256_mul_epu32(_mm256_srli_epi64(a, 32), b), _mm256_mul_epu32(a, _mm256_srli_epi64(b, 32)));
+
+	return _mm256_add_epi64(low, _mm256_slli_epi64(cross, 32));
+}
+
+// pcgOutput on four states, results in the low 32 bits of each lane
+static inline RANDOM_AVX2 __m256i pcgOutput4(__m256i state)
+{
+	const __m256i mask=_mm256_set1_epi64x(0xFFFFFFFF);
+	const __m256i xorShifted=_mm256_and_si256(_mm256_srli_epi64(_mm256_xor_si256(_mm256_srli_epi64(state, 18), state), 27), mask);
+	const __m256i rotate=_mm256_srli_epi64(state, 59);
+	const __m256i left=_mm256_and_si256(_mm256_sub_epi64(_mm256_set1_epi64x(32), rotate), _mm256_set1_epi64x(31));
+
+	return _mm256_and_si256(_mm256_or_si256(_mm256_srlv_epi64(xorShifted, rotate), _mm256_sllv_epi64(xorShifted, left)), mask);
+}
+
+// Eight outputs per step, lane i runs i states ahead and every lane advances eight states at a time
+static RANDOM_AVX2 uint32_t fillFloatsAVX2(Random_t *rng, float *out, uint32_t count)
+{
+	const uint32_t numBlocks=count/8;
+
+	if(numBlocks==0)
+		return 0;
+
+	uint64_t lanes[8];
+	uint64_t state=rng->state;
+
+	for(uint32_t i=0;i<8;i++)
+	{
+		lanes[i]=state;
+		state=state*PCG_MULTIPLIER+rng->increment;
+	}
+
+	uint64_t multiplier, plus;
+	pcgAdvanceCoefficients(8, rng->increment, &multiplier, &plus);
+
+	const __m256i stepMultiplier=_mm256_set1_epi64x((int64_t)multiplier);
+	const __m256i stepPlus=_mm256_set1_epi64x((int64_t)plus);
+	const __m256i pack=_mm256_setr_epi32(0, 2, 4, 6, 1, 3, 5, 7);
+	const __m256 scale=_mm256_set1_ps(1.0f/16777216.0f);
+
+	__m256i low=_mm256_loadu_si256((const __m256i *)&lanes[0]);
+	__m256i high=_mm256_loadu_si256((const __m256i *)&lanes[4]);
+
+	for(uint32_t i=0;i<numBlocks;i++)
+	{
+		// Gather the eight 32 bit outputs into order, lanes 0-3 then 4-7
+		const __m256i lowOut=_mm256_permutevar8x32_epi32(pcgOutput4(low), pack);
+		const __m256i highOut=_mm256_permutevar8x32_epi32(pcgOutput4(high), pack);
+		const __m256i outputs=_mm256_permute2x128_si256(lowOut, highOut, 0x20);
+
+		_mm256_storeu_ps(out+i*8, _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_srli_epi32(outputs, 8)), scale));
+
+		low=_mm256_add_epi64(mul64(low, stepMultiplier), stepPlus);
+		high=_mm256_add_epi64(mul64(high, stepMultiplier), stepPlus);
+	}
+
+	// Lane 0 has advanced exactly as far as the outputs used
+	_mm256_storeu_si256((__m256i *)&lanes[0], low);
+	rng->state=lanes[0];
+
+	return numBlocks*8;
+}
+#endif
+
+// Same values Random_Float would give one at a time, eight at a time where the CPU supports AVX2
+void Random_FillFloats(Random_t *rng, float *out, uint32_t count)
+{
+	uint32_t i=0;
+
+#ifdef RANDOM_AVX2
+	call_once(&avx2Once, detectAVX2);
+
+	if(hasAVX2)
+		i=fillFloatsAVX2(rng, out, count);
+#endif
+
+	for(;i<count;i++)
+		out[i]=Random_Float(rng);
+}
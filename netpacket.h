@@ -4,8 +4,12 @@
 #include <stdint.h>
 #include <stdbool.h>
 #include "math/math.h"
+#include "utils/serial.h"
 #include "camera/camera.h"
 #include "network/network.h"
+#include "network/interest.h"
+#include "network/priority.h"
+#include "network/bandwidth.h"
 
 // Packet magic uint32's
 #define CONNECT_PACKETMAGIC		('C'|('o'<<8)|('n'<<16)|('n'<<24)) // "Conn"
@@ -16,6 +20,9 @@
 // Max number of clients
 #define MAX_CLIENTS 16
 
+// Client relevance is tracked as a 32bit mask
+_Static_assert(MAX_CLIENTS<=32, "MAX_CLIENTS must fit in InterestSet_t::clientMask");
+
 // PacketMagic determines packet type:
 //
 // Connect:
@@ -24,31 +31,97 @@
 //		Client sends disconnect magic, server closes socket and removes client from list.
 // Status:
 //		Client to server: Sends current camera data
-//		Server to client: Sends all current connected client cameras.
+//		Server to client: Sends connected client cameras that are relevant to the receiving client.
 // Field:
-//		Server sends current play field (as it sees it) to all connected clients at a regular interval.
-
-// Status buffer:
-// Magic = 4 bytes
-// connected clients = 4 bytes (could be 1 byte)
-// (potentionally) 16x:
-//		clientID = 4 bytes
-//		camera position = 12 bytes
-//		camera velocity = 12 bytes
-//		camera orientation = 16 bytes
+//		Server sends the part of the play field (as it sees it) that is relevant to each client at a regular interval.
+//
+// Relevance is decided per client from the area around its camera (see network/interest.h),
+// and of those, only the highest priority asteroids that fit the per client byte budget are sent each update (see network/priority.h).
 //
-// Worst case is 712 bytes being sent to all clients.
-
-// Field buffer:
-// Magic = 4 bytes
-// asteroid count = 4 bytes
-// (potentionally) 1000x:
-//		asteroid position = 12 bytes
-//		asteroid velocity = 12 bytes
-//		asteroid orientation = 16 bytes
-//		asteroid radius = 4 bytes
+// Server to client status and field packets carry a per client sequence number, clients ack them on their status packets.
+// RTT, loss and throughput estimated from those drive each client's field update rate and byte budget (see network/bandwidth.h).
 //
-// 44008 bytes sent to all connected clients
+// Packet layouts are defined by the schemas below, all fields are packed little endian in the order listed.
+
+// Connect, client to server:
+#define CONNECT_REQUEST_SCHEMA(X) \
+	X(uint32, magic)
+
+// Connect, server to client:
+#define CONNECT_REPLY_SCHEMA(X) \
+	X(uint32, magic) \
+	X(uint32, clientID) \
+	X(uint32, seed) \
+	X(uint32, port)
+
+// Disconnect, client to server:
+#define DISCONNECT_SCHEMA(X) \
+	X(uint32, magic) \
+	X(uint32, clientID)
+
+// Status, client to server:
+#define CLIENT_STATUS_SCHEMA(X) \
+	X(uint32, magic) \
+	X(uint32, clientID) \
+	X(vec3, position)		/* camera position */ \
+	X(vec3, velocity)		/* camera velocity */ \
+	X(vec4, orientation)	/* camera orientation */
+
+// Optionally appended to the client status (older clients don't send these):
+#define CLIENT_ACK_SCHEMA(X) \
+	X(uint32, sequence)		/* client's sequence */ \
+	X(uint32, ack)			/* newest server sequence received */ \
+	X(uint32, ackBits)		/* bit N set if server sequence ack-1-N was also received */
+
+// Status, server to client, header followed by count entries:
+#define STATUS_HEADER_SCHEMA(X) \
+	X(uint32, magic) \
+	X(uint32, sequence) \
+	X(uint32, count)		/* relevant clients */
+
+#define STATUS_ENTRY_SCHEMA(X) \
+	X(uint32, clientID) \
+	X(vec3, position)		/* camera position */ \
+	X(vec3, velocity)		/* camera velocity */ \
+	X(vec4, orientation)	/* camera orientation */
+
+// Field, server to client, header followed by count entries:
+#define FIELD_HEADER_SCHEMA(X) \
+	X(uint32, magic) \
+	X(uint32, sequence) \
+	X(uint32, count)		/* asteroids in this update */
+
+#define FIELD_ENTRY_SCHEMA(X) \
+	X(uint32, index)		/* asteroid index */ \
+	X(vec3, position) \
+	X(vec3, velocity) \
+	X(vec4, orientation) \
+	X(float, radius)
+
+SERIAL_DEFINE_PACKET(ConnectRequest, CONNECT_REQUEST_SCHEMA)
+SERIAL_DEFINE_PACKET(ConnectReply, CONNECT_REPLY_SCHEMA)
+SERIAL_DEFINE_PACKET(Disconnect, DISCONNECT_SCHEMA)
+SERIAL_DEFINE_PACKET(ClientStatus, CLIENT_STATUS_SCHEMA)
+SERIAL_DEFINE_PACKET(ClientAck, CLIENT_ACK_SCHEMA)
+SERIAL_DEFINE_PACKET(StatusHeader, STATUS_HEADER_SCHEMA)
+SERIAL_DEFINE_PACKET(StatusEntry, STATUS_ENTRY_SCHEMA)
+SERIAL_DEFINE_PACKET(FieldHeader, FIELD_HEADER_SCHEMA)
+SERIAL_DEFINE_PACKET(FieldEntry, FIELD_ENTRY_SCHEMA)
+
+// Largest packet a client can send
+#define CLIENT_PACKET_MAX_SIZE (ClientStatus_SIZE+ClientAck_SIZE)
+
+// Status goes to everyone, at most all clients
+#define STATUS_PACKET_MAX_SIZE (StatusHeader_SIZE+(StatusEntry_SIZE*MAX_CLIENTS))
+
+// Field updates are limited by the per client byte budget
+#define FIELD_PACKET_MAX_ENTRIES ((BANDWIDTH_MAX_BUDGET-FieldHeader_SIZE)/FieldEntry_SIZE)
+#define FIELD_PACKET_MAX_SIZE (FieldHeader_SIZE+(FieldEntry_SIZE*FIELD_PACKET_MAX_ENTRIES))
+
+_Static_assert(ConnectRequest_SIZE<=CLIENT_PACKET_MAX_SIZE&&Disconnect_SIZE<=CLIENT_PACKET_MAX_SIZE, "Client packets don't fit the receive buffer");
+_Static_assert(ConnectReply_SIZE<=STATUS_PACKET_MAX_SIZE, "Connect reply doesn't fit the status buffer");
+_Static_assert(FIELD_PACKET_MAX_SIZE<=BANDWIDTH_MAX_BUDGET, "Field packet exceeds the max byte budget");
+_Static_assert(FIELD_PACKET_MAX_ENTRIES>0, "Byte budget can't fit a single field entry");
 
 typedef struct
 {
@@ -60,6 +133,10 @@ typedef struct
 	double TTL;
 
 	Camera_t camera;
+
+	InterestSet_t interest;
+	PriorityAccumulator_t priority;
+	Bandwidth_t bandwidth;
 } Client_t;
 
 #endif
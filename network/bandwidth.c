@@ -0,0 +1,204 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include "../system/system.h"
+#include "../math/math.h"
+#include "bandwidth.h"
+
+// Apply controller rate to snapshot size and interval.
+// Shrink the budget first, only drop the snapshot rate once the budget is at its minimum.
+static void applyRate(Bandwidth_t *bw)
+{
+	const float minRate=(float)(BANDWIDTH_MIN_BUDGET/BANDWIDTH_MAX_INTERVAL);
+	const float maxRate=(float)(BANDWIDTH_MAX_BUDGET/BANDWIDTH_MIN_INTERVAL);
+
+	bw->targetRate=clampf(bw->targetRate, minRate, maxRate);
+
+	const float budget=bw->targetRate*(float)BANDWIDTH_MIN_INTERVAL;
+
+	if(budget>=BANDWIDTH_MIN_BUDGET)
+	{
+		bw->byteBudget=(uint32_t)budget;
+		bw->sendInterval=BANDWIDTH_MIN_INTERVAL;
+	}
+	else
+	{
+		bw->byteBudget=BANDWIDTH_MIN_BUDGET;
+		bw->sendInterval=BANDWIDTH_MIN_BUDGET/bw->targetRate;
+	}
+}
+
+void Bandwidth_Init(Bandwidth_t *bw, double time)
+{
+	if(bw==NULL)
+		return;
+
+	memset(bw, 0, sizeof(Bandwidth_t));
+
+	bw->lastControlTime=time;
+	bw->lastDecreaseTime=time;
+	bw->nextSendTime=time;
+
+	// Start at full rate, backs off once acks show otherwise
+	bw->targetRate=(float)(BANDWIDTH_MAX_BUDGET/BANDWIDTH_MIN_INTERVAL);
+	applyRate(bw);
+}
+
+// Record an outgoing packet, returns the sequence number to stamp on it
+uint32_t Bandwidth_OnSend(Bandwidth_t *bw, uint32_t size, double time)
+{
+	const uint32_t sequence=bw->nextSequence++;
+
+	bw->sent[sequence&(BANDWIDTH_HISTORY-1)]=(BandwidthPacket_t){ sequence, size, time, false };
+
+	return sequence;
+}
+
+// Track the client's own sequence numbers to see what's lost on the way in
+void Bandwidth_OnReceive(Bandwidth_t *bw, uint32_t sequence)
+{
+	if(!bw->hasRemote)
+	{
+		bw->hasRemote=true;
+		bw->remoteSequence=sequence;
+		bw->remoteReceived=1;
+		bw->remoteExpected=1;
+		return;
+	}
+
+	const int32_t delta=(int32_t)(sequence-bw->remoteSequence);
+
+	// Late or duplicate packets were already counted as lost/received
+	if(delta<=0)
+		return;
+
+	bw->remoteSequence=sequence;
+	bw->remoteReceived++;
+	bw->remoteExpected+=delta;
+
+	// Keep it a recent-ish window
+	if(bw->remoteExpected>=1024)
+	{
+		bw->remoteLoss=1.0f-(float)bw->remoteReceived/(float)bw->remoteExpected;
+		bw->remoteReceived=0;
+		bw->remoteExpected=0;
+	}
+}
+
+static void markAcked(Bandwidth_t *bw, uint32_t sequence, double time, bool sampleRTT)
+{
+	BandwidthPacket_t *packet=&bw->sent[sequence&(BANDWIDTH_HISTORY-1)];
+
+	if(packet->sequence!=sequence||packet->acked)
+		return;
+
+	// Don't trust sequences that haven't been sent yet
+	if((int32_t)(sequence-bw->nextSequence)>=0)
+		return;
+
+	packet->acked=true;
+	bw->ackedBytes+=packet->size;
+
+	if(sampleRTT)
+	{
+		const float sample=(float)(time-packet->sendTime);
+
+		// Same smoothing as TCP (RFC 6298)
+		if(!bw->hasAcks)
+		{
+			bw->rtt=sample;
+			bw->rttVar=sample*0.5f;
+			bw->minRTT=sample;
+			bw->hasAcks=true;
+		}
+		else
+		{
+			bw->rttVar=0.75f*bw->rttVar+0.25f*fabsf(bw->rtt-sample);
+			bw->rtt=0.875f*bw->rtt+0.125f*sample;
+			bw->minRTT=fminf(bw->minRTT, sample);
+		}
+	}
+}
+
+// Process an ack from the client, ack is the newest sequence it has seen,
+//     bit N of ackBits is set if it has also seen sequence ack-1-N.
+void Bandwidth_OnAck(Bandwidth_t *bw, uint32_t ack, uint32_t ackBits, double time)
+{
+	markAcked(bw, ack, time, true);
+
+	for(uint32_t i=0;i<BANDWIDTH_ACK_BITS;i++)
+	{
+		if((ackBits>>i)&1)
+			markAcked(bw, ack-1-i, time, false);
+	}
+
+	if(!bw->hasAcks)
+		return;
+
+	// Anything that has fallen behind the ack window is resolved, count it as delivered or lost
+	const uint32_t windowStart=ack-BANDWIDTH_ACK_BITS;
+
+	// Way behind, skip what's been overwritten in the history
+	if((int32_t)(windowStart-bw->lossCursor)>BANDWIDTH_HISTORY)
+		bw->lossCursor=windowStart-BANDWIDTH_HISTORY;
+
+	while((int32_t)(windowStart-bw->lossCursor)>0)
+	{
+		const BandwidthPacket_t *packet=&bw->sent[bw->lossCursor&(BANDWIDTH_HISTORY-1)];
+
+		if(packet->sequence==bw->lossCursor)
+			bw->loss=0.95f*bw->loss+0.05f*(packet->acked?0.0f:1.0f);
+
+		bw->lossCursor++;
+	}
+}
+
+// Run the estimator and AIMD controller, call once per tick
+void Bandwidth_Update(Bandwidth_t *bw, double time)
+{
+	const double elapsed=time-bw->lastControlTime;
+
+	if(elapsed<BANDWIDTH_CONTROL_PERIOD)
+		return;
+
+	bw->lastControlTime=time;
+
+	// Clients that don't send acks stay at full rate, nothing to go on
+	if(!bw->hasAcks)
+		return;
+
+	const float sample=(float)(bw->ackedBytes/elapsed);
+	bw->throughput=0.8f*bw->throughput+0.2f*sample;
+	bw->ackedBytes=0;
+
+	const bool congested=bw->loss>BANDWIDTH_LOSS_THRESHOLD||(bw->rtt-bw->minRTT)>BANDWIDTH_DELAY_THRESHOLD;
+
+	if(congested)
+	{
+		// Back off at most once per round trip, so one congestion event doesn't collapse the rate
+		if(time-bw->lastDecreaseTime>fmax(bw->rtt+4.0f*bw->rttVar, BANDWIDTH_CONTROL_PERIOD))
+		{
+			bw->targetRate*=BANDWIDTH_DECREASE;
+			bw->lastDecreaseTime=time;
+		}
+	}
+	else
+		bw->targetRate+=BANDWIDTH_INCREASE;
+
+	applyRate(bw);
+}
+
+// Check if a snapshot is due for this client
+bool Bandwidth_ShouldSend(Bandwidth_t *bw, double time)
+{
+	if(time<bw->nextSendTime)
+		return false;
+
+	bw->nextSendTime+=bw->sendInterval;
+
+	// Don't try to catch up after a stall
+	if(bw->nextSendTime<time)
+		bw->nextSendTime=time+bw->sendInterval;
+
+	return true;
+}
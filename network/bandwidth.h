@@ -0,0 +1,73 @@
+#ifndef __BANDWIDTH_H__
+#define __BANDWIDTH_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Number of sent packets remembered for matching acks, power of 2
+#define BANDWIDTH_HISTORY 256
+
+// Acks carry the newest sequence and a bitfield for the 32 before it
+#define BANDWIDTH_ACK_BITS 32
+
+// Snapshot budget limits, the low end is a single unfragmented datagram
+#define BANDWIDTH_MIN_BUDGET 1200
+#define BANDWIDTH_MAX_BUDGET (16*1024)
+
+// Snapshot interval limits, full rate is 60Hz, most congested is 5Hz
+#define BANDWIDTH_MIN_INTERVAL (1.0/60.0)
+#define BANDWIDTH_MAX_INTERVAL (1.0/5.0)
+
+// Congestion controller tuning
+#define BANDWIDTH_CONTROL_PERIOD 0.1				// Seconds between rate adjustments
+#define BANDWIDTH_LOSS_THRESHOLD 0.05f				// Smoothed loss fraction considered congested
+#define BANDWIDTH_DELAY_THRESHOLD 0.1f				// Seconds of RTT over the minimum considered congested
+#define BANDWIDTH_DECREASE 0.7f						// Multiplicative decrease
+#define BANDWIDTH_INCREASE (32.0f*1024.0f)			// Additive increase, bytes/sec per control period
+
+typedef struct
+{
+	uint32_t sequence;
+	uint32_t size;
+	double sendTime;
+	bool acked;
+} BandwidthPacket_t;
+
+typedef struct
+{
+	// Outgoing packet history
+	BandwidthPacket_t sent[BANDWIDTH_HISTORY];
+	uint32_t nextSequence;
+	uint32_t lossCursor;		// Oldest sequence not yet counted as delivered or lost
+
+	// Incoming (client's) sequence tracking
+	bool hasRemote;
+	uint32_t remoteSequence;
+	uint32_t remoteReceived, remoteExpected;
+
+	// Estimates
+	bool hasAcks;
+	float rtt, rttVar, minRTT;	// Seconds
+	float loss;					// Smoothed fraction of packets lost, server to client
+	float remoteLoss;			// Fraction of packets lost, client to server
+	float throughput;			// Smoothed acknowledged bytes/sec
+
+	uint32_t ackedBytes;
+	double lastControlTime;
+	double lastDecreaseTime;
+
+	// Controller output
+	float targetRate;			// Bytes/sec
+	uint32_t byteBudget;		// Bytes per snapshot
+	double sendInterval;		// Seconds between snapshots
+	double nextSendTime;
+} Bandwidth_t;
+
+void Bandwidth_Init(Bandwidth_t *bw, double time);
+uint32_t Bandwidth_OnSend(Bandwidth_t *bw, uint32_t size, double time);
+void Bandwidth_OnReceive(Bandwidth_t *bw, uint32_t sequence);
+void Bandwidth_OnAck(Bandwidth_t *bw, uint32_t ack, uint32_t ackBits, double time);
+void Bandwidth_Update(Bandwidth_t *bw, double time);
+bool Bandwidth_ShouldSend(Bandwidth_t *bw, double time);
+
+#endif
@@ -0,0 +1,131 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../system/system.h"
+#include "../math/math.h"
+#include "../physics/physics.h"
+#include "../physics/spatialhash.h"
+#include "interest.h"
+
+bool Interest_Init(InterestSet_t *set, uint32_t maxRelevant)
+{
+	if(set==NULL||maxRelevant==0)
+		return false;
+
+	memset(set, 0, sizeof(InterestSet_t));
+
+	set->maxRelevant=maxRelevant;
+	set->list=(uint32_t *)Zone_Malloc(zone, sizeof(uint32_t)*maxRelevant);
+
+	if(set->list==NULL)
+	{
+		DBGPRINTF(DEBUG_ERROR, "Interest_Init: Unable to allocate memory.\n");
+		Interest_Destroy(set);
+		return false;
+	}
+
+	return true;
+}
+
+typedef struct
+{
+	uint32_t index;
+	float distance;
+} InterestCandidate_t;
+
+static int compareDistance(const void *a, const void *b)
+{
+	const float distanceA=((const InterestCandidate_t *)a)->distance;
+	const float distanceB=((const InterestCandidate_t *)b)->distance;
+
+	return (distanceA>distanceB)-(distanceA<distanceB);
+}
+
+static int compareIndex(const void *a, const void *b)
+{
+	const uint32_t indexA=*(const uint32_t *)a;
+	const uint32_t indexB=*(const uint32_t *)b;
+
+	return (indexA>indexB)-(indexA<indexB);
+}
+
+// Re-evaluate which entities are relevant to a camera at position.
+// Only looks at what the hash finds around the camera, so the cost follows what's nearby, not the entity count.
+void Interest_Update(InterestSet_t *set, const SpatialHash_t *hash, const RigidBody_t *bodies, const vec3 position)
+{
+	if(set==NULL||set->list==NULL||hash==NULL)
+		return;
+
+	// Anything that could stay relevant is inside the exit radius.
+	// Count first, so the scratch (only lives for this tick) is sized by what's around the camera, not by everything in the hash.
+	const uint32_t maxCandidates=SpatialHash_QuerySphere(hash, bodies, position, INTEREST_EXIT_RADIUS, NULL, 0);
+
+	if(maxCandidates==0)
+	{
+		set->numRelevant=0;
+		return;
+	}
+
+	uint32_t *candidates=(uint32_t *)FrameArena_Alloc(&frameArena, sizeof(uint32_t)*maxCandidates);
+	InterestCandidate_t *relevant=(InterestCandidate_t *)FrameArena_Alloc(&frameArena, sizeof(InterestCandidate_t)*maxCandidates);
+
+	if(candidates==NULL||relevant==NULL)
+		return;
+
+	const uint32_t numCandidates=SpatialHash_QuerySphere(hash, bodies, position, INTEREST_EXIT_RADIUS, candidates, maxCandidates);
+
+	// Decide against the old set first, then rewrite the list
+	uint32_t count=0;
+
+	for(uint32_t i=0;i<numCandidates;i++)
+	{
+		const uint32_t index=candidates[i];
+		const float distance=Vec3_Distance(position, bodies[index].position)-bodies[index].radius;
+
+		if(Interest_Hysteresis(Interest_IsRelevant(set, index), distance))
+			relevant[count++]=(InterestCandidate_t){ index, distance };
+	}
+
+	// Too crowded, the closest ones win
+	if(count>set->maxRelevant)
+	{
+		qsort(relevant, count, sizeof(InterestCandidate_t), compareDistance);
+		count=set->maxRelevant;
+	}
+
+	for(uint32_t i=0;i<count;i++)
+		set->list[i]=relevant[i].index;
+
+	set->numRelevant=count;
+	qsort(set->list, count, sizeof(uint32_t), compareIndex);
+}
+
+// Forget entities [first, first+count), for when those indices are about to be something else
+void Interest_Remove(InterestSet_t *set, uint32_t first, uint32_t count)
+{
+	if(set==NULL||set->list==NULL)
+		return;
+
+	uint32_t kept=0;
+
+	for(uint32_t i=0;i<set->numRelevant;i++)
+	{
+		// Unsigned, anything below first wraps around past count
+		if(set->list[i]-first>=count)
+			set->list[kept++]=set->list[i];
+	}
+
+	set->numRelevant=kept;
+}
+
+void Interest_Destroy(InterestSet_t *set)
+{
+	if(set==NULL)
+		return;
+
+	if(set->list)
+		Zone_Free(zone, set->list);
+
+	memset(set, 0, sizeof(InterestSet_t));
+}
@@ -0,0 +1,57 @@
+#ifndef __INTEREST_H__
+#define __INTEREST_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "../math/math.h"
+#include "../physics/physics.h"
+#include "../physics/spatialhash.h"
+
+// Area of interest radii around a client's camera, entities enter relevance inside
+// the enter radius and only drop out past the exit radius, so they don't flicker on the edge.
+#define INTEREST_ENTER_RADIUS 500.0f
+#define INTEREST_EXIT_RADIUS 600.0f
+
+// Most entities one client can have relevant at once, the closest ones are kept past this.
+// Per client state is sized by this rather than by how many entities there are.
+#define INTEREST_MAX_RELEVANT 1024
+
+typedef struct
+{
+	uint32_t maxRelevant;
+	uint32_t numRelevant;
+	uint32_t *list;			// Relevant entity indices, ascending
+
+	uint32_t clientMask;	// Bitset of relevant clients
+} InterestSet_t;
+
+// Hysteresis rule, distance is from the camera to the surface of the entity
+static inline bool Interest_Hysteresis(const bool wasRelevant, const float distance)
+{
+	return distance<=INTEREST_ENTER_RADIUS||(wasRelevant&&distance<=INTEREST_EXIT_RADIUS);
+}
+
+// Binary search of the sorted list
+static inline bool Interest_IsRelevant(const InterestSet_t *set, const uint32_t index)
+{
+	uint32_t first=0, last=set->numRelevant;
+
+	while(first<last)
+	{
+		const uint32_t middle=(first+last)/2;
+
+		if(set->list[middle]<index)
+			first=middle+1;
+		else
+			last=middle;
+	}
+
+	return first<set->numRelevant&&set->list[first]==index;
+}
+
+bool Interest_Init(InterestSet_t *set, uint32_t maxRelevant);
+void Interest_Update(InterestSet_t *set, const SpatialHash_t *hash, const RigidBody_t *bodies, const vec3 position);
+void Interest_Remove(InterestSet_t *set, uint32_t first, uint32_t count);
+void Interest_Destroy(InterestSet_t *set);
+
+#endif
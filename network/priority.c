@@ -0,0 +1,194 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include "../system/system.h"
+#include "../math/math.h"
+#include "../physics/physics.h"
+#include "interest.h"
+#include "priority.h"
+
+bool Priority_Init(PriorityAccumulator_t *acc, uint32_t maxEntities)
+{
+	if(acc==NULL||maxEntities==0)
+		return false;
+
+	memset(acc, 0, sizeof(PriorityAccumulator_t));
+
+	acc->maxEntities=maxEntities;
+	acc->index=(uint32_t *)Zone_Malloc(zone, sizeof(uint32_t)*maxEntities);
+	acc->priority=(float *)Zone_Malloc(zone, sizeof(float)*maxEntities);
+	acc->nextIndex=(uint32_t *)Zone_Malloc(zone, sizeof(uint32_t)*maxEntities);
+	acc->nextPriority=(float *)Zone_Malloc(zone, sizeof(float)*maxEntities);
+
+	if(acc->index==NULL||acc->priority==NULL||acc->nextIndex==NULL||acc->nextPriority==NULL)
+	{
+		DBGPRINTF(DEBUG_ERROR, "Priority_Init: Unable to allocate memory.\n");
+		Priority_Destroy(acc);
+		return false;
+	}
+
+	return true;
+}
+
+// Grow priority of relevant entities by how stale, close and fast they are, plus any collision boost.
+// Priorities carry over for entities that stay in the interest set, ones that just came in start at
+//     PRIORITY_ENTER and ones that left are forgotten. Both lists are sorted, so that's one merge.
+void Priority_Accumulate(PriorityAccumulator_t *acc, const InterestSet_t *interest, const RigidBody_t *bodies, const float *boost, const vec3 position, const float dt)
+{
+	if(acc==NULL||acc->priority==NULL||interest==NULL)
+		return;
+
+	const uint32_t count=interest->numRelevant<acc->maxEntities?interest->numRelevant:acc->maxEntities;
+	uint32_t old=0;
+
+	for(uint32_t i=0;i<count;i++)
+	{
+		const uint32_t index=interest->list[i];
+
+		while(old<acc->numEntities&&acc->index[old]<index)
+			old++;
+
+		float priority=PRIORITY_ENTER;
+
+		if(old<acc->numEntities&&acc->index[old]==index)
+			priority=acc->priority[old];
+
+		const float distance=fmaxf(0.0f, Vec3_Distance(position, bodies[index].position)-bodies[index].radius);
+		const float speed=Vec3_Length(bodies[index].velocity);
+
+		const float distanceWeight=PRIORITY_DISTANCE_FALLOFF/(PRIORITY_DISTANCE_FALLOFF+distance);
+		const float velocityWeight=1.0f+speed*PRIORITY_VELOCITY_WEIGHT;
+
+		priority+=dt*distanceWeight*velocityWeight;
+
+		if(boost)
+			priority+=boost[index]*PRIORITY_COLLISION_WEIGHT;
+
+		acc->nextIndex[i]=index;
+		acc->nextPriority[i]=priority;
+	}
+
+	uint32_t *tempIndex=acc->index;
+	float *tempPriority=acc->priority;
+
+	acc->index=acc->nextIndex;
+	acc->priority=acc->nextPriority;
+	acc->nextIndex=tempIndex;
+	acc->nextPriority=tempPriority;
+	acc->numEntities=count;
+}
+
+// Partition order[first..last] so the k highest priorities come first (quickselect)
+static void selectHighest(const float *priority, uint32_t *order, int32_t first, int32_t last, int32_t k)
+{
+	while(first<last)
+	{
+		const float pivot=priority[order[(first+last)/2]];
+		int32_t i=first, j=last;
+
+		while(i<=j)
+		{
+			while(priority[order[i]]>pivot)
+				i++;
+
+			while(priority[order[j]]<pivot)
+				j--;
+
+			if(i<=j)
+			{
+				uint32_t temp=order[i];
+				order[i]=order[j];
+				order[j]=temp;
+				i++;
+				j--;
+			}
+		}
+
+		if(k<=j)
+			last=j;
+		else if(k>=i)
+			first=i;
+		else
+			return;
+	}
+}
+
+// Pick the highest priority relevant entities that fit in byteBudget at entrySize bytes each,
+//     resets their priority (they're being sent) and returns the count, with the indices in *selected.
+// The selection is frame arena scratch, so it's only good until the end of the tick.
+uint32_t Priority_Schedule(PriorityAccumulator_t *acc, uint32_t entrySize, uint32_t byteBudget, uint32_t **selected)
+{
+	if(acc==NULL||acc->priority==NULL||entrySize==0)
+		return 0;
+
+	const uint32_t maxEntries=byteBudget/entrySize;
+	uint32_t count=acc->numEntities;
+	uint32_t *order=(uint32_t *)FrameArena_Alloc(&frameArena, sizeof(uint32_t)*(count?count:1));
+
+	if(order==NULL)
+		return 0;
+
+	// Positions in the accumulator, turned into entity indices once picked
+	for(uint32_t i=0;i<count;i++)
+		order[i]=i;
+
+	if(count>maxEntries)
+	{
+		if(maxEntries>0)
+			selectHighest(acc->priority, order, 0, count-1, maxEntries-1);
+
+		count=maxEntries;
+	}
+
+	for(uint32_t i=0;i<count;i++)
+	{
+		acc->priority[order[i]]=0.0f;
+		order[i]=acc->index[order[i]];
+	}
+
+	*selected=order;
+
+	return count;
+}
+
+// Forget entities [first, first+count), they come back in at PRIORITY_ENTER
+void Priority_Remove(PriorityAccumulator_t *acc, uint32_t first, uint32_t count)
+{
+	if(acc==NULL||acc->priority==NULL)
+		return;
+
+	uint32_t kept=0;
+
+	for(uint32_t i=0;i<acc->numEntities;i++)
+	{
+		// Unsigned, anything below first wraps around past count
+		if(acc->index[i]-first>=count)
+		{
+			acc->index[kept]=acc->index[i];
+			acc->priority[kept]=acc->priority[i];
+			kept++;
+		}
+	}
+
+	acc->numEntities=kept;
+}
+
+void Priority_Destroy(PriorityAccumulator_t *acc)
+{
+	if(acc==NULL)
+		return;
+
+	if(acc->index)
+		Zone_Free(zone, acc->index);
+
+	if(acc->priority)
+		Zone_Free(zone, acc->priority);
+
+	if(acc->nextIndex)
+		Zone_Free(zone, acc->nextIndex);
+
+	if(acc->nextPriority)
+		Zone_Free(zone, acc->nextPriority);
+
+	memset(acc, 0, sizeof(PriorityAccumulator_t));
+}
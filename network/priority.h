@@ -0,0 +1,41 @@
+#ifndef __PRIORITY_H__
+#define __PRIORITY_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "../math/math.h"
+#include "../physics/physics.h"
+#include "interest.h"
+
+// Priority growth, per second of staleness:
+//     (1+speed*PRIORITY_VELOCITY_WEIGHT)*(PRIORITY_DISTANCE_FALLOFF/(PRIORITY_DISTANCE_FALLOFF+distance))
+#define PRIORITY_VELOCITY_WEIGHT 0.1f
+#define PRIORITY_DISTANCE_FALLOFF 100.0f
+
+// One-off boost per unit of collision response (what PhysicsSphereToSphereCollisionResponse returns)
+#define PRIORITY_COLLISION_WEIGHT 1.0f
+
+// Entities that just became relevant start here, so they get sent right away
+#define PRIORITY_ENTER 1000.0f
+
+// Per client priority accumulator over the client's interest set, only relevant entities have a priority.
+// Entries follow the interest list (same indices, same order) as of the last accumulate.
+typedef struct
+{
+	uint32_t maxEntities;
+	uint32_t numEntities;
+	uint32_t *index;		// Entity indices, ascending
+	float *priority;
+
+	// Swapped in while merging with a new interest list
+	uint32_t *nextIndex;
+	float *nextPriority;
+} PriorityAccumulator_t;
+
+bool Priority_Init(PriorityAccumulator_t *acc, uint32_t maxEntities);
+void Priority_Accumulate(PriorityAccumulator_t *acc, const InterestSet_t *interest, const RigidBody_t *bodies, const float *boost, const vec3 position, const float dt);
+uint32_t Priority_Schedule(PriorityAccumulator_t *acc, uint32_t entrySize, uint32_t byteBudget, uint32_t **selected);
+void Priority_Remove(PriorityAccumulator_t *acc, uint32_t first, uint32_t count);
+void Priority_Destroy(PriorityAccumulator_t *acc);
+
+#endif
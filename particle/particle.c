@@ -34,17 +34,17 @@
 //	vec4 Up;
 //} particlePC;
 
-inline static void emitterDefaultInit(Particle_t *particle)
+inline static void emitterDefaultInit(Random_t *random, Particle_t *particle)
 {
 	float seedRadius=30.0f;
-	float theta=RandFloat()*2.0f*PI;
-	float r=RandFloat()*seedRadius;
+	float theta=Random_Float(random)*2.0f*PI;
+	float r=Random_Float(random)*seedRadius;
 
 	// Set particle start position to emitter position
 	particle->position=Vec3b(0.0f);
-	particle->velocity=Vec3(r*sinf(theta), RandFloat()*100.0f, r*cosf(theta));
+	particle->velocity=Vec3(r*sinf(theta), Random_Float(random)*100.0f, r*cosf(theta));
 
-	particle->life=RandFloat()*0.999f+0.001f;
+	particle->life=Random_Float(random)*0.999f+0.001f;
 }
 
 // Adds a particle emitter to the system
@@ -58,58 +58,82 @@ uint32_t ParticleSystem_AddEmitter(ParticleSystem_t *system, vec3 position, vec3
 	// Pull the next ID from the global ID count
 	uint32_t ID=system->baseID++;
 
-	// Increment emitter count and resize emitter memory
+	// Take a slot for the emitter
+	ParticleEmitter_t *emitter=(ParticleEmitter_t *)Pool_Alloc(&system->emitterPool);
 
-	ParticleEmitter_t emitter;
+	if(emitter==NULL)
+	{
+		mtx_unlock(&system->mutex);
+		return UINT32_MAX;
+	}
 
 	if(initCallback==NULL)
-		emitter.initCallback=NULL;
+		emitter->initCallback=NULL;
 	else
-		emitter.initCallback=initCallback;
+		emitter->initCallback=initCallback;
 
 	// Set various flags/parameters
-	emitter.type=type;
-	emitter.ID=ID;
-	emitter.startColor=startColor;
-	emitter.endColor=endColor;
-	emitter.particleSize=particleSize;
+	emitter->type=type;
+	emitter->ID=ID;
+	emitter->startColor=startColor;
+	emitter->endColor=endColor;
+	emitter->particleSize=particleSize;
+
+	// Own stream per emitter, so its particles come out the same whichever thread steps it
+	Random_Init(&emitter->random, ID, ID);
 
 	// Set number of particles and allocate memory
-	emitter.numParticles=numParticles;
-	emitter.particles=(Particle_t *)Zone_Malloc(zone, numParticles*sizeof(Particle_t));
+	emitter->numParticles=numParticles;
+	emitter->particles=Zone_HandleAlloc(zone, numParticles*sizeof(Particle_t), PARTICLE_ALIGN);
 
-	if(emitter.particles==NULL)
+	if(emitter->particles==ZONE_INVALID_HANDLE)
 	{
+		Pool_Free(&system->emitterPool, emitter);
 		mtx_unlock(&system->mutex);
 		return UINT32_MAX;
 	}
 
-	memset(emitter.particles, 0, numParticles*sizeof(Particle_t));
+	Particle_t *particles=(Particle_t *)Zone_HandleLock(zone, emitter->particles);
+
+	memset(particles, 0, numParticles*sizeof(Particle_t));
 
 	// Set emitter position (used when resetting/recycling particles when they die)
-	emitter.position=position;
+	emitter->position=position;
 
 	// Set initial particle position and life to -1.0 (dead), unless it's a one-shot, then set it up with default or callback
-	for(uint32_t i=0;i<emitter.numParticles;i++)
+	for(uint32_t i=0;i<emitter->numParticles;i++)
 	{
-		emitter.particles[i].ID=ID;
-		emitter.particles[i].position=position;
+		particles[i].ID=ID;
+		particles[i].position=position;
 
-		if(emitter.type==PARTICLE_EMITTER_ONCE)
+		if(emitter->type==PARTICLE_EMITTER_ONCE)
 		{
-			if(emitter.initCallback)
-				emitter.initCallback(i, emitter.numParticles, &emitter.particles[i]);
+			if(emitter->initCallback)
+				emitter->initCallback(i, emitter->numParticles, &particles[i]);
 			else
-				emitterDefaultInit(&emitter.particles[i]);
+				emitterDefaultInit(&emitter->random, &particles[i]);
 
 			// Add particle emitter position to the calculated position
-			emitter.particles[i].position=Vec3_Addv(emitter.particles[i].position, emitter.position);
+			particles[i].position=Vec3_Addv(particles[i].position, emitter->position);
 		}
 		else
-			emitter.particles[i].life=-1.0f;
+			particles[i].life=-1.0f;
 	}
 
-	List_Add(&system->emitters, &emitter);
+	Zone_HandleUnlock(zone, emitter->particles);
+
+	emitter->index=(uint32_t)List_GetCount(&system->emitters);
+
+	if(!List_Add(&system->emitters, &emitter)||!HashMap_Set(&system->emitterIDs, ID, &emitter))
+	{
+		if(List_GetCount(&system->emitters)>emitter->index)
+			List_Del(&system->emitters, emitter->index);
+
+		Zone_HandleFree(zone, emitter->particles);
+		Pool_Free(&system->emitterPool, emitter);
+		mtx_unlock(&system->mutex);
+		return UINT32_MAX;
+	}
 
 	// Resize vertex buffers (both system memory and OpenGL buffer)
 	// if(!ParticleSystem_ResizeBuffer(system))
@@ -131,19 +155,30 @@ void ParticleSystem_DeleteEmitter(ParticleSystem_t *system, uint32_t ID)
 
 	mtx_lock(&system->mutex);
 
-	for(uint32_t i=0;i<List_GetCount(&system->emitters);i++)
+	ParticleEmitter_t **entry=(ParticleEmitter_t **)HashMap_Get(&system->emitterIDs, ID);
+
+	if(entry)
 	{
-		ParticleEmitter_t *emitter=(ParticleEmitter_t *)List_GetPointer(&system->emitters, i);
+		ParticleEmitter_t *emitter=*entry;
+		const uint32_t last=(uint32_t)List_GetCount(&system->emitters)-1;
 
-		if(emitter->ID==ID)
+		// Move the last emitter into the hole, so removal doesn't shift the whole list
+		if(emitter->index!=last)
 		{
-			Zone_Free(zone, emitter->particles);
-			List_Del(&system->emitters, i);
+			ParticleEmitter_t *moved=*(ParticleEmitter_t **)List_GetPointer(&system->emitters, last);
 
-			// Resize vertex buffers (both system memory and OpenGL buffer)
-			// ParticleSystem_ResizeBuffer(system);
-			break;
+			moved->index=emitter->index;
+			*(ParticleEmitter_t **)List_GetPointer(&system->emitters, emitter->index)=moved;
 		}
+
+		List_Del(&system->emitters, last);
+		HashMap_Remove(&system->emitterIDs, ID);
+
+		Zone_HandleFree(zone, emitter->particles);
+		Pool_Free(&system->emitterPool, emitter);
+
+		// Resize vertex buffers (both system memory and OpenGL buffer)
+		// ParticleSystem_ResizeBuffer(system);
 	}
 
 	mtx_unlock(&system->mutex);
@@ -155,31 +190,31 @@ void ParticleSystem_ResetEmitter(ParticleSystem_t *system, uint32_t ID)
 	if(system==NULL||ID==UINT32_MAX)
 		return;
 
-	for(uint32_t i=0;i<List_GetCount(&system->emitters);i++)
-	{
-		ParticleEmitter_t *emitter=(ParticleEmitter_t *)List_GetPointer(&system->emitters, i);
+	ParticleEmitter_t **entry=(ParticleEmitter_t **)HashMap_Get(&system->emitterIDs, ID);
+
+	if(entry==NULL)
+		return;
+
+	ParticleEmitter_t *emitter=*entry;
+	Particle_t *particles=(Particle_t *)Zone_HandleLock(zone, emitter->particles);
 
-		if(emitter->ID==ID)
+	for(uint32_t j=0;j<emitter->numParticles;j++)
+	{
+		// Only reset dead particles, limit "total reset" weirdness
+		if(particles[j].life<0.0f)
 		{
-			for(uint32_t j=0;j<emitter->numParticles;j++)
-			{
-				// Only reset dead particles, limit "total reset" weirdness
-				if(emitter->particles[j].life<0.0f)
-				{
-					// If a velocity/life callback was set, use it... Otherwise use default "fountain" style
-					if(emitter->initCallback)
-						emitter->initCallback(j, emitter->numParticles, &emitter->particles[j]);
-					else
-						emitterDefaultInit(&emitter->particles[j]);
-
-					// Add particle emitter position to the calculated position
-					emitter->particles[j].position=Vec3_Addv(emitter->particles[j].position, emitter->position);
-				}
-			}
+			// If a velocity/life callback was set, use it... Otherwise use default "fountain" style
+			if(emitter->initCallback)
+				emitter->initCallback(j, emitter->numParticles, &particles[j]);
+			else
+				emitterDefaultInit(&emitter->random, &particles[j]);
 
-			return;
+			// Add particle emitter position to the calculated position
+			particles[j].position=Vec3_Addv(particles[j].position, emitter->position);
 		}
 	}
+
+	Zone_HandleUnlock(zone, emitter->particles);
 }
 
 void ParticleSystem_SetEmitterPosition(ParticleSystem_t *system, uint32_t ID, vec3 position)
@@ -187,16 +222,10 @@ void ParticleSystem_SetEmitterPosition(ParticleSystem_t *system, uint32_t ID, ve
 	if(system==NULL||ID==UINT32_MAX)
 		return;
 
-	for(uint32_t i=0;i<List_GetCount(&system->emitters);i++)
-	{
-		ParticleEmitter_t *emitter=(ParticleEmitter_t*)List_GetPointer(&system->emitters, i);
+	ParticleEmitter_t **entry=(ParticleEmitter_t **)HashMap_Get(&system->emitterIDs, ID);
 
-		if(emitter->ID==ID)
-		{
-			emitter->position=position;
-			return;
-		}
-	}
+	if(entry)
+		(*entry)->position=position;
 }
 
 bool ParticleSystem_SetGravity(ParticleSystem_t *system, float x, float y, float z)
@@ -232,7 +261,23 @@ bool ParticleSystem_Init(ParticleSystem_t *system)
 
 	system->baseID=0;
 
-	List_Init(&system->emitters, sizeof(ParticleEmitter_t), 10, NULL);
+	if(!Pool_Init(&system->emitterPool, sizeof(ParticleEmitter_t), PARTICLE_EMITTERS_PER_SLAB, PARTICLE_MAX_EMITTERS, false))
+	{
+		DBGPRINTF(DEBUG_ERROR, "ParticleSystem_Init: Unable to create emitter pool.\r\n");
+		mtx_destroy(&system->mutex);
+		return false;
+	}
+
+	List_Init(&system->emitters, sizeof(ParticleEmitter_t *), 10, NULL);
+
+	if(!HashMap_Init(&system->emitterIDs, sizeof(ParticleEmitter_t *), PARTICLE_EMITTERS_PER_SLAB))
+	{
+		DBGPRINTF(DEBUG_ERROR, "ParticleSystem_Init: Unable to create emitter ID map.\r\n");
+		List_Destroy(&system->emitters);
+		Pool_Destroy(&system->emitterPool);
+		mtx_destroy(&system->mutex);
+		return false;
+	}
 
 	system->count=0;
 
@@ -314,39 +359,46 @@ void ParticleSystem_Step(ParticleSystem_t *system, float dt)
 	if(system==NULL)
 		return;
 
-	for(uint32_t i=0;i<List_GetCount(&system->emitters);i++)
+	for(uint32_t i=0;i<List_GetCount(&system->emitters);)
 	{
-		ParticleEmitter_t *emitter=(ParticleEmitter_t *)List_GetPointer(&system->emitters, i);
+		ParticleEmitter_t *emitter=*(ParticleEmitter_t **)List_GetPointer(&system->emitters, i);
+		Particle_t *particles=(Particle_t *)Zone_HandleLock(zone, emitter->particles);
 		bool isActive=false;
 
 		for(uint32_t j=0;j<emitter->numParticles;j++)
 		{
-			if(emitter->particles[j].life>0.0f)
+			if(particles[j].life>0.0f)
 			{
 				isActive=true;
-				emitter->particles[j].velocity=Vec3_Addv(emitter->particles[j].velocity, Vec3_Muls(system->gravity, dt));
-				emitter->particles[j].position=Vec3_Addv(emitter->particles[j].position, Vec3_Muls(emitter->particles[j].velocity, dt));
+				particles[j].velocity=Vec3_Addv(particles[j].velocity, Vec3_Muls(system->gravity, dt));
+				particles[j].position=Vec3_Addv(particles[j].position, Vec3_Muls(particles[j].velocity, dt));
 			}
 			else if(emitter->type==PARTICLE_EMITTER_CONTINOUS)
 			{
 				// If a velocity/life callback was set, use it... Otherwise use default "fountain" style
 				if(emitter->initCallback)
-					emitter->initCallback(j, emitter->numParticles, &emitter->particles[j]);
+					emitter->initCallback(j, emitter->numParticles, &particles[j]);
 				else
-					emitterDefaultInit(&emitter->particles[j]);
+					emitterDefaultInit(&emitter->random, &particles[j]);
 
 				// Add particle emitter position to the calculated position
-				emitter->particles[j].position=Vec3_Addv(emitter->particles[j].position, emitter->position);
+				particles[j].position=Vec3_Addv(particles[j].position, emitter->position);
 			}
 
-			emitter->particles[j].life-=dt*0.75f;
+			particles[j].life-=dt*0.75f;
 		}
 
+		Zone_HandleUnlock(zone, emitter->particles);
+
 		if(!isActive&&emitter->type==PARTICLE_EMITTER_ONCE)
 		{
 			DBGPRINTF(DEBUG_WARNING, "REMOVING UNUSED EMITTER #%d\n", emitter->ID);
+
+			// Last emitter gets moved into this slot, step it next
 			ParticleSystem_DeleteEmitter(system, emitter->ID);
 		}
+		else
+			i++;
 	}
 }
 
@@ -378,7 +430,7 @@ void ParticleSystem_Step(ParticleSystem_t *system, float dt)
 //
 //	for(uint32_t i=0;i<List_GetCount(&system->emitters);i++)
 //	{
-//		ParticleEmitter_t *emitter=(ParticleEmitter_t *)List_GetPointer(&system->emitters, i);
+//		ParticleEmitter_t *emitter=*(ParticleEmitter_t **)List_GetPointer(&system->emitters, i);
 //		count+=emitter->numParticles;
 //	}
 //
@@ -411,7 +463,7 @@ void ParticleSystem_Step(ParticleSystem_t *system, float dt)
 //
 //	for(uint32_t i=0;i<List_GetCount(&system->emitters);i++)
 //	{
-//		ParticleEmitter_t *emitter=(ParticleEmitter_t *)List_GetPointer(&system->emitters, i);
+//		ParticleEmitter_t *emitter=*(ParticleEmitter_t **)List_GetPointer(&system->emitters, i);
 //
 //		for(uint32_t j=0;j<emitter->numParticles;j++)
 //		{
@@ -471,10 +523,12 @@ void ParticleSystem_Destroy(ParticleSystem_t *system)
 
 	for(uint32_t i=0;i<List_GetCount(&system->emitters);i++)
 	{
-		ParticleEmitter_t *emitter=(ParticleEmitter_t *)List_GetPointer(&system->emitters, i);
+		ParticleEmitter_t *emitter=*(ParticleEmitter_t **)List_GetPointer(&system->emitters, i);
 
-		Zone_Free(zone, emitter->particles);
+		Zone_HandleFree(zone, emitter->particles);
 	}
 
 	List_Destroy(&system->emitters);
+	HashMap_Destroy(&system->emitterIDs);
+	Pool_Destroy(&system->emitterPool);
 }
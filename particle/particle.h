@@ -6,6 +6,9 @@
 #include <stdatomic.h>
 #include <threads.h>
 #include "../utils/list.h"
+#include "../utils/hashmap.h"
+#include "../system/pool.h"
+#include "../system/memzone.h"
 #include "../math/math.h"
 //#include "../vulkan/vulkan.h"
 
@@ -16,6 +19,10 @@ typedef struct Particle_s
 	vec3 position, velocity;
 } Particle_t;
 
+#define PARTICLE_MAX_EMITTERS 1024
+#define PARTICLE_EMITTERS_PER_SLAB 64
+#define PARTICLE_ALIGN 64			// Particle arrays start on a cache line
+
 typedef void (*ParticleInitCallback)(uint32_t index, uint32_t numParticles, Particle_t *particle);
 
 typedef enum ParticleEmitterType_e
@@ -28,12 +35,14 @@ typedef enum ParticleEmitterType_e
 typedef struct ParticleEmitter_s
 {
 	uint32_t ID;
+	uint32_t index;				// Position in the system's active emitter list
 	ParticleEmitterType_e type;
 	vec3 position;
 	vec3 startColor, endColor;
 	float particleSize;
 	uint32_t numParticles;
-	Particle_t *particles;
+	ZoneHandle_t particles;		// Relocatable, so emitter churn doesn't fragment the zone. Lock to get at the array.
+	Random_t random;			// Drives the default particle init
 
 	ParticleInitCallback initCallback;
 } ParticleEmitter_t;
@@ -44,7 +53,9 @@ typedef struct ParticleSystem_s
 
 	vec3 gravity;
 
-	List_t emitters;
+	Pool_t emitterPool;		// Emitter storage
+	List_t emitters;		// Pointers into the pool of the active emitters
+	HashMap_t emitterIDs;	// Emitter ID to emitter pointer
 
 	mtx_t mutex;
 
@@ -3,34 +3,25 @@
 #include <stdio.h>
 #include "physics.h"
 
-static void applyConstraints(RigidBody_t *body)
+// Angular velocity keeps this much per 60th of a second, scaled to the actual step so bodies
+//     stepped less often (or coasted) slow down the same as ones stepped every tick
+#define ANGULAR_DAMPING 0.998f
+#define DAMPING_RATE 60.0f
+
+static void applyConstraints(RigidBody_t *body, const float dt)
 {
-	vec3 center={ 0.0f, 0.0f, 0.0f };
-	const float maxRadius=2000.0f;
 	const float maxVelocity=500.0f;
 
 	// Clamp velocity, this reduces the chance of the simulation going unstable
+	// No outer boundary, the field goes on as far as the chunks do
 	body->velocity=Vec3_Clamp(body->velocity, -maxVelocity, maxVelocity);
 
-	// Check for collision with outer boundary sphere and reflect velocity if needed
-	vec3 normal=Vec3_Subv(body->position, center);
-
-	float distanceSq=Vec3_Dot(normal, normal);
-	const float radiiSum=(maxRadius*maxRadius)-(body->radius*body->radius);
-
-	if(distanceSq>radiiSum)
-	{
-		const float distance=Vec3_Normalize(&normal);
-		body->velocity=Vec3_Addv(body->velocity, Vec3_Muls(normal, -distance));
-	}
-
 	// Apply linear velocity damping
 	//const float linearDamping=0.998f;
 	//body->velocity=Vec3_Muls(body->velocity, linearDamping);
 
 	// Apply angular velocity damping
-	const float angularDamping=0.998f;
-	body->angularVelocity=Vec3_Muls(body->angularVelocity, angularDamping);
+	body->angularVelocity=Vec3_Muls(body->angularVelocity, powf(ANGULAR_DAMPING, dt*DAMPING_RATE));
 }
 
 vec4 integrateAngularVelocity(const vec4 q, const vec3 w, const float dt)
@@ -82,7 +73,32 @@ void PhysicsIntegrate(RigidBody_t *body, const float dt)
 	// Integrate angular velocity using quaternions
 	body->orientation=integrateAngularVelocity(body->orientation, body->angularVelocity, dt);
 
-	applyConstraints(body);
+	applyConstraints(body, dt);
+}
+
+// Force free motion over dt in closed form, for catching up bodies that were left out of the simulation.
+// Matches any number of PhysicsIntegrate steps adding up to dt with no forces, without the error of one big step.
+void PhysicsCoast(RigidBody_t *body, const float dt)
+{
+	if(dt<=0.0f)
+		return;
+
+	body->position=Vec3_Addv(body->position, Vec3_Muls(body->velocity, dt));
+	body->force=Vec3b(0.0f);
+
+	const float angularSpeed=Vec3_Length(body->angularVelocity);
+
+	if(angularSpeed>0.0f)
+	{
+		// Spin decays exponentially with damping, the angle turned is the integral of that
+		const float decay=powf(ANGULAR_DAMPING, dt*DAMPING_RATE);
+		const float angle=angularSpeed*(1.0f-decay)/(-logf(ANGULAR_DAMPING)*DAMPING_RATE);
+
+		body->orientation=QuatMultiply(body->orientation, QuatAnglev(angle, body->angularVelocity));
+		Vec4_Normalize(&body->orientation);
+
+		body->angularVelocity=Vec3_Muls(body->angularVelocity, decay);
+	}
 }
 
 void PhysicsExplode(RigidBody_t *body)
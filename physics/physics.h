@@ -24,6 +24,7 @@ typedef struct RigidBody_s
 } RigidBody_t;
 
 void PhysicsIntegrate(RigidBody_t *body, const float dt);
+void PhysicsCoast(RigidBody_t *body, const float dt);
 void PhysicsExplode(RigidBody_t *body);
 float PhysicsSphereToSphereCollisionResponse(RigidBody_t *a, RigidBody_t *b);
 float PhysicsSphereToAABBCollisionResponse(RigidBody_t *sphere, RigidBody_t *aabb);
@@ -0,0 +1,198 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include "../system/system.h"
+#include "../math/math.h"
+#include "physics.h"
+#include "spatialhash.h"
+
+typedef struct
+{
+	int32_t x, y, z;
+} Cell_t;
+
+static inline Cell_t getCell(const SpatialHash_t *hash, const vec3 position)
+{
+	return (Cell_t)
+	{
+		(int32_t)floorf(position.x*hash->invCellSize),
+		(int32_t)floorf(position.y*hash->invCellSize),
+		(int32_t)floorf(position.z*hash->invCellSize)
+	};
+}
+
+static inline uint32_t hashCell(const SpatialHash_t *hash, const Cell_t cell)
+{
+	return (((uint32_t)cell.x*73856093u)^((uint32_t)cell.y*19349663u)^((uint32_t)cell.z*83492791u))&(hash->tableSize-1);
+}
+
+bool SpatialHash_Init(SpatialHash_t *hash, float cellSize, uint32_t tableSize, uint32_t maxEntries)
+{
+	if(hash==NULL||cellSize<=0.0f||!IsPower2(tableSize))
+		return false;
+
+	memset(hash, 0, sizeof(SpatialHash_t));
+
+	hash->cellSize=cellSize;
+	hash->invCellSize=1.0f/cellSize;
+	hash->tableSize=tableSize;
+	hash->maxEntries=maxEntries;
+
+	hash->cellStart=(uint32_t *)Zone_Malloc(zone, sizeof(uint32_t)*(tableSize+1));
+	hash->entries=(uint32_t *)Zone_Malloc(zone, sizeof(uint32_t)*maxEntries);
+	hash->entryHash=(uint32_t *)Zone_Malloc(zone, sizeof(uint32_t)*maxEntries);
+
+	if(hash->cellStart==NULL||hash->entries==NULL||hash->entryHash==NULL)
+	{
+		DBGPRINTF(DEBUG_ERROR, "SpatialHash_Init: Unable to allocate memory.\n");
+		SpatialHash_Destroy(hash);
+		return false;
+	}
+
+	memset(hash->cellStart, 0, sizeof(uint32_t)*(tableSize+1));
+
+	return true;
+}
+
+void SpatialHash_Build(SpatialHash_t *hash, const RigidBody_t *bodies, uint32_t numBodies)
+{
+	if(hash==NULL||bodies==NULL)
+		return;
+
+	if(numBodies>hash->maxEntries)
+	{
+		DBGPRINTF(DEBUG_WARNING, "SpatialHash_Build: Too many bodies (%d>%d), clamping.\n", numBodies, hash->maxEntries);
+		numBodies=hash->maxEntries;
+	}
+
+	memset(hash->cellStart, 0, sizeof(uint32_t)*(hash->tableSize+1));
+	hash->maxRadius=0.0f;
+
+	uint32_t numEntries=0;
+
+	// Count bodies per bucket, bodies with no radius are empty slots and stay out of the hash
+	for(uint32_t i=0;i<numBodies;i++)
+	{
+		if(bodies[i].radius<=0.0f)
+		{
+			hash->entryHash[i]=UINT32_MAX;
+			continue;
+		}
+
+		const uint32_t h=hashCell(hash, getCell(hash, bodies[i].position));
+
+		hash->entryHash[i]=h;
+		hash->cellStart[h]++;
+		hash->maxRadius=fmaxf(hash->maxRadius, bodies[i].radius);
+		numEntries++;
+	}
+
+	// Inclusive prefix sum gives the end of each bucket
+	for(uint32_t i=1;i<hash->tableSize;i++)
+		hash->cellStart[i]+=hash->cellStart[i-1];
+
+	hash->cellStart[hash->tableSize]=numEntries;
+
+	// Fill back to front, which leaves cellStart at the start of each bucket and keeps indices ascending within a bucket
+	for(uint32_t i=numBodies;i-->0;)
+	{
+		if(hash->entryHash[i]!=UINT32_MAX)
+			hash->entries[--hash->cellStart[hash->entryHash[i]]]=i;
+	}
+
+	hash->numEntries=numEntries;
+}
+
+// Find all bodies whose sphere touches the query sphere, returns number of indices written to results.
+// With results NULL it only counts them, so callers can size the results buffer first.
+uint32_t SpatialHash_QuerySphere(const SpatialHash_t *hash, const RigidBody_t *bodies, vec3 center, float radius, uint32_t *results, uint32_t maxResults)
+{
+	if(hash==NULL||bodies==NULL)
+		return 0;
+
+	if(results==NULL)
+		maxResults=UINT32_MAX;
+
+	uint32_t count=0;
+
+	// Bodies are bucketed by center, so grow the search by the largest radius
+	const float searchRadius=radius+hash->maxRadius;
+	const Cell_t cellMin=getCell(hash, Vec3_Subs(center, searchRadius));
+	const Cell_t cellMax=getCell(hash, Vec3_Adds(center, searchRadius));
+
+	const uint64_t numCells=(uint64_t)(cellMax.x-cellMin.x+1)*(uint64_t)(cellMax.y-cellMin.y+1)*(uint64_t)(cellMax.z-cellMin.z+1);
+
+	// If the query covers more cells than there are buckets, it's cheaper to just test everything
+	if(numCells>hash->tableSize)
+	{
+		for(uint32_t j=0;j<hash->numEntries&&count<maxResults;j++)
+		{
+			const uint32_t i=hash->entries[j];
+			const float radiiSum=radius+bodies[i].radius;
+
+			if(Vec3_DistanceSq(center, bodies[i].position)<=radiiSum*radiiSum)
+			{
+				if(results)
+					results[count]=i;
+
+				count++;
+			}
+		}
+
+		return count;
+	}
+
+	for(int32_t z=cellMin.z;z<=cellMax.z;z++)
+	{
+		for(int32_t y=cellMin.y;y<=cellMax.y;y++)
+		{
+			for(int32_t x=cellMin.x;x<=cellMax.x;x++)
+			{
+				const Cell_t cell={ x, y, z };
+				const uint32_t h=hashCell(hash, cell);
+
+				for(uint32_t j=hash->cellStart[h];j<hash->cellStart[h+1];j++)
+				{
+					const uint32_t i=hash->entries[j];
+					const Cell_t bodyCell=getCell(hash, bodies[i].position);
+
+					// Different cells can share a bucket, only take bodies that actually live in this cell
+					if(bodyCell.x!=x||bodyCell.y!=y||bodyCell.z!=z)
+						continue;
+
+					const float radiiSum=radius+bodies[i].radius;
+
+					if(Vec3_DistanceSq(center, bodies[i].position)<=radiiSum*radiiSum)
+					{
+						if(count>=maxResults)
+							return count;
+
+						if(results)
+							results[count]=i;
+
+						count++;
+					}
+				}
+			}
+		}
+	}
+
+	return count;
+}
+
+void SpatialHash_Destroy(SpatialHash_t *hash)
+{
+	if(hash==NULL)
+		return;
+
+	if(hash->cellStart)
+		Zone_Free(zone, hash->cellStart);
+
+	if(hash->entries)
+		Zone_Free(zone, hash->entries);
+
+	if(hash->entryHash)
+		Zone_Free(zone, hash->entryHash);
+
+	memset(hash, 0, sizeof(SpatialHash_t));
+}
@@ -0,0 +1,31 @@
+#ifndef __SPATIALHASH_H__
+#define __SPATIALHASH_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "../math/math.h"
+#include "physics.h"
+
+// Uniform grid over rigid body centers, hashed into a fixed size bucket table.
+// Rebuilt from scratch (counting sort) whenever the bodies move.
+// Bodies with zero radius are treated as empty slots and left out.
+typedef struct
+{
+	float cellSize, invCellSize;
+	float maxRadius;
+
+	uint32_t tableSize;		// Power of 2
+	uint32_t *cellStart;	// tableSize+1 entries, bucket N spans [cellStart[N], cellStart[N+1])
+
+	uint32_t maxEntries;
+	uint32_t numEntries;
+	uint32_t *entries;		// Body indices sorted by bucket
+	uint32_t *entryHash;	// Bucket per body, scratch for the build
+} SpatialHash_t;
+
+bool SpatialHash_Init(SpatialHash_t *hash, float cellSize, uint32_t tableSize, uint32_t maxEntries);
+void SpatialHash_Build(SpatialHash_t *hash, const RigidBody_t *bodies, uint32_t numBodies);
+uint32_t SpatialHash_QuerySphere(const SpatialHash_t *hash, const RigidBody_t *bodies, vec3 center, float radius, uint32_t *results, uint32_t maxResults);
+void SpatialHash_Destroy(SpatialHash_t *hash);
+
+#endif
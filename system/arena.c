@@ -0,0 +1,238 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include "../system/system.h"
+#include "arena.h"
+
+_Static_assert(sizeof(ArenaChunk_t)%ARENA_ALIGN==0, "Chunk header must keep allocations aligned");
+
+// Which sub-arena this thread uses, only valid for the arena with a matching serial
+static thread_local struct
+{
+	uint32_t serial;
+	uint32_t index;
+} threadArena;
+
+static atomic_uint arenaSerial=0;
+
+static inline size_t alignSize(size_t size)
+{
+	return (size+ARENA_ALIGN-1)&~((size_t)ARENA_ALIGN-1);
+}
+
+// Sub-arena is full, carve from a chunk of zone memory instead
+static void *spill(FrameSubArena_t *sub, size_t size)
+{
+	if(sub->overflow==NULL||sub->overflowOffset+size>sub->overflow->size)
+	{
+		// Grow at least by a whole sub-arena, so a big frame doesn't mean lots of zone allocations
+		const size_t chunkSize=size>sub->size?size:sub->size;
+		ArenaChunk_t *chunk=(ArenaChunk_t *)Zone_Malloc(zone, sizeof(ArenaChunk_t)+chunkSize);
+
+		if(chunk==NULL)
+			return NULL;
+
+		chunk->next=sub->overflow;
+		chunk->size=chunkSize;
+		sub->overflow=chunk;
+		sub->overflowOffset=0;
+	}
+
+	void *ptr=(uint8_t *)sub->overflow+sizeof(ArenaChunk_t)+sub->overflowOffset;
+	sub->overflowOffset+=size;
+
+	return ptr;
+}
+
+static void *subArenaAlloc(FrameSubArena_t *sub, size_t size)
+{
+	void *ptr=NULL;
+
+	if(sub->offset+size<=sub->size)
+	{
+		ptr=sub->base+sub->offset;
+		sub->offset+=size;
+	}
+	else
+		ptr=spill(sub, size);
+
+	if(ptr)
+		sub->used+=size;
+
+	return ptr;
+}
+
+bool FrameArena_Init(FrameArena_t *arena, size_t subArenaSize, uint32_t maxThreads)
+{
+	if(arena==NULL||subArenaSize==0||maxThreads==0)
+		return false;
+
+	memset(arena, 0, sizeof(FrameArena_t));
+
+	if(mtx_init(&arena->mutex, mtx_plain))
+	{
+		DBGPRINTF(DEBUG_ERROR, "FrameArena_Init: Unable to create mutex.\n");
+		return false;
+	}
+
+	arena->subArenaSize=alignSize(subArenaSize);
+	arena->maxThreads=maxThreads;
+
+	// The extra sub-arena is shared by any threads past maxThreads
+	arena->subArenas=(FrameSubArena_t *)Zone_Malloc(zone, sizeof(FrameSubArena_t)*(maxThreads+1));
+	arena->memory=(uint8_t *)Zone_Malloc(zone, arena->subArenaSize*(maxThreads+1));
+
+	if(arena->subArenas==NULL||arena->memory==NULL)
+	{
+		DBGPRINTF(DEBUG_ERROR, "FrameArena_Init: Unable to allocate memory.\n");
+		FrameArena_Destroy(arena);
+		return false;
+	}
+
+	memset(arena->subArenas, 0, sizeof(FrameSubArena_t)*(maxThreads+1));
+
+	for(uint32_t i=0;i<=maxThreads;i++)
+	{
+		arena->subArenas[i].base=arena->memory+arena->subArenaSize*i;
+		arena->subArenas[i].size=arena->subArenaSize;
+	}
+
+	arena->serial=atomic_fetch_add(&arenaSerial, 1)+1;
+
+	return true;
+}
+
+// Scratch memory valid until the next reset, 16-byte aligned
+void *FrameArena_Alloc(FrameArena_t *arena, size_t size)
+{
+	if(arena==NULL||arena->memory==NULL||size==0)
+		return NULL;
+
+	size=alignSize(size);
+
+	// First allocation on this thread claims a sub-arena
+	if(threadArena.serial!=arena->serial)
+	{
+		threadArena.serial=arena->serial;
+		threadArena.index=atomic_fetch_add(&arena->numClaimed, 1);
+
+		if(threadArena.index>=arena->maxThreads)
+			threadArena.index=arena->maxThreads;
+	}
+
+	FrameSubArena_t *sub=&arena->subArenas[threadArena.index];
+	void *ptr=NULL;
+
+	if(threadArena.index==arena->maxThreads)
+	{
+		mtx_lock(&arena->mutex);
+		ptr=subArenaAlloc(sub, size);
+		mtx_unlock(&arena->mutex);
+	}
+	else
+		ptr=subArenaAlloc(sub, size);
+
+	if(ptr==NULL)
+		DBGPRINTF(DEBUG_ERROR, "FrameArena_Alloc: Unable to allocate %zu bytes.\n", size);
+
+	return ptr;
+}
+
+// End of the frame, everything handed out since the last reset is gone.
+// No other thread can be allocating from the arena while this runs.
+void FrameArena_Reset(FrameArena_t *arena)
+{
+	if(arena==NULL||arena->memory==NULL)
+		return;
+
+	size_t total=0;
+
+	for(uint32_t i=0;i<=arena->maxThreads;i++)
+	{
+		FrameSubArena_t *sub=&arena->subArenas[i];
+
+		if(sub->overflow)
+		{
+			sub->numSpills++;
+
+			// Only worth a warning when it spills further than before, FrameArena_Print has the totals
+			if(sub->used>sub->highWater)
+				DBGPRINTF(DEBUG_WARNING, "FrameArena_Reset: Sub-arena %d spilled, used %0.1fKB of %0.1fKB.\n", i, (float)sub->used/1000.0f, (float)sub->size/1000.0f);
+
+			while(sub->overflow)
+			{
+				ArenaChunk_t *next=sub->overflow->next;
+
+				Zone_Free(zone, sub->overflow);
+				sub->overflow=next;
+			}
+		}
+
+		if(sub->used>sub->highWater)
+			sub->highWater=sub->used;
+
+		total+=sub->used;
+
+		sub->offset=0;
+		sub->overflowOffset=0;
+		sub->used=0;
+	}
+
+	arena->lastUsed=total;
+
+	if(total>arena->highWater)
+		arena->highWater=total;
+
+	arena->frame++;
+}
+
+// High-water report, per sub-arena and overall
+void FrameArena_Print(FrameArena_t *arena)
+{
+	if(arena==NULL||arena->memory==NULL)
+		return;
+
+	const uint32_t numClaimed=atomic_load(&arena->numClaimed);
+
+	DBGPRINTF(DEBUG_WARNING, "Frame arena: %d frames, last frame %0.1fKB, high water %0.1fKB, %d/%d threads\n",
+			  (uint32_t)arena->frame, (float)arena->lastUsed/1000.0f, (float)arena->highWater/1000.0f, numClaimed<arena->maxThreads?numClaimed:arena->maxThreads, arena->maxThreads);
+
+	for(uint32_t i=0;i<=arena->maxThreads;i++)
+	{
+		const FrameSubArena_t *sub=&arena->subArenas[i];
+
+		if(sub->highWater)
+			DBGPRINTF(DEBUG_WARNING, "\tSub-arena %d%s: high water %0.1fKB of %0.1fKB, spilled in %d frames\n", i, i==arena->maxThreads?" (shared)":"", (float)sub->highWater/1000.0f, (float)sub->size/1000.0f, sub->numSpills);
+	}
+}
+
+void FrameArena_Destroy(FrameArena_t *arena)
+{
+	if(arena==NULL)
+		return;
+
+	if(arena->subArenas)
+	{
+		for(uint32_t i=0;i<=arena->maxThreads;i++)
+		{
+			while(arena->subArenas[i].overflow)
+			{
+				ArenaChunk_t *next=arena->subArenas[i].overflow->next;
+
+				Zone_Free(zone, arena->subArenas[i].overflow);
+				arena->subArenas[i].overflow=next;
+			}
+		}
+
+		Zone_Free(zone, arena->subArenas);
+	}
+
+	if(arena->memory)
+		Zone_Free(zone, arena->memory);
+
+	if(arena->maxThreads)
+		mtx_destroy(&arena->mutex);
+
+	memset(arena, 0, sizeof(FrameArena_t));
+}
@@ -0,0 +1,65 @@
+#ifndef __ARENA_H__
+#define __ARENA_H__
+
+#include <threads.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdatomic.h>
+
+// Frame arena, bump allocator for scratch memory that only lives until the end of the tick.
+// Each thread bumps its own sub-arena, so allocation never locks and nothing is ever freed individually,
+//     the whole arena is reset at once when the tick is done.
+// If a sub-arena runs out, it spills into chunks from the zone for the rest of the frame and the
+//     high-water mark shows how big it should have been.
+// A thread claims its sub-arena on first use and keeps it, threads are expected to use just the one frame arena.
+
+#define ARENA_ALIGN 16
+
+typedef struct ArenaChunk_s
+{
+	struct ArenaChunk_s *next;
+	size_t size;
+} ArenaChunk_t;
+
+typedef struct
+{
+	uint8_t *base;
+	size_t size;
+	size_t offset;
+
+	// Spill chunks for this frame, current one is at the head
+	ArenaChunk_t *overflow;
+	size_t overflowOffset;
+
+	size_t used;				// Bytes handed out this frame, including spill
+	size_t highWater;			// Most used in any one frame
+	uint32_t numSpills;			// Frames that ran past the sub-arena into the zone
+
+	uint8_t padding[64];		// Keep sub-arenas on separate cache lines
+} FrameSubArena_t;
+
+typedef struct
+{
+	uint32_t serial;
+	uint32_t maxThreads;
+	atomic_uint numClaimed;
+
+	size_t subArenaSize;
+	uint8_t *memory;
+	FrameSubArena_t *subArenas;	// One per thread, plus a shared one behind the mutex when they run out
+
+	mtx_t mutex;
+
+	uint64_t frame;
+	size_t lastUsed;			// Total across sub-arenas at the last reset
+	size_t highWater;			// Most total used in any one frame
+} FrameArena_t;
+
+bool FrameArena_Init(FrameArena_t *arena, size_t subArenaSize, uint32_t maxThreads);
+void *FrameArena_Alloc(FrameArena_t *arena, size_t size);
+void FrameArena_Reset(FrameArena_t *arena);
+void FrameArena_Print(FrameArena_t *arena);
+void FrameArena_Destroy(FrameArena_t *arena);
+
+#endif
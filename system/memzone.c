@@ -4,408 +4,2066 @@
 #include <stdbool.h>
 #include <string.h>
 #include <assert.h>
+#include <stdatomic.h>
+#ifdef WIN32
+#include <Windows.h>
+#else
+#include <unistd.h>
+#include <sys/mman.h>
+#endif
+// The Zone_*Site functions are defined here, so don't redirect the plain ones to them
+#define ZONE_NO_SITE_MACROS
 #include "../system/system.h"
 #include "memzone.h"
 
-#define SIZE_MASK (((size_t)-1)>>1)
-#define SIZE_SHIFT (0)
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+// Two level segregated fit allocator (TLSF, Masmano et al.).
+//
+// Every block starts with a header holding a pointer to the physically previous block (boundary tag)
+//     and its own size, so neighbours can be found and merged in O(1) in both directions.
+// Free blocks are kept in segregated lists by size class, with bitmaps of the non-empty lists,
+//     so finding a large enough free block is a couple of bit scans instead of a walk.
+//
+// The zone is made of one or more chunks of OS mapped memory, the end of each is marked with a zero sized
+//     used sentinel block and the first block has no previous block, so merging never crosses a chunk.
+// Growable zones map another chunk when nothing fits, doubling the zone each time, up to maxSize.
+//
+// In front of that, each thread gets a cache of small blocks by size class. Caches refill from and flush
+//     to the zone in batches under one lock. Cached blocks stay "used" as far as the zone is concerned and
+//     carry the ID of their owning cache in the top bits of the size field, a block freed on another thread
+//     goes back to its owner through a lock-free deferred list that the owner drains when it runs dry.
+//
+// Used blocks can also carry the ID of the call site that allocated them (just below the owner ID),
+//     per-site counters are updated on allocation and free for Zone_GetSiteStats.
+//
+// Relocatable blocks are only reached through a handle table, and store their handle index where the
+//     site and owner IDs would be. While a block isn't pinned, the compactor can slide it down into the
+//     free block in front of it, moving the free space up towards the end of the chunk.
+
+typedef struct ZoneBlock_s
+{
+	struct ZoneBlock_s *prevPhys;	// Block physically before this one, NULL for the first block
+	size_t size;					// Block size including header, low bits are flags
+
+	// Only valid while the block is free, otherwise this is the start of the user data
+	struct ZoneBlock_s *nextFree;
+	struct ZoneBlock_s *prevFree;
+} ZoneBlock_t;
+
+#define BLOCK_HEADER_SIZE (offsetof(ZoneBlock_t, nextFree))
+#define BLOCK_MIN_SIZE (sizeof(ZoneBlock_t))
+
+#define BLOCK_FREE_BIT ((size_t)1)
+#define BLOCK_CACHED_BIT ((size_t)2)				// Sitting in a thread cache or deferred list
+#define BLOCK_FLAG_MASK ((size_t)ZONE_ALIGN-1)
+#define BLOCK_SITE_SHIFT 42							// Allocating call site ID, 0 if it isn't tracked
+#define BLOCK_SITE_MASK ((size_t)(ZONE_MAX_SITES-1)<<BLOCK_SITE_SHIFT)
+#define BLOCK_OWNER_SHIFT 52						// Owning cache ID+1, 0 for blocks that aren't cached
+#define BLOCK_OWNER_MASK (~(size_t)0<<BLOCK_OWNER_SHIFT)
+#define BLOCK_META_MASK (BLOCK_FLAG_MASK|BLOCK_SITE_MASK|BLOCK_OWNER_MASK)
+#define BLOCK_MOVABLE_BIT ((size_t)4)				// Relocatable, only reached through its handle
+#define BLOCK_HANDLE_SHIFT BLOCK_SITE_SHIFT			// Handle index of a relocatable block, in place of the site and owner
+
+_Static_assert(BLOCK_HEADER_SIZE%ZONE_ALIGN==0, "Block header must keep user data aligned");
+_Static_assert(BLOCK_MIN_SIZE%ZONE_ALIGN==0, "Minimum block size must be aligned");
+_Static_assert(sizeof(size_t)==8&&ZONE_FL_MAX+1<BLOCK_SITE_SHIFT, "Block size field needs room for the site and owner IDs");
+_Static_assert((ZONE_MAX_SITES&(ZONE_MAX_SITES-1))==0&&ZONE_MAX_SITES<=(1<<(BLOCK_OWNER_SHIFT-BLOCK_SITE_SHIFT)), "Too many sites for the site ID bits");
+_Static_assert(ZONE_MAX_CACHES<(1<<(64-BLOCK_OWNER_SHIFT)), "Too many caches for the owner ID bits");
+_Static_assert(ZONE_HANDLE_INDEX_BITS<=64-BLOCK_HANDLE_SHIFT, "Too many handles for the handle index bits");
+
+typedef struct ZoneHandleEntry_s
+{
+	ZoneBlock_t *block;		// NULL while the entry is free
+	uint32_t generation;
+	uint32_t pins;			// Locked pointers out, the block can't move while this isn't 0
+	uint32_t alignment;
+	uint32_t nextFree;
+} ZoneHandleEntry_t;
+
+#define HANDLE_GENERATION_MASK ((1u<<(32-ZONE_HANDLE_INDEX_BITS))-1)
+#define HANDLE_TABLE_MIN 256
+
+// How often the compactor checks the clock
+#define COMPACT_CLOCK_INTERVAL 64
+
+typedef struct ZoneCache_s
+{
+	MemZone_t *zone;
+	size_t ownerBits;		// (ID+1)<<BLOCK_OWNER_SHIFT, stamped into every block this cache hands out
+	bool alive;
+
+	struct
+	{
+		ZoneBlock_t *head;
+		uint32_t count;
+	} classes[ZONE_CACHE_CLASSES];
+
+	// Blocks freed by other threads, pushed lock-free and drained all at once by the owner
+	_Atomic(ZoneBlock_t *) deferred;
+} ZoneCache_t;
+
+// Marks the deferred list of a cache whose thread has exited, other threads free directly to the zone instead
+#define CACHE_DEAD ((ZoneBlock_t *)(uintptr_t)1)
+
+// Which cache this thread uses, only valid for the zone with a matching serial
+static thread_local struct
+{
+	uint32_t serial;
+	ZoneCache_t *cache;
+} threadCache;
+
+static atomic_uint zoneSerial=0;
+static once_flag cacheKeyOnce=ONCE_FLAG_INIT;
+static tss_t cacheKey;
+
+// Allocation call sites, shared by all zones. Entries are claimed once and never removed,
+//     a site is looked up lock-free and only inserting one takes the mutex.
+typedef struct
+{
+	_Atomic(const char *) file;
+	uint32_t line;
+	atomic_size_t allocations;
+	atomic_size_t liveBlocks;
+	atomic_size_t liveBytes;
+} ZoneSite_t;
+
+static ZoneSite_t zoneSites[ZONE_MAX_SITES];
+static once_flag siteMutexOnce=ONCE_FLAG_INIT;
+static mtx_t siteMutex;
+
+static inline size_t blockSize(const ZoneBlock_t *block)
+{
+	return block->size&~BLOCK_META_MASK;
+}
+
+static inline void blockSetSize(ZoneBlock_t *block, size_t size)
+{
+	block->size=size|(block->size&BLOCK_META_MASK);
+}
+
+static inline bool blockIsFree(const ZoneBlock_t *block)
+{
+	return (block->size&BLOCK_FREE_BIT)!=0;
+}
+
+static inline void blockSetFree(ZoneBlock_t *block, bool isFree)
+{
+	if(isFree)
+		block->size|=BLOCK_FREE_BIT;
+	else
+		block->size&=~BLOCK_FREE_BIT;
+}
+
+static inline ZoneBlock_t *blockNext(const ZoneBlock_t *block)
+{
+	return (ZoneBlock_t *)((uint8_t *)block+blockSize(block));
+}
+
+static inline void *blockToPtr(const ZoneBlock_t *block)
+{
+	return (void *)((uint8_t *)block+BLOCK_HEADER_SIZE);
+}
+
+static inline ZoneBlock_t *blockFromPtr(const void *ptr)
+{
+	return (ZoneBlock_t *)((uint8_t *)ptr-BLOCK_HEADER_SIZE);
+}
+
+// A block is merging into the one in front of it and its header goes away, keep the compactor's cursor on a real block
+static inline void blockMerged(MemZone_t *zone, const ZoneBlock_t *block, ZoneBlock_t *into)
+{
+	if(zone->compactCursor==block)
+		zone->compactCursor=into;
+}
+
+// Index of highest/lowest set bit, undefined for 0
+static inline int32_t bitScanReverse(size_t value)
+{
+#ifdef _MSC_VER
+	unsigned long index;
+	_BitScanReverse64(&index, (unsigned __int64)value);
+	return (int32_t)index;
+#else
+	return (int32_t)(sizeof(unsigned long long)*8-1)-__builtin_clzll((unsigned long long)value);
+#endif
+}
+
+static inline int32_t bitScanForward(uint32_t value)
+{
+#ifdef _MSC_VER
+	unsigned long index;
+	_BitScanForward(&index, value);
+	return (int32_t)index;
+#else
+	return __builtin_ctz(value);
+#endif
+}
+
+// Size class of a block of this size (for inserting)
+static inline void mappingInsert(size_t size, int32_t *fl, int32_t *sl)
+{
+	if(size<ZONE_SMALL_BLOCK)
+	{
+		*fl=0;
+		*sl=(int32_t)(size/(ZONE_SMALL_BLOCK/ZONE_SL_COUNT));
+	}
+	else
+	{
+		const int32_t bit=bitScanReverse(size);
+
+		*sl=(int32_t)(size>>(bit-ZONE_SL_COUNT_LOG2))^ZONE_SL_COUNT;
+		*fl=bit-(ZONE_FL_SHIFT-1);
+	}
+}
+
+// Size class where every block is guaranteed to be at least this size (for searching)
+static inline void mappingSearch(size_t size, int32_t *fl, int32_t *sl)
+{
+	if(size>=ZONE_SMALL_BLOCK)
+		size+=((size_t)1<<(bitScanReverse(size)-ZONE_SL_COUNT_LOG2))-1;
+
+	mappingInsert(size, fl, sl);
+}
+
+static void removeFreeBlock(MemZone_t *zone, ZoneBlock_t *block)
+{
+	int32_t fl, sl;
+	mappingInsert(blockSize(block), &fl, &sl);
+
+	zone->freeBytes-=blockSize(block);
+	zone->numFree--;
+	zone->freeCounts[fl]--;
+
+	if(block->nextFree)
+		block->nextFree->prevFree=block->prevFree;
+
+	if(block->prevFree)
+		block->prevFree->nextFree=block->nextFree;
+	else
+	{
+		zone->freeLists[fl][sl]=block->nextFree;
+
+		// List went empty, clear the bitmaps
+		if(block->nextFree==NULL)
+		{
+			zone->slBitmap[fl]&=~(1u<<sl);
+
+			if(!zone->slBitmap[fl])
+				zone->flBitmap&=~(1u<<fl);
+		}
+	}
+}
+
+static void insertFreeBlock(MemZone_t *zone, ZoneBlock_t *block)
+{
+	int32_t fl, sl;
+	mappingInsert(blockSize(block), &fl, &sl);
+
+	zone->freeBytes+=blockSize(block);
+	zone->numFree++;
+	zone->freeCounts[fl]++;
+
+	block->prevFree=NULL;
+	block->nextFree=zone->freeLists[fl][sl];
+
+	if(block->nextFree)
+		block->nextFree->prevFree=block;
+
+	zone->freeLists[fl][sl]=block;
+	zone->flBitmap|=1u<<fl;
+	zone->slBitmap[fl]|=1u<<sl;
+}
+
+// Find a free block of at least size bytes and take it off its list
+static ZoneBlock_t *findFreeBlock(MemZone_t *zone, size_t size)
+{
+	int32_t fl, sl;
+	mappingSearch(size, &fl, &sl);
+
+	if(fl>=ZONE_FL_COUNT)
+		return NULL;
+
+	// Any non-empty list at this first level and at least this second level?
+	uint32_t slMap=zone->slBitmap[fl]&(~0u<<sl);
+
+	if(!slMap)
+	{
+		// No, go up to the next non-empty first level
+		const uint32_t flMap=(fl+1<32)?zone->flBitmap&(~0u<<(fl+1)):0;
+
+		if(!flMap)
+			return NULL;
+
+		fl=bitScanForward(flMap);
+		slMap=zone->slBitmap[fl];
+	}
+
+	sl=bitScanForward(slMap);
+
+	ZoneBlock_t *block=zone->freeLists[fl][sl];
+	removeFreeBlock(zone, block);
+
+	return block;
+}
+
+// Cut a block down to size, putting the remainder back as a free block (merged with the next block if it's free)
+static void trimBlock(MemZone_t *zone, ZoneBlock_t *block, size_t size)
+{
+	const size_t remaining=blockSize(block)-size;
+
+	if(remaining<BLOCK_MIN_SIZE)
+		return;
+
+	ZoneBlock_t *next=blockNext(block);
+	ZoneBlock_t *remainder=(ZoneBlock_t *)((uint8_t *)block+size);
+
+	blockSetSize(block, size);
+
+	remainder->prevPhys=block;
+	remainder->size=remaining|BLOCK_FREE_BIT;
+	zone->allocations++;
+
+	if(blockIsFree(next))
+	{
+		removeFreeBlock(zone, next);
+		blockMerged(zone, next, remainder);
+		blockSetSize(remainder, remaining+blockSize(next));
+		zone->allocations--;
+	}
+
+	blockNext(remainder)->prevPhys=remainder;
+	insertFreeBlock(zone, remainder);
+}
+
+// Requested size to block size, returns 0 on overflow
+static inline size_t adjustSize(size_t size)
+{
+	if(size>((size_t)1<<ZONE_FL_MAX))
+		return 0;
+
+	size=(size+BLOCK_HEADER_SIZE+ZONE_ALIGN-1)&~((size_t)ZONE_ALIGN-1);
+
+	return size<BLOCK_MIN_SIZE?BLOCK_MIN_SIZE:size;
+}
+
+static size_t pageSize(void)
+{
+#ifdef WIN32
+	SYSTEM_INFO info;
+	GetSystemInfo(&info);
+
+	return info.dwPageSize;
+#else
+	const long size=sysconf(_SC_PAGESIZE);
+
+	return size>0?(size_t)size:4096;
+#endif
+}
+
+// Get memory from the OS, size is rounded up to the page size actually used
+static void *mapChunk(size_t *size, uint32_t flags, bool *hugePages)
+{
+	const size_t page=pageSize();
+	void *memory=NULL;
+
+	*hugePages=false;
+
+#ifdef WIN32
+	// Large pages need the lock pages privilege, so ZONE_HUGEPAGES is ignored here
+	*size=(*size+page-1)&~(page-1);
+	memory=VirtualAlloc(NULL, *size, MEM_RESERVE|MEM_COMMIT, PAGE_READWRITE);
+
+	if(memory==NULL)
+		return NULL;
+#else
+#ifdef MAP_HUGETLB
+	// Explicit huge pages only work if the system has some reserved, fall back to normal pages if not
+	if(flags&ZONE_HUGEPAGES)
+	{
+		const size_t hugeSize=(*size+ZONE_HUGE_PAGE_SIZE-1)&~((size_t)ZONE_HUGE_PAGE_SIZE-1);
+
+		memory=mmap(NULL, hugeSize, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS|MAP_HUGETLB, -1, 0);
+
+		if(memory!=MAP_FAILED)
+		{
+			*size=hugeSize;
+			*hugePages=true;
+		}
+		else
+			memory=NULL;
+	}
+#endif
+
+	if(memory==NULL)
+	{
+		*size=(*size+page-1)&~(page-1);
+		memory=mmap(NULL, *size, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+
+		if(memory==MAP_FAILED)
+			return NULL;
+
+#ifdef MADV_HUGEPAGE
+		// Ask for transparent huge pages instead, before anything faults in
+		if(flags&ZONE_HUGEPAGES)
+			madvise(memory, *size, MADV_HUGEPAGE);
+#endif
+	}
+#endif
+
+	if(flags&ZONE_PREFAULT)
+	{
+		for(size_t offset=0;offset<*size;offset+=page)
+			((volatile uint8_t *)memory)[offset]=0;
+	}
+
+	return memory;
+}
+
+static void unmapChunk(ZoneChunk_t *chunk)
+{
+#ifdef WIN32
+	VirtualFree(chunk->memory, 0, MEM_RELEASE);
+#else
+	munmap(chunk->memory, chunk->mapSize);
+#endif
+}
+
+// Map another chunk with at least minSize usable bytes and add it as one free block, zone must be locked
+static bool addChunk(MemZone_t *zone, size_t minSize)
+{
+	if(zone->numChunks>=ZONE_MAX_CHUNKS||zone->size>=zone->maxSize||minSize>zone->maxSize-zone->size)
+		return false;
+
+	// Double the zone each time, so growing is rare
+	size_t size=zone->size>minSize?zone->size:minSize;
+
+	if(size>zone->maxSize-zone->size)
+		size=zone->maxSize-zone->size;
+
+	ZoneChunk_t *chunk=&zone->chunks[zone->numChunks];
+
+	chunk->mapSize=size+BLOCK_HEADER_SIZE;
+	chunk->memory=mapChunk(&chunk->mapSize, zone->flags, &chunk->hugePages);
+
+	if(chunk->memory==NULL)
+	{
+		DBGPRINTF(DEBUG_ERROR, "Zone: Unable to map %0.3fMB chunk.\n", (float)size/1000.0f/1000.0f);
+		return false;
+	}
+
+	// Rounding up to the page size gives a little extra, use it
+	chunk->size=(chunk->mapSize-BLOCK_HEADER_SIZE)&~((size_t)ZONE_ALIGN-1);
+
+	// Chunk is one free block
+	ZoneBlock_t *block=(ZoneBlock_t *)chunk->memory;
+	block->prevPhys=NULL;
+	block->size=chunk->size|BLOCK_FREE_BIT;
+
+	// And the sentinel after it, a used zero sized block.
+	ZoneBlock_t *sentinel=blockNext(block);
+	sentinel->prevPhys=block;
+	sentinel->size=0;
+
+	insertFreeBlock(zone, block);
+	zone->allocations++;
+	zone->size+=chunk->size;
+	zone->numChunks++;
+
+#ifdef _DEBUG
+	DBGPRINTF(DEBUG_INFO, "Zone: Mapped chunk %d at %p, size: %0.3fMB%s\n", zone->numChunks-1, chunk->memory, (float)chunk->size/1000.0f/1000.0f, chunk->hugePages?" (huge pages)":"");
+#endif
+
+	return true;
+}
+
+static inline void updatePeak(MemZone_t *zone)
+{
+	const size_t inUse=zone->size-zone->freeBytes;
+
+	if(inUse>zone->peakInUse)
+		zone->peakInUse=inUse;
+}
+
+// Take a used block of exactly this (adjusted) size from the zone, growing the zone if allowed and needed.
+// Zone must be locked.
+static ZoneBlock_t *allocateBlock(MemZone_t *zone, size_t size, bool grow)
+{
+	ZoneBlock_t *block=findFreeBlock(zone, size);
+
+	// The search rounds the size up to the next class (by at most 1/32nd), so the new chunk needs that much room
+	if(block==NULL&&grow&&addChunk(zone, size+(size>>ZONE_SL_COUNT_LOG2)+ZONE_SMALL_BLOCK))
+		block=findFreeBlock(zone, size);
+
+	if(block==NULL)
+		return NULL;
+
+	blockSetFree(block, false);
+	trimBlock(zone, block, size);
+	updatePeak(zone);
+
+	return block;
+}
+
+// Return a used block to the zone, merging with free neighbours, zone must be locked
+static void freeBlock(MemZone_t *zone, ZoneBlock_t *block)
+{
+	// Drop the cache owner and flags, free blocks never carry them
+	block->size=blockSize(block)|BLOCK_FREE_BIT;
+
+	// Merge with the previous block if it's free, the boundary tag makes this O(1)
+	ZoneBlock_t *prev=block->prevPhys;
+
+	if(prev&&blockIsFree(prev))
+	{
+		removeFreeBlock(zone, prev);
+		blockMerged(zone, block, prev);
+		blockSetSize(prev, blockSize(prev)+blockSize(block));
+		block=prev;
+		zone->allocations--;
+	}
+
+	// Merge with the next block if it's free (the sentinel never is)
+	ZoneBlock_t *next=blockNext(block);
+
+	if(blockIsFree(next))
+	{
+		removeFreeBlock(zone, next);
+		blockMerged(zone, next, block);
+		blockSetSize(block, blockSize(block)+blockSize(next));
+		zone->allocations--;
+	}
+
+	blockNext(block)->prevPhys=block;
+	insertFreeBlock(zone, block);
+
+	// New free space, the compactor may be able to close it up
+	zone->compactDirty=true;
+	zone->compactIdleChunks=0;
+}
+
+// Resize a used block without moving it, shrinking gives the tail back and growing takes from the next block
+//     if it's free and big enough. Zone must be locked.
+static bool resizeBlock(MemZone_t *zone, ZoneBlock_t *block, size_t size)
+{
+	const size_t currentSize=blockSize(block);
+
+	if(size<=currentSize)
+	{
+		trimBlock(zone, block, size);
+		return true;
+	}
+
+	ZoneBlock_t *next=blockNext(block);
+
+	if(!blockIsFree(next)||currentSize+blockSize(next)<size)
+		return false;
+
+	removeFreeBlock(zone, next);
+	blockMerged(zone, next, block);
+	blockSetSize(block, currentSize+blockSize(next));
+	blockNext(block)->prevPhys=block;
+	zone->allocations--;
+
+	trimBlock(zone, block, size);
+	updatePeak(zone);
+
+	return true;
+}
+
+// First aligned user pointer at or after ptr that leaves either no gap or one big enough to be a block
+static inline uintptr_t alignBlockPtr(uintptr_t ptr, size_t alignment)
+{
+	uintptr_t aligned=(ptr+alignment-1)&~((uintptr_t)alignment-1);
+
+	if(aligned!=ptr&&aligned-ptr<BLOCK_MIN_SIZE)
+		aligned=(ptr+BLOCK_MIN_SIZE+alignment-1)&~((uintptr_t)alignment-1);
+
+	return aligned;
+}
+
+// Take a used block whose user pointer is aligned, zone must be locked.
+// The worst case gap in front is a minimum block plus the alignment, so over-allocate by that
+//     and split the gap off as a free block, which merges into the previous block if that's free.
+static ZoneBlock_t *allocateAligned(MemZone_t *zone, size_t size, size_t alignment)
+{
+	if(alignment<=ZONE_ALIGN)
+		return allocateBlock(zone, size, true);
+
+	ZoneBlock_t *block=allocateBlock(zone, size+alignment+BLOCK_MIN_SIZE, true);
+
+	if(block==NULL)
+		return NULL;
+
+	const uintptr_t ptr=(uintptr_t)blockToPtr(block);
+	const uintptr_t aligned=alignBlockPtr(ptr, alignment);
+
+	if(aligned!=ptr)
+	{
+		const size_t gap=(size_t)(aligned-ptr);
+		ZoneBlock_t *alignedBlock=blockFromPtr((void *)aligned);
+
+		alignedBlock->prevPhys=block;
+		alignedBlock->size=blockSize(block)-gap;
+		blockNext(alignedBlock)->prevPhys=alignedBlock;
+		zone->allocations++;
+
+		blockSetSize(block, gap);
+		freeBlock(zone, block);
+
+		block=alignedBlock;
+	}
+
+	trimBlock(zone, block, size);
+
+	return block;
+}
+
+// How many blocks of a size class move between a cache and the zone at once
+static inline uint32_t cacheBatchCount(size_t size)
+{
+	const size_t count=ZONE_CACHE_BATCH_BYTES/size;
+
+	return count<4?4:(count>64?64:(uint32_t)count);
+}
+
+static inline void cachePush(ZoneCache_t *cache, ZoneBlock_t *block)
+{
+	const size_t cls=blockSize(block)>>ZONE_ALIGN_LOG2;
+
+	block->nextFree=cache->classes[cls].head;
+	cache->classes[cls].head=block;
+	cache->classes[cls].count++;
+}
+
+// Move everything other threads have handed back into the size class lists
+static void cacheDrainDeferred(ZoneCache_t *cache)
+{
+	if(atomic_load_explicit(&cache->deferred, memory_order_relaxed)==NULL)
+		return;
+
+	ZoneBlock_t *block=atomic_exchange_explicit(&cache->deferred, NULL, memory_order_acquire);
+
+	while(block)
+	{
+		ZoneBlock_t *next=block->nextFree;
+
+		cachePush(cache, block);
+		block=next;
+	}
+}
+
+// Fill a size class with a batch of blocks, carved from one free block when possible
+static void cacheRefill(ZoneCache_t *cache, size_t cls)
+{
+	MemZone_t *zone=cache->zone;
+	const size_t size=cls<<ZONE_ALIGN_LOG2;
+	const uint32_t count=cacheBatchCount(size);
+	const size_t bits=cache->ownerBits|BLOCK_CACHED_BIT;
+
+	mtx_lock(&zone->mutex);
+
+	ZoneBlock_t *block=allocateBlock(zone, size*count, false);
+
+	if(block==NULL)
+	{
+		// Zone is too fragmented for a whole run, take what single blocks there are
+		uint32_t numBlocks=0;
+
+		for(;numBlocks<count;numBlocks++)
+		{
+			ZoneBlock_t *single=allocateBlock(zone, size, false);
+
+			if(single==NULL)
+				break;
+
+			single->size|=bits;
+			cachePush(cache, single);
+		}
+
+		// Nothing fits at all, grow the zone (if it can) for a whole run
+		if(numBlocks==0)
+			block=allocateBlock(zone, size*count, true);
+	}
+
+	if(block)
+	{
+		// Split the run into blocks of the class size, linking up the boundary tags.
+		// If the free block was too close in size to trim, the last one takes the slack.
+		const size_t slack=blockSize(block)-size*count;
+		ZoneBlock_t *prev=block->prevPhys;
+
+		for(uint32_t i=0;i<count;i++)
+		{
+			ZoneBlock_t *split=(ZoneBlock_t *)((uint8_t *)block+i*size);
+
+			split->prevPhys=prev;
+			split->size=(i==count-1?size+slack:size)|bits;
+			cachePush(cache, split);
+			prev=split;
+		}
+
+		blockNext(prev)->prevPhys=prev;
+		zone->allocations+=count-1;
+	}
+
+	mtx_unlock(&zone->mutex);
+}
+
+// Give a batch of a size class back to the zone
+static void cacheFlush(ZoneCache_t *cache, size_t cls, uint32_t count)
+{
+	MemZone_t *zone=cache->zone;
+
+	mtx_lock(&zone->mutex);
+
+	for(uint32_t i=0;i<count&&cache->classes[cls].head;i++)
+	{
+		ZoneBlock_t *block=cache->classes[cls].head;
+
+		cache->classes[cls].head=block->nextFree;
+		cache->classes[cls].count--;
+		freeBlock(zone, block);
+	}
+
+	mtx_unlock(&zone->mutex);
+}
+
+// Thread exit, return everything to the zone and leave the slot for another thread
+static void cacheRelease(void *arg)
+{
+	ZoneCache_t *cache=(ZoneCache_t *)arg;
+	MemZone_t *zone=cache->zone;
+
+	// After this, other threads see a dead cache and free to the zone themselves
+	ZoneBlock_t *block=atomic_exchange_explicit(&cache->deferred, CACHE_DEAD, memory_order_acquire);
+
+	mtx_lock(&zone->mutex);
+
+	while(block)
+	{
+		ZoneBlock_t *next=block->nextFree;
+
+		freeBlock(zone, block);
+		block=next;
+	}
+
+	for(uint32_t i=0;i<ZONE_CACHE_CLASSES;i++)
+	{
+		while(cache->classes[i].head)
+		{
+			block=cache->classes[i].head;
+			cache->classes[i].head=block->nextFree;
+			freeBlock(zone, block);
+		}
+
+		cache->classes[i].count=0;
+	}
+
+	cache->alive=false;
+
+	mtx_unlock(&zone->mutex);
+}
+
+static void cacheCreateKey(void)
+{
+	if(tss_create(&cacheKey, cacheRelease)!=thrd_success)
+		DBGPRINTF(DEBUG_ERROR, "Zone: Unable to create thread cache key.\n");
+}
+
+// This thread's cache for the zone, creating it on first use.
+// A thread only caches for one zone at a time, returns NULL if it's bound to another or all slots are taken.
+static ZoneCache_t *cacheGet(MemZone_t *zone)
+{
+	if(threadCache.serial==zone->serial)
+		return threadCache.cache;
+
+	if(threadCache.serial!=0)
+		return NULL;
+
+	mtx_lock(&zone->mutex);
+
+	// Reuse a slot from a thread that's exited, otherwise take a new one
+	ZoneCache_t *cache=NULL;
+
+	for(uint32_t i=0;i<zone->numCaches;i++)
+	{
+		if(!zone->caches[i]->alive)
+		{
+			cache=zone->caches[i];
+			break;
+		}
+	}
+
+	if(cache==NULL&&zone->numCaches<ZONE_MAX_CACHES)
+	{
+		ZoneBlock_t *block=allocateBlock(zone, adjustSize(sizeof(ZoneCache_t)), true);
+
+		if(block)
+		{
+			cache=(ZoneCache_t *)blockToPtr(block);
+			memset(cache, 0, sizeof(ZoneCache_t));
+
+			cache->zone=zone;
+			cache->ownerBits=(size_t)(zone->numCaches+1)<<BLOCK_OWNER_SHIFT;
+			zone->caches[zone->numCaches++]=cache;
+		}
+	}
+
+	if(cache)
+	{
+		atomic_store_explicit(&cache->deferred, NULL, memory_order_relaxed);
+		cache->alive=true;
+	}
+
+	mtx_unlock(&zone->mutex);
+
+	if(cache==NULL)
+		return NULL;
+
+	threadCache.serial=zone->serial;
+	threadCache.cache=cache;
+
+	call_once(&cacheKeyOnce, cacheCreateKey);
+	tss_set(cacheKey, cache);
+
+	return cache;
+}
+
+static void siteMutexInit(void)
+{
+	mtx_init(&siteMutex, mtx_plain);
+}
+
+// ID for a call site, claiming an entry the first time it's seen, 0 if there's no site or the table is full.
+// A call site always passes the same string literal, so the file name pointer is enough to tell them apart.
+static uint32_t siteLookup(const char *file, uint32_t line)
+{
+	if(file==NULL)
+		return 0;
+
+	const uint32_t hash=(uint32_t)(((uintptr_t)file>>3)*2654435761u)^(line*2246822519u);
+
+	for(uint32_t probe=0;probe<ZONE_MAX_SITES-1;probe++)
+	{
+		// ID 0 is reserved for untracked blocks
+		const uint32_t id=1+(hash+probe)%(ZONE_MAX_SITES-1);
+		ZoneSite_t *site=&zoneSites[id];
+		const char *siteFile=atomic_load_explicit(&site->file, memory_order_acquire);
+
+		if(siteFile==NULL)
+		{
+			call_once(&siteMutexOnce, siteMutexInit);
+			mtx_lock(&siteMutex);
+
+			// Another thread might have claimed it in the meantime
+			siteFile=atomic_load_explicit(&site->file, memory_order_relaxed);
+
+			if(siteFile==NULL)
+			{
+				site->line=line;
+				atomic_store_explicit(&site->file, file, memory_order_release);
+				mtx_unlock(&siteMutex);
+
+				return id;
+			}
+
+			mtx_unlock(&siteMutex);
+		}
+
+		if(siteFile==file&&site->line==line)
+			return id;
+	}
+
+	return 0;
+}
+
+// Tag a freshly allocated block with its call site, the caller owns the block so no lock is needed
+static inline void siteStamp(ZoneBlock_t *block, uint32_t id)
+{
+	if(id==0)
+		return;
+
+	ZoneSite_t *site=&zoneSites[id];
+
+	block->size|=(size_t)id<<BLOCK_SITE_SHIFT;
+	atomic_fetch_add_explicit(&site->allocations, 1, memory_order_relaxed);
+	atomic_fetch_add_explicit(&site->liveBlocks, 1, memory_order_relaxed);
+	atomic_fetch_add_explicit(&site->liveBytes, blockSize(block), memory_order_relaxed);
+}
+
+static inline uint32_t siteGet(const ZoneBlock_t *block)
+{
+	if(block->size&BLOCK_MOVABLE_BIT)
+		return 0;
+
+	return (uint32_t)((block->size&BLOCK_SITE_MASK)>>BLOCK_SITE_SHIFT);
+}
+
+// Block is being freed, take it off its site's counts
+static inline void siteRelease(ZoneBlock_t *block)
+{
+	const uint32_t id=siteGet(block);
+
+	if(id==0)
+		return;
+
+	ZoneSite_t *site=&zoneSites[id];
+
+	block->size&=~BLOCK_SITE_MASK;
+	atomic_fetch_sub_explicit(&site->liveBlocks, 1, memory_order_relaxed);
+	atomic_fetch_sub_explicit(&site->liveBytes, blockSize(block), memory_order_relaxed);
+}
+
+// Block was resized in place
+static inline void siteResize(const ZoneBlock_t *block, size_t oldSize)
+{
+	const uint32_t id=siteGet(block);
+
+	if(id==0)
+		return;
+
+	atomic_fetch_add_explicit(&zoneSites[id].liveBytes, blockSize(block), memory_order_relaxed);
+	atomic_fetch_sub_explicit(&zoneSites[id].liveBytes, oldSize, memory_order_relaxed);
+}
+
+// Fixed size zone
+MemZone_t *Zone_Init(size_t size)
+{
+	return Zone_InitEx(size, size, 0);
+}
+
+// Zone that starts at size and grows in chunks as needed up to maxSize
+MemZone_t *Zone_InitEx(size_t size, size_t maxSize, uint32_t flags)
+{
+	size&=~((size_t)ZONE_ALIGN-1);
+
+	if(size<BLOCK_MIN_SIZE)
+	{
+		DBGPRINTF(DEBUG_ERROR, "Zone_Init: Zone size too small.\n");
+		return NULL;
+	}
+
+	MemZone_t *zone=(MemZone_t *)malloc(sizeof(MemZone_t));
+
+	if(zone==NULL)
+	{
+		DBGPRINTF(DEBUG_ERROR, "Zone_Init: Unable to allocate memory for zone.\n");
+		return NULL;
+	}
+
+	memset(zone, 0, sizeof(MemZone_t));
+
+	zone->maxSize=maxSize>size?maxSize:size;
+	zone->flags=flags;
+	zone->freeHandle=UINT32_MAX;
+
+	// Thread caches key off this, so a new zone at the same address isn't mistaken for an old one
+	zone->serial=atomic_fetch_add(&zoneSerial, 1)+1;
+
+	// Create a mutex for thread safety
+	if(mtx_init(&zone->mutex, mtx_plain))
+	{
+		DBGPRINTF(DEBUG_ERROR, "Zone_Init: Unable to create mutex.\n");
+		free(zone);
+		return NULL;
+	}
+
+	// Map the initial chunk, the cap is allowed to round up to a whole page
+	if(!addChunk(zone, size))
+	{
+		DBGPRINTF(DEBUG_ERROR, "Zone_Init: Unable to allocate memory for zone.\n");
+		mtx_destroy(&zone->mutex);
+		free(zone);
+		return NULL;
+	}
+
+	zone->memory=zone->chunks[0].memory;
+
+	if(zone->maxSize<zone->size)
+		zone->maxSize=zone->size;
+
+#ifdef _DEBUG
+	DBGPRINTF(DEBUG_INFO, "Zone_Init: Allocated at %p, size: %0.3fMB\n", zone, (float)zone->size/1000.0f/1000.0f);
+#endif
+
+	return zone;
+}
+
+// Any other threads that allocated from the zone must have exited before it's destroyed.
+void Zone_Destroy(MemZone_t *zone)
+{
+	if(zone)
+	{
+		if(threadCache.serial==zone->serial)
+		{
+			threadCache.serial=0;
+			threadCache.cache=NULL;
+			tss_set(cacheKey, NULL);
+		}
+
+		for(uint32_t i=0;i<zone->numChunks;i++)
+			unmapChunk(&zone->chunks[i]);
+
+		free(zone->handles);
+
+		mtx_destroy(&zone->mutex);
+		free(zone);
+	}
+}
+
+static void *mallocSite(MemZone_t *zone, size_t size, uint32_t site)
+{
+	if(size==0)
+	{
+#ifdef _DEBUG
+		DBGPRINTF(DEBUG_WARNING, "Zone_Malloc: Attempted to allocate 0 bytes\n");
+#endif
+		return NULL;
+	}
+
+	const size_t adjustedSize=adjustSize(size);
+
+	if(adjustedSize==0)
+	{
+		DBGPRINTF(DEBUG_ERROR, "Zone_Malloc: Allocation too large (%zu bytes).\n", size);
+		return NULL;
+	}
+
+	// Small blocks come from the thread's cache without locking
+	if(adjustedSize<=ZONE_CACHE_MAX_BLOCK)
+	{
+		ZoneCache_t *cache=cacheGet(zone);
+
+		if(cache)
+		{
+			const size_t cls=adjustedSize>>ZONE_ALIGN_LOG2;
+
+			if(cache->classes[cls].head==NULL)
+			{
+				cacheDrainDeferred(cache);
+
+				if(cache->classes[cls].head==NULL)
+					cacheRefill(cache, cls);
+			}
+
+			ZoneBlock_t *block=cache->classes[cls].head;
+
+			if(block)
+			{
+				cache->classes[cls].head=block->nextFree;
+				cache->classes[cls].count--;
+				block->size&=~BLOCK_CACHED_BIT;
+				siteStamp(block, site);
+
+				return blockToPtr(block);
+			}
+		}
+	}
+
+	mtx_lock(&zone->mutex);
+
+	ZoneBlock_t *block=allocateBlock(zone, adjustedSize, true);
+
+	if(block==NULL)
+		zone->failures++;
+
+	mtx_unlock(&zone->mutex);
+
+	if(block==NULL)
+	{
+		DBGPRINTF(DEBUG_ERROR, "Zone_Malloc: Unable locate large enough free block (%0.3fKB).\n", (float)size/1000.0f);
+		return NULL;
+	}
+
+#ifdef _DEBUG
+	DBGPRINTF(DEBUG_WARNING, "Zone_Malloc: Allocated block, location: %p, size: %0.3fKB\n", block, (float)(blockSize(block)-BLOCK_HEADER_SIZE)/1000.0f);
+#endif
+
+	siteStamp(block, site);
+
+	return blockToPtr(block);
+}
+
+static void *callocSite(MemZone_t *zone, size_t size, size_t count, uint32_t site)
+{
+	if(count&&size>SIZE_MAX/count)
+		return NULL;
+
+	void *ptr=mallocSite(zone, size*count, site);
+
+	if(ptr)
+		memset(ptr, 0, size*count);
+
+	return ptr;
+}
+
+// Blocks that move keep their call site, unless the caller has one of its own
+static void *reallocSite(MemZone_t *zone, void *ptr, size_t size, uint32_t site)
+{
+	// Input pointer is NULL, just do an allocation
+	if(!ptr)
+		return mallocSite(zone, size, site);
+
+	// Size=0, free the block
+	if(size==0)
+	{
+		Zone_Free(zone, ptr);
+		return NULL;
+	}
+
+	ZoneBlock_t *block=blockFromPtr(ptr);
+
+	const size_t adjustedSize=adjustSize(size);
+
+	if(adjustedSize==0)
+	{
+		DBGPRINTF(DEBUG_ERROR, "Zone_Realloc: Allocation too large (%zu bytes).\n", size);
+		return NULL;
+	}
+
+	if(block->size&BLOCK_CACHED_BIT)
+	{
+		DBGPRINTF(DEBUG_ERROR, "Zone_Realloc: attempted to reallocate a free block.\n");
+		return NULL;
+	}
+
+	if(block->size&BLOCK_MOVABLE_BIT)
+	{
+		DBGPRINTF(DEBUG_ERROR, "Zone_Realloc: Pointer %p belongs to a handle.\n", ptr);
+		return NULL;
+	}
+
+	// Blocks from a thread cache are fixed to their size class, so resizing always moves them
+	if(block->size&BLOCK_OWNER_MASK)
+	{
+		const size_t currentSize=blockSize(block);
+
+		if(adjustedSize==currentSize)
+			return ptr;
+
+		void *newPtr=mallocSite(zone, size, site?site:siteGet(block));
+
+		if(newPtr)
+		{
+			memcpy(newPtr, ptr, (adjustedSize<currentSize?adjustedSize:currentSize)-BLOCK_HEADER_SIZE);
+			Zone_Free(zone, ptr);
+		}
+
+		return newPtr;
+	}
+
+	mtx_lock(&zone->mutex);
+
+	// Block being reallocated shouldn't be free
+	if(blockIsFree(block))
+	{
+		mtx_unlock(&zone->mutex);
+
+		DBGPRINTF(DEBUG_ERROR, "Zone_Realloc: attempted to reallocate a free block.\n");
+		return NULL;
+	}
+
+	const size_t currentSize=blockSize(block);
+
+	if(resizeBlock(zone, block, adjustedSize))
+	{
+		mtx_unlock(&zone->mutex);
+
+		siteResize(block, currentSize);
+
+#ifdef _DEBUG
+		DBGPRINTF(DEBUG_WARNING, "Zone_Realloc: Resized block (%p) in place, %0.3fKB -> %0.3fKB.\n", ptr, (float)currentSize/1000.0f, (float)adjustedSize/1000.0f);
+#endif
+		return ptr;
+	}
+
+	mtx_unlock(&zone->mutex);
+
+	// If there isn't a a free block to use, just allocate a new block and copy original data.
+	void *newPtr=mallocSite(zone, size, site?site:siteGet(block));
+
+	if(newPtr)
+	{
+		memcpy(newPtr, ptr, currentSize-BLOCK_HEADER_SIZE);
+		Zone_Free(zone, ptr);
+	}
+
+#ifdef _DEBUG
+	DBGPRINTF(DEBUG_WARNING, "Zone_Realloc: Allocating new block (%p) and copying.\n", newPtr);
+#endif
+
+	return newPtr;
+}
+
+// Allocation whose address is a multiple of alignment (a power of 2, up to ZONE_MAX_ALIGN).
+// Over-allocates by the alignment, then splits the gap in front off as a free block, so the
+//     block is an ordinary zone block and frees and merges like any other.
+static void *mallocAlignedSite(MemZone_t *zone, size_t size, size_t alignment, uint32_t site)
+{
+	if(alignment==0||(alignment&(alignment-1))||alignment>ZONE_MAX_ALIGN)
+	{
+		DBGPRINTF(DEBUG_ERROR, "Zone_MallocAligned: Alignment must be a power of 2 up to %d (got %zu).\n", ZONE_MAX_ALIGN, alignment);
+		return NULL;
+	}
+
+	// Every block is at least this aligned already
+	if(alignment<=ZONE_ALIGN)
+		return mallocSite(zone, size, site);
+
+	if(size==0)
+	{
+#ifdef _DEBUG
+		DBGPRINTF(DEBUG_WARNING, "Zone_MallocAligned: Attempted to allocate 0 bytes\n");
+#endif
+		return NULL;
+	}
+
+	const size_t adjustedSize=adjustSize(size);
+
+	if(adjustedSize==0)
+	{
+		DBGPRINTF(DEBUG_ERROR, "Zone_MallocAligned: Allocation too large (%zu bytes).\n", size);
+		return NULL;
+	}
+
+	mtx_lock(&zone->mutex);
+
+	ZoneBlock_t *block=allocateAligned(zone, adjustedSize, alignment);
+
+	if(block==NULL)
+	{
+		zone->failures++;
+		mtx_unlock(&zone->mutex);
+
+		DBGPRINTF(DEBUG_ERROR, "Zone_MallocAligned: Unable locate large enough free block (%0.3fKB).\n", (float)size/1000.0f);
+		return NULL;
+	}
+
+	mtx_unlock(&zone->mutex);
+
+#ifdef _DEBUG
+	DBGPRINTF(DEBUG_WARNING, "Zone_MallocAligned: Allocated block, location: %p, size: %0.3fKB, alignment: %zu\n", block, (float)(blockSize(block)-BLOCK_HEADER_SIZE)/1000.0f, alignment);
+#endif
+
+	siteStamp(block, site);
+
+	return blockToPtr(block);
+}
+
+// Resize keeping the alignment, in place when possible
+static void *reallocAlignedSite(MemZone_t *zone, void *ptr, size_t size, size_t alignment, uint32_t site)
+{
+	if(!ptr)
+		return mallocAlignedSite(zone, size, alignment, site);
+
+	if(size==0)
+	{
+		Zone_Free(zone, ptr);
+		return NULL;
+	}
+
+	if(alignment==0||(alignment&(alignment-1))||alignment>ZONE_MAX_ALIGN)
+	{
+		DBGPRINTF(DEBUG_ERROR, "Zone_ReallocAligned: Alignment must be a power of 2 up to %d (got %zu).\n", ZONE_MAX_ALIGN, alignment);
+		return NULL;
+	}
+
+	if(alignment<=ZONE_ALIGN)
+		return reallocSite(zone, ptr, size, site);
+
+	ZoneBlock_t *block=blockFromPtr(ptr);
+
+	const size_t adjustedSize=adjustSize(size);
+
+	if(adjustedSize==0)
+	{
+		DBGPRINTF(DEBUG_ERROR, "Zone_ReallocAligned: Allocation too large (%zu bytes).\n", size);
+		return NULL;
+	}
+
+	if(block->size&BLOCK_CACHED_BIT)
+	{
+		DBGPRINTF(DEBUG_ERROR, "Zone_ReallocAligned: attempted to reallocate a free block.\n");
+		return NULL;
+	}
+
+	if(block->size&BLOCK_MOVABLE_BIT)
+	{
+		DBGPRINTF(DEBUG_ERROR, "Zone_ReallocAligned: Pointer %p belongs to a handle.\n", ptr);
+		return NULL;
+	}
+
+	size_t currentSize=blockSize(block);
+
+	// Only zone blocks that already have the alignment can stay where they are
+	if(((uintptr_t)ptr&(alignment-1))==0&&!(block->size&BLOCK_OWNER_MASK))
+	{
+		mtx_lock(&zone->mutex);
+
+		if(blockIsFree(block))
+		{
+			mtx_unlock(&zone->mutex);
+
+			DBGPRINTF(DEBUG_ERROR, "Zone_ReallocAligned: attempted to reallocate a free block.\n");
+			return NULL;
+		}
+
+		currentSize=blockSize(block);
+
+		if(resizeBlock(zone, block, adjustedSize))
+		{
+			mtx_unlock(&zone->mutex);
+
+			siteResize(block, currentSize);
+
+			return ptr;
+		}
+
+		mtx_unlock(&zone->mutex);
+	}
+
+	void *newPtr=mallocAlignedSite(zone, size, alignment, site?site:siteGet(block));
+
+	if(newPtr)
+	{
+		memcpy(newPtr, ptr, (adjustedSize<currentSize?adjustedSize:currentSize)-BLOCK_HEADER_SIZE);
+		Zone_Free(zone, ptr);
+	}
+
+	return newPtr;
+}
+
+void *Zone_Malloc(MemZone_t *zone, size_t size)
+{
+	return mallocSite(zone, size, 0);
+}
+
+void *Zone_Calloc(MemZone_t *zone, size_t size, size_t count)
+{
+	return callocSite(zone, size, count, 0);
+}
+
+void *Zone_Realloc(MemZone_t *zone, void *ptr, size_t size)
+{
+	return reallocSite(zone, ptr, size, 0);
+}
+
+void *Zone_MallocAligned(MemZone_t *zone, size_t size, size_t alignment)
+{
+	return mallocAlignedSite(zone, size, alignment, 0);
+}
+
+void *Zone_ReallocAligned(MemZone_t *zone, void *ptr, size_t size, size_t alignment)
+{
+	return reallocAlignedSite(zone, ptr, size, alignment, 0);
+}
+
+// Call site tracked versions, normally reached through the ZONE_TRACK_SITES macros
+void *Zone_MallocSite(MemZone_t *zone, size_t size, const char *file, uint32_t line)
+{
+	return mallocSite(zone, size, siteLookup(file, line));
+}
+
+void *Zone_CallocSite(MemZone_t *zone, size_t size, size_t count, const char *file, uint32_t line)
+{
+	return callocSite(zone, size, count, siteLookup(file, line));
+}
+
+void *Zone_ReallocSite(MemZone_t *zone, void *ptr, size_t size, const char *file, uint32_t line)
+{
+	return reallocSite(zone, ptr, size, siteLookup(file, line));
+}
+
+void *Zone_MallocAlignedSite(MemZone_t *zone, size_t size, size_t alignment, const char *file, uint32_t line)
+{
+	return mallocAlignedSite(zone, size, alignment, siteLookup(file, line));
+}
+
+void *Zone_ReallocAlignedSite(MemZone_t *zone, void *ptr, size_t size, size_t alignment, const char *file, uint32_t line)
+{
+	return reallocAlignedSite(zone, ptr, size, alignment, siteLookup(file, line));
+}
+
+void Zone_Free(MemZone_t *zone, void *ptr)
+{
+	if(ptr==NULL)
+	{
+#ifdef _DEBUG
+		DBGPRINTF(DEBUG_ERROR, "Zone_Free: Attempted to free NULL pointer.\n");
+#endif
+		return;
+	}
+
+	ZoneBlock_t *block=blockFromPtr(ptr);
+
+	// The caller owns the block, so its size field is stable without the lock
+	const size_t header=block->size;
+
+	if(header&BLOCK_CACHED_BIT)
+	{
+#ifdef _DEBUG
+		DBGPRINTF(DEBUG_ERROR, "Zone_Free: Attempted to free already freed pointer.\n");
+#endif
+		return;
+	}
+
+	if(header&BLOCK_MOVABLE_BIT)
+	{
+		DBGPRINTF(DEBUG_ERROR, "Zone_Free: Pointer %p belongs to a handle, use Zone_HandleFree.\n", ptr);
+		return;
+	}
+
+	// Free blocks never carry a site, so a double free doesn't count twice
+	siteRelease(block);
+
+	// Block came from a thread cache, hand it back to the owner
+	if(header&BLOCK_OWNER_MASK)
+	{
+		if(threadCache.serial==zone->serial&&threadCache.cache->ownerBits==(header&BLOCK_OWNER_MASK))
+		{
+			ZoneCache_t *cache=threadCache.cache;
+			const size_t cls=blockSize(block)>>ZONE_ALIGN_LOG2;
+
+			block->size|=BLOCK_CACHED_BIT;
+			cachePush(cache, block);
+
+			// Too many sitting idle, give a batch back
+			const uint32_t batch=cacheBatchCount(blockSize(block));
+
+			if(cache->classes[cls].count>batch*2)
+				cacheFlush(cache, cls, batch);
+
+			return;
+		}
+
+		ZoneCache_t *owner=zone->caches[(header>>BLOCK_OWNER_SHIFT)-1];
+		ZoneBlock_t *head=atomic_load_explicit(&owner->deferred, memory_order_relaxed);
+
+		block->size|=BLOCK_CACHED_BIT;
+
+		while(head!=CACHE_DEAD)
+		{
+			block->nextFree=head;
+
+			if(atomic_compare_exchange_weak_explicit(&owner->deferred, &head, block, memory_order_release, memory_order_relaxed))
+				return;
+		}
+
+		// Owner thread has exited, fall through and free it to the zone
+	}
+
+	mtx_lock(&zone->mutex);
+
+	if(blockIsFree(block))
+	{
+		mtx_unlock(&zone->mutex);
+
+#ifdef _DEBUG
+		DBGPRINTF(DEBUG_ERROR, "Zone_Free: Attempted to free already freed pointer.\n");
+#endif
+		return;
+	}
+
+#ifdef _DEBUG
+	DBGPRINTF(DEBUG_WARNING, "Zone_Free: Freed block, location: %p, size: %0.3fKB\n", block, (float)(blockSize(block)-BLOCK_HEADER_SIZE)/1000.0f);
+#endif
+
+	freeBlock(zone, block);
+
+	mtx_unlock(&zone->mutex);
+}
+
+// Handle table entry for a live handle, NULL if it's stale or invalid. Zone must be locked.
+static ZoneHandleEntry_t *handleEntry(MemZone_t *zone, ZoneHandle_t handle)
+{
+	const uint32_t index=handle&ZONE_MAX_HANDLES;
+
+	if(handle==ZONE_INVALID_HANDLE||index>=zone->numHandles)
+		return NULL;
+
+	ZoneHandleEntry_t *entry=&zone->handles[index];
+
+	if(entry->block==NULL||(entry->generation&HANDLE_GENERATION_MASK)!=(handle>>ZONE_HANDLE_INDEX_BITS))
+		return NULL;
+
+	return entry;
+}
+
+// Free handle table entry, growing the table if needed. Zone must be locked.
+static uint32_t handleTake(MemZone_t *zone)
+{
+	if(zone->freeHandle!=UINT32_MAX)
+	{
+		const uint32_t index=zone->freeHandle;
+
+		zone->freeHandle=zone->handles[index].nextFree;
+
+		return index;
+	}
+
+	if(zone->numHandles>=zone->maxHandles)
+	{
+		if(zone->maxHandles>=ZONE_MAX_HANDLES)
+			return UINT32_MAX;
+
+		uint32_t maxHandles=zone->maxHandles?zone->maxHandles*2:HANDLE_TABLE_MIN;
+
+		if(maxHandles>ZONE_MAX_HANDLES)
+			maxHandles=ZONE_MAX_HANDLES;
+
+		// Lives outside the zone like the zone struct itself, so compaction never has to move it
+		ZoneHandleEntry_t *handles=(ZoneHandleEntry_t *)realloc(zone->handles, sizeof(ZoneHandleEntry_t)*maxHandles);
+
+		if(handles==NULL)
+			return UINT32_MAX;
+
+		zone->handles=handles;
+		zone->maxHandles=maxHandles;
+	}
+
+	const uint32_t index=zone->numHandles++;
+
+	zone->handles[index].generation=0;
+
+	return index;
+}
+
+// Relocatable allocation, the memory is only reachable through Zone_HandleLock and may move between locks.
+// Alignment is kept when the block moves, 0 or anything up to ZONE_ALIGN is the zone default.
+ZoneHandle_t Zone_HandleAlloc(MemZone_t *zone, size_t size, size_t alignment)
+{
+	if(alignment<ZONE_ALIGN)
+		alignment=ZONE_ALIGN;
 
-#define FREE_MASK (~SIZE_MASK)
-#define FREE_SHIFT (sizeof(size_t)*8-1)
+	if((alignment&(alignment-1))||alignment>ZONE_MAX_ALIGN)
+	{
+		DBGPRINTF(DEBUG_ERROR, "Zone_HandleAlloc: Alignment must be a power of 2 up to %d (got %zu).\n", ZONE_MAX_ALIGN, alignment);
+		return ZONE_INVALID_HANDLE;
+	}
 
-MemZone_t *Zone_Init(size_t size)
-{
-	// Allocate all the needed memory into the Zone structure pointer.
-	MemZone_t *zone=(MemZone_t *)malloc(size+sizeof(MemZone_t));
+	const size_t adjustedSize=adjustSize(size);
 
-	if(zone==NULL)
+	if(size==0||adjustedSize==0)
 	{
-		DBGPRINTF(DEBUG_ERROR, "Zone_Init: Unable to allocate memory for zone.\n");
-		return NULL;
+		DBGPRINTF(DEBUG_ERROR, "Zone_HandleAlloc: Invalid allocation size (%zu bytes).\n", size);
+		return ZONE_INVALID_HANDLE;
 	}
 
-	// Set the memory pointer to the allocations to just off the end of Zone's structure.
-	zone->memory=(uint8_t *)zone+sizeof(MemZone_t);
+	mtx_lock(&zone->mutex);
+
+	const uint32_t index=handleTake(zone);
+
+	if(index==UINT32_MAX)
+	{
+		zone->failures++;
+		mtx_unlock(&zone->mutex);
 
-	// Set up initial free block header.
-	size_t *header=zone->memory;
-	*header=FREE_MASK|(size&SIZE_MASK);
+		DBGPRINTF(DEBUG_ERROR, "Zone_HandleAlloc: Out of handles.\n");
+		return ZONE_INVALID_HANDLE;
+	}
 
-	zone->allocations=1;
-	zone->size=size;
+	ZoneHandleEntry_t *entry=&zone->handles[index];
+	ZoneBlock_t *block=allocateAligned(zone, adjustedSize, alignment);
 
-	// Create a mutex for thread safety
-	if(mtx_init(&zone->mutex, mtx_plain))
+	if(block==NULL)
 	{
-		DBGPRINTF(DEBUG_ERROR, "Zone_Init: Unable to create mutex.\n");
-		return false;
+		entry->block=NULL;
+		entry->nextFree=zone->freeHandle;
+		zone->freeHandle=index;
+		zone->failures++;
+		mtx_unlock(&zone->mutex);
+
+		DBGPRINTF(DEBUG_ERROR, "Zone_HandleAlloc: Unable locate large enough free block (%0.3fKB).\n", (float)size/1000.0f);
+		return ZONE_INVALID_HANDLE;
 	}
 
-#ifdef _DEBUG
-	DBGPRINTF(DEBUG_INFO, "Zone_Init: Allocated at %p, size: %0.3fMB\n", zone, (float)size/1000.0f/1000.0f);
-#endif
+	block->size|=BLOCK_MOVABLE_BIT|((size_t)index<<BLOCK_HANDLE_SHIFT);
 
-	return zone;
-}
+	entry->block=block;
+	entry->pins=0;
+	entry->alignment=(uint32_t)alignment;
+	zone->numLiveHandles++;
 
-void Zone_Destroy(MemZone_t *zone)
-{
-	if(zone)
-		free(zone);
+	const ZoneHandle_t handle=((entry->generation&HANDLE_GENERATION_MASK)<<ZONE_HANDLE_INDEX_BITS)|index;
+
+	mtx_unlock(&zone->mutex);
+
+	return handle;
 }
 
-void *Zone_Malloc(MemZone_t *zone, size_t size)
+void Zone_HandleFree(MemZone_t *zone, ZoneHandle_t handle)
 {
-	size+=sizeof(size_t);	// Block header
-	size=(size+7)&~7;		// Align to 8-byte boundary
-
-	if(size==sizeof(size_t))
-	{
-#ifdef _DEBUG
-		DBGPRINTF(DEBUG_WARNING, "Zone_Malloc: Attempted to allocate 0 bytes\n");
-#endif
-		return NULL;
-	}
+	if(handle==ZONE_INVALID_HANDLE)
+		return;
 
 	mtx_lock(&zone->mutex);
 
-	// Search for free blocks
-	size_t *block=zone->memory;
+	ZoneHandleEntry_t *entry=handleEntry(zone, handle);
 
-	for(size_t i=0;i<zone->allocations;i++)
+	if(entry==NULL)
 	{
-		bool isFree=((*block&FREE_MASK)>>FREE_SHIFT)==true;
-		size_t blockSize=*block&SIZE_MASK;
+		mtx_unlock(&zone->mutex);
 
-		// Is block free and large enough?
-		if(isFree&&size<=blockSize)
-		{
-			size_t newFreeSize=blockSize-size;
+		DBGPRINTF(DEBUG_ERROR, "Zone_HandleFree: Stale or invalid handle %X.\n", handle);
+		return;
+	}
 
-			// Set the new location and header for free block, only if we haven't consumed entire block
-			if(size<blockSize&&newFreeSize>sizeof(size_t))
-			{
-				size_t *newBlock=(size_t *)((uint8_t *)block+size);
-				*newBlock=FREE_MASK|(newFreeSize&SIZE_MASK);
+	if(entry->pins)
+		DBGPRINTF(DEBUG_WARNING, "Zone_HandleFree: Freeing handle %X while it's still locked.\n", handle);
 
-				zone->allocations++;
-			}
-			else
-				size+=newFreeSize; // Consume the remainder of the block
+	freeBlock(zone, entry->block);
 
-			// Set the new block size
-			*block=size&SIZE_MASK;
+	// Bumping the generation makes any copies of this handle stale
+	entry->block=NULL;
+	entry->generation++;
+	entry->nextFree=zone->freeHandle;
+	zone->freeHandle=handle&ZONE_MAX_HANDLES;
+	zone->numLiveHandles--;
 
-			mtx_unlock(&zone->mutex);
+	mtx_unlock(&zone->mutex);
+}
 
-#ifdef _DEBUG
-			DBGPRINTF(DEBUG_WARNING, "Zone_Malloc: Allocated block, location: %p, size: %0.3fKB\n", block, (float)(size-sizeof(size_t))/1000.0f);
-#endif
-			return (void *)((uint8_t *)block+sizeof(size_t));
-		}
+// Pin the block and return where it is, it won't move until the matching Zone_HandleUnlock.
+// Locks nest, the block stays pinned until every lock has been undone.
+void *Zone_HandleLock(MemZone_t *zone, ZoneHandle_t handle)
+{
+	mtx_lock(&zone->mutex);
+
+	ZoneHandleEntry_t *entry=handleEntry(zone, handle);
+
+	if(entry==NULL)
+	{
+		mtx_unlock(&zone->mutex);
 
-		block=(size_t *)((uint8_t *)block+blockSize);
+		DBGPRINTF(DEBUG_ERROR, "Zone_HandleLock: Stale or invalid handle %X.\n", handle);
+		return NULL;
 	}
 
+	entry->pins++;
+
+	void *ptr=blockToPtr(entry->block);
+
 	mtx_unlock(&zone->mutex);
 
-	DBGPRINTF(DEBUG_ERROR, "Zone_Malloc: Unable locate large enough free block (%0.3fKB).\n", (float)(size-sizeof(size_t))/1000.0f);
-	return NULL;
+	return ptr;
 }
 
-void *Zone_Calloc(MemZone_t *zone, size_t size, size_t count)
+void Zone_HandleUnlock(MemZone_t *zone, ZoneHandle_t handle)
 {
-	void *ptr=Zone_Malloc(zone, size*count);
+	mtx_lock(&zone->mutex);
 
-	if(ptr)
-		memset(ptr, 0, size*count);
+	ZoneHandleEntry_t *entry=handleEntry(zone, handle);
 
-	return ptr;
+	if(entry==NULL||entry->pins==0)
+	{
+		mtx_unlock(&zone->mutex);
+
+		DBGPRINTF(DEBUG_ERROR, "Zone_HandleUnlock: Handle %X isn't locked.\n", handle);
+		return;
+	}
+
+	entry->pins--;
+
+	mtx_unlock(&zone->mutex);
 }
 
-void *Zone_Realloc(MemZone_t *zone, void *ptr, size_t size)
+// Slide the relocatable block after a free block down into it, so the free space ends up after the block
+//     (merged with the next block if that's free). Returns the free block now after it, or NULL if it can't move.
+// Zone must be locked.
+static ZoneBlock_t *compactSlide(MemZone_t *zone, ZoneBlock_t *freeBlk, ZoneBlock_t *block)
 {
-	// Input pointer is NULL, just do an allocation
-	if(!ptr)
-		return Zone_Malloc(zone, size);
+	ZoneHandleEntry_t *entry=&zone->handles[block->size>>BLOCK_HANDLE_SHIFT];
 
-	size_t *block=(size_t *)((uint8_t *)ptr-sizeof(size_t));
-	size_t currentSize=*block&SIZE_MASK;
-	bool isFree=((*block&FREE_MASK)>>FREE_SHIFT)==true;
+	if(entry->pins)
+		return NULL;
 
-	// Block being reallocated shouldn't be free
-	if(isFree)
-	{
-		DBGPRINTF(DEBUG_ERROR, "Zone_Realloc: attempted to reallocate a free block.\n");
+	// Keep the block's alignment, which may leave a small free block in front
+	const uintptr_t newPtr=alignBlockPtr((uintptr_t)blockToPtr(freeBlk), entry->alignment);
+	ZoneBlock_t *newBlock=blockFromPtr((void *)newPtr);
+
+	if(newBlock>=block)
 		return NULL;
-	}
 
-	size+=sizeof(size_t);	// Block header
-	size=(size+7)&~7;		// Align to 8-byte boundary
+	ZoneBlock_t *after=blockNext(block);
+	const size_t shift=(size_t)((uint8_t *)block-(uint8_t *)newBlock);
+	const bool afterFree=blockIsFree(after);
 
-	if(size==sizeof(size_t))
-	{
-		// Size=0, free the block
-		Zone_Free(zone, ptr);
+	// Space left behind has to be a block of its own unless it can join the next one
+	if(shift<BLOCK_MIN_SIZE&&!afterFree)
 		return NULL;
+
+	const size_t gap=(size_t)((uint8_t *)newBlock-(uint8_t *)freeBlk);
+	const size_t header=block->size;
+	const size_t size=blockSize(block);
+	ZoneBlock_t *prev=freeBlk->prevPhys;
+
+	removeFreeBlock(zone, freeBlk);
+
+	if(afterFree)
+	{
+		removeFreeBlock(zone, after);
+		zone->allocations--;
 	}
-	else if(size<=currentSize)
+
+	// Ranges overlap, and the old header may be under the new data
+	memmove(blockToPtr(newBlock), blockToPtr(block), size-BLOCK_HEADER_SIZE);
+
+	if(gap)
 	{
-		// Shrinking Block:
+		freeBlk->size=gap|BLOCK_FREE_BIT;
+		insertFreeBlock(zone, freeBlk);
+		zone->allocations++;
+		prev=freeBlk;
+	}
 
-		// If the sizes are equal, just bail.
-		if(size==currentSize)
-		{
-#ifdef _DEBUG
-			DBGPRINTF(DEBUG_WARNING, "Zone_Realloc: Location: %p, new size (%0.3fKB) == old size (%0.3fKB).\n", ptr, (float)size/1000.0f, (float)currentSize/1000.0f);
-#endif
-			return ptr;
-		}
+	newBlock->prevPhys=prev;
+	newBlock->size=header;
 
-		mtx_lock(&zone->mutex);
+	ZoneBlock_t *tail=blockNext(newBlock);
 
-		// Otherwise, if there is a free block after, expand that block otherwise, create a new free block if possible.
-#ifdef _DEBUG
-		DBGPRINTF(DEBUG_WARNING, "Zone_Realloc: Location: %p, new size (%0.3fKB) < old size (%0.3fKB).\n", ptr, (float)size/1000.0f, (float)currentSize/1000.0f);
-#endif
-		size_t *nextBlock=(size_t *)((uint8_t *)block+currentSize);
-		size_t nextSize=*nextBlock&SIZE_MASK;
-		bool nextIsFree=((*nextBlock&FREE_MASK)>>FREE_SHIFT)==true;
+	tail->prevPhys=newBlock;
+	tail->size=(shift+(afterFree?blockSize(after):0))|BLOCK_FREE_BIT;
+	blockNext(tail)->prevPhys=tail;
+	insertFreeBlock(zone, tail);
 
-		// Check if nextBlock is a free block.
-		if(nextBlock&&nextIsFree)
-		{
-			// Calculate the total new free size.
-			size_t freeSize=currentSize-size+nextSize;
+	entry->block=newBlock;
+
+	return tail;
+}
 
-			// Resize the Block's size to the new size.
-			*block=size&SIZE_MASK;
+// Slide relocatable blocks towards the start of their chunks for up to budget seconds, carrying on from
+//     where the last call stopped. Returns how many bytes were moved.
+// Blocks that aren't relocatable (or are locked) stay put and the compactor steps over them.
+size_t Zone_Compact(MemZone_t *zone, double budget)
+{
+	if(zone==NULL||zone->numLiveHandles==0||!zone->compactDirty)
+		return 0;
 
-			// Create a new block at the end of Block's new size.
-			size_t *newBlock=(size_t *)((uint8_t *)block+size);
-			*newBlock=FREE_MASK|(freeSize&SIZE_MASK);
+	const double endTime=GetClock()+budget;
+	size_t moved=0;
+	uint32_t chunksDone=0, steps=0;
 
-#ifdef _DEBUG
-			DBGPRINTF(DEBUG_WARNING, "Zone_Realloc: Free block merge.\n");
-#endif
-		}
-		else
+	mtx_lock(&zone->mutex);
+
+	// At most one full pass over the zone per call (the pass can start part way through a chunk)
+	while(chunksDone<=zone->numChunks)
+	{
+		if(zone->compactCursor==NULL)
 		{
-			// If there isn't a free nextBlock, insert a free block in the size of the remaining size.
-			// But only if the new size is enough to also fit a block header in it's place.
-			size_t freeSize=currentSize-size;
+			if(zone->compactChunk>=zone->numChunks)
+				zone->compactChunk=0;
 
-			if(freeSize>sizeof(size_t))
-			{
-				// Resize the original block's size to the new size.
-				*block=size&SIZE_MASK;
+			zone->compactCursor=(ZoneBlock_t *)zone->chunks[zone->compactChunk].memory;
+		}
 
-				// Create a newBlock at the end of Block's new size.
-				size_t *newBlock=(size_t *)((uint8_t *)block+size);
-				*newBlock=FREE_MASK|(freeSize&SIZE_MASK);
+		ZoneBlock_t *block=zone->compactCursor;
 
-				zone->allocations++;
+		// End of the chunk, on to the next one
+		if(blockSize(block)==0)
+		{
+			zone->compactChunk++;
+			zone->compactCursor=NULL;
+			chunksDone++;
 
-#ifdef _DEBUG
-				DBGPRINTF(DEBUG_WARNING, "Zone_Realloc: Free block insert.\n");
-#endif
+			// Been all the way round without moving anything (maybe over several calls),
+			//     nothing left to do until something else is freed
+			if(++zone->compactIdleChunks>zone->numChunks)
+			{
+				zone->compactDirty=false;
+				zone->compactIdleChunks=0;
+				break;
 			}
-		}
 
-		mtx_unlock(&zone->mutex);
-
-		// Return the adjusted block's address after adjusting free blocks.
-		return ptr;
-	}
-	else
-	{
-		// Enlarging block:
+			continue;
+		}
 
-		size_t *nextBlock=(size_t *)((uint8_t *)block+currentSize);
-		size_t nextSize=*nextBlock&SIZE_MASK;
-		bool nextIsFree=((*nextBlock&FREE_MASK)>>FREE_SHIFT)==true;
+		ZoneBlock_t *next=blockNext(block);
+		ZoneBlock_t *tail=NULL;
 
-		// If there is an adjacent free block.
-		if(nextBlock&&nextIsFree)
+		if(blockIsFree(block)&&(next->size&BLOCK_MOVABLE_BIT))
 		{
-			// Calculate total size of this block and the free block.
-			size_t totalSize=currentSize+nextSize;
+			const size_t size=blockSize(next);
 
-			// If it is large enough to expand this block into.
-			if(size<=totalSize)
+			if((tail=compactSlide(zone, block, next))!=NULL)
 			{
-				size_t freeSize=totalSize-size;
+				moved+=size;
+				zone->compactIdleChunks=0;
+			}
+		}
 
-				mtx_lock(&zone->mutex);
+		zone->compactCursor=tail?tail:next;
 
-				// Free size must be larger than the header in order to split a free block,
-				//     otherwise consume the whole block.
-				if(freeSize>sizeof(size_t))
-				{
-					size_t *newBlock=(size_t *)((uint8_t *)block+size);
-					*newBlock=FREE_MASK|(freeSize&SIZE_MASK);
+		if((++steps%COMPACT_CLOCK_INTERVAL)==0&&GetClock()>endTime)
+			break;
+	}
 
-					*block=size&SIZE_MASK;
+	mtx_unlock(&zone->mutex);
 
-#ifdef _DEBUG
-					DBGPRINTF(DEBUG_WARNING, "Zone_Realloc: Enlarging block (%p) into adjacent free block.\n", ptr);
-#endif
-				}
-				else
-				{
-					*block=totalSize&SIZE_MASK;
+	return moved;
+}
 
-#ifdef _DEBUG
-					DBGPRINTF(DEBUG_WARNING, "Zone_Realloc: Enlarging block (%p), consuming free block.\n", ptr);
-#endif
-				}
+// Walk the blocks in one chunk, zone must be locked
+static bool verifyChunk(const MemZone_t *zone, const ZoneChunk_t *chunk, size_t *numBlocks, size_t *numFree)
+{
+	ZoneBlock_t *block=(ZoneBlock_t *)chunk->memory;
+	ZoneBlock_t *prev=NULL;
+	ZoneBlock_t *endZone=(ZoneBlock_t *)((uint8_t *)chunk->memory+chunk->size);
 
-				mtx_unlock(&zone->mutex);
+	while(block!=endZone)
+	{
+		ZoneBlock_t *nextBlock=blockNext(block);
 
-				return ptr;
-			}
+		if(blockSize(block)<BLOCK_MIN_SIZE||nextBlock>endZone)
+		{
+			DBGPRINTF(DEBUG_ERROR, "Zone_VerifyHeap: Corrupted heap! Block (%p>%p) went out of range.\n", nextBlock, endZone);
+			return false;
 		}
 
-		// If there isn't a a free block to use, just allocate a new block and copy original data.
-		void *newBlock=Zone_Malloc(zone, size);
+		if(block->prevPhys!=prev)
+		{
+			DBGPRINTF(DEBUG_ERROR, "Zone_VerifyHeap: Corrupted heap! Block %p has a bad previous block link.\n", block);
+			return false;
+		}
 
-		if(newBlock)
+		if(blockIsFree(block))
 		{
-			memcpy(newBlock, ptr, currentSize);
-			Zone_Free(zone, ptr);
+			if(prev&&blockIsFree(prev))
+			{
+				DBGPRINTF(DEBUG_ERROR, "Zone_VerifyHeap: Adjacent free blocks at %p were not merged.\n", block);
+				return false;
+			}
+
+			(*numFree)++;
 		}
+		else if(block->size&BLOCK_MOVABLE_BIT)
+		{
+			const uint32_t index=(uint32_t)(block->size>>BLOCK_HANDLE_SHIFT);
 
-#ifdef _DEBUG
-		DBGPRINTF(DEBUG_WARNING, "Zone_Realloc: Allocating new block (%p) and copying.\n", newBlock);
-#endif
+			if(index>=zone->numHandles||zone->handles[index].block!=block)
+			{
+				DBGPRINTF(DEBUG_ERROR, "Zone_VerifyHeap: Relocatable block %p doesn't match its handle.\n", block);
+				return false;
+			}
+		}
 
-		return newBlock;
+		(*numBlocks)++;
+		prev=block;
+		block=nextBlock;
 	}
-}
 
-void Zone_Free(MemZone_t *zone, void *ptr)
-{
-	if(ptr==NULL)
+	if(block->prevPhys!=prev||blockSize(block)!=0)
 	{
-#ifdef _DEBUG
-		DBGPRINTF(DEBUG_ERROR, "Zone_Free: Attempted to free NULL pointer.\n");
-#endif
-		return;
+		DBGPRINTF(DEBUG_ERROR, "Zone_VerifyHeap: Corrupted heap! Bad end sentinel.\n");
+		return false;
 	}
 
-	size_t *block=(size_t *)((uint8_t *)ptr-sizeof(size_t));
+	return true;
+}
 
-	bool isFree=((*block&FREE_MASK)>>FREE_SHIFT)==true;
-	size_t blockSize=*block&SIZE_MASK;
+// Walk the blocks in the heap and verify that none go out of bounds and the links and free lists agree
+bool Zone_VerifyHeap(MemZone_t *zone)
+{
+	mtx_lock(&zone->mutex);
 
-	if(isFree)
+	size_t numBlocks=0, numFree=0;
+
+	for(uint32_t i=0;i<zone->numChunks;i++)
 	{
-#ifdef _DEBUG
-		DBGPRINTF(DEBUG_ERROR, "Zone_Free: Attempted to free already freed pointer.\n");
-#endif
-		return;
+		if(!verifyChunk(zone, &zone->chunks[i], &numBlocks, &numFree))
+		{
+			mtx_unlock(&zone->mutex);
+			return false;
+		}
 	}
 
-#ifdef _DEBUG
-	DBGPRINTF(DEBUG_WARNING, "Zone_Free: Freed block, location: %p, size: %0.3fKB\n", block, (float)(blockSize-sizeof(size_t))/1000.0f);
-#endif
+	// Every free block must be on the list for its size class, and the bitmaps must match
+	size_t numListed=0, listedBytes=0;
 
-	mtx_lock(&zone->mutex);
+	for(int32_t fl=0;fl<ZONE_FL_COUNT;fl++)
+	{
+		for(int32_t sl=0;sl<ZONE_SL_COUNT;sl++)
+		{
+			const bool hasBlocks=zone->freeLists[fl][sl]!=NULL;
+			const bool bitSet=((zone->slBitmap[fl]>>sl)&1)!=0;
+
+			if(hasBlocks!=bitSet)
+			{
+				DBGPRINTF(DEBUG_ERROR, "Zone_VerifyHeap: Free list bitmap mismatch at %d/%d.\n", fl, sl);
+				mtx_unlock(&zone->mutex);
+				return false;
+			}
 
-	// Freeing a block is as simple as setting it to free.
-	*block|=FREE_MASK;
+			for(ZoneBlock_t *freeBlock=zone->freeLists[fl][sl];freeBlock;freeBlock=freeBlock->nextFree)
+			{
+				int32_t blockFl, blockSl;
+				mappingInsert(blockSize(freeBlock), &blockFl, &blockSl);
 
-	// Check previous and next blocks to see if either are free blocks,
-	//     if they are, merge them all into one large free block.
-	size_t *nextBlock=(size_t *)((uint8_t *)block+blockSize);
-	bool isNextFree=((*nextBlock&FREE_MASK)>>FREE_SHIFT)==true;
+				if(!blockIsFree(freeBlock)||blockFl!=fl||blockSl!=sl)
+				{
+					DBGPRINTF(DEBUG_ERROR, "Zone_VerifyHeap: Block %p is on the wrong free list.\n", freeBlock);
+					mtx_unlock(&zone->mutex);
+					return false;
+				}
 
-	// If next is valid and free, enlarge Block by nextBlock's size
-	//     and decrement allocations (removes next).
-	if(nextBlock&&isNextFree)
-	{
-		blockSize+=*nextBlock&SIZE_MASK;
-		*block=FREE_MASK|(blockSize&SIZE_MASK);
+				numListed++;
+				listedBytes+=blockSize(freeBlock);
+			}
+		}
 
-		zone->allocations--;
+		if(((zone->flBitmap>>fl)&1)!=(zone->slBitmap[fl]!=0))
+		{
+			DBGPRINTF(DEBUG_ERROR, "Zone_VerifyHeap: First level bitmap mismatch at %d.\n", fl);
+			mtx_unlock(&zone->mutex);
+			return false;
+		}
 	}
 
-	// Search for the previous block.
-	//
-	// TODO: Change this to use "previous pointers" or offsets to the previous block,
-	//     so this doesn't have to iterate over the list. It's not exactly slow, but can be avoided.
-	size_t *prevBlock=NULL;
-	size_t *currentBlock=zone->memory;
+	mtx_unlock(&zone->mutex);
 
-	for(size_t i=0;i<zone->allocations;i++)
+	if(numListed!=numFree||numFree!=zone->numFree||listedBytes!=zone->freeBytes||numBlocks!=zone->allocations)
 	{
-		size_t currentSize=*currentBlock&SIZE_MASK;
+		DBGPRINTF(DEBUG_ERROR, "Zone_VerifyHeap: Block count mismatch (%zu free, %zu listed, %zu blocks, %zu counted).\n", numFree, numListed, numBlocks, zone->allocations);
+		return false;
+	}
 
-		if(currentBlock==block)
-			break;
+	return true;
+}
+
+// Iterate over the allocations and print out some stats.
+void Zone_Print(MemZone_t *zone)
+{
+	DBGPRINTF(DEBUG_WARNING, "Zone size: %0.2fMB  Location: 0x%p\n", (float)(zone->size/1000.0f/1000.0f), zone);
 
-		prevBlock=currentBlock;
-		currentBlock=(size_t *)((uint8_t *)currentBlock+currentSize);
+	mtx_lock(&zone->mutex);
+
+	for(uint32_t i=0;i<zone->numChunks;i++)
+	{
+		DBGPRINTF(DEBUG_WARNING, "\tChunk: %p, Size: %0.3fMB%s\n", zone->chunks[i].memory, (float)zone->chunks[i].size/1000.0f/1000.0f, zone->chunks[i].hugePages?" (huge pages)":"");
+
+		// Sentinel is the only zero sized block
+		for(ZoneBlock_t *block=(ZoneBlock_t *)zone->chunks[i].memory;blockSize(block);block=blockNext(block))
+			DBGPRINTF(DEBUG_WARNING, "\tBlock: %p, Address: %p, Size: %0.3fKB, Free: %s\n", block, blockToPtr(block), (float)(blockSize(block)-BLOCK_HEADER_SIZE)/1000.0f, blockIsFree(block)?"yes":"no");
 	}
 
-	// If prevBlock is found and is free, enlarge prevBlock by Block's size
-	//     and decrement allocations (removes Block).
-	// Note: Block may have been also enlarged and merged by the previous operation,
-	//     thus merging all 3 blocks together into a single free block.
-	if(prevBlock)
+	mtx_unlock(&zone->mutex);
+}
+
+// Snapshot of the zone's counters, only the largest free list gets walked so this is cheap enough for every tick
+void Zone_GetStats(MemZone_t *zone, ZoneStats_t *stats)
+{
+	if(stats==NULL)
+		return;
+
+	// No zone reads as an empty one rather than leaving the caller with garbage
+	memset(stats, 0, sizeof(ZoneStats_t));
+
+	if(zone==NULL)
+		return;
+
+	mtx_lock(&zone->mutex);
+
+	stats->size=zone->size;
+	stats->maxSize=zone->maxSize;
+	stats->numChunks=zone->numChunks;
+	stats->bytesInUse=zone->size-zone->freeBytes;
+	stats->peakInUse=zone->peakInUse;
+	stats->freeBytes=zone->freeBytes;
+	stats->numBlocks=zone->allocations;
+	stats->numFree=zone->numFree;
+	stats->failures=zone->failures;
+	memcpy(stats->freeHistogram, zone->freeCounts, sizeof(stats->freeHistogram));
+
+	// The largest free block is on the highest non-empty list
+	size_t largest=0;
+
+	if(zone->flBitmap)
 	{
-		bool isPrevFree=((*prevBlock&FREE_MASK)>>FREE_SHIFT)==true;
-		size_t prevSize=*prevBlock&SIZE_MASK;
+		const int32_t fl=bitScanReverse(zone->flBitmap);
+		const int32_t sl=bitScanReverse(zone->slBitmap[fl]);
 
-		if(isPrevFree)
+		for(ZoneBlock_t *block=zone->freeLists[fl][sl];block;block=block->nextFree)
 		{
-			prevSize+=blockSize;
-			*prevBlock=FREE_MASK|(prevSize&SIZE_MASK);
-
-			zone->allocations--;
+			if(blockSize(block)>largest)
+				largest=blockSize(block);
 		}
 	}
 
 	mtx_unlock(&zone->mutex);
+
+	stats->largestFree=largest?largest-BLOCK_HEADER_SIZE:0;
+	stats->fragmentation=stats->freeBytes?1.0f-(float)largest/(float)stats->freeBytes:0.0f;
 }
 
-// Walk the blocks in the heap and verify that none go out of bounds
-bool Zone_VerifyHeap(MemZone_t *zone)
+static int compareSiteStats(const void *a, const void *b)
+{
+	const size_t bytesA=((const ZoneSiteStats_t *)a)->liveBytes;
+	const size_t bytesB=((const ZoneSiteStats_t *)b)->liveBytes;
+
+	return (bytesA<bytesB)-(bytesA>bytesB);
+}
+
+// Live memory by call site across all zones, largest first. Only sites allocated through the
+//     ZONE_TRACK_SITES macros (or the Zone_*Site functions) show up.
+uint32_t Zone_GetSiteStats(ZoneSiteStats_t *sites, uint32_t maxSites)
 {
-	size_t *block=zone->memory;
-	size_t *endZone=(size_t *)((uint8_t *)zone->memory+zone->size);
+	if(sites==NULL||maxSites==0)
+		return 0;
+
+	ZoneSiteStats_t all[ZONE_MAX_SITES];
+	uint32_t count=0;
 
-	for(size_t i=0;i<zone->allocations;i++)
+	for(uint32_t i=1;i<ZONE_MAX_SITES;i++)
 	{
-		size_t blockSize=*block&SIZE_MASK;
-		size_t *nextBlock=(size_t *)((uint8_t *)block+blockSize);
+		const char *file=atomic_load_explicit(&zoneSites[i].file, memory_order_acquire);
 
-		if(nextBlock>endZone)
-		{
-			DBGPRINTF(DEBUG_ERROR, "Zone_VerifyHeap: Corrupted heap! Block (%p>%p) went out of range.\n", nextBlock, endZone);
-			return false;
-		}
+		if(file==NULL)
+			continue;
 
-		block=(size_t *)((uint8_t *)block+blockSize);
+		all[count].file=file;
+		all[count].line=zoneSites[i].line;
+		all[count].allocations=atomic_load_explicit(&zoneSites[i].allocations, memory_order_relaxed);
+		all[count].liveBlocks=atomic_load_explicit(&zoneSites[i].liveBlocks, memory_order_relaxed);
+		all[count].liveBytes=atomic_load_explicit(&zoneSites[i].liveBytes, memory_order_relaxed);
+		count++;
 	}
 
-	return true;
+	qsort(all, count, sizeof(ZoneSiteStats_t), compareSiteStats);
+
+	if(count>maxSites)
+		count=maxSites;
+
+	memcpy(sites, all, sizeof(ZoneSiteStats_t)*count);
+
+	return count;
 }
 
-// Iterate over the allocations and print out some stats.
-void Zone_Print(MemZone_t *zone)
+void Zone_PrintStats(MemZone_t *zone)
 {
-	DBGPRINTF(DEBUG_WARNING, "Zone size: %0.2fMB  Location: 0x%p\n", (float)(zone->size/1000.0f/1000.0f), zone);
+	if(zone==NULL)
+		return;
+
+	ZoneStats_t stats;
+	Zone_GetStats(zone, &stats);
 
-	size_t *block=zone->memory;
+	DBGPRINTF(DEBUG_WARNING, "Zone: %0.2fMB of %0.2fMB in %d chunks, in use %0.2fMB (peak %0.2fMB), %d failed allocations\n",
+			  (float)stats.size/1000.0f/1000.0f, (float)stats.maxSize/1000.0f/1000.0f, stats.numChunks,
+			  (float)stats.bytesInUse/1000.0f/1000.0f, (float)stats.peakInUse/1000.0f/1000.0f, (uint32_t)stats.failures);
+	DBGPRINTF(DEBUG_WARNING, "\tFree %0.2fMB in %d blocks, largest %0.2fMB, fragmentation %0.1f%%\n",
+			  (float)stats.freeBytes/1000.0f/1000.0f, (uint32_t)stats.numFree, (float)stats.largestFree/1000.0f/1000.0f, stats.fragmentation*100.0f);
 
-	for(size_t i=0;i<zone->allocations;i++)
+	// First level 0 covers everything below the small block size, after that each is a power of 2 range
+	for(uint32_t i=0;i<ZONE_FL_COUNT;i++)
 	{
-		bool isFree=((*block&FREE_MASK)>>FREE_SHIFT)==true;
-		size_t blockSize=*block&SIZE_MASK;
+		if(stats.freeHistogram[i])
+			DBGPRINTF(DEBUG_WARNING, "\t\t%10zu bytes and up: %d free\n", i?(size_t)1<<(i+ZONE_FL_SHIFT-1):0, (uint32_t)stats.freeHistogram[i]);
+	}
 
-		DBGPRINTF(DEBUG_WARNING, "\tBlock: %p, Address: %p, Size: %0.3fKB, Free: %s\n", block, (uint8_t *)block+sizeof(size_t), (float)(blockSize-sizeof(size_t))/1000.0f, isFree?"yes":"no");
+	ZoneSiteStats_t sites[10];
+	const uint32_t numSites=Zone_GetSiteStats(sites, 10);
 
-		block=(size_t *)((uint8_t *)block+blockSize);
-	}
+	for(uint32_t i=0;i<numSites;i++)
+		DBGPRINTF(DEBUG_WARNING, "\t%s:%d: %0.1fKB in %d blocks (%d allocations)\n", sites[i].file, sites[i].line, (float)sites[i].liveBytes/1000.0f, (uint32_t)sites[i].liveBlocks, (uint32_t)sites[i].allocations);
 }
@@ -2,24 +2,163 @@
 #define __MEMZONE_H__
 
 #include <threads.h>
+#include <stdint.h>
 #include <stdbool.h>
 
+// Two level segregated fit (TLSF) parameters:
+// First level splits sizes by power of 2, second level splits each of those linearly into ZONE_SL_COUNT lists.
+#define ZONE_ALIGN_LOG2 4
+#define ZONE_ALIGN (1<<ZONE_ALIGN_LOG2)							// Minimum alignment of all allocations
+#define ZONE_SL_COUNT_LOG2 5
+#define ZONE_SL_COUNT (1<<ZONE_SL_COUNT_LOG2)
+#define ZONE_FL_SHIFT (ZONE_SL_COUNT_LOG2+ZONE_ALIGN_LOG2)
+#define ZONE_FL_MAX 40											// Largest block class is 2^ZONE_FL_MAX bytes
+#define ZONE_FL_COUNT (ZONE_FL_MAX-ZONE_FL_SHIFT+1)
+#define ZONE_SMALL_BLOCK (1<<ZONE_FL_SHIFT)						// Below this size, first level 0 is split linearly
+#define ZONE_MAX_ALIGN 4096										// Largest alignment Zone_MallocAligned takes
+
+// Per-thread caches of small blocks, so most small allocations and frees never take the zone mutex.
+#define ZONE_MAX_CACHES 64										// Most threads that can have a cache at once
+#define ZONE_CACHE_MAX_BLOCK 512								// Largest block size (including header) that's cached
+#define ZONE_CACHE_CLASSES ((ZONE_CACHE_MAX_BLOCK>>ZONE_ALIGN_LOG2)+2)	// Indexed by block size, plus one for blocks with slack
+#define ZONE_CACHE_BATCH_BYTES (16*1024)						// Roughly how much to move between a cache and the zone at once
+
+// Zones are built from OS mapped chunks, a growable zone maps more as it needs them up to its cap.
+#define ZONE_MAX_CHUNKS 64
+#define ZONE_HUGE_PAGE_SIZE (2*1024*1024)
+
+// Allocation call sites that can be told apart, see ZONE_TRACK_SITES below
+#define ZONE_MAX_SITES 1024
+
+// Relocatable allocations are reached through a handle, slot index in the low bits and the slot's
+//     generation in the high bits, so the compactor can move them and stale handles are caught.
+typedef uint32_t ZoneHandle_t;
+#define ZONE_INVALID_HANDLE UINT32_MAX
+#define ZONE_HANDLE_INDEX_BITS 20
+#define ZONE_MAX_HANDLES ((1u<<ZONE_HANDLE_INDEX_BITS)-1)
+
+// Zone_InitEx flags
+#define ZONE_HUGEPAGES 0x1		// Back chunks with huge pages (MAP_HUGETLB, falling back to transparent huge page advice)
+#define ZONE_PREFAULT 0x2		// Touch every page up front, so the first use of the memory doesn't page fault
+
+struct ZoneBlock_s;
+struct ZoneCache_s;
+struct ZoneHandleEntry_s;
+
+typedef struct
+{
+	void *memory;			// First block in the chunk
+	size_t size;			// Usable bytes, not counting the end sentinel
+	size_t mapSize;			// Bytes mapped from the OS
+	bool hugePages;
+} ZoneChunk_t;
+
 typedef struct
 {
 	mtx_t mutex;
 
-	size_t allocations;
-	size_t size;
-	void *memory;
+	size_t allocations;		// Number of blocks (used and free)
+	size_t size;			// Total usable size of all chunks
+	void *memory;			// First chunk's memory
+
+	size_t maxSize;			// Most the zone can grow to
+	uint32_t flags;
+	uint32_t numChunks;
+	ZoneChunk_t chunks[ZONE_MAX_CHUNKS];
+
+	// Free list heads for each size class, and bitmaps of which are non-empty
+	uint32_t flBitmap;
+	uint32_t slBitmap[ZONE_FL_COUNT];
+	struct ZoneBlock_s *freeLists[ZONE_FL_COUNT][ZONE_SL_COUNT];
+
+	// Telemetry, kept up to date as blocks go on and off the free lists
+	size_t freeBytes;
+	size_t numFree;
+	size_t freeCounts[ZONE_FL_COUNT];
+	size_t peakInUse;
+	size_t failures;
+
+	// Relocatable blocks and the incremental compactor's position, which survives across calls
+	struct ZoneHandleEntry_s *handles;
+	uint32_t numHandles, maxHandles;
+	uint32_t numLiveHandles;
+	uint32_t freeHandle;
+	struct ZoneBlock_s *compactCursor;
+	uint32_t compactChunk;
+	uint32_t compactIdleChunks;	// Chunk ends passed since the compactor last moved something
+	bool compactDirty;			// Something was freed since the compactor last found nothing to move
+
+	// Thread caches, indexed by the owner ID stored in cached block headers
+	uint32_t serial;
+	uint32_t numCaches;
+	struct ZoneCache_s *caches[ZONE_MAX_CACHES];
 } MemZone_t;
 
+// Snapshot from Zone_GetStats, cheap enough to take every tick
+typedef struct
+{
+	size_t size;			// Total usable size of all chunks
+	size_t maxSize;			// Most the zone can grow to
+	uint32_t numChunks;
+
+	size_t bytesInUse;		// Taken from the zone, including block headers and blocks held in thread caches
+	size_t peakInUse;
+	size_t freeBytes;
+	size_t largestFree;		// Largest allocation that would succeed without growing the zone
+	float fragmentation;	// 1-largestFree/freeBytes, 0 when all the free space is in one block
+
+	size_t numBlocks;		// Used and free
+	size_t numFree;
+	size_t failures;		// Allocations that returned NULL
+
+	size_t freeHistogram[ZONE_FL_COUNT];	// Free blocks in each first level size class
+} ZoneStats_t;
+
+typedef struct
+{
+	const char *file;
+	uint32_t line;
+	size_t allocations;		// Made from this site since startup
+	size_t liveBlocks;
+	size_t liveBytes;
+} ZoneSiteStats_t;
+
 MemZone_t *Zone_Init(size_t size);
+MemZone_t *Zone_InitEx(size_t size, size_t maxSize, uint32_t flags);
 void Zone_Destroy(MemZone_t *zone);
 void Zone_Free(MemZone_t *zone, void *ptr);
 void *Zone_Malloc(MemZone_t *zone, size_t size);
 void *Zone_Calloc(MemZone_t *zone, size_t size, size_t count);
 void *Zone_Realloc(MemZone_t *zone, void *ptr, size_t size);
+void *Zone_MallocAligned(MemZone_t *zone, size_t size, size_t alignment);
+void *Zone_ReallocAligned(MemZone_t *zone, void *ptr, size_t size, size_t alignment);
 bool Zone_VerifyHeap(MemZone_t *zone);
 void Zone_Print(MemZone_t *zone);
 
+ZoneHandle_t Zone_HandleAlloc(MemZone_t *zone, size_t size, size_t alignment);
+void Zone_HandleFree(MemZone_t *zone, ZoneHandle_t handle);
+void *Zone_HandleLock(MemZone_t *zone, ZoneHandle_t handle);
+void Zone_HandleUnlock(MemZone_t *zone, ZoneHandle_t handle);
+size_t Zone_Compact(MemZone_t *zone, double budget);
+
+void Zone_GetStats(MemZone_t *zone, ZoneStats_t *stats);
+uint32_t Zone_GetSiteStats(ZoneSiteStats_t *sites, uint32_t maxSites);
+void Zone_PrintStats(MemZone_t *zone);
+
+void *Zone_MallocSite(MemZone_t *zone, size_t size, const char *file, uint32_t line);
+void *Zone_CallocSite(MemZone_t *zone, size_t size, size_t count, const char *file, uint32_t line);
+void *Zone_ReallocSite(MemZone_t *zone, void *ptr, size_t size, const char *file, uint32_t line);
+void *Zone_MallocAlignedSite(MemZone_t *zone, size_t size, size_t alignment, const char *file, uint32_t line);
+void *Zone_ReallocAlignedSite(MemZone_t *zone, void *ptr, size_t size, size_t alignment, const char *file, uint32_t line);
+
+// Define ZONE_TRACK_SITES to tag every allocation with the file and line it was made from,
+//     Zone_GetSiteStats then breaks live memory down by call site.
+#if defined(ZONE_TRACK_SITES)&&!defined(ZONE_NO_SITE_MACROS)
+#define Zone_Malloc(zone, size) Zone_MallocSite(zone, size, __FILE__, __LINE__)
+#define Zone_Calloc(zone, size, count) Zone_CallocSite(zone, size, count, __FILE__, __LINE__)
+#define Zone_Realloc(zone, ptr, size) Zone_ReallocSite(zone, ptr, size, __FILE__, __LINE__)
+#define Zone_MallocAligned(zone, size, alignment) Zone_MallocAlignedSite(zone, size, alignment, __FILE__, __LINE__)
+#define Zone_ReallocAligned(zone, ptr, size, alignment) Zone_ReallocAlignedSite(zone, ptr, size, alignment, __FILE__, __LINE__)
+#endif
+
 #endif
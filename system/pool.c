@@ -0,0 +1,235 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include "../system/system.h"
+#include "pool.h"
+
+#define POOL_ALIGN 16
+
+// Which slab a pointer is in, slabs aren't contiguous with each other so this walks the (short) slab list
+static uint32_t findSlot(const Pool_t *pool, const void *ptr)
+{
+	const uint8_t *p=(const uint8_t *)ptr;
+	const size_t slabSize=pool->stride*pool->slotsPerSlab;
+
+	for(uint32_t i=0;i<pool->numSlabs;i++)
+	{
+		if(p>=pool->slabs[i]&&p<pool->slabs[i]+slabSize)
+		{
+			const size_t offset=(size_t)(p-pool->slabs[i]);
+
+			// Must point at the start of a slot
+			if(offset%pool->stride)
+				return UINT32_MAX;
+
+			return i*pool->slotsPerSlab+(uint32_t)(offset/pool->stride);
+		}
+	}
+
+	return UINT32_MAX;
+}
+
+static inline bool isUsed(const Pool_t *pool, uint32_t index)
+{
+	return (pool->used[index>>5]>>(index&31))&1;
+}
+
+// Allocate another slab and thread its slots onto the free list, lowest index first
+static bool addSlab(Pool_t *pool)
+{
+	if(pool->numSlabs>=pool->maxSlabs)
+		return false;
+
+	uint8_t *slab=(uint8_t *)Zone_Malloc(zone, pool->stride*pool->slotsPerSlab);
+
+	if(slab==NULL)
+		return false;
+
+	// Last slab may run past maxSlots, those slots are never handed out
+	const uint32_t firstIndex=pool->numSlabs*pool->slotsPerSlab;
+	const uint32_t numSlots=(pool->maxSlots-firstIndex)<pool->slotsPerSlab?(pool->maxSlots-firstIndex):pool->slotsPerSlab;
+
+	for(uint32_t i=numSlots;i>0;i--)
+	{
+		void **slot=(void **)(slab+(i-1)*pool->stride);
+
+		*slot=pool->freeList;
+		pool->freeList=slot;
+	}
+
+	pool->slabs[pool->numSlabs++]=slab;
+
+	return true;
+}
+
+bool Pool_Init(Pool_t *pool, size_t objectSize, uint32_t slotsPerSlab, uint32_t maxSlots, bool generations)
+{
+	if(pool==NULL||objectSize==0||slotsPerSlab==0)
+		return false;
+
+	if(maxSlots==0||maxSlots>=POOL_MAX_SLOTS)
+	{
+		DBGPRINTF(DEBUG_ERROR, "Pool_Init: Slot count must be between 1 and %d.\n", POOL_MAX_SLOTS-1);
+		return false;
+	}
+
+	memset(pool, 0, sizeof(Pool_t));
+
+	// Slots need room for the free list link and keep objects aligned like the zone does
+	if(objectSize<sizeof(void *))
+		objectSize=sizeof(void *);
+
+	pool->stride=(objectSize+POOL_ALIGN-1)&~((size_t)POOL_ALIGN-1);
+	pool->slotsPerSlab=slotsPerSlab<maxSlots?slotsPerSlab:maxSlots;
+	pool->maxSlots=maxSlots;
+	pool->maxSlabs=(maxSlots+pool->slotsPerSlab-1)/pool->slotsPerSlab;
+
+	const uint32_t numSlots=pool->maxSlabs*pool->slotsPerSlab;
+
+	pool->slabs=(uint8_t **)Zone_Malloc(zone, sizeof(uint8_t *)*pool->maxSlabs);
+	pool->used=(uint32_t *)Zone_Malloc(zone, sizeof(uint32_t)*((numSlots+31)/32));
+
+	if(generations)
+		pool->generations=(uint16_t *)Zone_Malloc(zone, sizeof(uint16_t)*numSlots);
+
+	if(pool->slabs==NULL||pool->used==NULL||(generations&&pool->generations==NULL))
+	{
+		DBGPRINTF(DEBUG_ERROR, "Pool_Init: Unable to allocate memory.\n");
+		Pool_Destroy(pool);
+		return false;
+	}
+
+	memset(pool->used, 0, sizeof(uint32_t)*((numSlots+31)/32));
+
+	if(pool->generations)
+		memset(pool->generations, 0, sizeof(uint16_t)*numSlots);
+
+	return true;
+}
+
+void *Pool_Alloc(Pool_t *pool)
+{
+	if(pool==NULL||pool->numUsed>=pool->maxSlots)
+		return NULL;
+
+	if(pool->freeList==NULL&&!addSlab(pool))
+	{
+		DBGPRINTF(DEBUG_ERROR, "Pool_Alloc: Unable to allocate new slab.\n");
+		return NULL;
+	}
+
+	void **slot=(void **)pool->freeList;
+	pool->freeList=*slot;
+
+	const uint32_t index=findSlot(pool, slot);
+
+	pool->used[index>>5]|=1u<<(index&31);
+	pool->numUsed++;
+
+	return (void *)slot;
+}
+
+void Pool_Free(Pool_t *pool, void *ptr)
+{
+	if(pool==NULL||ptr==NULL)
+		return;
+
+	const uint32_t index=findSlot(pool, ptr);
+
+	if(index==UINT32_MAX||!isUsed(pool, index))
+	{
+		DBGPRINTF(DEBUG_ERROR, "Pool_Free: Pointer %p is not a live object in this pool.\n", ptr);
+		return;
+	}
+
+	pool->used[index>>5]&=~(1u<<(index&31));
+	pool->numUsed--;
+
+	// Invalidate any handles to this slot
+	if(pool->generations)
+		pool->generations[index]++;
+
+	*(void **)ptr=pool->freeList;
+	pool->freeList=ptr;
+}
+
+// Slot index of a live object, UINT32_MAX if it isn't one
+uint32_t Pool_GetIndex(const Pool_t *pool, const void *ptr)
+{
+	if(pool==NULL||ptr==NULL)
+		return UINT32_MAX;
+
+	const uint32_t index=findSlot(pool, ptr);
+
+	if(index==UINT32_MAX||!isUsed(pool, index))
+		return UINT32_MAX;
+
+	return index;
+}
+
+// Object in a slot, NULL if the slot is free, for walking every live object by index
+void *Pool_GetAt(const Pool_t *pool, uint32_t index)
+{
+	if(pool==NULL||index>=pool->numSlabs*pool->slotsPerSlab||!isUsed(pool, index))
+		return NULL;
+
+	return pool->slabs[index/pool->slotsPerSlab]+(index%pool->slotsPerSlab)*pool->stride;
+}
+
+PoolHandle_t Pool_GetHandle(const Pool_t *pool, const void *ptr)
+{
+	const uint32_t index=Pool_GetIndex(pool, ptr);
+
+	if(index==UINT32_MAX)
+		return POOL_INVALID_HANDLE;
+
+	const uint32_t generation=pool->generations?(pool->generations[index]&POOL_GENERATION_MASK):0;
+
+	return (generation<<POOL_INDEX_BITS)|index;
+}
+
+// Object a handle refers to, NULL if it's been freed since the handle was made
+void *Pool_Get(const Pool_t *pool, PoolHandle_t handle)
+{
+	if(handle==POOL_INVALID_HANDLE)
+		return NULL;
+
+	const uint32_t index=handle&POOL_INDEX_MASK;
+	void *ptr=Pool_GetAt(pool, index);
+
+	if(ptr&&pool->generations&&(pool->generations[index]&POOL_GENERATION_MASK)!=(handle>>POOL_INDEX_BITS))
+		return NULL;
+
+	return ptr;
+}
+
+uint32_t Pool_GetCount(const Pool_t *pool)
+{
+	if(pool==NULL)
+		return 0;
+
+	return pool->numUsed;
+}
+
+void Pool_Destroy(Pool_t *pool)
+{
+	if(pool==NULL)
+		return;
+
+	if(pool->slabs)
+	{
+		for(uint32_t i=0;i<pool->numSlabs;i++)
+			Zone_Free(zone, pool->slabs[i]);
+
+		Zone_Free(zone, pool->slabs);
+	}
+
+	if(pool->used)
+		Zone_Free(zone, pool->used);
+
+	if(pool->generations)
+		Zone_Free(zone, pool->generations);
+
+	memset(pool, 0, sizeof(Pool_t));
+}
@@ -0,0 +1,48 @@
+#ifndef __POOL_H__
+#define __POOL_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+// Fixed size object pool, slots are handed out from contiguous slabs that are allocated from the zone
+//     as the pool grows and kept until it's destroyed, so objects never move and never fragment the zone.
+// Not thread safe on its own, owners lock around it the same as they would a List_t.
+
+#define POOL_INDEX_BITS 20
+#define POOL_MAX_SLOTS (1u<<POOL_INDEX_BITS)
+#define POOL_INDEX_MASK (POOL_MAX_SLOTS-1)
+#define POOL_GENERATION_MASK ((1u<<(32-POOL_INDEX_BITS))-1)
+
+// Handle is the slot index in the low bits and the slot's generation in the high bits,
+//     a handle goes stale as soon as its slot is freed, even if the slot gets reused.
+typedef uint32_t PoolHandle_t;
+#define POOL_INVALID_HANDLE UINT32_MAX
+
+typedef struct
+{
+	size_t stride;				// Slot size, object size rounded up for alignment
+	uint32_t slotsPerSlab;
+	uint32_t maxSlots;
+
+	uint32_t numSlabs, maxSlabs;
+	uint8_t **slabs;
+
+	uint32_t numUsed;
+	uint32_t *used;				// Bitset, one bit per slot
+	uint16_t *generations;		// Per slot, NULL if the pool doesn't use handles
+
+	void *freeList;				// Free slots, linked through their first bytes
+} Pool_t;
+
+bool Pool_Init(Pool_t *pool, size_t objectSize, uint32_t slotsPerSlab, uint32_t maxSlots, bool generations);
+void *Pool_Alloc(Pool_t *pool);
+void Pool_Free(Pool_t *pool, void *ptr);
+uint32_t Pool_GetIndex(const Pool_t *pool, const void *ptr);
+void *Pool_GetAt(const Pool_t *pool, uint32_t index);
+PoolHandle_t Pool_GetHandle(const Pool_t *pool, const void *ptr);
+void *Pool_Get(const Pool_t *pool, PoolHandle_t handle);
+uint32_t Pool_GetCount(const Pool_t *pool);
+void Pool_Destroy(Pool_t *pool);
+
+#endif
@@ -5,6 +5,7 @@
 #include <stdarg.h>
 #include <stdio.h>
 #include "memzone.h"
+#include "arena.h"
 
 #ifndef DEBUG_ERROR
 #define DEBUG_ERROR "\x1B[91m"
@@ -58,6 +59,7 @@ inline static void DBGPRINTF(const char *level, const char *format, ...)
 #endif
 
 extern MemZone_t *zone;
+extern FrameArena_t frameArena;
 
 double GetClock(void);
 
@@ -1,4 +1,13 @@
+#ifdef __linux__
+#define _GNU_SOURCE
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#elif defined(WIN32)
+#include <Windows.h>
+#endif
 #include <stdio.h>
+#include <math.h>
 #include <string.h>
 #include "system.h"
 #include "threads.h"
@@ -17,20 +26,19 @@ int Thread_Worker(void *data)
 	{
 		mtx_lock(&worker->mutex);
 
-		if(!(worker->stop||worker->numJobs>0)||worker->pause)
+		while(!worker->stop&&(worker->numJobs==0||worker->pause))
 			cnd_wait(&worker->condition, &worker->mutex);
 
 		if(worker->numJobs>0)
 		{
-			// Get a copy of the current job
-			ThreadJob_t job=worker->jobs[0];
+			// Get a copy of the oldest job and take it off the list
+			ThreadJob_t job=worker->jobs[worker->jobHead];
 
-			// Remove it from the job list
+			worker->jobHead=(worker->jobHead+1)%THREAD_MAXJOBS;
 			worker->numJobs--;
 
-			// Shift job list
-			for(uint32_t i=0;i<worker->numJobs;i++)
-				worker->jobs[i]=worker->jobs[i+1];
+			// Let a blocked Thread_AddJob in
+			cnd_signal(&worker->spaceCondition);
 
 			// Unlock the mutex
 			mtx_unlock(&worker->mutex);
@@ -57,27 +65,37 @@ int Thread_Worker(void *data)
 // Get the number of current jobs
 uint32_t Thread_GetJobCount(ThreadWorker_t *worker)
 {
-	if(worker)
-		return worker->numJobs;
+	if(worker==NULL)
+		return 0;
 
-	return 0;
+	mtx_lock(&worker->mutex);
+	const uint32_t numJobs=worker->numJobs;
+	mtx_unlock(&worker->mutex);
+
+	return numJobs;
 }
 
-// Adds a job function and argument to the job list
+// Adds a job function and argument to the job list, waits for space if the list is full.
+// Must not be called from the worker's own jobs, it would wait on itself.
 bool Thread_AddJob(ThreadWorker_t *worker, ThreadFunction_t jobFunc, void *arg)
 {
-	if(worker)
-	{
-		if(worker->numJobs>=THREAD_MAXJOBS)
-			return false;
+	if(worker==NULL)
+		return false;
 
-		mtx_lock(&worker->mutex);
-		worker->jobs[worker->numJobs++]=(ThreadJob_t){ jobFunc, arg };
-		cnd_signal(&worker->condition);
+	mtx_lock(&worker->mutex);
+
+	while(worker->numJobs>=THREAD_MAXJOBS&&!worker->stop)
+		cnd_wait(&worker->spaceCondition, &worker->mutex);
+
+	if(worker->stop)
+	{
 		mtx_unlock(&worker->mutex);
-	}
-	else
 		return false;
+	}
+
+	worker->jobs[(worker->jobHead+worker->numJobs++)%THREAD_MAXJOBS]=(ThreadJob_t){ jobFunc, arg };
+	cnd_signal(&worker->condition);
+	mtx_unlock(&worker->mutex);
 
 	return true;
 }
@@ -124,6 +142,7 @@ bool Thread_Init(ThreadWorker_t *worker)
 
 	// initialize the job list
 	memset(worker->jobs, 0, sizeof(ThreadJob_t)*THREAD_MAXJOBS);
+	worker->jobHead=0;
 	worker->numJobs=0;
 
 	// Initialize the mutex
@@ -134,7 +153,7 @@ bool Thread_Init(ThreadWorker_t *worker)
 	}
 
 	// Initialize the condition
-	if(cnd_init(&worker->condition))
+	if(cnd_init(&worker->condition)||cnd_init(&worker->spaceCondition))
 	{
 		DBGPRINTF(DEBUG_ERROR, "Unable to create condition.\r\n");
 		return false;
@@ -189,6 +208,7 @@ bool Thread_Destroy(ThreadWorker_t *worker)
 	// Wake up thread
 	worker->pause=false;
 	cnd_broadcast(&worker->condition);
+	cnd_broadcast(&worker->spaceCondition);
 
 	mtx_unlock(&worker->mutex);
 
@@ -196,51 +216,1167 @@ bool Thread_Destroy(ThreadWorker_t *worker)
 	thrd_join(worker->thread, NULL);
 
 	// Destroy the mutex and condition variable
-	mtx_lock(&worker->mutex);
 	mtx_destroy(&worker->mutex);
 	cnd_destroy(&worker->condition);
+	cnd_destroy(&worker->spaceCondition);
 
 	return true;
 }
 
-bool ThreadBarrier_Init(ThreadBarrier_t *barrier, uint32_t count)
+// Pool this thread is a worker of, so jobs that add jobs can tell they're on a worker
+static thread_local ThreadPool_t *currentPool=NULL;
+static thread_local uint32_t currentWorker=UINT32_MAX;
+static thread_local uint32_t stealSeed=0;
+
+// How many pool jobs this thread is inside of, so a job that waits and helps doesn't count its time twice
+static thread_local uint32_t runDepth=0;
+
+// One Thread_ParallelFor call, lives on the caller's stack until every index has run
+typedef struct
+{
+	ThreadRangeFunction_t function;
+	void *arg;
+	uint32_t grain;
+	atomic_uint remaining;		// Indices not yet run
+} ParallelFor_t;
+
+static bool dequeInit(ThreadDeque_t *deque)
 {
-	if(count==0)
+	deque->slots=(ThreadDequeSlot_t *)Zone_Malloc(zone, sizeof(ThreadDequeSlot_t)*THREAD_DEQUE_SIZE);
+
+	if(deque->slots==NULL)
 		return false;
 
-	if(cnd_init(&barrier->cond)!=thrd_success)
+	for(uint32_t i=0;i<THREAD_DEQUE_SIZE;i++)
+	{
+		atomic_init(&deque->slots[i].function, 0);
+		atomic_init(&deque->slots[i].arg, 0);
+		atomic_init(&deque->slots[i].begin, 0);
+		atomic_init(&deque->slots[i].end, 0);
+		atomic_init(&deque->slots[i].queued, 0);
+	}
+
+	atomic_init(&deque->top, 0);
+	atomic_init(&deque->bottom, 0);
+
+	return true;
+}
+
+static void dequeDestroy(ThreadDeque_t *deque)
+{
+	if(deque->slots)
+		Zone_Free(zone, deque->slots);
+
+	deque->slots=NULL;
+}
+
+// Slot fields are atomics only so a thief can read a slot the owner might be reusing,
+//     a thief only keeps what it read if its CAS on top proves the slot wasn't reused.
+static void slotWrite(ThreadDequeSlot_t *slot, const ThreadTask_t *task)
+{
+	atomic_store_explicit(&slot->function, (uintptr_t)task->function, memory_order_relaxed);
+	atomic_store_explicit(&slot->arg, (uintptr_t)task->arg, memory_order_relaxed);
+	atomic_store_explicit(&slot->begin, task->begin, memory_order_relaxed);
+	atomic_store_explicit(&slot->end, task->end, memory_order_relaxed);
+	atomic_store_explicit(&slot->queued, task->queued, memory_order_relaxed);
+}
+
+static void slotRead(ThreadDequeSlot_t *slot, ThreadTask_t *task)
+{
+	task->function=(ThreadFunction_t)atomic_load_explicit(&slot->function, memory_order_relaxed);
+	task->arg=(void *)atomic_load_explicit(&slot->arg, memory_order_relaxed);
+	task->begin=atomic_load_explicit(&slot->begin, memory_order_relaxed);
+	task->end=atomic_load_explicit(&slot->end, memory_order_relaxed);
+	task->queued=atomic_load_explicit(&slot->queued, memory_order_relaxed);
+}
+
+// Owner only, false if the deque is full
+static bool dequePush(ThreadDeque_t *deque, const ThreadTask_t *task)
+{
+	const int64_t bottom=atomic_load_explicit(&deque->bottom, memory_order_relaxed);
+	const int64_t top=atomic_load_explicit(&deque->top, memory_order_acquire);
+
+	if(bottom-top>=THREAD_DEQUE_SIZE)
 		return false;
 
-	if(mtx_init(&barrier->mutex, mtx_plain)!=thrd_success)
+	slotWrite(&deque->slots[bottom&(THREAD_DEQUE_SIZE-1)], task);
+	atomic_thread_fence(memory_order_release);
+	atomic_store_explicit(&deque->bottom, bottom+1, memory_order_relaxed);
+
+	return true;
+}
+
+// Owner only, newest task first
+static bool dequePop(ThreadDeque_t *deque, ThreadTask_t *task)
+{
+	const int64_t bottom=atomic_load_explicit(&deque->bottom, memory_order_relaxed)-1;
+
+	atomic_store_explicit(&deque->bottom, bottom, memory_order_relaxed);
+	atomic_thread_fence(memory_order_seq_cst);
+
+	int64_t top=atomic_load_explicit(&deque->top, memory_order_relaxed);
+
+	if(top>bottom)
+	{
+		// Was empty
+		atomic_store_explicit(&deque->bottom, bottom+1, memory_order_relaxed);
 		return false;
+	}
 
-	barrier->count=count;
-	barrier->initCount=count;
-	barrier->check=0;
+	slotRead(&deque->slots[bottom&(THREAD_DEQUE_SIZE-1)], task);
+
+	if(top==bottom)
+	{
+		// Last task, race any thief for it
+		const bool won=atomic_compare_exchange_strong_explicit(&deque->top, &top, top+1, memory_order_seq_cst, memory_order_relaxed);
+
+		atomic_store_explicit(&deque->bottom, bottom+1, memory_order_relaxed);
+
+		return won;
+	}
 
 	return true;
 }
 
-bool ThreadBarrier_Wait(ThreadBarrier_t *barrier)
+// Any other thread, oldest task first
+static bool dequeSteal(ThreadDeque_t *deque, ThreadTask_t *task)
 {
-	mtx_lock(&barrier->mutex);
-	uint32_t check=barrier->check;
+	int64_t top=atomic_load_explicit(&deque->top, memory_order_acquire);
+	atomic_thread_fence(memory_order_seq_cst);
+	const int64_t bottom=atomic_load_explicit(&deque->bottom, memory_order_acquire);
+
+	if(top>=bottom)
+		return false;
+
+	slotRead(&deque->slots[top&(THREAD_DEQUE_SIZE-1)], task);
+
+	return atomic_compare_exchange_strong_explicit(&deque->top, &top, top+1, memory_order_seq_cst, memory_order_relaxed);
+}
+
+static bool dequeIsEmpty(ThreadDeque_t *deque)
+{
+	return atomic_load_explicit(&deque->top, memory_order_relaxed)>=atomic_load_explicit(&deque->bottom, memory_order_relaxed);
+}
+
+static void parallelForRun(ThreadPool_t *pool, ParallelFor_t *parallelFor, uint32_t begin, uint32_t end);
+static void poolWakeAll(ThreadPool_t *pool);
+
+static inline uint64_t poolClock(void)
+{
+	return (uint64_t)(GetClock()*1e9);
+}
+
+static inline void atomicMax(atomic_uint *value, uint32_t candidate)
+{
+	uint32_t current=atomic_load_explicit(value, memory_order_relaxed);
+
+	while(candidate>current&&!atomic_compare_exchange_weak_explicit(value, &current, candidate, memory_order_relaxed, memory_order_relaxed))
+		;
+}
+
+// Counters for the calling thread, everything outside the pool shares one set
+static inline ThreadPoolCounters_t *poolCounters(ThreadPool_t *pool)
+{
+	return currentPool==pool?&pool->workers[currentWorker].counters:&pool->external;
+}
+
+static inline uint32_t latencyBucket(uint64_t nanoseconds)
+{
+	if(nanoseconds<2)
+		return 0;
+
+#ifdef _MSC_VER
+	unsigned long index;
+	_BitScanReverse64(&index, nanoseconds);
+	const uint32_t bucket=(uint32_t)index;
+#else
+	const uint32_t bucket=63-__builtin_clzll(nanoseconds);
+#endif
+
+	return bucket<THREAD_POOL_LATENCY_BUCKETS?bucket:THREAD_POOL_LATENCY_BUCKETS-1;
+}
+
+static void poolRunTask(ThreadPool_t *pool, const ThreadTask_t *task)
+{
+	ThreadPoolCounters_t *counters=poolCounters(pool);
+	const bool isWorker=currentPool==pool;
+	const bool outermost=runDepth++==0;
+	const uint64_t start=poolClock();
+
+	atomic_fetch_add_explicit(&counters->latency[latencyBucket(start>task->queued?start-task->queued:0)], 1, memory_order_relaxed);
+
+	if(outermost&&isWorker)
+		atomic_store_explicit(&pool->workers[currentWorker].busySince, start, memory_order_relaxed);
+
+	if(task->function)
+		task->function(task->arg);
+	else
+		parallelForRun(pool, (ParallelFor_t *)task->arg, task->begin, task->end);
+
+	runDepth--;
+
+	if(outermost)
+	{
+		atomic_fetch_add_explicit(&counters->busyTime, poolClock()-start, memory_order_relaxed);
+
+		if(isWorker)
+			atomic_store_explicit(&pool->workers[currentWorker].busySince, 0, memory_order_relaxed);
+	}
+
+	atomic_fetch_add_explicit(&counters->jobsExecuted, 1, memory_order_relaxed);
+
+	// Last pending task done, wake anyone in ThreadPool_Wait
+	if(atomic_fetch_sub(&pool->numPending, 1)==1)
+	{
+		mtx_lock(&pool->mutex);
+		cnd_broadcast(&pool->idleCondition);
+		mtx_unlock(&pool->mutex);
+	}
+}
+
+// Producers check for sleeping workers after they publish a task, sleeping workers count themselves before
+//     looking one last time, so either the producer sees the sleeper or the sleeper sees the task.
+static void poolWake(ThreadPool_t *pool)
+{
+	atomic_thread_fence(memory_order_seq_cst);
+
+	if(atomic_load_explicit(&pool->numSleeping, memory_order_relaxed))
+	{
+		mtx_lock(&pool->mutex);
+		cnd_signal(&pool->jobCondition);
+		mtx_unlock(&pool->mutex);
+	}
+}
+
+// Took a task off the shared queue, let a blocked producer in.
+// Blocked producers have their own mutex, this gets called with the pool mutex held by threads about to sleep.
+static void poolMadeSpace(ThreadPool_t *pool)
+{
+	atomic_thread_fence(memory_order_seq_cst);
+
+	if(atomic_load_explicit(&pool->numBlocked, memory_order_relaxed))
+	{
+		mtx_lock(&pool->spaceMutex);
+		cnd_signal(&pool->spaceCondition);
+		mtx_unlock(&pool->spaceMutex);
+	}
+}
+
+// Own deque first (newest, still warm in cache), then the shared queue, then steal the oldest from another worker
+static bool poolFindTask(ThreadPool_t *pool, uint32_t self, ThreadTask_t *task)
+{
+	if(self!=UINT32_MAX&&dequePop(&pool->workers[self].deque, task))
+		return true;
+
+	if(Queue_Pop(&pool->jobs, task))
+	{
+		poolMadeSpace(pool);
+		return true;
+	}
+
+	// Start at a different victim each time, so thieves don't all pile onto worker 0
+	stealSeed=stealSeed*1664525u+1013904223u;
+
+	const uint32_t start=(stealSeed>>16)%pool->numThreads;
+
+	for(uint32_t i=0;i<pool->numThreads;i++)
+	{
+		const uint32_t victim=(start+i)%pool->numThreads;
 
-	if(--barrier->count==0)
+		if(victim!=self&&dequeSteal(&pool->workers[victim].deque, task))
+		{
+			atomic_fetch_add_explicit(&poolCounters(pool)->steals, 1, memory_order_relaxed);
+			return true;
+		}
+	}
+
+	return false;
+}
+
+// Queue a task from whichever thread this is, a worker uses its own deque
+static void poolPushTask(ThreadPool_t *pool, const ThreadTask_t *job)
+{
+	ThreadTask_t stamped=*job;
+	const ThreadTask_t *task=&stamped;
+
+	stamped.queued=poolClock();
+
+	atomic_fetch_add(&pool->numPending, 1);
+
+	if(currentPool==pool)
+	{
+		ThreadPoolWorker_t *worker=&pool->workers[currentWorker];
+
+		if(dequePush(&worker->deque, task))
+		{
+			const int64_t depth=atomic_load_explicit(&worker->deque.bottom, memory_order_relaxed)-atomic_load_explicit(&worker->deque.top, memory_order_relaxed);
+
+			atomicMax(&worker->counters.dequeHighWater, (uint32_t)depth);
+			poolWake(pool);
+			return;
+		}
+	}
+
+	if(!Queue_Push(&pool->jobs, task))
+	{
+		// A worker can't wait on the pool it's part of, it does the work itself
+		if(currentPool==pool)
+		{
+			poolRunTask(pool, task);
+			return;
+		}
+
+		mtx_lock(&pool->spaceMutex);
+
+		// Same handshake as sleeping workers, count as blocked before trying again
+		atomic_fetch_add(&pool->numBlocked, 1);
+		atomic_thread_fence(memory_order_seq_cst);
+
+		while(!Queue_Push(&pool->jobs, task))
+			cnd_wait(&pool->spaceCondition, &pool->spaceMutex);
+
+		atomic_fetch_sub(&pool->numBlocked, 1);
+		mtx_unlock(&pool->spaceMutex);
+	}
+
+	atomicMax(&pool->queueHighWater, Queue_GetCount(&pool->jobs));
+	poolWake(pool);
+}
+
+// Next task for a worker, sleeps if there isn't one. False when the pool is stopping and everything is drained.
+static bool poolNextTask(ThreadPool_t *pool, uint32_t self, ThreadTask_t *task)
+{
+	if(poolFindTask(pool, self, task))
+		return true;
+
+	mtx_lock(&pool->mutex);
+
+	atomic_fetch_add(&pool->numSleeping, 1);
+	atomic_thread_fence(memory_order_seq_cst);
+
+	bool found;
+
+	while(!(found=poolFindTask(pool, self, task))&&!atomic_load(&pool->stop))
+		cnd_wait(&pool->jobCondition, &pool->mutex);
+
+	atomic_fetch_sub(&pool->numSleeping, 1);
+	mtx_unlock(&pool->mutex);
+
+	return found;
+}
+
+static int poolWorker(void *data)
+{
+	ThreadPoolWorker_t *worker=(ThreadPoolWorker_t *)data;
+	ThreadPool_t *pool=worker->pool;
+	ThreadTask_t task;
+
+	currentPool=pool;
+	currentWorker=worker->index;
+	stealSeed=worker->index*0x9E3779B9u+1;
+
+	while(poolNextTask(pool, worker->index, &task))
+		poolRunTask(pool, &task);
+
+	currentPool=NULL;
+	currentWorker=UINT32_MAX;
+
+	return 0;
+}
+
+// Starts numThreads workers, the shared queue for jobs from outside the pool holds at least queueSize jobs
+bool ThreadPool_Init(ThreadPool_t *pool, uint32_t numThreads, uint32_t queueSize)
+{
+	if(pool==NULL||numThreads==0||queueSize==0)
+		return false;
+
+	if(numThreads>THREAD_POOL_MAX_THREADS)
 	{
-		barrier->check++;
-		barrier->count=barrier->initCount;
+		DBGPRINTF(DEBUG_ERROR, "ThreadPool_Init: At most %d threads.\n", THREAD_POOL_MAX_THREADS);
+		return false;
+	}
 
-		cnd_broadcast(&barrier->cond);
-		mtx_unlock(&barrier->mutex);
+	memset(pool, 0, sizeof(ThreadPool_t));
 
+	if(!Queue_Init(&pool->jobs, sizeof(ThreadTask_t), queueSize))
+	{
+		DBGPRINTF(DEBUG_ERROR, "ThreadPool_Init: Unable to create job queue.\n");
 		return false;
 	}
 
-	while(check==barrier->check)
-		cnd_wait(&barrier->cond, &barrier->mutex);
+	for(uint32_t i=0;i<numThreads;i++)
+	{
+		if(!dequeInit(&pool->workers[i].deque))
+		{
+			DBGPRINTF(DEBUG_ERROR, "ThreadPool_Init: Unable to create worker deques.\n");
 
-	mtx_unlock(&barrier->mutex);
+			for(uint32_t j=0;j<i;j++)
+				dequeDestroy(&pool->workers[j].deque);
+
+			Queue_Destroy(&pool->jobs);
+			return false;
+		}
+	}
+
+	if(mtx_init(&pool->mutex, mtx_plain)||mtx_init(&pool->spaceMutex, mtx_plain)||cnd_init(&pool->jobCondition)||cnd_init(&pool->spaceCondition)||cnd_init(&pool->idleCondition))
+	{
+		DBGPRINTF(DEBUG_ERROR, "ThreadPool_Init: Unable to create mutex or conditions.\n");
+
+		for(uint32_t i=0;i<numThreads;i++)
+			dequeDestroy(&pool->workers[i].deque);
+
+		Queue_Destroy(&pool->jobs);
+		return false;
+	}
+
+	atomic_init(&pool->numSleeping, 0);
+	atomic_init(&pool->numBlocked, 0);
+	atomic_init(&pool->numPending, 0);
+	atomic_init(&pool->stop, false);
+	atomic_init(&pool->queueHighWater, 0);
+
+	pool->startTime=poolClock();
+
+	// Workers steal from every deque, so they all have to exist before any worker starts
+	pool->numThreads=numThreads;
+
+	for(uint32_t i=0;i<numThreads;i++)
+	{
+		pool->workers[i].pool=pool;
+		pool->workers[i].index=i;
+
+		if(thrd_create(&pool->workers[i].thread, poolWorker, &pool->workers[i])!=thrd_success)
+		{
+			DBGPRINTF(DEBUG_ERROR, "ThreadPool_Init: Unable to create worker thread %d.\n", i);
+
+			// Only join the ones that started
+			pool->numThreads=i;
+			ThreadPool_Destroy(pool);
+			return false;
+		}
+	}
+
+	return true;
+}
+
+// Queues a job for any worker. From outside the pool this waits for space if the shared queue is full,
+//     a worker puts it on its own deque, or runs it right away if that's full too.
+bool ThreadPool_AddJob(ThreadPool_t *pool, ThreadFunction_t jobFunc, void *arg)
+{
+	if(pool==NULL||pool->numThreads==0||jobFunc==NULL)
+		return false;
+
+	poolPushTask(pool, &(ThreadTask_t){ .function=jobFunc, .arg=arg });
 
 	return true;
 }
+
+// Tasks queued or still running
+uint32_t ThreadPool_GetJobCount(ThreadPool_t *pool)
+{
+	if(pool==NULL)
+		return 0;
+
+	return atomic_load(&pool->numPending);
+}
+
+// Which worker of the pool the calling thread is, UINT32_MAX if it isn't one
+uint32_t ThreadPool_GetWorkerIndex(ThreadPool_t *pool)
+{
+	if(pool==NULL||currentPool!=pool)
+		return UINT32_MAX;
+
+	return currentWorker;
+}
+
+// Waits until every job added so far (and any they add) has finished. Not from inside a job.
+void ThreadPool_Wait(ThreadPool_t *pool)
+{
+	if(pool==NULL||pool->numThreads==0)
+		return;
+
+	mtx_lock(&pool->mutex);
+
+	while(atomic_load(&pool->numPending))
+		cnd_wait(&pool->idleCondition, &pool->mutex);
+
+	mtx_unlock(&pool->mutex);
+}
+
+// Runs whatever is still queued, then stops and joins the workers
+void ThreadPool_Destroy(ThreadPool_t *pool)
+{
+	if(pool==NULL)
+		return;
+
+	mtx_lock(&pool->mutex);
+	atomic_store(&pool->stop, true);
+	cnd_broadcast(&pool->jobCondition);
+	mtx_unlock(&pool->mutex);
+
+	for(uint32_t i=0;i<pool->numThreads;i++)
+		thrd_join(pool->workers[i].thread, NULL);
+
+	for(uint32_t i=0;i<THREAD_POOL_MAX_THREADS;i++)
+		dequeDestroy(&pool->workers[i].deque);
+
+	mtx_destroy(&pool->mutex);
+	mtx_destroy(&pool->spaceMutex);
+	cnd_destroy(&pool->jobCondition);
+	cnd_destroy(&pool->spaceCondition);
+	cnd_destroy(&pool->idleCondition);
+	Queue_Destroy(&pool->jobs);
+
+	memset(pool, 0, sizeof(ThreadPool_t));
+}
+
+static void countersRead(ThreadPoolCounters_t *counters, ThreadPoolWorkerStats_t *stats)
+{
+	stats->jobsExecuted=atomic_load_explicit(&counters->jobsExecuted, memory_order_relaxed);
+	stats->steals=atomic_load_explicit(&counters->steals, memory_order_relaxed);
+	stats->busyTime=(double)atomic_load_explicit(&counters->busyTime, memory_order_relaxed)*1e-9;
+	stats->idleTime=0.0;
+	stats->dequeHighWater=atomic_load_explicit(&counters->dequeHighWater, memory_order_relaxed);
+
+	for(uint32_t i=0;i<THREAD_POOL_LATENCY_BUCKETS;i++)
+		stats->latency[i]=atomic_load_explicit(&counters->latency[i], memory_order_relaxed);
+}
+
+// Snapshot of the pool's counters, cheap enough to take every tick. Counters are read one at a time
+//     while the pool runs, so they can be a job or two out from each other.
+void ThreadPool_GetStats(ThreadPool_t *pool, ThreadPoolStats_t *stats)
+{
+	if(pool==NULL||stats==NULL)
+		return;
+
+	memset(stats, 0, sizeof(ThreadPoolStats_t));
+
+	const uint64_t now=poolClock();
+
+	stats->numThreads=pool->numThreads;
+	stats->pending=atomic_load(&pool->numPending);
+	stats->queueDepth=Queue_GetCount(&pool->jobs);
+	stats->queueHighWater=atomic_load_explicit(&pool->queueHighWater, memory_order_relaxed);
+	stats->uptime=(double)(now-pool->startTime)*1e-9;
+
+	for(uint32_t i=0;i<pool->numThreads;i++)
+	{
+		ThreadPoolWorkerStats_t *worker=&stats->workers[i];
+
+		countersRead(&pool->workers[i].counters, worker);
+
+		// Count the job it's in the middle of as busy too
+		const uint64_t busySince=atomic_load_explicit(&pool->workers[i].busySince, memory_order_relaxed);
+
+		if(busySince&&now>busySince)
+			worker->busyTime+=(double)(now-busySince)*1e-9;
+
+		worker->idleTime=fmax(stats->uptime-worker->busyTime, 0.0);
+	}
+
+	countersRead(&pool->external, &stats->external);
+}
+
+// Upper bound in seconds of the latency bucket the given fraction (0 to 1) of jobs started within
+double ThreadPool_GetLatencyPercentile(const uint64_t *latency, float percentile)
+{
+	uint64_t total=0;
+
+	for(uint32_t i=0;i<THREAD_POOL_LATENCY_BUCKETS;i++)
+		total+=latency[i];
+
+	if(total==0)
+		return 0.0;
+
+	const uint64_t target=(uint64_t)ceil((double)total*percentile);
+	uint64_t count=0;
+
+	for(uint32_t i=0;i<THREAD_POOL_LATENCY_BUCKETS;i++)
+	{
+		count+=latency[i];
+
+		if(count>=target)
+			return (double)(2ull<<i)*1e-9;
+	}
+
+	return (double)(2ull<<(THREAD_POOL_LATENCY_BUCKETS-1))*1e-9;
+}
+
+static void printWorkerStats(const char *name, const ThreadPoolWorkerStats_t *stats, double uptime)
+{
+	DBGPRINTF(DEBUG_WARNING, "\t%s: %llu jobs, %llu steals, busy %0.1f%%, deque high water %d, start latency p50 %0.1fus p99 %0.1fus\n",
+			  name, (unsigned long long)stats->jobsExecuted, (unsigned long long)stats->steals, uptime>0.0?stats->busyTime/uptime*100.0:0.0,
+			  stats->dequeHighWater, ThreadPool_GetLatencyPercentile(stats->latency, 0.5f)*1e6, ThreadPool_GetLatencyPercentile(stats->latency, 0.99f)*1e6);
+}
+
+void ThreadPool_PrintStats(ThreadPool_t *pool)
+{
+	ThreadPoolStats_t stats;
+	ThreadPool_GetStats(pool, &stats);
+
+	DBGPRINTF(DEBUG_WARNING, "Thread pool: %d workers, %d jobs pending, shared queue %d (high water %d), up %0.1fs\n",
+			  stats.numThreads, stats.pending, stats.queueDepth, stats.queueHighWater, stats.uptime);
+
+	for(uint32_t i=0;i<stats.numThreads;i++)
+	{
+		char name[32];
+		snprintf(name, sizeof(name), "Worker %u", i);
+		printWorkerStats(name, &stats.workers[i], stats.uptime);
+	}
+
+	// Outside threads have no idle time of their own, busy is against the pool's uptime
+	if(stats.external.jobsExecuted)
+		printWorkerStats("External", &stats.external, stats.uptime);
+}
+
+// Something a waiter is waiting on just finished, waiters sleep with the idle workers so wake them all
+static void poolWakeAll(ThreadPool_t *pool)
+{
+	mtx_lock(&pool->mutex);
+	cnd_broadcast(&pool->jobCondition);
+	mtx_unlock(&pool->mutex);
+}
+
+// Help out with whatever's queued until counter drops to zero, for callers waiting on their own work.
+// When there's nothing to take, sleep like an idle worker would. Work still running elsewhere can queue more,
+//     that has to wake this thread as well as the workers. Whoever takes counter to zero calls poolWakeAll.
+static void poolHelpUntilZero(ThreadPool_t *pool, atomic_uint *counter)
+{
+	const uint32_t self=currentPool==pool?currentWorker:UINT32_MAX;
+	ThreadTask_t task;
+
+	while(atomic_load(counter))
+	{
+		bool found=poolFindTask(pool, self, &task);
+
+		if(!found)
+		{
+			mtx_lock(&pool->mutex);
+
+			atomic_fetch_add(&pool->numSleeping, 1);
+			atomic_thread_fence(memory_order_seq_cst);
+
+			while(atomic_load(counter)&&!(found=poolFindTask(pool, self, &task)))
+				cnd_wait(&pool->jobCondition, &pool->mutex);
+
+			atomic_fetch_sub(&pool->numSleeping, 1);
+			mtx_unlock(&pool->mutex);
+
+			// Woken because the wait is over, the wake might have been meant for a task, pass it on
+			if(!found)
+				poolWake(pool);
+		}
+
+		if(found)
+			poolRunTask(pool, &task);
+	}
+}
+
+// Lazy binary splitting: whenever there's nothing left on this thread's deque for others to steal,
+//     hand off the upper half of what's left and carry on with the lower half, otherwise just run
+//     the next grain. Busy workers end up splitting rarely and idle ones always have something to take.
+static void parallelForRun(ThreadPool_t *pool, ParallelFor_t *parallelFor, uint32_t begin, uint32_t end)
+{
+	const bool isWorker=currentPool==pool;
+
+	while(begin<end)
+	{
+		const bool canSplit=isWorker?dequeIsEmpty(&pool->workers[currentWorker].deque):Queue_GetCount(&pool->jobs)==0;
+
+		if(end-begin>parallelFor->grain&&canSplit)
+		{
+			const uint32_t middle=begin+(end-begin)/2;
+
+			poolPushTask(pool, &(ThreadTask_t){ .function=NULL, .arg=parallelFor, .begin=middle, .end=end });
+			end=middle;
+			continue;
+		}
+
+		const uint32_t chunkEnd=end-begin>parallelFor->grain?begin+parallelFor->grain:end;
+
+		parallelFor->function(begin, chunkEnd, parallelFor->arg);
+
+		// Whoever finishes the last index wakes the caller
+		if(atomic_fetch_sub(&parallelFor->remaining, chunkEnd-begin)==chunkEnd-begin)
+			poolWakeAll(pool);
+
+		begin=chunkEnd;
+	}
+}
+
+// Calls function over [begin, end) in pieces of at least grain indices, spread over the pool's workers,
+//     and returns once every index is done. The calling thread works on the range too, so this can be
+//     called from inside a job (nested loops just split further) as well as from outside the pool.
+bool Thread_ParallelFor(ThreadPool_t *pool, uint32_t begin, uint32_t end, uint32_t grain, ThreadRangeFunction_t function, void *arg)
+{
+	if(function==NULL||begin>end)
+		return false;
+
+	if(begin==end)
+		return true;
+
+	if(grain==0)
+		grain=1;
+
+	// No pool, or nothing to split, just run it here
+	if(pool==NULL||pool->numThreads==0||end-begin<=grain)
+	{
+		function(begin, end, arg);
+		return true;
+	}
+
+	ParallelFor_t parallelFor={ .function=function, .arg=arg, .grain=grain };
+	atomic_init(&parallelFor.remaining, end-begin);
+
+	parallelForRun(pool, &parallelFor, begin, end);
+
+	poolHelpUntilZero(pool, &parallelFor.remaining);
+
+	return true;
+}
+
+static void nodeRun(void *arg);
+
+// One fewer thing holding the node back, queue it once nothing is
+static void nodeRelease(ThreadNode_t *node)
+{
+	if(atomic_fetch_sub(&node->dependencies, 1)!=1)
+		return;
+
+	if(node->pool&&node->pool->numThreads)
+		poolPushTask(node->pool, &(ThreadTask_t){ .function=nodeRun, .arg=node });
+	else
+		nodeRun(node);
+}
+
+// Member node finished (or the group was closed), the last one out releases the continuations
+static void groupRelease(ThreadPool_t *pool, ThreadGroup_t *group)
+{
+	if(atomic_fetch_sub(&group->pending, 1)!=1)
+		return;
+
+	for(uint32_t i=0;i<group->numContinuations;i++)
+		nodeRelease(group->continuations[i]);
+
+	// Nothing touches the group after this, waiters are free to reuse it
+	atomic_store(&group->running, 0);
+
+	if(pool&&pool->numThreads)
+		poolWakeAll(pool);
+}
+
+static void nodeRun(void *arg)
+{
+	ThreadNode_t *node=(ThreadNode_t *)arg;
+
+	// Copy out what's needed, the node's owner may reuse it as soon as its group is done
+	ThreadPool_t *pool=node->pool;
+	ThreadGroup_t *group=node->group;
+
+	node->function(node->arg);
+
+	for(uint32_t i=0;i<node->numSuccessors;i++)
+		nodeRelease(node->successors[i]);
+
+	if(group)
+		groupRelease(pool, group);
+}
+
+// Sets up a node to run function(arg) once it's submitted and everything it depends on has finished.
+// Nodes are wired up with ThreadNode_Precede and ThreadGroup_Then before they're submitted, and can be
+//     reused once they've run (or their group is done) by initializing them again.
+void ThreadNode_Init(ThreadNode_t *node, ThreadFunction_t function, void *arg, ThreadGroup_t *group)
+{
+	if(node==NULL)
+		return;
+
+	node->function=function;
+	node->arg=arg;
+	node->group=group;
+	node->pool=NULL;
+	node->numSuccessors=0;
+
+	// Held back until submitted
+	atomic_init(&node->dependencies, 1);
+
+	if(group)
+		atomic_fetch_add(&group->pending, 1);
+}
+
+// Successor won't start until node has finished. Both must not have been submitted yet.
+bool ThreadNode_Precede(ThreadNode_t *node, ThreadNode_t *successor)
+{
+	if(node==NULL||successor==NULL)
+		return false;
+
+	if(node->numSuccessors>=THREAD_NODE_MAX_SUCCESSORS)
+	{
+		DBGPRINTF(DEBUG_ERROR, "ThreadNode_Precede: Node already has %d successors.\n", THREAD_NODE_MAX_SUCCESSORS);
+		return false;
+	}
+
+	atomic_fetch_add(&successor->dependencies, 1);
+	node->successors[node->numSuccessors++]=successor;
+
+	return true;
+}
+
+// Hands the node to the pool, it runs as soon as its dependencies are done. With no pool it runs on this thread.
+void ThreadNode_Submit(ThreadPool_t *pool, ThreadNode_t *node)
+{
+	if(node==NULL||node->function==NULL)
+		return;
+
+	node->pool=pool;
+	nodeRelease(node);
+}
+
+void ThreadGroup_Init(ThreadGroup_t *group)
+{
+	if(group==NULL)
+		return;
+
+	// Held open until closed, so it can't finish while members are still being added
+	atomic_init(&group->pending, 1);
+	atomic_init(&group->running, 1);
+	group->closed=false;
+	group->numContinuations=0;
+}
+
+// Node runs once every member of the group has finished, it must not be a member itself.
+// Both must not have been submitted or closed yet.
+bool ThreadGroup_Then(ThreadGroup_t *group, ThreadNode_t *node)
+{
+	if(group==NULL||node==NULL)
+		return false;
+
+	if(group->numContinuations>=THREAD_GROUP_MAX_CONTINUATIONS||group->closed)
+	{
+		DBGPRINTF(DEBUG_ERROR, "ThreadGroup_Then: Group is closed or already has %d continuations.\n", THREAD_GROUP_MAX_CONTINUATIONS);
+		return false;
+	}
+
+	atomic_fetch_add(&node->dependencies, 1);
+	group->continuations[group->numContinuations++]=node;
+
+	return true;
+}
+
+// No more members will be added, the group is done once the ones it has finish
+void ThreadGroup_Close(ThreadPool_t *pool, ThreadGroup_t *group)
+{
+	if(group==NULL||group->closed)
+		return;
+
+	group->closed=true;
+	groupRelease(pool, group);
+}
+
+bool ThreadGroup_IsDone(ThreadGroup_t *group)
+{
+	return group==NULL||atomic_load(&group->running)==0;
+}
+
+// Closes the group if it's still open and works on queued jobs until every member and continuation release is done.
+// Continuations themselves aren't waited on unless they're members of another group that is.
+void ThreadGroup_Wait(ThreadPool_t *pool, ThreadGroup_t *group)
+{
+	if(group==NULL)
+		return;
+
+	ThreadGroup_Close(pool, group);
+
+	if(pool&&pool->numThreads)
+		poolHelpUntilZero(pool, &group->running);
+}
+
+bool ThreadBarrier_Init(ThreadBarrier_t *barrier, uint32_t count)
+{
+	if(barrier==NULL||count==0)
+		return false;
+
+	if(cnd_init(&barrier->cond)!=thrd_success)
+		return false;
+
+	if(mtx_init(&barrier->mutex, mtx_plain)!=thrd_success)
+	{
+		cnd_destroy(&barrier->cond);
+		return false;
+	}
+
+	barrier->initCount=count;
+	atomic_init(&barrier->count, count);
+	atomic_init(&barrier->generation, 0);
+	atomic_init(&barrier->numParked, 0);
+
+	// Spinning only pays off when every thread can be running at once, otherwise it's holding up the one that's late
+	ThreadBarrier_SetSpin(barrier, count<=Thread_GetCPUCount()?THREAD_BARRIER_MAX_SPIN:0);
+
+	return true;
+}
+
+// Most pause instructions a waiter spins for before parking, not while anything is waiting on the barrier
+void ThreadBarrier_SetSpin(ThreadBarrier_t *barrier, uint32_t maxSpin)
+{
+	if(barrier==NULL)
+		return;
+
+	barrier->maxSpin=maxSpin;
+	atomic_store(&barrier->spin, maxSpin);
+}
+
+// Returns false on the one thread that opened the barrier, true on the rest
+bool ThreadBarrier_Wait(ThreadBarrier_t *barrier)
+{
+	const uint32_t generation=atomic_load(&barrier->generation);
+
+	if(atomic_fetch_sub(&barrier->count, 1)==1)
+	{
+		// Reset for the next phase before opening, nobody can arrive at it until they see the new generation
+		atomic_store_explicit(&barrier->count, barrier->initCount, memory_order_relaxed);
+		atomic_fetch_add(&barrier->generation, 1);
+
+		if(atomic_load(&barrier->numParked))
+		{
+			mtx_lock(&barrier->mutex);
+			cnd_broadcast(&barrier->cond);
+			mtx_unlock(&barrier->mutex);
+		}
+
+		return false;
+	}
+
+	const uint32_t spin=atomic_load_explicit(&barrier->spin, memory_order_relaxed);
+
+	for(uint32_t i=0;i<spin;i++)
+	{
+		if(atomic_load_explicit(&barrier->generation, memory_order_acquire)!=generation)
+		{
+			// Opened while spinning, worth spinning a bit longer next time
+			if(spin<barrier->maxSpin)
+				atomic_store_explicit(&barrier->spin, spin*2<barrier->maxSpin?spin*2:barrier->maxSpin, memory_order_relaxed);
+
+			return true;
+		}
+
+		Thread_SpinPause();
+	}
+
+	// Spun for nothing, spin less next time
+	if(spin>THREAD_BARRIER_MIN_SPIN)
+		atomic_store_explicit(&barrier->spin, spin/2, memory_order_relaxed);
+
+	mtx_lock(&barrier->mutex);
+
+	// Whoever opens the barrier checks for parked threads after bumping the generation, so one of the two sees the other
+	atomic_fetch_add(&barrier->numParked, 1);
+
+	while(atomic_load(&barrier->generation)==generation)
+		cnd_wait(&barrier->cond, &barrier->mutex);
+
+	atomic_fetch_sub(&barrier->numParked, 1);
+
+	mtx_unlock(&barrier->mutex);
+
+	return true;
+}
+
+void ThreadBarrier_Destroy(ThreadBarrier_t *barrier)
+{
+	if(barrier==NULL)
+		return;
+
+	cnd_destroy(&barrier->cond);
+	mtx_destroy(&barrier->mutex);
+}
+
+// CPUs this process may run on, read the first time anything asks. Pinning a thread narrows that thread's
+//     own mask, so asking again afterwards from the same thread would only see the one CPU it was pinned to.
+#ifdef __linux__
+#define THREAD_MAX_CPUS CPU_SETSIZE
+#else
+#define THREAD_MAX_CPUS 1024
+#endif
+
+static once_flag cpuListOnce=ONCE_FLAG_INIT;
+static uint16_t cpuList[THREAD_MAX_CPUS];
+static uint32_t numCPUs=0;
+
+static void cpuListInit(void)
+{
+	uint32_t count=1;
+
+#ifdef __linux__
+	cpu_set_t set;
+
+	// IDs needn't be contiguous under a cpuset or taskset, keep the actual ones
+	if(sched_getaffinity(0, sizeof(set), &set)==0)
+	{
+		for(uint32_t cpu=0;cpu<CPU_SETSIZE;cpu++)
+		{
+			if(CPU_ISSET(cpu, &set))
+				cpuList[numCPUs++]=(uint16_t)cpu;
+		}
+
+		if(numCPUs)
+			return;
+	}
+
+	const long online=sysconf(_SC_NPROCESSORS_ONLN);
+
+	if(online>0)
+		count=(uint32_t)online;
+#elif defined(WIN32)
+	SYSTEM_INFO info;
+	GetSystemInfo(&info);
+
+	count=info.dwNumberOfProcessors;
+#endif
+
+	// Without a mask to go on, assume they're numbered from zero
+	for(numCPUs=0;numCPUs<count&&numCPUs<THREAD_MAX_CPUS;numCPUs++)
+		cpuList[numCPUs]=(uint16_t)numCPUs;
+}
+
+// Logical CPUs available to this process
+uint32_t Thread_GetCPUCount(void)
+{
+	call_once(&cpuListOnce, cpuListInit);
+
+	return numCPUs;
+}
+
+// ID of the index'th CPU this process may run on, wrapping around, for Thread_SetAffinity
+uint32_t Thread_GetCPU(uint32_t index)
+{
+	call_once(&cpuListOnce, cpuListInit);
+
+	return cpuList[index%numCPUs];
+}
+
+// Keep a thread on one CPU, so its cache stays warm and it doesn't fight another pinned thread
+bool Thread_SetAffinity(thrd_t thread, uint32_t cpu)
+{
+#ifdef __linux__
+	if(cpu>=CPU_SETSIZE)
+	{
+		DBGPRINTF(DEBUG_ERROR, "Thread_SetAffinity: CPU %d out of range.\n", cpu);
+		return false;
+	}
+
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	CPU_SET(cpu, &set);
+
+	// C11 threads are pthreads underneath on Linux
+	if(pthread_setaffinity_np((pthread_t)thread, sizeof(set), &set)!=0)
+	{
+		DBGPRINTF(DEBUG_ERROR, "Thread_SetAffinity: Unable to pin thread to CPU %d.\n", cpu);
+		return false;
+	}
+
+	return true;
+#elif defined(WIN32)
+	if(cpu>=sizeof(DWORD_PTR)*8)
+	{
+		DBGPRINTF(DEBUG_ERROR, "Thread_SetAffinity: CPU %d out of range.\n", cpu);
+		return false;
+	}
+
+	// C11 threads don't give out the native handle here, so a thread can only pin itself
+	if(!thrd_equal(thread, thrd_current()))
+	{
+		DBGPRINTF(DEBUG_WARNING, "Thread_SetAffinity: Only the calling thread can be pinned on this platform.\n");
+		return false;
+	}
+
+	if(SetThreadAffinityMask(GetCurrentThread(), (DWORD_PTR)1<<cpu)==0)
+	{
+		DBGPRINTF(DEBUG_ERROR, "Thread_SetAffinity: Unable to pin thread to CPU %d.\n", cpu);
+		return false;
+	}
+
+	return true;
+#else
+	DBGPRINTF(DEBUG_WARNING, "Thread_SetAffinity: Not supported on this platform.\n");
+	return false;
+#endif
+}
+
+// High is a real-time class, so a thread running at it that never blocks will starve the rest of the system
+bool Thread_SetPriority(thrd_t thread, ThreadPriority_e priority)
+{
+#ifdef __linux__
+	struct sched_param param={ 0 };
+	int policy=SCHED_OTHER;
+
+	if(priority==THREAD_PRIO_LOW)
+		policy=SCHED_IDLE;
+	else if(priority==THREAD_PRIO_HIGH)
+	{
+		policy=SCHED_RR;
+		param.sched_priority=sched_get_priority_min(SCHED_RR);
+	}
+
+	// Real-time needs privileges, that's expected to fail on most setups so it's only a warning
+	if(pthread_setschedparam((pthread_t)thread, policy, &param)!=0)
+	{
+		DBGPRINTF(DEBUG_WARNING, "Thread_SetPriority: Priority %d not permitted.\n", priority);
+		return false;
+	}
+
+	return true;
+#elif defined(WIN32)
+	// Time critical is as high as a thread goes without moving the whole process into the real-time class
+	int level=THREAD_PRIORITY_NORMAL;
+
+	if(priority==THREAD_PRIO_LOW)
+		level=THREAD_PRIORITY_IDLE;
+	else if(priority==THREAD_PRIO_HIGH)
+		level=THREAD_PRIORITY_TIME_CRITICAL;
+
+	if(!thrd_equal(thread, thrd_current()))
+	{
+		DBGPRINTF(DEBUG_WARNING, "Thread_SetPriority: Only the calling thread can be changed on this platform.\n");
+		return false;
+	}
+
+	if(!SetThreadPriority(GetCurrentThread(), level))
+	{
+		DBGPRINTF(DEBUG_WARNING, "Thread_SetPriority: Priority %d not permitted.\n", priority);
+		return false;
+	}
+
+	return true;
+#else
+	DBGPRINTF(DEBUG_WARNING, "Thread_SetPriority: Not supported on this platform.\n");
+	return false;
+#endif
+}
+
+// Pin worker i to the (firstCPU+i)'th available CPU, wrapping around
+bool ThreadPool_SetAffinity(ThreadPool_t *pool, uint32_t firstCPU)
+{
+	if(pool==NULL)
+		return false;
+
+	bool result=true;
+
+	for(uint32_t i=0;i<pool->numThreads;i++)
+		result&=Thread_SetAffinity(pool->workers[i].thread, Thread_GetCPU(firstCPU+i));
+
+	return result;
+}
+
+bool ThreadPool_SetPriority(ThreadPool_t *pool, ThreadPriority_e priority)
+{
+	if(pool==NULL)
+		return false;
+
+	bool result=true;
+
+	for(uint32_t i=0;i<pool->numThreads;i++)
+		result&=Thread_SetPriority(pool->workers[i].thread, priority);
+
+	return result;
+}
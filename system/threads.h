@@ -5,10 +5,17 @@
 #include <stdint.h>
 #include <stdbool.h>
 #include <stdatomic.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#include "../utils/queue.h"
 
 #define THREAD_MAXJOBS 128
+#define THREAD_POOL_MAX_THREADS 64
+#define THREAD_DEQUE_SIZE 1024			// Per worker, power of two
 
 typedef void (*ThreadFunction_t)(void *arg);
+typedef void (*ThreadRangeFunction_t)(uint32_t begin, uint32_t end, void *arg);
 
 // Structure that holds the function pointer and argument
 // to store in a list that can be iterated as a job list.
@@ -24,12 +31,15 @@ typedef struct
 	bool pause;
 	bool stop;
 
+	// Circular job list, oldest job at jobHead
 	ThreadJob_t jobs[THREAD_MAXJOBS];
+	uint32_t jobHead;
 	uint32_t numJobs;
 
 	thrd_t thread;
 	mtx_t mutex;
 	cnd_t condition;
+	cnd_t spaceCondition;		// Signalled when a job is taken off a full list
 
 	ThreadFunction_t constructor;
 	void *constructorArg;
@@ -38,15 +48,179 @@ typedef struct
 	void *destructorArg;
 } ThreadWorker_t;
 
+// Work item as it sits in the pool's queues, either a plain job or a piece of a parallel for's range
+typedef struct
+{
+	ThreadFunction_t function;	// NULL for a range piece, then arg is the parallel for it belongs to
+	void *arg;
+	uint32_t begin, end;
+	uint64_t queued;			// When it was queued, in nanoseconds
+} ThreadTask_t;
+
+typedef struct
+{
+	atomic_uintptr_t function;
+	atomic_uintptr_t arg;
+	atomic_uint begin, end;
+	atomic_ullong queued;
+} ThreadDequeSlot_t;
+
+// Chase-Lev work stealing deque, the owning worker pushes and pops at the bottom and other workers
+//     steal from the top, only a race for the last task needs a CAS.
+typedef struct
+{
+	atomic_int_fast64_t top;
+	uint8_t pad0[CACHE_LINE_SIZE-sizeof(atomic_int_fast64_t)];
+
+	atomic_int_fast64_t bottom;
+	uint8_t pad1[CACHE_LINE_SIZE-sizeof(atomic_int_fast64_t)];
+
+	ThreadDequeSlot_t *slots;
+	uint8_t pad2[CACHE_LINE_SIZE-sizeof(ThreadDequeSlot_t *)];
+} ThreadDeque_t;
+
+// Queued to started latency, bucket i counts jobs that waited [2^i, 2^(i+1)) nanoseconds
+#define THREAD_POOL_LATENCY_BUCKETS 32
+
+// Running totals, relaxed atomics so ThreadPool_GetStats can read them while the pool runs
+typedef struct
+{
+	atomic_ullong jobsExecuted;
+	atomic_ullong steals;				// Jobs taken from another worker's deque
+	atomic_ullong busyTime;				// Nanoseconds spent running jobs, nested jobs aren't counted twice
+	atomic_uint dequeHighWater;			// Deepest this worker's deque has been
+	atomic_ullong latency[THREAD_POOL_LATENCY_BUCKETS];
+} ThreadPoolCounters_t;
+
+struct ThreadPool_s;
+
+typedef struct
+{
+	ThreadDeque_t deque;
+	ThreadPoolCounters_t counters;
+	atomic_ullong busySince;			// Start of the job it's running, zero between jobs
+	thrd_t thread;
+	struct ThreadPool_s *pool;
+	uint32_t index;
+	uint8_t pad[CACHE_LINE_SIZE];		// Keep the counters off the next worker's deque
+} ThreadPoolWorker_t;
+
+// Work stealing pool of worker threads.
+// Jobs added from outside the pool go through a shared lock-free MPMC queue, jobs added by a worker go on
+//     its own deque, and a worker that runs dry steals from the others before it goes to sleep.
+// The mutex and conditions are only touched when a worker goes to sleep, or when the shared queue is full
+//     and a producer has to wait for space.
+typedef struct ThreadPool_s
+{
+	uint32_t numThreads;
+	ThreadPoolWorker_t workers[THREAD_POOL_MAX_THREADS];
+
+	Queue_t jobs;
+
+	mtx_t mutex;
+	cnd_t jobCondition;			// Sleeping workers and Thread_ParallelFor callers wait here for jobs
+	mtx_t spaceMutex;
+	cnd_t spaceCondition;		// Blocked producers wait here for space
+	cnd_t idleCondition;		// ThreadPool_Wait waits here for the pending count to hit zero
+
+	atomic_uint numSleeping;	// Threads waiting on jobCondition
+	atomic_uint numBlocked;		// Producers waiting on spaceCondition
+	atomic_uint numPending;		// Tasks queued or running
+	atomic_bool stop;
+
+	uint64_t startTime;				// Nanoseconds, idle time is whatever of the time since isn't busy
+	atomic_uint queueHighWater;		// Deepest the shared queue has been
+	ThreadPoolCounters_t external;	// Jobs run by threads outside the pool, while they help out or when the queue is full
+} ThreadPool_t;
+
+// Snapshot from ThreadPool_GetStats, take two and subtract to see a window of time
+typedef struct
+{
+	uint64_t jobsExecuted;
+	uint64_t steals;
+	double busyTime;				// Seconds
+	double idleTime;				// Seconds, workers only
+	uint32_t dequeHighWater;
+	uint64_t latency[THREAD_POOL_LATENCY_BUCKETS];
+} ThreadPoolWorkerStats_t;
+
+typedef struct
+{
+	uint32_t numThreads;
+	uint32_t pending;				// Jobs queued or running
+	uint32_t queueDepth;			// Jobs in the shared queue right now
+	uint32_t queueHighWater;
+	double uptime;					// Seconds since the pool started
+	ThreadPoolWorkerStats_t workers[THREAD_POOL_MAX_THREADS];
+	ThreadPoolWorkerStats_t external;
+} ThreadPoolStats_t;
+
+#define THREAD_NODE_MAX_SUCCESSORS 32
+#define THREAD_GROUP_MAX_CONTINUATIONS 8
+
+struct ThreadGroup_s;
+
+// Job in a dependency graph, runs once it's been submitted and every node it depends on has finished
+typedef struct ThreadNode_s
+{
+	ThreadFunction_t function;
+	void *arg;
+
+	struct ThreadGroup_s *group;	// Group it's a member of, NULL for none
+	ThreadPool_t *pool;				// Pool it was submitted to
+
+	atomic_uint dependencies;		// Unfinished predecessors, plus one until it's submitted
+	uint32_t numSuccessors;
+	struct ThreadNode_s *successors[THREAD_NODE_MAX_SUCCESSORS];
+} ThreadNode_t;
+
+// Set of nodes that can be waited on as a whole, with continuation nodes that run once they've all finished
+typedef struct ThreadGroup_s
+{
+	atomic_uint pending;			// Members not yet finished, plus one until the group is closed
+	atomic_uint running;			// Cleared once the group is done and nothing will touch it again
+	bool closed;
+
+	uint32_t numContinuations;
+	ThreadNode_t *continuations[THREAD_GROUP_MAX_CONTINUATIONS];
+} ThreadGroup_t;
+
+// Barrier waiters spin for a while before parking on the condition, phases that open within the spin
+//     never touch the mutex. The spin budget grows when phases open while waiters spin and shrinks when they park.
+#define THREAD_BARRIER_MAX_SPIN 4096		// Pause instructions
+#define THREAD_BARRIER_MIN_SPIN 64
+
 typedef struct
 {
     mtx_t mutex;
     cnd_t cond;
 	uint32_t initCount;
-	uint32_t count;
-	uint32_t check;
+	uint32_t maxSpin;				// Zero to always park straight away
+	atomic_uint count;				// Threads yet to arrive this phase
+	atomic_uint generation;			// Bumped every time the barrier opens
+	atomic_uint numParked;
+	atomic_uint spin;				// Current spin budget
 } ThreadBarrier_t;
 
+typedef enum
+{
+	THREAD_PRIO_LOW,				// Only runs when nothing else wants the CPU
+	THREAD_PRIO_NORMAL,
+	THREAD_PRIO_HIGH,				// Real-time, must block rather than busy wait. Usually needs privileges.
+} ThreadPriority_e;
+
+// CPU hint for spin-wait loops, eases off the pipeline and the sibling hyperthread
+static inline void Thread_SpinPause(void)
+{
+#if defined(_MSC_VER)
+	_mm_pause();
+#elif defined(__x86_64__)||defined(__i386__)
+	__builtin_ia32_pause();
+#elif defined(__aarch64__)
+	__asm__ __volatile__("yield");
+#endif
+}
+
 uint32_t Thread_GetJobCount(ThreadWorker_t *worker);
 bool Thread_AddJob(ThreadWorker_t *worker, ThreadFunction_t jobFunc, void *arg);
 void Thread_AddConstructor(ThreadWorker_t *worker, ThreadFunction_t constructorFunc, void *arg);
@@ -57,7 +231,38 @@ void Thread_Pause(ThreadWorker_t *worker);
 void Thread_Resume(ThreadWorker_t *worker);
 bool Thread_Destroy(ThreadWorker_t *worker);
 
+bool ThreadPool_Init(ThreadPool_t *pool, uint32_t numThreads, uint32_t queueSize);
+bool ThreadPool_AddJob(ThreadPool_t *pool, ThreadFunction_t jobFunc, void *arg);
+uint32_t ThreadPool_GetJobCount(ThreadPool_t *pool);
+uint32_t ThreadPool_GetWorkerIndex(ThreadPool_t *pool);
+void ThreadPool_Wait(ThreadPool_t *pool);
+void ThreadPool_Destroy(ThreadPool_t *pool);
+void ThreadPool_GetStats(ThreadPool_t *pool, ThreadPoolStats_t *stats);
+double ThreadPool_GetLatencyPercentile(const uint64_t *latency, float percentile);
+void ThreadPool_PrintStats(ThreadPool_t *pool);
+
+bool Thread_ParallelFor(ThreadPool_t *pool, uint32_t begin, uint32_t end, uint32_t grain, ThreadRangeFunction_t function, void *arg);
+
+void ThreadNode_Init(ThreadNode_t *node, ThreadFunction_t function, void *arg, ThreadGroup_t *group);
+bool ThreadNode_Precede(ThreadNode_t *node, ThreadNode_t *successor);
+void ThreadNode_Submit(ThreadPool_t *pool, ThreadNode_t *node);
+
+void ThreadGroup_Init(ThreadGroup_t *group);
+bool ThreadGroup_Then(ThreadGroup_t *group, ThreadNode_t *node);
+void ThreadGroup_Close(ThreadPool_t *pool, ThreadGroup_t *group);
+bool ThreadGroup_IsDone(ThreadGroup_t *group);
+void ThreadGroup_Wait(ThreadPool_t *pool, ThreadGroup_t *group);
+
 bool ThreadBarrier_Init(ThreadBarrier_t *barrier, uint32_t count);
+void ThreadBarrier_SetSpin(ThreadBarrier_t *barrier, uint32_t maxSpin);
 bool ThreadBarrier_Wait(ThreadBarrier_t *barrier);
+void ThreadBarrier_Destroy(ThreadBarrier_t *barrier);
+
+uint32_t Thread_GetCPUCount(void);
+uint32_t Thread_GetCPU(uint32_t index);
+bool Thread_SetAffinity(thrd_t thread, uint32_t cpu);
+bool Thread_SetPriority(thrd_t thread, ThreadPriority_e priority);
+bool ThreadPool_SetAffinity(ThreadPool_t *pool, uint32_t firstCPU);
+bool ThreadPool_SetPriority(ThreadPool_t *pool, ThreadPriority_e priority);
 
 #endif
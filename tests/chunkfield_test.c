@@ -0,0 +1,436 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../math/math.h"
+#include "../physics/physics.h"
+#include "../system/threads.h"
+#include "../world/chunkfield.h"
+#include "test.h"
+
+#define SMALL_CHUNKS 64
+#define NUM_CAMERAS 16
+#define MANY_CHUNKS (NUM_CAMERAS*CHUNK_MAX_PER_CAMERA)
+#define MAX_LOAD_UPDATES 2000
+#define CONTAIN_TICKS 600
+#define TICK (1.0f/60.0f)
+
+static RigidBody_t serialBodies[SMALL_CHUNKS*CHUNK_MAX_BODIES];
+static RigidBody_t workerBodies[SMALL_CHUNKS*CHUNK_MAX_BODIES];
+static RigidBody_t resetBodies[SMALL_CHUNKS*CHUNK_MAX_BODIES];
+static RigidBody_t manyBodies[MANY_CHUNKS*CHUNK_MAX_BODIES];
+static RigidBody_t tinyBodies[CHUNK_MAX_PER_CAMERA*CHUNK_MAX_BODIES];
+
+static ThreadWorker_t worker;
+
+static void Nap(void)
+{
+	thrd_sleep(&(struct timespec){ .tv_nsec=200000 }, NULL);
+}
+
+static bool SameBody(const RigidBody_t *a, const RigidBody_t *b)
+{
+	return !memcmp(&a->position, &b->position, sizeof(vec3))&&!memcmp(&a->velocity, &b->velocity, sizeof(vec3))&&
+		!memcmp(&a->orientation, &b->orientation, sizeof(vec4))&&!memcmp(&a->angularVelocity, &b->angularVelocity, sizeof(vec3))&&
+		a->radius==b->radius&&a->mass==b->mass&&a->invMass==b->invMass&&a->inertia==b->inertia&&a->invInertia==b->invInertia;
+}
+
+static uint32_t CountState(const ChunkField_t *field, ChunkState_e state)
+{
+	uint32_t count=0;
+
+	for(uint32_t i=0;i<field->maxChunks;i++)
+		count+=field->chunks[i].state==state;
+
+	return count;
+}
+
+// Keep updating until no generate job is in flight, jobs write into the field so it can't be destroyed before then
+static void Settle(ChunkField_t *field, const vec3 *cameras, uint32_t numCameras, double time)
+{
+	for(uint32_t i=0;i<MAX_LOAD_UPDATES&&CountState(field, CHUNK_LOADING);i++)
+	{
+		Nap();
+		ChunkField_Update(field, cameras, numCameras, time);
+	}
+
+	TEST_CHECK(CountState(field, CHUNK_LOADING)==0);
+}
+
+// Resident slot holding a chunk, UINT32_MAX if it isn't resident
+static uint32_t FindChunk(const ChunkField_t *field, uint64_t key)
+{
+	for(uint32_t i=0;i<field->maxChunks;i++)
+	{
+		if(field->chunks[i].state!=CHUNK_FREE&&field->chunks[i].key==key)
+			return i;
+	}
+
+	return UINT32_MAX;
+}
+
+// Every active chunk in a matches the same chunk in b body for body, whichever slots they ended up in
+static bool SameChunks(const ChunkField_t *a, const RigidBody_t *aBodies, const ChunkField_t *b, const RigidBody_t *bBodies)
+{
+	for(uint32_t i=0;i<a->maxChunks;i++)
+	{
+		if(a->chunks[i].state!=CHUNK_ACTIVE)
+			continue;
+
+		const uint32_t j=FindChunk(b, a->chunks[i].key);
+
+		if(j==UINT32_MAX||b->chunks[j].state!=CHUNK_ACTIVE||b->chunks[j].numBodies!=a->chunks[i].numBodies)
+			return false;
+
+		for(uint32_t k=0;k<CHUNK_MAX_BODIES;k++)
+		{
+			if(!SameBody(&aBodies[i*CHUNK_MAX_BODIES+k], &bBodies[j*CHUNK_MAX_BODIES+k]))
+				return false;
+		}
+	}
+
+	return true;
+}
+
+// Whether every chunk within load distance of the camera is active
+static bool CameraLoaded(const ChunkField_t *field, vec3 camera)
+{
+	const int32_t cx=(int32_t)floorf(camera.x/CHUNK_SIZE), cy=(int32_t)floorf(camera.y/CHUNK_SIZE), cz=(int32_t)floorf(camera.z/CHUNK_SIZE);
+
+	for(int32_t z=cz-CHUNK_LOAD_REACH;z<=cz+CHUNK_LOAD_REACH;z++)
+	{
+		for(int32_t y=cy-CHUNK_LOAD_REACH;y<=cy+CHUNK_LOAD_REACH;y++)
+		{
+			for(int32_t x=cx-CHUNK_LOAD_REACH;x<=cx+CHUNK_LOAD_REACH;x++)
+			{
+				const vec3 low=Vec3(x*CHUNK_SIZE, y*CHUNK_SIZE, z*CHUNK_SIZE);
+
+				if(Vec3_Distance(camera, Vec3_Clampv(camera, low, Vec3_Adds(low, CHUNK_SIZE)))>CHUNK_LOAD_DISTANCE)
+					continue;
+
+				bool found=false;
+
+				for(uint32_t i=0;i<field->maxChunks;i++)
+				{
+					const Chunk_t *chunk=&field->chunks[i];
+
+					if(chunk->state==CHUNK_ACTIVE&&chunk->x==x&&chunk->y==y&&chunk->z==z)
+						found=true;
+				}
+
+				if(!found)
+					return false;
+			}
+		}
+	}
+
+	return true;
+}
+
+// Same seed gives the same field, whether generated inline, on the worker or again after a reset
+static void Generation(void)
+{
+	ChunkField_t serial, threaded, reset;
+	const vec3 camera=Vec3(0.0f, 0.0f, 0.0f);
+
+	TEST_CHECK(ChunkField_Init(&serial, serialBodies, SMALL_CHUNKS, NULL, 42));
+	TEST_CHECK(ChunkField_Init(&threaded, workerBodies, SMALL_CHUNKS, &worker, 42));
+	TEST_CHECK(ChunkField_Init(&reset, resetBodies, SMALL_CHUNKS, NULL, 7));
+
+	ChunkField_Update(&serial, &camera, 1, 0.0);
+
+	TEST_CHECK(CountState(&serial, CHUNK_ACTIVE)>0);
+	TEST_CHECK(CountState(&serial, CHUNK_LOADING)==0);
+	TEST_CHECK(CameraLoaded(&serial, camera));
+
+	// Nothing overlaps and the spawn point is clear
+	uint32_t numBodies=0, overlapping=0, tooClose=0;
+
+	for(uint32_t i=0;i<serial.numBodies;i++)
+	{
+		const RigidBody_t *a=&serialBodies[i];
+
+		if(a->radius<=0.0f)
+			continue;
+
+		numBodies++;
+
+		if(Vec3_Length(a->position)<CHUNK_SPAWN_CLEARANCE)
+			tooClose++;
+
+		for(uint32_t j=i+1;j<serial.numBodies;j++)
+		{
+			const RigidBody_t *b=&serialBodies[j];
+
+			if(b->radius>0.0f&&Vec3_Distance(a->position, b->position)<a->radius+b->radius)
+				overlapping++;
+		}
+	}
+
+	TEST_CHECK(numBodies>=CountState(&serial, CHUNK_ACTIVE)*CHUNK_MIN_BODIES);
+	TEST_CHECK(overlapping==0);
+	TEST_CHECK(tooClose==0);
+
+	for(uint32_t i=0;i<MAX_LOAD_UPDATES&&!CameraLoaded(&threaded, camera);i++)
+	{
+		Nap();
+		ChunkField_Update(&threaded, &camera, 1, 0.0);
+	}
+
+	TEST_CHECK(CameraLoaded(&threaded, camera));
+	TEST_CHECK(SameChunks(&serial, serialBodies, &threaded, workerBodies));
+	TEST_CHECK(SameChunks(&threaded, workerBodies, &serial, serialBodies));
+
+	// Different seed, different field, until it's reset to the same seed
+	ChunkField_Update(&reset, &camera, 1, 0.0);
+	TEST_CHECK(!SameChunks(&serial, serialBodies, &reset, resetBodies));
+
+	ChunkField_Reset(&reset, 42);
+
+	TEST_CHECK(reset.numBodies==0);
+	TEST_CHECK(reset.numSleepers==0);
+	TEST_CHECK(reset.numFreed>0);
+
+	ChunkField_Update(&reset, &camera, 1, 0.0);
+	TEST_CHECK(SameChunks(&serial, serialBodies, &reset, resetBodies));
+
+	Settle(&threaded, &camera, 1, 0.0);
+	ChunkField_Destroy(&threaded);
+	ChunkField_Destroy(&serial);
+	ChunkField_Destroy(&reset);
+}
+
+// Chunks left behind go idle, then hibernate and free their slots, and wake with the state they went to sleep with
+static void Hibernation(void)
+{
+	ChunkField_t field;
+	const vec3 home=Vec3(0.0f, 0.0f, 0.0f), away=Vec3(50000.0f, 0.0f, 0.0f);
+
+	TEST_CHECK(ChunkField_Init(&field, serialBodies, SMALL_CHUNKS, NULL, 42));
+
+	ChunkField_Update(&field, &home, 1, 0.0);
+
+	const uint32_t numHome=CountState(&field, CHUNK_ACTIVE);
+	uint64_t keys[SMALL_CHUNKS];
+	static RigidBody_t saved[SMALL_CHUNKS*CHUNK_MAX_BODIES];
+
+	// Disturb the bodies, so waking them has to restore this rather than regenerate them
+	for(uint32_t i=0;i<field.numBodies;i++)
+	{
+		if(serialBodies[i].radius>0.0f)
+		{
+			serialBodies[i].position.x+=0.5f;
+			serialBodies[i].velocity.y+=1.0f;
+		}
+	}
+
+	for(uint32_t i=0;i<SMALL_CHUNKS;i++)
+		keys[i]=field.chunks[i].state==CHUNK_ACTIVE?field.chunks[i].key:UINT64_MAX;
+
+	memcpy(saved, serialBodies, sizeof(saved));
+
+	ChunkField_Update(&field, &away, 1, 1.0);
+	TEST_CHECK(CountState(&field, CHUNK_IDLE)==numHome);
+	TEST_CHECK(field.numSleepers==0);
+
+	ChunkField_Update(&field, &away, 1, 1.0+CHUNK_HIBERNATE_DELAY*2.0);
+	TEST_CHECK(CountState(&field, CHUNK_IDLE)==0);
+	TEST_CHECK(field.numSleepers==numHome);
+	TEST_CHECK(HashMap_GetCount(&field.sleeping)==numHome);
+	TEST_CHECK(field.numFreed==numHome);
+
+	for(uint32_t i=0;i<field.numFreed;i++)
+		TEST_CHECK(field.chunks[field.freed[i]].state==CHUNK_FREE);
+
+	for(uint32_t i=0;i<SMALL_CHUNKS;i++)
+	{
+		if(keys[i]!=UINT64_MAX)
+			TEST_CHECK(FindChunk(&field, keys[i])==UINT32_MAX);
+	}
+
+	// Back home before the chunks out there have been idle long enough to sleep, everything here wakes straight
+	//     away with what it had
+	ChunkField_Update(&field, &home, 1, 2.0+CHUNK_HIBERNATE_DELAY*2.0);
+	TEST_CHECK(field.numSleepers==0);
+	TEST_CHECK(HashMap_GetCount(&field.sleeping)==0);
+
+	uint32_t mismatched=0;
+
+	for(uint32_t i=0;i<SMALL_CHUNKS;i++)
+	{
+		if(keys[i]==UINT64_MAX)
+			continue;
+
+		const uint32_t slot=FindChunk(&field, keys[i]);
+
+		if(slot==UINT32_MAX||field.chunks[slot].state!=CHUNK_ACTIVE)
+		{
+			mismatched++;
+			continue;
+		}
+
+		for(uint32_t j=0;j<field.chunks[slot].numBodies;j++)
+			mismatched+=!SameBody(&serialBodies[slot*CHUNK_MAX_BODIES+j], &saved[i*CHUNK_MAX_BODIES+j]);
+	}
+
+	TEST_CHECK(mismatched==0);
+
+	ChunkField_Destroy(&field);
+}
+
+// Many cameras at once, every one gets a generate job on the first update and all of them load fully.
+// Then the bodies are sped up and stepped through LOD slices, and have to stay inside their own chunks.
+static void ManyCameras(void)
+{
+	ChunkField_t field;
+	vec3 cameras[NUM_CAMERAS];
+
+	for(uint32_t i=0;i<NUM_CAMERAS;i++)
+		cameras[i]=Vec3(i*10000.0f+500.0f, 500.0f, (i&1)*-7000.0f+500.0f);
+
+	TEST_CHECK(ChunkField_Init(&field, manyBodies, MANY_CHUNKS, &worker, 99));
+
+	ChunkField_Update(&field, cameras, NUM_CAMERAS, 0.0);
+
+	uint32_t withJob=0;
+
+	for(uint32_t i=0;i<NUM_CAMERAS;i++)
+	{
+		const int32_t cx=(int32_t)floorf(cameras[i].x/CHUNK_SIZE);
+
+		for(uint32_t j=0;j<field.maxChunks;j++)
+		{
+			if(field.chunks[j].state==CHUNK_LOADING&&field.chunks[j].x>=cx-CHUNK_LOAD_REACH&&field.chunks[j].x<=cx+CHUNK_LOAD_REACH)
+			{
+				withJob++;
+				break;
+			}
+		}
+	}
+
+	TEST_CHECK(withJob==NUM_CAMERAS);
+
+	double time=0.0;
+	bool loaded=false;
+
+	for(uint32_t i=0;i<MAX_LOAD_UPDATES&&!loaded;i++)
+	{
+		Nap();
+		time+=TICK;
+		ChunkField_Update(&field, cameras, NUM_CAMERAS, time);
+
+		loaded=CountState(&field, CHUNK_LOADING)==0;
+
+		for(uint32_t j=0;j<NUM_CAMERAS;j++)
+			loaded&=CameraLoaded(&field, cameras[j]);
+	}
+
+	TEST_CHECK(loaded);
+	TEST_CHECK(!field.fullWarned);
+
+	for(uint32_t i=0;i<field.numBodies;i++)
+		manyBodies[i].velocity=Vec3_Muls(manyBodies[i].velocity, 400.0f);
+
+	for(uint32_t tick=0;tick<CONTAIN_TICKS;tick++)
+	{
+		const uint32_t numStep=ChunkField_Slice(&field, TICK);
+
+		for(uint32_t i=0;i<numStep;i++)
+			PhysicsIntegrate(&manyBodies[field.step[i]], field.stepDelta[i]);
+
+		ChunkField_Contain(&field);
+
+		time+=TICK;
+
+		if((tick%10)==0)
+			ChunkField_Update(&field, cameras, NUM_CAMERAS, time);
+	}
+
+	uint32_t outside=0;
+
+	for(uint32_t i=0;i<field.maxChunks;i++)
+	{
+		const Chunk_t *chunk=&field.chunks[i];
+
+		if(chunk->state!=CHUNK_ACTIVE)
+			continue;
+
+		for(uint32_t j=0;j<chunk->numBodies;j++)
+		{
+			const RigidBody_t *body=&manyBodies[i*CHUNK_MAX_BODIES+j];
+			const vec3 low=Vec3_Adds(Vec3(chunk->x*CHUNK_SIZE, chunk->y*CHUNK_SIZE, chunk->z*CHUNK_SIZE), body->radius-0.01f);
+			const vec3 high=Vec3_Adds(low, CHUNK_SIZE-2.0f*body->radius+0.02f);
+
+			if(body->position.x<low.x||body->position.y<low.y||body->position.z<low.z||
+				body->position.x>high.x||body->position.y>high.y||body->position.z>high.z)
+				outside++;
+		}
+	}
+
+	TEST_CHECK(outside==0);
+
+	// Everyone leaves, the sleeper table and its map have to agree
+	for(uint32_t i=0;i<NUM_CAMERAS;i++)
+		cameras[i]=Vec3_Adds(cameras[i], 3000000.0f);
+
+	for(uint32_t i=0;i<60;i++)
+	{
+		Nap();
+		time+=0.5;
+		ChunkField_Update(&field, cameras, NUM_CAMERAS, time);
+	}
+
+	TEST_CHECK(field.numSleepers>0);
+	TEST_CHECK(HashMap_GetCount(&field.sleeping)==field.numSleepers);
+
+	for(uint32_t i=0;i<field.numSleepers;i++)
+	{
+		const uint32_t *index=(const uint32_t *)HashMap_Get(&field.sleeping, field.sleepers[i].key);
+
+		TEST_CHECK(index!=NULL&&*index==i);
+	}
+
+	Settle(&field, cameras, NUM_CAMERAS, time);
+	ChunkField_Destroy(&field);
+}
+
+// Only enough slots for one camera, jumping somewhere new has to evict the idle chunks to make room
+static void Eviction(void)
+{
+	ChunkField_t field;
+	vec3 camera=Vec3(500.0f, 500.0f, 500.0f);
+
+	TEST_CHECK(ChunkField_Init(&field, tinyBodies, CHUNK_MAX_PER_CAMERA, NULL, 5));
+
+	ChunkField_Update(&field, &camera, 1, 0.0);
+	TEST_CHECK(CameraLoaded(&field, camera));
+
+	camera=Vec3(100500.0f, 500.0f, 500.0f);
+	ChunkField_Update(&field, &camera, 1, 0.1);
+
+	TEST_CHECK(CameraLoaded(&field, camera));
+	TEST_CHECK(field.numSleepers>0);
+	TEST_CHECK(field.numFreed>0);
+
+	ChunkField_Destroy(&field);
+}
+
+int main(void)
+{
+	zone=Zone_Init(64*1024*1024);
+
+	if(zone==NULL)
+		return 1;
+
+	if(!Thread_Init(&worker)||!Thread_Start(&worker))
+		return 1;
+
+	Generation();
+	Hibernation();
+	ManyCameras();
+	Eviction();
+
+	Thread_Destroy(&worker);
+	Zone_Destroy(zone);
+
+	return Test_Result("chunkfield_test");
+}
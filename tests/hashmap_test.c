@@ -0,0 +1,167 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../math/math.h"
+#include "../utils/hashmap.h"
+#include "test.h"
+
+#define NUM_KEYS 8192
+#define NUM_OPS 1000000
+#define VERIFY_INTERVAL 10000
+#define CLEAR_INTERVAL 250000
+
+// Odd sized so values aren't a power of two stride, and carries the key so a value under the wrong key shows up
+typedef struct
+{
+	uint64_t key;
+	uint32_t serial;
+	uint8_t tag;
+} Value_t;
+
+// Plain array of what the map should hold, indexed the same as the key table
+typedef struct
+{
+	bool present;
+	Value_t value;
+} Reference_t;
+
+static uint64_t keys[NUM_KEYS];
+static Reference_t reference[NUM_KEYS];
+
+// Sequential IDs, keys that only differ in their high bits, and random 64 bit keys (including 0 and all ones)
+static void MakeKeys(void)
+{
+	for(uint32_t i=0;i<NUM_KEYS;i++)
+	{
+		switch(i%3)
+		{
+			case 0:
+				keys[i]=i/3;
+				break;
+
+			case 1:
+				keys[i]=(uint64_t)(i/3+1)<<40;
+				break;
+
+			default:
+				keys[i]=((uint64_t)Random()<<32)|Random();
+				break;
+		}
+	}
+
+	keys[2]=UINT64_MAX;
+}
+
+static bool Matches(HashMap_t *map, uint32_t index)
+{
+	const Value_t *value=(const Value_t *)HashMap_Get(map, keys[index]);
+
+	if(!reference[index].present)
+		return value==NULL;
+
+	const Value_t *expected=&reference[index].value;
+
+	return value!=NULL&&value->key==expected->key&&value->serial==expected->serial&&value->tag==expected->tag;
+}
+
+static bool VerifyAll(HashMap_t *map)
+{
+	uint32_t count=0;
+
+	for(uint32_t i=0;i<NUM_KEYS;i++)
+	{
+		if(!Matches(map, i))
+			return false;
+
+		count+=reference[i].present;
+	}
+
+	return count==HashMap_GetCount(map);
+}
+
+int main(void)
+{
+	zone=Zone_Init(16*1024*1024);
+
+	if(zone==NULL)
+		return 1;
+
+	RandomSeed(12345);
+	MakeKeys();
+
+	HashMap_t map;
+
+	// Starts tiny, so it grows many times and spends a lot of the run part way through a migration
+	TEST_CHECK(HashMap_Init(&map, sizeof(Value_t), 4));
+
+	uint32_t serial=0, count=0, migrating=0;
+
+	for(uint32_t op=0;op<NUM_OPS;op++)
+	{
+		// Skew towards the first part of the key table for a while, so the map fills up and drains again
+		const uint32_t range=(op/50000)%2?NUM_KEYS:NUM_KEYS/4;
+		const uint32_t index=Random()%range;
+		const uint32_t action=Random()%100;
+
+		if(action<45)
+		{
+			Value_t value={ keys[index], serial++, (uint8_t)Random() };
+
+			TEST_CHECK(HashMap_Set(&map, keys[index], &value));
+
+			if(!reference[index].present)
+				count++;
+
+			reference[index]=(Reference_t){ true, value };
+		}
+		else if(action<75)
+		{
+			TEST_CHECK(HashMap_Remove(&map, keys[index])==reference[index].present);
+
+			if(reference[index].present)
+				count--;
+
+			reference[index].present=false;
+		}
+		else
+			TEST_CHECK(Matches(&map, index));
+
+		TEST_CHECK(HashMap_GetCount(&map)==count);
+
+		if(map.oldTable.memory)
+			migrating++;
+
+		if((op%VERIFY_INTERVAL)==0)
+			TEST_CHECK(VerifyAll(&map));
+
+		if(op>0&&(op%CLEAR_INTERVAL)==0)
+		{
+			HashMap_Clear(&map);
+
+			for(uint32_t i=0;i<NUM_KEYS;i++)
+				reference[i].present=false;
+
+			count=0;
+
+			TEST_CHECK(VerifyAll(&map));
+		}
+	}
+
+	TEST_CHECK(VerifyAll(&map));
+	TEST_CHECK(migrating>0);
+
+	// Drain it completely, then make sure nothing is left behind
+	for(uint32_t i=0;i<NUM_KEYS;i++)
+	{
+		TEST_CHECK(HashMap_Remove(&map, keys[i])==reference[i].present);
+		reference[i].present=false;
+	}
+
+	TEST_CHECK(HashMap_GetCount(&map)==0);
+	TEST_CHECK(VerifyAll(&map));
+
+	HashMap_Destroy(&map);
+	Zone_Destroy(zone);
+
+	return Test_Result("hashmap_test");
+}
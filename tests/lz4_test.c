@@ -0,0 +1,231 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../math/math.h"
+#include "../utils/lz4.h"
+#include "test.h"
+
+// The compressor reads and writes whole words past the end of its buffers, so both get some slack
+#define PADDING 64
+
+// Bytes past the decoder's output length that must come back untouched
+#define GUARD_SIZE 64
+#define GUARD_BYTE 0xA5
+
+#define CORRUPT_TRIALS 2000
+
+typedef enum
+{
+	FILL_ZEROS,
+	FILL_RANDOM,
+	FILL_PATTERN,		// Short repeating pattern, exercises the overlapping match copies
+	FILL_MIXED,			// Runs of random bytes and repeats of earlier data, like a field snapshot
+	NUM_FILLS
+} Fill_e;
+
+static void Fill(uint8_t *data, size_t size, Fill_e fill, uint32_t period)
+{
+	switch(fill)
+	{
+		case FILL_ZEROS:
+			memset(data, 0, size);
+			break;
+
+		case FILL_RANDOM:
+			for(size_t i=0;i<size;i++)
+				data[i]=(uint8_t)Random();
+			break;
+
+		case FILL_PATTERN:
+			for(size_t i=0;i<size;i++)
+				data[i]=i<period?(uint8_t)Random():data[i-period];
+			break;
+
+		case FILL_MIXED:
+			for(size_t i=0;i<size;)
+			{
+				size_t run=Random()%64+1;
+
+				if(i>0&&(Random()&1))
+				{
+					const size_t offset=Random()%i+1;
+
+					for(size_t j=0;j<run&&i<size;j++, i++)
+						data[i]=data[i-offset];
+				}
+				else
+				{
+					for(size_t j=0;j<run&&i<size;j++, i++)
+						data[i]=(uint8_t)Random();
+				}
+			}
+			break;
+
+		default:
+			break;
+	}
+}
+
+// Compress and decompress one buffer, into an exact size output so no wild copies are allowed to overshoot
+static void RoundTrip(const uint8_t *data, size_t size)
+{
+	uint8_t *compressed=(uint8_t *)calloc(1, size+size/255+PADDING);
+	uint8_t *decompressed=(uint8_t *)malloc(size+GUARD_SIZE);
+
+	const size_t compressedSize=lz4_compress(data, size, compressed);
+
+	TEST_CHECK(compressedSize>0);
+	TEST_CHECK(lz4_decompress(compressed, compressedSize, NULL, 0)==size);
+
+	memset(decompressed, GUARD_BYTE, size+GUARD_SIZE);
+
+	const size_t decompressedSize=lz4_decompress(compressed, compressedSize, decompressed, size);
+
+	TEST_CHECK(decompressedSize==size);
+	TEST_CHECK(memcmp(decompressed, data, size)==0);
+
+	for(size_t i=0;i<GUARD_SIZE;i++)
+		TEST_CHECK(decompressed[size+i]==GUARD_BYTE);
+
+	// One byte short of room has to be refused, not truncated
+	if(size>1)
+		TEST_CHECK(lz4_decompress(compressed, compressedSize, decompressed, size-1)==0);
+
+	free(compressed);
+	free(decompressed);
+}
+
+// Streams that break the format in one specific way, each must be rejected outright
+static void Malformed(void)
+{
+	uint8_t out[256];
+
+	// Match offset of zero
+	const uint8_t zeroOffset[]={ 0x40, 'a', 'b', 'c', 'd', 0x00, 0x00, 0x10, 'e' };
+	TEST_CHECK(lz4_decompress(zeroOffset, sizeof(zeroOffset), out, sizeof(out))==0);
+	TEST_CHECK(lz4_decompress(zeroOffset, sizeof(zeroOffset), NULL, 0)==0);
+
+	// Match offset reaching back before the start of the output
+	const uint8_t farOffset[]={ 0x40, 'a', 'b', 'c', 'd', 0x05, 0x00, 0x10, 'e' };
+	TEST_CHECK(lz4_decompress(farOffset, sizeof(farOffset), out, sizeof(out))==0);
+	TEST_CHECK(lz4_decompress(farOffset, sizeof(farOffset), NULL, 0)==0);
+
+	// Literal run longer than the rest of the input
+	const uint8_t longLiterals[]={ 0x80, 'a', 'b', 'c' };
+	TEST_CHECK(lz4_decompress(longLiterals, sizeof(longLiterals), out, sizeof(out))==0);
+	TEST_CHECK(lz4_decompress(longLiterals, sizeof(longLiterals), NULL, 0)==0);
+
+	// Extended literal length that runs off the end of the input
+	const uint8_t openLength[]={ 0xF0, 0xFF, 0xFF };
+	TEST_CHECK(lz4_decompress(openLength, sizeof(openLength), out, sizeof(out))==0);
+	TEST_CHECK(lz4_decompress(openLength, sizeof(openLength), NULL, 0)==0);
+
+	// Only one byte of match offset left
+	const uint8_t shortOffset[]={ 0x40, 'a', 'b', 'c', 'd', 0x01 };
+	TEST_CHECK(lz4_decompress(shortOffset, sizeof(shortOffset), out, sizeof(out))==0);
+	TEST_CHECK(lz4_decompress(shortOffset, sizeof(shortOffset), NULL, 0)==0);
+
+	// Valid stream, but the match runs past the end of the output buffer
+	const uint8_t longMatch[]={ 0x1F, 'a', 0x01, 0x00, 0xFF, 0xFF, 0x00, 0x10, 'b' };
+	TEST_CHECK(lz4_decompress(longMatch, sizeof(longMatch), out, sizeof(out))==0);
+	TEST_CHECK(lz4_decompress(longMatch, sizeof(longMatch), NULL, 0)==1+15+4+255+255+1);
+}
+
+// Truncated and byte flipped copies of a valid stream, whatever they decode to has to stay inside the output
+static void Corrupt(void)
+{
+	const size_t size=16384;
+	uint8_t *data=(uint8_t *)calloc(1, size+PADDING);
+	uint8_t *compressed=(uint8_t *)calloc(1, size+size/255+PADDING);
+	uint8_t *decompressed=(uint8_t *)malloc(size+GUARD_SIZE);
+
+	Fill(data, size, FILL_MIXED, 0);
+
+	const size_t compressedSize=lz4_compress(data, size, compressed);
+	uint32_t rejected=0;
+
+	for(uint32_t i=0;i<CORRUPT_TRIALS;i++)
+	{
+		// Exact size copy, so reading past the end shows up under a sanitizer
+		uint8_t *corrupt=(uint8_t *)malloc(compressedSize);
+		size_t corruptSize=compressedSize;
+
+		memcpy(corrupt, compressed, compressedSize);
+
+		// Odd trials truncate anywhere from empty to one byte short, even ones flip bytes
+		if(i&1)
+			corruptSize=Random()%compressedSize;
+		else
+		{
+			for(uint32_t j=0;j<8;j++)
+				corrupt[Random()%compressedSize]=(uint8_t)Random();
+		}
+
+		memset(decompressed, GUARD_BYTE, size+GUARD_SIZE);
+
+		const size_t decompressedSize=lz4_decompress(corrupt, corruptSize, decompressed, size);
+
+		TEST_CHECK(decompressedSize<=size);
+
+		bool guardIntact=true;
+
+		for(size_t j=0;j<GUARD_SIZE;j++)
+			guardIntact&=decompressed[size+j]==GUARD_BYTE;
+
+		TEST_CHECK(guardIntact);
+
+		if(decompressedSize==0)
+			rejected++;
+
+		free(corrupt);
+	}
+
+	// Truncation almost always cuts a sequence in half, so a good share of trials must have been caught
+	TEST_CHECK(rejected>CORRUPT_TRIALS/4);
+
+	free(data);
+	free(compressed);
+	free(decompressed);
+}
+
+int main(void)
+{
+	static const size_t sizes[]={ 1, 4, 5, 12, 13, 31, 33, 100, 255, 270, 4096, 65535, 65536, 200000 };
+	static const uint32_t periods[]={ 1, 2, 3, 7, 16, 17, 31, 32, 40 };
+
+	RandomSeed(12345);
+
+	for(uint32_t i=0;i<sizeof(sizes)/sizeof(sizes[0]);i++)
+	{
+		uint8_t *data=(uint8_t *)calloc(1, sizes[i]+PADDING);
+
+		for(uint32_t fill=0;fill<NUM_FILLS;fill++)
+		{
+			if(fill==FILL_PATTERN)
+			{
+				for(uint32_t j=0;j<sizeof(periods)/sizeof(periods[0]);j++)
+				{
+					Fill(data, sizes[i], FILL_PATTERN, periods[j]);
+					RoundTrip(data, sizes[i]);
+				}
+			}
+			else
+			{
+				Fill(data, sizes[i], (Fill_e)fill, 0);
+				RoundTrip(data, sizes[i]);
+			}
+		}
+
+		free(data);
+	}
+
+	// Nothing in, nothing out
+	uint8_t empty[PADDING]={ 0 };
+	TEST_CHECK(lz4_compress(empty, 0, empty)==0);
+	TEST_CHECK(lz4_decompress(empty, 0, empty, sizeof(empty))==0);
+
+	Malformed();
+	Corrupt();
+
+	return Test_Result("lz4_test");
+}
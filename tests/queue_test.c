@@ -0,0 +1,335 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <threads.h>
+#include "../utils/ring.h"
+#include "../utils/queue.h"
+#include "test.h"
+
+// Small capacities so producers and consumers keep running into full and empty, and the indices wrap a lot
+#define RING_CAPACITY 16
+#define QUEUE_CAPACITY 8
+#define BATCH_SIZE 7
+#define RING_ITEMS 1000000
+#define NUM_PRODUCERS 4
+#define NUM_CONSUMERS 4
+#define QUEUE_ITEMS_PER_PRODUCER 250000
+
+// Items carry their producer in the top half and a per-producer sequence number in the bottom half
+#define ITEM(producer, sequence) (((uint64_t)(producer)<<32)|(uint32_t)(sequence))
+#define ITEM_PRODUCER(item) ((uint32_t)((item)>>32))
+#define ITEM_SEQUENCE(item) ((uint32_t)(item))
+
+typedef struct
+{
+	Ring_t *ring;
+	Queue_t *queue;
+	uint32_t index;
+	bool batch;
+
+	// Consumer side results, checked on the main thread after joining
+	uint32_t *seen;					// Per item, how many times it came out
+	uint64_t received;
+	bool ordered;
+} Worker_t;
+
+static atomic_uint producersDone;
+
+// Full and empty behaviour on one thread, and the count at every step
+static void SingleThreaded(void)
+{
+	Ring_t ring;
+	Queue_t queue;
+	uint64_t item=0;
+
+	TEST_CHECK(Ring_Init(&ring, sizeof(uint64_t), 5));
+	TEST_CHECK(ring.capacity==8);
+	TEST_CHECK(!Ring_Pop(&ring, &item));
+
+	for(uint64_t i=0;i<8;i++)
+	{
+		TEST_CHECK(Ring_Push(&ring, &i));
+		TEST_CHECK(Ring_GetCount(&ring)==i+1);
+	}
+
+	TEST_CHECK(!Ring_Push(&ring, &item));
+
+	for(uint64_t i=0;i<8;i++)
+		TEST_CHECK(Ring_Pop(&ring, &item)&&item==i);
+
+	TEST_CHECK(!Ring_Pop(&ring, &item));
+
+	// Batches that wrap around the end of the buffer
+	uint64_t batch[12], out[12];
+
+	for(uint32_t round=0;round<20;round++)
+	{
+		for(uint32_t i=0;i<12;i++)
+			batch[i]=round*100+i;
+
+		TEST_CHECK(Ring_PushBatch(&ring, batch, 5)==5);
+		TEST_CHECK(Ring_PushBatch(&ring, batch+5, 7)==3);
+		TEST_CHECK(Ring_PopBatch(&ring, out, 12)==8);
+		TEST_CHECK(memcmp(out, batch, 8*sizeof(uint64_t))==0);
+	}
+
+	Ring_Destroy(&ring);
+
+	TEST_CHECK(Queue_Init(&queue, sizeof(uint64_t), 3));
+	TEST_CHECK(queue.capacity==4);
+	TEST_CHECK(!Queue_Pop(&queue, &item));
+
+	for(uint32_t round=0;round<10;round++)
+	{
+		for(uint64_t i=0;i<4;i++)
+			TEST_CHECK(Queue_Push(&queue, &i));
+
+		TEST_CHECK(Queue_GetCount(&queue)==4);
+		TEST_CHECK(!Queue_Push(&queue, &item));
+
+		for(uint64_t i=0;i<4;i++)
+			TEST_CHECK(Queue_Pop(&queue, &item)&&item==i);
+
+		TEST_CHECK(Queue_GetCount(&queue)==0);
+		TEST_CHECK(!Queue_Pop(&queue, &item));
+	}
+
+	Queue_Destroy(&queue);
+}
+
+static int RingProducer(void *arg)
+{
+	Worker_t *worker=(Worker_t *)arg;
+
+	if(worker->batch)
+	{
+		uint64_t items[BATCH_SIZE];
+
+		for(uint32_t next=0;next<RING_ITEMS;)
+		{
+			const uint32_t count=(RING_ITEMS-next)<BATCH_SIZE?RING_ITEMS-next:BATCH_SIZE;
+
+			for(uint32_t i=0;i<count;i++)
+				items[i]=next+i;
+
+			for(uint32_t pushed=0;pushed<count;)
+			{
+				const uint32_t n=Ring_PushBatch(worker->ring, items+pushed, count-pushed);
+
+				if(n==0)
+					thrd_yield();
+
+				pushed+=n;
+			}
+
+			next+=count;
+		}
+
+		return 0;
+	}
+
+	for(uint64_t i=0;i<RING_ITEMS;i++)
+	{
+		while(!Ring_Push(worker->ring, &i))
+			thrd_yield();
+	}
+
+	return 0;
+}
+
+// Single producer, so everything has to come out in exactly the order it went in
+static int RingConsumer(void *arg)
+{
+	Worker_t *worker=(Worker_t *)arg;
+	uint64_t items[BATCH_SIZE];
+
+	worker->ordered=true;
+
+	while(worker->received<RING_ITEMS)
+	{
+		uint32_t count=0;
+
+		if(worker->batch)
+			count=Ring_PopBatch(worker->ring, items, BATCH_SIZE);
+		else
+			count=Ring_Pop(worker->ring, items)?1:0;
+
+		if(count==0)
+		{
+			thrd_yield();
+			continue;
+		}
+
+		for(uint32_t i=0;i<count;i++)
+		{
+			if(items[i]!=worker->received)
+				worker->ordered=false;
+
+			worker->received++;
+		}
+	}
+
+	return 0;
+}
+
+static void RingContention(bool batch)
+{
+	Ring_t ring;
+	Worker_t producer={ .ring=&ring, .batch=batch };
+	Worker_t consumer={ .ring=&ring, .batch=batch };
+	thrd_t threads[2];
+
+	TEST_CHECK(Ring_Init(&ring, sizeof(uint64_t), RING_CAPACITY));
+
+	thrd_create(&threads[0], RingConsumer, &consumer);
+	thrd_create(&threads[1], RingProducer, &producer);
+
+	thrd_join(threads[0], NULL);
+	thrd_join(threads[1], NULL);
+
+	TEST_CHECK(consumer.received==RING_ITEMS);
+	TEST_CHECK(consumer.ordered);
+	TEST_CHECK(Ring_GetCount(&ring)==0);
+
+	Ring_Destroy(&ring);
+}
+
+static int QueueProducer(void *arg)
+{
+	Worker_t *worker=(Worker_t *)arg;
+
+	for(uint32_t i=0;i<QUEUE_ITEMS_PER_PRODUCER;i++)
+	{
+		const uint64_t item=ITEM(worker->index, i);
+
+		while(!Queue_Push(worker->queue, &item))
+			thrd_yield();
+	}
+
+	atomic_fetch_add(&producersDone, 1);
+
+	return 0;
+}
+
+// Items from any one producer have to reach each consumer in the order that producer pushed them
+static int QueueConsumer(void *arg)
+{
+	Worker_t *worker=(Worker_t *)arg;
+	int64_t last[NUM_PRODUCERS];
+
+	for(uint32_t i=0;i<NUM_PRODUCERS;i++)
+		last[i]=-1;
+
+	worker->ordered=true;
+
+	while(true)
+	{
+		uint64_t item;
+
+		if(!Queue_Pop(worker->queue, &item))
+		{
+			// Only done once every producer has finished and the queue is still empty after that
+			if(atomic_load(&producersDone)==NUM_PRODUCERS&&!Queue_Pop(worker->queue, &item))
+				break;
+
+			thrd_yield();
+			continue;
+		}
+
+		const uint32_t producer=ITEM_PRODUCER(item);
+		const uint32_t sequence=ITEM_SEQUENCE(item);
+
+		if(producer>=NUM_PRODUCERS||sequence>=QUEUE_ITEMS_PER_PRODUCER)
+		{
+			worker->ordered=false;
+			continue;
+		}
+
+		if((int64_t)sequence<=last[producer])
+			worker->ordered=false;
+
+		last[producer]=sequence;
+		worker->seen[producer*QUEUE_ITEMS_PER_PRODUCER+sequence]++;
+		worker->received++;
+	}
+
+	return 0;
+}
+
+static void QueueContention(void)
+{
+	Queue_t queue;
+	Worker_t producers[NUM_PRODUCERS], consumers[NUM_CONSUMERS];
+	thrd_t threads[NUM_PRODUCERS+NUM_CONSUMERS];
+	const uint32_t numItems=NUM_PRODUCERS*QUEUE_ITEMS_PER_PRODUCER;
+
+	TEST_CHECK(Queue_Init(&queue, sizeof(uint64_t), QUEUE_CAPACITY));
+
+	atomic_store(&producersDone, 0);
+
+	for(uint32_t i=0;i<NUM_CONSUMERS;i++)
+	{
+		consumers[i]=(Worker_t){ .queue=&queue, .index=i };
+		consumers[i].seen=(uint32_t *)calloc(numItems, sizeof(uint32_t));
+		thrd_create(&threads[i], QueueConsumer, &consumers[i]);
+	}
+
+	for(uint32_t i=0;i<NUM_PRODUCERS;i++)
+	{
+		producers[i]=(Worker_t){ .queue=&queue, .index=i };
+		thrd_create(&threads[NUM_CONSUMERS+i], QueueProducer, &producers[i]);
+	}
+
+	for(uint32_t i=0;i<NUM_PRODUCERS+NUM_CONSUMERS;i++)
+		thrd_join(threads[i], NULL);
+
+	// Every item exactly once across all the consumers
+	uint64_t received=0;
+	uint32_t missing=0, duplicated=0;
+
+	for(uint32_t i=0;i<NUM_CONSUMERS;i++)
+	{
+		TEST_CHECK(consumers[i].ordered);
+		received+=consumers[i].received;
+	}
+
+	for(uint32_t i=0;i<numItems;i++)
+	{
+		uint32_t count=0;
+
+		for(uint32_t j=0;j<NUM_CONSUMERS;j++)
+			count+=consumers[j].seen[i];
+
+		if(count==0)
+			missing++;
+		else if(count>1)
+			duplicated++;
+	}
+
+	TEST_CHECK(received==numItems);
+	TEST_CHECK(missing==0);
+	TEST_CHECK(duplicated==0);
+	TEST_CHECK(Queue_GetCount(&queue)==0);
+
+	for(uint32_t i=0;i<NUM_CONSUMERS;i++)
+		free(consumers[i].seen);
+
+	Queue_Destroy(&queue);
+}
+
+int main(void)
+{
+	zone=Zone_Init(8*1024*1024);
+
+	if(zone==NULL)
+		return 1;
+
+	SingleThreaded();
+	RingContention(false);
+	RingContention(true);
+	QueueContention();
+
+	Zone_Destroy(zone);
+
+	return Test_Result("queue_test");
+}
@@ -0,0 +1,31 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "test.h"
+
+// Tests don't link the server main, so supply the globals it normally provides
+MemZone_t *zone=NULL;
+
+uint32_t testFailures=0;
+
+double GetClock(void)
+{
+	struct timespec ts;
+
+	if(timespec_get(&ts, TIME_UTC))
+		return ts.tv_sec+(double)ts.tv_nsec/1000000000.0;
+
+	return 0.0;
+}
+
+int Test_Result(const char *name)
+{
+	if(testFailures)
+	{
+		DBGPRINTF(DEBUG_ERROR, "%s: %d checks failed.\n", name, testFailures);
+		return 1;
+	}
+
+	DBGPRINTF(DEBUG_INFO, "%s: Passed.\n", name);
+	return 0;
+}
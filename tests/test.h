@@ -0,0 +1,24 @@
+#ifndef __TEST_H__
+#define __TEST_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "../system/system.h"
+
+// Failed checks so far, a test's main returns Test_Result() so CTest sees any of them
+extern uint32_t testFailures;
+
+// Logs and counts a failed check, the test keeps going so one run reports everything that's wrong
+#define TEST_CHECK(condition) \
+	do \
+	{ \
+		if(!(condition)) \
+		{ \
+			DBGPRINTF(DEBUG_ERROR, "%s:%d: Check failed: %s\n", __FILE__, __LINE__, #condition); \
+			testFailures++; \
+		} \
+	} while(0)
+
+int Test_Result(const char *name);
+
+#endif
@@ -0,0 +1,289 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../math/math.h"
+#include "test.h"
+
+#define ZONE_SIZE (16*1024*1024)
+#define NUM_SLOTS 2048
+#define NUM_OPS 200000
+#define VERIFY_INTERVAL 5000
+
+#define COMPACT_ZONE_SIZE (1024*1024)
+#define MAX_HANDLES 1024
+
+// Live allocation and what should be in it, every byte is derived from the seed so corruption shows up
+typedef struct
+{
+	uint8_t *ptr;
+	size_t size;
+	size_t alignment;
+	uint32_t seed;
+} Slot_t;
+
+static void FillPattern(uint8_t *ptr, size_t size, uint32_t seed)
+{
+	for(size_t i=0;i<size;i++)
+		ptr[i]=(uint8_t)((seed+i)*2654435761u>>24);
+}
+
+static bool CheckZero(const uint8_t *ptr, size_t size)
+{
+	for(size_t i=0;i<size;i++)
+	{
+		if(ptr[i])
+			return false;
+	}
+
+	return true;
+}
+
+static bool CheckPattern(const uint8_t *ptr, size_t size, uint32_t seed)
+{
+	for(size_t i=0;i<size;i++)
+	{
+		if(ptr[i]!=(uint8_t)((seed+i)*2654435761u>>24))
+			return false;
+	}
+
+	return true;
+}
+
+// Mostly small sizes that go through the thread cache, with a tail of large ones that go to the zone
+static size_t RandomSize(void)
+{
+	const uint32_t r=Random()%100;
+
+	if(r<70)
+		return Random()%256+1;
+	else if(r<95)
+		return Random()%8192+1;
+
+	return Random()%65536+1;
+}
+
+// Random malloc, calloc, realloc, aligned and free against a table of what each live allocation should hold
+static void RandomOps(void)
+{
+	static Slot_t slots[NUM_SLOTS];
+
+	zone=Zone_Init(ZONE_SIZE);
+	TEST_CHECK(zone!=NULL);
+
+	if(zone==NULL)
+		return;
+
+	memset(slots, 0, sizeof(slots));
+
+	uint32_t seed=1;
+
+	for(uint32_t op=0;op<NUM_OPS;op++)
+	{
+		Slot_t *slot=&slots[Random()%NUM_SLOTS];
+
+		if(slot->ptr)
+		{
+			TEST_CHECK(CheckPattern(slot->ptr, slot->size, slot->seed));
+			TEST_CHECK(((uintptr_t)slot->ptr&(slot->alignment-1))==0);
+
+			if(Random()&1)
+			{
+				Zone_Free(zone, slot->ptr);
+				slot->ptr=NULL;
+			}
+			else
+			{
+				// Realloc keeps the common prefix, refill so the whole block is checkable again
+				const size_t size=RandomSize();
+				uint8_t *ptr=NULL;
+
+				if(slot->alignment>ZONE_ALIGN)
+					ptr=(uint8_t *)Zone_ReallocAligned(zone, slot->ptr, size, slot->alignment);
+				else
+					ptr=(uint8_t *)Zone_Realloc(zone, slot->ptr, size);
+
+				TEST_CHECK(ptr!=NULL);
+
+				if(ptr)
+				{
+					const size_t common=size<slot->size?size:slot->size;
+
+					TEST_CHECK(CheckPattern(ptr, common, slot->seed));
+					TEST_CHECK(((uintptr_t)ptr&(slot->alignment-1))==0);
+
+					slot->ptr=ptr;
+					slot->size=size;
+					slot->seed=seed++;
+					FillPattern(slot->ptr, slot->size, slot->seed);
+				}
+			}
+		}
+		else
+		{
+			const uint32_t kind=Random()%4;
+
+			slot->size=RandomSize();
+			slot->alignment=ZONE_ALIGN;
+
+			if(kind==0)
+			{
+				slot->ptr=(uint8_t *)Zone_Calloc(zone, slot->size, 1);
+
+				if(slot->ptr)
+					TEST_CHECK(CheckZero(slot->ptr, slot->size));
+			}
+			else if(kind==1)
+			{
+				slot->alignment=(size_t)32<<(Random()%8);
+				slot->ptr=(uint8_t *)Zone_MallocAligned(zone, slot->size, slot->alignment);
+			}
+			else
+				slot->ptr=(uint8_t *)Zone_Malloc(zone, slot->size);
+
+			// Live data stays well under the zone size, so nothing should fail
+			TEST_CHECK(slot->ptr!=NULL);
+
+			if(slot->ptr)
+			{
+				TEST_CHECK(((uintptr_t)slot->ptr&(slot->alignment-1))==0);
+
+				slot->seed=seed++;
+				FillPattern(slot->ptr, slot->size, slot->seed);
+			}
+		}
+
+		if((op%VERIFY_INTERVAL)==0)
+			TEST_CHECK(Zone_VerifyHeap(zone));
+	}
+
+	for(uint32_t i=0;i<NUM_SLOTS;i++)
+	{
+		if(slots[i].ptr)
+		{
+			TEST_CHECK(CheckPattern(slots[i].ptr, slots[i].size, slots[i].seed));
+			Zone_Free(zone, slots[i].ptr);
+		}
+	}
+
+	TEST_CHECK(Zone_VerifyHeap(zone));
+
+	// Everything went back and merged, apart from what the thread cache is still holding on to
+	ZoneStats_t stats;
+	Zone_GetStats(zone, &stats);
+
+	TEST_CHECK(stats.largestFree>=ZONE_SIZE/2);
+
+	void *big=Zone_Malloc(zone, ZONE_SIZE/2);
+	TEST_CHECK(big!=NULL);
+	Zone_Free(zone, big);
+
+	Zone_Destroy(zone);
+	zone=NULL;
+}
+
+// Fill a zone with relocatable blocks, free every other one so the free space is all small holes,
+//     then compact and check the data moved intact, pinned blocks stayed put and the holes merged.
+static void Compaction(void)
+{
+	static ZoneHandle_t handles[MAX_HANDLES];
+	static Slot_t slots[MAX_HANDLES];
+	uint32_t numHandles=0;
+
+	zone=Zone_Init(COMPACT_ZONE_SIZE);
+	TEST_CHECK(zone!=NULL);
+
+	if(zone==NULL)
+		return;
+
+	ZoneStats_t stats;
+	Zone_GetStats(zone, &stats);
+
+	// Stop while there's still room for the biggest block, so no allocation fails
+	while(numHandles<MAX_HANDLES&&stats.largestFree>8192)
+	{
+		Slot_t *slot=&slots[numHandles];
+
+		slot->size=Random()%3072+1024;
+		slot->alignment=(Random()&3)==0?256:ZONE_ALIGN;
+		slot->seed=numHandles+1;
+
+		handles[numHandles]=Zone_HandleAlloc(zone, slot->size, slot->alignment);
+		TEST_CHECK(handles[numHandles]!=ZONE_INVALID_HANDLE);
+
+		uint8_t *ptr=(uint8_t *)Zone_HandleLock(zone, handles[numHandles]);
+		TEST_CHECK(ptr!=NULL&&((uintptr_t)ptr&(slot->alignment-1))==0);
+
+		if(ptr)
+			FillPattern(ptr, slot->size, slot->seed);
+
+		Zone_HandleUnlock(zone, handles[numHandles]);
+
+		numHandles++;
+		Zone_GetStats(zone, &stats);
+	}
+
+	TEST_CHECK(numHandles>64);
+
+	for(uint32_t i=0;i<numHandles;i+=2)
+	{
+		Zone_HandleFree(zone, handles[i]);
+		handles[i]=ZONE_INVALID_HANDLE;
+	}
+
+	TEST_CHECK(Zone_VerifyHeap(zone));
+
+	ZoneStats_t before;
+	Zone_GetStats(zone, &before);
+
+	// One block stays locked through the compaction, it has to be where it was afterwards
+	const uint32_t pinned=numHandles/2|1;
+	uint8_t *pinnedPtr=(uint8_t *)Zone_HandleLock(zone, handles[pinned]);
+
+	size_t moved=0, total=0;
+
+	while((moved=Zone_Compact(zone, 1.0))>0)
+		total+=moved;
+
+	TEST_CHECK(total>0);
+	TEST_CHECK(Zone_VerifyHeap(zone));
+	TEST_CHECK(Zone_HandleLock(zone, handles[pinned])==pinnedPtr);
+
+	Zone_HandleUnlock(zone, handles[pinned]);
+	Zone_HandleUnlock(zone, handles[pinned]);
+
+	for(uint32_t i=1;i<numHandles;i+=2)
+	{
+		const uint8_t *ptr=(const uint8_t *)Zone_HandleLock(zone, handles[i]);
+
+		TEST_CHECK(ptr!=NULL&&((uintptr_t)ptr&(slots[i].alignment-1))==0);
+		TEST_CHECK(ptr!=NULL&&CheckPattern(ptr, slots[i].size, slots[i].seed));
+
+		Zone_HandleUnlock(zone, handles[i]);
+	}
+
+	// The holes on either side of the pinned block end up as two big free blocks
+	ZoneStats_t after;
+	Zone_GetStats(zone, &after);
+
+	TEST_CHECK(after.largestFree>before.largestFree*8);
+	TEST_CHECK(after.largestFree>=before.freeBytes/4);
+	TEST_CHECK(after.fragmentation<before.fragmentation);
+
+	for(uint32_t i=1;i<numHandles;i+=2)
+		Zone_HandleFree(zone, handles[i]);
+
+	TEST_CHECK(Zone_VerifyHeap(zone));
+
+	Zone_Destroy(zone);
+	zone=NULL;
+}
+
+int main(void)
+{
+	RandomSeed(12345);
+
+	RandomOps();
+	Compaction();
+
+	return Test_Result("zone_test");
+}
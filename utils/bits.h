@@ -0,0 +1,20 @@
+#ifndef __BITS_H__
+#define __BITS_H__
+
+#include <stdint.h>
+
+// Smallest power of 2 that's at least x, for sizing masked ring indices and hash tables.
+// Zero and anything past 2^31 come out as zero, callers range check their sizes first.
+static inline uint32_t NextPow2(uint32_t x)
+{
+	x--;
+	x|=x>>1;
+	x|=x>>2;
+	x|=x>>4;
+	x|=x>>8;
+	x|=x>>16;
+
+	return x+1;
+}
+
+#endif
@@ -0,0 +1,342 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include "../system/system.h"
+#include "bits.h"
+#include "hashmap.h"
+
+#define DISTANCE_REMOVED 0x8000
+#define DISTANCE_MASK 0x7FFF
+
+// Keys are often small sequential IDs or packed addresses, mix them so they spread over the whole table
+static inline uint64_t hashKey(uint64_t key)
+{
+	key^=key>>33;
+	key*=0xFF51AFD7ED558CCDull;
+	key^=key>>33;
+	key*=0xC4CEB9FE1A85EC53ull;
+	key^=key>>33;
+
+	return key;
+}
+
+// One zone block per table, keys first so they and the values stay 8 byte aligned
+static bool tableAlloc(HashTable_t *table, uint32_t capacity, size_t stride)
+{
+	uint8_t *memory=(uint8_t *)Zone_Malloc(zone, (sizeof(uint64_t)+stride+sizeof(uint16_t))*capacity);
+
+	if(memory==NULL)
+		return false;
+
+	table->capacity=capacity;
+	table->mask=capacity-1;
+	table->memory=memory;
+	table->keys=(uint64_t *)memory;
+	table->values=memory+sizeof(uint64_t)*capacity;
+	table->distance=(uint16_t *)(table->values+stride*capacity);
+
+	memset(table->distance, 0, sizeof(uint16_t)*capacity);
+
+	return true;
+}
+
+static void tableFree(HashTable_t *table)
+{
+	if(table->memory)
+		Zone_Free(zone, table->memory);
+
+	memset(table, 0, sizeof(HashTable_t));
+}
+
+// Bucket holding key, UINT32_MAX if it isn't in the table
+static uint32_t tableFind(const HashTable_t *table, uint64_t hash, uint64_t key)
+{
+	uint32_t index=(uint32_t)hash&table->mask;
+
+	for(uint32_t distance=1;;distance++)
+	{
+		const uint16_t bucket=table->distance[index];
+
+		// Empty, or an entry closer to home than the key would be, so the key would have taken its place
+		if((uint32_t)(bucket&DISTANCE_MASK)<distance)
+			return UINT32_MAX;
+
+		if(!(bucket&DISTANCE_REMOVED)&&table->keys[index]==key)
+			return index;
+
+		index=(index+1)&table->mask;
+	}
+}
+
+// Key must not already be in the table
+static void tableInsert(HashTable_t *table, size_t stride, uint8_t *swap, uint64_t hash, uint64_t key, const void *value)
+{
+	uint8_t *carry=swap, *temp=swap+stride;
+	uint32_t index=(uint32_t)hash&table->mask;
+	uint16_t distance=1;
+
+	memcpy(carry, value, stride);
+
+	for(;;)
+	{
+		uint8_t *slot=table->values+index*stride;
+
+		if(table->distance[index]==0)
+		{
+			table->keys[index]=key;
+			table->distance[index]=distance;
+			memcpy(slot, carry, stride);
+			return;
+		}
+
+		// Take from the rich, carry the displaced entry on from here
+		if(table->distance[index]<distance)
+		{
+			const uint64_t tempKey=table->keys[index];
+			const uint16_t tempDistance=table->distance[index];
+
+			table->keys[index]=key;
+			table->distance[index]=distance;
+			key=tempKey;
+			distance=tempDistance;
+
+			memcpy(temp, slot, stride);
+			memcpy(slot, carry, stride);
+
+			uint8_t *t=carry;
+			carry=temp;
+			temp=t;
+		}
+
+		index=(index+1)&table->mask;
+		distance++;
+	}
+}
+
+// Backward shift deletion, pull following entries back until one is already home
+static void tableErase(HashTable_t *table, size_t stride, uint32_t index)
+{
+	uint32_t next=(index+1)&table->mask;
+
+	while(table->distance[next]>1)
+	{
+		table->keys[index]=table->keys[next];
+		table->distance[index]=table->distance[next]-1;
+		memcpy(table->values+index*stride, table->values+next*stride, stride);
+
+		index=next;
+		next=(next+1)&table->mask;
+	}
+
+	table->distance[index]=0;
+}
+
+// Entry in the old table that hasn't been moved over yet
+static uint32_t oldFind(const HashMap_t *map, uint64_t hash, uint64_t key)
+{
+	if(map->oldTable.memory==NULL)
+		return UINT32_MAX;
+
+	const uint32_t index=tableFind(&map->oldTable, hash, key);
+
+	// Below the cursor it's already been moved, if it's not in the new table then it's been removed since
+	if(index==UINT32_MAX||index<map->migrateCursor)
+		return UINT32_MAX;
+
+	return index;
+}
+
+// Move some old table buckets into the new table, drop the old table once it's done
+static void migrate(HashMap_t *map, uint32_t numBuckets)
+{
+	HashTable_t *old=&map->oldTable;
+
+	while(numBuckets--&&old->memory)
+	{
+		const uint32_t index=map->migrateCursor++;
+		const uint16_t bucket=old->distance[index];
+
+		if(bucket&&!(bucket&DISTANCE_REMOVED))
+			tableInsert(&map->table, map->stride, map->swap, hashKey(old->keys[index]), old->keys[index], old->values+index*map->stride);
+
+		if(map->migrateCursor>=old->capacity)
+		{
+			tableFree(old);
+			map->migrateCursor=0;
+		}
+	}
+}
+
+// Start moving everything into a table twice the size, finishing any previous growth first
+static bool grow(HashMap_t *map)
+{
+	migrate(map, UINT32_MAX);
+
+	if(map->table.capacity>=(1u<<31))
+		return false;
+
+	HashTable_t table;
+
+	if(!tableAlloc(&table, map->table.capacity*2, map->stride))
+		return false;
+
+	map->oldTable=map->table;
+	map->table=table;
+	map->migrateCursor=0;
+
+	return true;
+}
+
+// Capacity is how many entries to expect before the first growth
+bool HashMap_Init(HashMap_t *map, size_t stride, uint32_t capacity)
+{
+	if(map==NULL||stride==0)
+		return false;
+
+	memset(map, 0, sizeof(HashMap_t));
+
+	if(capacity>(1u<<30))
+	{
+		DBGPRINTF(DEBUG_ERROR, "HashMap_Init: Capacity must be at most %u.\n", 1u<<30);
+		return false;
+	}
+
+	// Room for that many entries under the load limit
+	capacity=NextPow2((uint32_t)(((uint64_t)capacity*HASHMAP_MAX_LOAD_DEN+HASHMAP_MAX_LOAD_NUM-1)/HASHMAP_MAX_LOAD_NUM));
+
+	if(capacity<8)
+		capacity=8;
+
+	map->stride=stride;
+	map->swap=(uint8_t *)Zone_Malloc(zone, stride*2);
+
+	if(map->swap==NULL||!tableAlloc(&map->table, capacity, stride))
+	{
+		DBGPRINTF(DEBUG_ERROR, "HashMap_Init: Unable to allocate memory.\n");
+		HashMap_Destroy(map);
+		return false;
+	}
+
+	return true;
+}
+
+// Insert or replace, false if the map needed to grow and couldn't
+bool HashMap_Set(HashMap_t *map, uint64_t key, const void *value)
+{
+	if(map==NULL||map->table.memory==NULL||value==NULL)
+		return false;
+
+	const uint64_t hash=hashKey(key);
+	uint32_t index=tableFind(&map->table, hash, key);
+
+	if(index!=UINT32_MAX)
+	{
+		memcpy(map->table.values+index*map->stride, value, map->stride);
+		return true;
+	}
+
+	// Still in the old table, take it out of there and insert it fresh
+	index=oldFind(map, hash, key);
+
+	if(index!=UINT32_MAX)
+	{
+		map->oldTable.distance[index]|=DISTANCE_REMOVED;
+		map->count--;
+	}
+	else if((uint64_t)(map->count+1)*HASHMAP_MAX_LOAD_DEN>(uint64_t)map->table.capacity*HASHMAP_MAX_LOAD_NUM&&!grow(map))
+	{
+		DBGPRINTF(DEBUG_ERROR, "HashMap_Set: Unable to grow map past %d entries.\n", map->count);
+		return false;
+	}
+
+	tableInsert(&map->table, map->stride, map->swap, hash, key, value);
+	map->count++;
+
+	migrate(map, HASHMAP_MIGRATE_STEP);
+
+	return true;
+}
+
+// Pointer to the value stored for key, NULL if there isn't one. Only valid until the next set or remove.
+void *HashMap_Get(HashMap_t *map, uint64_t key)
+{
+	if(map==NULL||map->table.memory==NULL)
+		return NULL;
+
+	const uint64_t hash=hashKey(key);
+	uint32_t index=tableFind(&map->table, hash, key);
+
+	if(index!=UINT32_MAX)
+		return map->table.values+index*map->stride;
+
+	index=oldFind(map, hash, key);
+
+	if(index!=UINT32_MAX)
+		return map->oldTable.values+index*map->stride;
+
+	return NULL;
+}
+
+bool HashMap_Remove(HashMap_t *map, uint64_t key)
+{
+	if(map==NULL||map->table.memory==NULL)
+		return false;
+
+	const uint64_t hash=hashKey(key);
+	uint32_t index=tableFind(&map->table, hash, key);
+
+	if(index!=UINT32_MAX)
+		tableErase(&map->table, map->stride, index);
+	else
+	{
+		index=oldFind(map, hash, key);
+
+		if(index==UINT32_MAX)
+			return false;
+
+		// Can't shift entries in the old table, they'd slip past the migration cursor
+		map->oldTable.distance[index]|=DISTANCE_REMOVED;
+	}
+
+	map->count--;
+
+	migrate(map, HASHMAP_MIGRATE_STEP);
+
+	return true;
+}
+
+uint32_t HashMap_GetCount(HashMap_t *map)
+{
+	if(map==NULL)
+		return 0;
+
+	return map->count;
+}
+
+// Remove everything, keeps the current table size
+void HashMap_Clear(HashMap_t *map)
+{
+	if(map==NULL||map->table.memory==NULL)
+		return;
+
+	tableFree(&map->oldTable);
+	memset(map->table.distance, 0, sizeof(uint16_t)*map->table.capacity);
+
+	map->migrateCursor=0;
+	map->count=0;
+}
+
+void HashMap_Destroy(HashMap_t *map)
+{
+	if(map==NULL)
+		return;
+
+	tableFree(&map->table);
+	tableFree(&map->oldTable);
+
+	if(map->swap)
+		Zone_Free(zone, map->swap);
+
+	memset(map, 0, sizeof(HashMap_t));
+}
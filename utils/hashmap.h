@@ -0,0 +1,50 @@
+#ifndef __HASHMAP_H__
+#define __HASHMAP_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+// Open addressing hash map from 64 bit keys to fixed size values, Robin Hood probing.
+// Each bucket remembers how far it is from its home bucket, an insert takes the place of any entry that's
+//     closer to home than it is, which keeps probe lengths short and lets a lookup stop at the first entry
+//     that's closer to home than the key would be. Removal shifts the following entries back, no tombstones.
+// Growing doesn't stop the world, the old table is kept and its buckets move over a few at a time on
+//     every insert and remove until it's empty, lookups check both tables in the meantime.
+// Not thread safe on its own, owners lock around it the same as they would a List_t.
+
+#define HASHMAP_MAX_LOAD_NUM 7			// Grow past 7/8 full
+#define HASHMAP_MAX_LOAD_DEN 8
+#define HASHMAP_MIGRATE_STEP 8			// Old table buckets moved per insert/remove while growing
+
+typedef struct
+{
+	uint32_t capacity;				// Power of two
+	uint32_t mask;
+	uint64_t *keys;
+	uint8_t *values;
+	uint16_t *distance;				// Per bucket, probe distance+1 (0 is empty), top bit marks removed entries in the old table
+	void *memory;
+} HashTable_t;
+
+typedef struct
+{
+	size_t stride;
+	uint32_t count;
+
+	HashTable_t table;
+	HashTable_t oldTable;			// Being migrated into table, empty when not growing
+	uint32_t migrateCursor;			// Buckets of the old table below this have been moved
+
+	uint8_t *swap;					// Scratch for displacing values, two values long
+} HashMap_t;
+
+bool HashMap_Init(HashMap_t *map, size_t stride, uint32_t capacity);
+bool HashMap_Set(HashMap_t *map, uint64_t key, const void *value);
+void *HashMap_Get(HashMap_t *map, uint64_t key);
+bool HashMap_Remove(HashMap_t *map, uint64_t key);
+uint32_t HashMap_GetCount(HashMap_t *map);
+void HashMap_Clear(HashMap_t *map);
+void HashMap_Destroy(HashMap_t *map);
+
+#endif
@@ -10,7 +10,22 @@
 #define FREE(p) { if(p) { free(p); p=NULL; } }
 #endif
 
+// Buffer allocations go through here, so aligned lists stay aligned when they grow
+static void *List_Realloc(List_t *List, void *Ptr, size_t Size)
+{
+	if(List->Alignment)
+		return Zone_ReallocAligned(zone, Ptr, Size, List->Alignment);
+
+	return Zone_Realloc(zone, Ptr, Size);
+}
+
 bool List_Init(List_t *List, const size_t Stride, const size_t Count, const void *Data)
+{
+	return List_InitAligned(List, Stride, Count, Data, 0);
+}
+
+// Same as List_Init, but the buffer is aligned to Alignment bytes (power of 2, 0 for the zone default)
+bool List_InitAligned(List_t *List, const size_t Stride, const size_t Count, const void *Data, const size_t Alignment)
 {
 	if(List==NULL)
 		return false;
@@ -19,8 +34,10 @@ bool List_Init(List_t *List, const size_t Stride, const size_t Count, const void
 	if(!Stride)
 		return false;
 
-	// Save stride
+	// Save stride and alignment
 	List->Stride=Stride;
+	List->Alignment=Alignment;
+	List->Buffer=NULL;
 
 	// If initial data was specified, allocate and copy it
 	if(Data)
@@ -30,12 +47,12 @@ bool List_Init(List_t *List, const size_t Stride, const size_t Count, const void
 		// Actual buffer size is 1.5x list size to help avoid reallocation stalls at the cost of more memory usage
 		List->bufSize=List->Size*2;
 
-		List->Buffer=(uint8_t *)Zone_Malloc(zone, List->bufSize);
+		List->Buffer=(uint8_t *)List_Realloc(List, NULL, List->bufSize);
 
 		if(List->Buffer==NULL)
 			return false;
 
-		memcpy(List->Buffer, Data, List->bufSize);
+		memcpy(List->Buffer, Data, List->Size);
 	}
 	// Otherwise, initalize the buffer to at least stride*2 for starters
 	// Or if Count is specified and no data, use that as a pre-allocation.
@@ -47,7 +64,7 @@ bool List_Init(List_t *List, const size_t Stride, const size_t Count, const void
 		else
 			List->bufSize=Stride*Count*2;
 
-		List->Buffer=(uint8_t *)Zone_Malloc(zone, List->bufSize);
+		List->Buffer=(uint8_t *)List_Realloc(List, NULL, List->bufSize);
 
 		if(List->Buffer==NULL)
 			return false;
@@ -77,7 +94,7 @@ bool List_Add(List_t *List, void *Data)
 		List->bufSize=List->Size*2;
 
 		// Reallocate the buffer
-		uint8_t *Ptr=(uint8_t *)Zone_Realloc(zone, List->Buffer, List->bufSize);
+		uint8_t *Ptr=(uint8_t *)List_Realloc(List, List->Buffer, List->bufSize);
 
 		if(Ptr==NULL)
 			return false;
@@ -101,7 +118,7 @@ bool List_Del(List_t *List, const size_t Index)
 		return false;
 
 	// Shift data from index to end, overwriting the item to be removed
-	memcpy(&List->Buffer[Index*List->Stride], &List->Buffer[(Index+1)*List->Stride], List->Size-(Index*List->Stride));
+	memmove(&List->Buffer[Index*List->Stride], &List->Buffer[(Index+1)*List->Stride], List->Size-((Index+1)*List->Stride));
 	// Update list size
 	List->Size-=List->Stride;
 
@@ -157,7 +174,7 @@ bool List_ShrinkFit(List_t *List)
 	if(List==NULL)
 		return false;
 
-	void *temp=Zone_Realloc(zone, List->Buffer, List->Size);
+	void *temp=List_Realloc(List, List->Buffer, List->Size);
 
 	if(temp==NULL)
 		return false;
@@ -9,10 +9,12 @@ typedef struct
     size_t Size;
 	size_t bufSize;
 	size_t Stride;
+	size_t Alignment;		// Buffer alignment, 0 for the zone default
     uint8_t *Buffer;
 } List_t;
 
 bool List_Init(List_t *List, const size_t Stride, const size_t Count, const void *Data);
+bool List_InitAligned(List_t *List, const size_t Stride, const size_t Count, const void *Data, const size_t Alignment);
 bool List_Add(List_t *List, void *Data);
 bool List_Del(List_t *List, const size_t Index);
 void *List_GetPointer(List_t *List, const size_t Index);
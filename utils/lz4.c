@@ -1,5 +1,7 @@
 #include <stdint.h>
+#include <stdbool.h>
 #include <string.h>
+#include "lz4.h"
 
 #define PADDING_LITERALS 5
 
@@ -75,7 +77,7 @@ size_t lz4_compress(const uint8_t *in, size_t inLength, uint8_t *out)
             uint32_t length=bestLength-MIN_MATCH;
             const uint32_t nibble=MIN(length, 15);
 
-            if(pp!=p)
+            if(pp!=(size_t)p)
             {
                 const uint32_t run=(uint32_t)(p-pp);
 
@@ -130,7 +132,7 @@ size_t lz4_compress(const uint8_t *in, size_t inLength, uint8_t *out)
         }
     }
 
-    if(pp!=p)
+    if(pp!=(size_t)p)
     {
         const uint32_t run=(uint32_t)(p-pp);
 
@@ -157,131 +159,172 @@ size_t lz4_compress(const uint8_t *in, size_t inLength, uint8_t *out)
     return op;
 }
 
-size_t lz4_decompress(const uint8_t *in, size_t inLength, uint8_t *out, size_t outLength)
+// Copy helpers for the decoder, fixed sizes so they compile down to single vector moves
+static inline void copy16(uint8_t *dst, const uint8_t *src)
 {
-    size_t p=0, ip=0;
+    memcpy(dst, src, 16);
+}
 
-    // if output buffer is null, just count run lengths and return decompressed size
-    if(out==NULL||outLength==0)
+static inline void copy32(uint8_t *dst, const uint8_t *src)
+{
+    memcpy(dst, src, 32);
+}
+
+// Reads an extended length (run of 255's terminated by a smaller byte), returns false if it runs off the input
+static inline bool readLength(const uint8_t **ip, const uint8_t *iend, size_t *length)
+{
+    uint8_t c;
+
+    do
     {
-        for(;;)
-        {
-            const uint8_t token=in[ip++];
+        if(*ip>=iend)
+            return false;
 
-            if(token>=16)
-            {
-                uint32_t run=token>>4;
+        c=*(*ip)++;
+        *length+=c;
+    } while(c==255);
 
-                if(run==15)
-                {
-                    for(;;)
-                    {
-                        const uint8_t c=in[ip++];
-                        run+=c;
+    return true;
+}
 
-                        if(c!=255)
-                            break;
-                    }
-                }
+// Count decompressed size without writing anything, returns 0 on malformed input
+static size_t lz4_decompressedSize(const uint8_t *in, size_t inLength)
+{
+    const uint8_t *ip=in, *iend=in+inLength;
+    size_t p=0;
 
-                p+=run;
-                ip+=run;
+    while(ip<iend)
+    {
+        const uint8_t token=*ip++;
+        size_t run=token>>4;
 
-                if(ip>=inLength)
-                    break;
-            }
+        if(run==15&&!readLength(&ip, iend, &run))
+            return 0;
 
-            ip+=2;
+        if(run>(size_t)(iend-ip))
+            return 0;
 
-            uint32_t len=(token&15)+MIN_MATCH;
+        p+=run;
+        ip+=run;
 
-            if(len==(15+MIN_MATCH))
-            {
-                for(;;)
-                {
-                    const uint8_t c=in[ip++];
-                    len+=c;
+        if(ip==iend)
+            break;
 
-                    if(c!=255)
-                        break;
-                }
-            }
+        if((iend-ip)<2)
+            return 0;
 
-            p+=len;
-        }
+        const size_t offset=ip[0]|(ip[1]<<8);
+        ip+=2;
+
+        if(offset==0||offset>p)
+            return 0;
+
+        size_t len=(token&15)+MIN_MATCH;
+
+        if(len==(15+MIN_MATCH)&&!readLength(&ip, iend, &len))
+            return 0;
+
+        p+=len;
     }
-    else // do actual decompressing
+
+    return p;
+}
+
+size_t lz4_decompress(const uint8_t *in, size_t inLength, uint8_t *out, size_t outLength)
+{
+    if(in==NULL||inLength==0)
+        return 0;
+
+    // if output buffer is null, just count run lengths and return decompressed size
+    if(out==NULL||outLength==0)
+        return lz4_decompressedSize(in, inLength);
+
+    const uint8_t *ip=in, *iend=in+inLength;
+    uint8_t *op=out, *oend=out+outLength;
+
+    while(ip<iend)
     {
-        for(;;)
-        {
-            const uint8_t token=in[ip++];
+        const uint8_t token=*ip++;
+        size_t run=token>>4;
 
-            if(token>=16)
-            {
-                uint32_t run=token>>4;
+        // Literals
+        if(run==15&&!readLength(&ip, iend, &run))
+            return 0;
 
-                if(run==15)
-                {
-                    for(;;)
-                    {
-                        const uint8_t c=in[ip++];
-                        run+=c;
+        if(run>(size_t)(iend-ip)||run>(size_t)(oend-op))
+            return 0;
 
-                        if(c!=255)
-                            break;
-                    }
-                }
+        // Wild copy in 32 byte chunks when both buffers have room for the overshoot, otherwise exact copy for the tail
+        if(run+32<=(size_t)(iend-ip)&&run+32<=(size_t)(oend-op))
+        {
+            for(size_t i=0;i<run;i+=32)
+                copy32(op+i, ip+i);
+        }
+        else
+            memcpy(op, ip, run);
 
-                if((p+run)>outLength)
-                    return 0;
+        op+=run;
+        ip+=run;
 
-                for(uint32_t i=0;i<run;i+=4)
-                    *(uint32_t *)&out[p+i]=*(uint32_t *)&in[ip+i];
+        // Last sequence is literals only
+        if(ip==iend)
+            break;
 
-                p+=run;
-                ip+=run;
+        // Match
+        if((iend-ip)<2)
+            return 0;
 
-                if(ip>=inLength)
-                    break;
-            }
+        const size_t offset=ip[0]|(ip[1]<<8);
+        ip+=2;
 
-            size_t s=p-(*(uint16_t *)&in[ip]);
-            ip+=2;
+        // Offset must land inside what has already been decoded
+        if(offset==0||offset>(size_t)(op-out))
+            return 0;
 
-            if(s<0)
-                return 0;
+        size_t len=(token&15)+MIN_MATCH;
 
-            uint32_t len=(token&15)+MIN_MATCH;
+        if(len==(15+MIN_MATCH)&&!readLength(&ip, iend, &len))
+            return 0;
 
-            if(len==(15+MIN_MATCH))
-            {
-                for(;;)
-                {
-                    const uint8_t c=in[ip++];
-                    len+=c;
+        if(len>(size_t)(oend-op))
+            return 0;
 
-                    if(c!=255)
-                        break;
-                }
-            }
+        const uint8_t *match=op-offset;
 
-            if((p+len)>outLength)
-                return 0;
+        if(len+32>(size_t)(oend-op))
+        {
+            // Not enough room to overshoot, byte copy (handles any overlap)
+            for(size_t i=0;i<len;i++)
+                op[i]=match[i];
+        }
+        else if(offset>=32)
+        {
+            for(size_t i=0;i<len;i+=32)
+                copy32(op+i, match+i);
+        }
+        else if(offset>=16)
+        {
+            for(size_t i=0;i<len;i+=16)
+                copy16(op+i, match+i);
+        }
+        else if(offset==1)
+            memset(op, *match, len);
+        else
+        {
+            // Small overlapping offset, replicate the repeating pattern and stamp it out
+            //     in steps of the largest multiple of the offset that fits.
+            uint8_t pattern[32];
+            const size_t step=32-(32%offset);
 
-            if((p-s)>=4)
-            {
-                for(uint32_t i=0;i<len;i+=4)
-                    *(uint32_t *)&out[p+i]=*(uint32_t *)&out[s+i];
+            for(size_t i=0;i<32;i++)
+                pattern[i]=match[i%offset];
 
-                p+=len;
-            }
-            else
-            {
-                while(len--)
-                    out[p++]=out[s++];
-            }
+            for(size_t i=0;i<len;i+=step)
+                copy32(op+i, pattern);
         }
+
+        op+=len;
     }
 
-    return p;
+    return (size_t)(op-out);
 }
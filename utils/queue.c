@@ -0,0 +1,147 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include "../system/system.h"
+#include "bits.h"
+#include "queue.h"
+
+// Cell sequence protocol, for position pos and cell pos&mask:
+//     sequence==pos          cell is free for the producer at pos,
+//     sequence==pos+1        cell holds the element for the consumer at pos,
+//     sequence==pos+capacity consumer is done, cell is free for the producer one lap later.
+// Positions and sequences wrap at 2^32, they're compared through a signed difference.
+
+_Static_assert(sizeof(atomic_uint)<=QUEUE_CELL_HEADER, "Cell header must fit the sequence number");
+
+static inline atomic_uint *cellSequence(Queue_t *queue, uint32_t pos)
+{
+	return (atomic_uint *)(queue->cells+(pos&queue->mask)*queue->cellStride);
+}
+
+static inline uint8_t *cellData(Queue_t *queue, uint32_t pos)
+{
+	return queue->cells+(pos&queue->mask)*queue->cellStride+QUEUE_CELL_HEADER;
+}
+
+// Capacity is rounded up to a power of two
+bool Queue_Init(Queue_t *queue, size_t stride, uint32_t capacity)
+{
+	if(queue==NULL||stride==0||capacity==0)
+		return false;
+
+	if(capacity>(1u<<30))
+	{
+		DBGPRINTF(DEBUG_ERROR, "Queue_Init: Capacity must be at most %u.\n", 1u<<30);
+		return false;
+	}
+
+	memset(queue, 0, sizeof(Queue_t));
+
+	// A single cell can't tell "full" from "empty" by its sequence alone
+	if(capacity<2)
+		capacity=2;
+
+	queue->stride=stride;
+	queue->cellStride=(QUEUE_CELL_HEADER+stride+7)&~(size_t)7;
+	queue->capacity=NextPow2(capacity);
+	queue->mask=queue->capacity-1;
+	queue->cells=(uint8_t *)Zone_Malloc(zone, queue->cellStride*queue->capacity);
+
+	if(queue->cells==NULL)
+	{
+		DBGPRINTF(DEBUG_ERROR, "Queue_Init: Unable to allocate memory.\n");
+		return false;
+	}
+
+	for(uint32_t i=0;i<queue->capacity;i++)
+		atomic_init(cellSequence(queue, i), i);
+
+	atomic_init(&queue->enqueuePos, 0);
+	atomic_init(&queue->dequeuePos, 0);
+
+	return true;
+}
+
+// Any thread, false if the queue is full
+bool Queue_Push(Queue_t *queue, const void *data)
+{
+	uint32_t pos=atomic_load_explicit(&queue->enqueuePos, memory_order_relaxed);
+
+	for(;;)
+	{
+		const uint32_t sequence=atomic_load_explicit(cellSequence(queue, pos), memory_order_acquire);
+		const int32_t diff=(int32_t)(sequence-pos);
+
+		if(diff==0)
+		{
+			// Cell is free, try to claim it (pos is reloaded on failure)
+			if(atomic_compare_exchange_weak_explicit(&queue->enqueuePos, &pos, pos+1, memory_order_relaxed, memory_order_relaxed))
+				break;
+		}
+		else if(diff<0)
+			return false;	// Still holds last lap's element, the queue is full
+		else
+			pos=atomic_load_explicit(&queue->enqueuePos, memory_order_relaxed);	// Another producer got here first
+	}
+
+	memcpy(cellData(queue, pos), data, queue->stride);
+	atomic_store_explicit(cellSequence(queue, pos), pos+1, memory_order_release);
+
+	return true;
+}
+
+// Any thread, false if the queue is empty
+bool Queue_Pop(Queue_t *queue, void *data)
+{
+	uint32_t pos=atomic_load_explicit(&queue->dequeuePos, memory_order_relaxed);
+
+	for(;;)
+	{
+		const uint32_t sequence=atomic_load_explicit(cellSequence(queue, pos), memory_order_acquire);
+		const int32_t diff=(int32_t)(sequence-(pos+1));
+
+		if(diff==0)
+		{
+			if(atomic_compare_exchange_weak_explicit(&queue->dequeuePos, &pos, pos+1, memory_order_relaxed, memory_order_relaxed))
+				break;
+		}
+		else if(diff<0)
+			return false;	// Nothing published here yet, the queue is empty
+		else
+			pos=atomic_load_explicit(&queue->dequeuePos, memory_order_relaxed);
+	}
+
+	memcpy(data, cellData(queue, pos), queue->stride);
+	atomic_store_explicit(cellSequence(queue, pos), pos+queue->capacity, memory_order_release);
+
+	return true;
+}
+
+// Snapshot only, may be stale by the time it returns
+uint32_t Queue_GetCount(Queue_t *queue)
+{
+	if(queue==NULL)
+		return 0;
+
+	const uint32_t dequeuePos=atomic_load_explicit(&queue->dequeuePos, memory_order_acquire);
+	const uint32_t enqueuePos=atomic_load_explicit(&queue->enqueuePos, memory_order_acquire);
+	const uint32_t count=enqueuePos-dequeuePos;
+
+	// Positions can be read across a pop that overtook the push, clamp rather than wrap
+	if((int32_t)count<0)
+		return 0;
+
+	return count>queue->capacity?queue->capacity:count;
+}
+
+void Queue_Destroy(Queue_t *queue)
+{
+	if(queue==NULL)
+		return;
+
+	if(queue->cells)
+		Zone_Free(zone, queue->cells);
+
+	memset(queue, 0, sizeof(Queue_t));
+}
@@ -0,0 +1,48 @@
+#ifndef __QUEUE_H__
+#define __QUEUE_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdatomic.h>
+
+// Bounded multi producer, multi consumer queue of fixed size elements, lock-free (Vyukov's array queue).
+// Every cell carries a sequence number that says whose turn it is, a producer claims a cell by bumping the
+//     enqueue position with a CAS, copies its element in and then publishes it by advancing the sequence.
+//     Consumers do the same on the dequeue side, so producers and consumers only meet on the cell itself.
+// A stalled thread between claiming and publishing holds up that one cell, the queue reads as full (or empty) at it.
+
+#ifndef CACHE_LINE_SIZE
+#define CACHE_LINE_SIZE 64
+#endif
+
+// Element data follows the cell's sequence number at this offset, so elements are 8 byte aligned
+#define QUEUE_CELL_HEADER 8
+
+typedef struct
+{
+	// Read-only after init
+	size_t stride;
+	size_t cellStride;
+	uint32_t capacity;			// Power of two, at least 2
+	uint32_t mask;
+	uint8_t *cells;
+
+	uint8_t pad0[CACHE_LINE_SIZE];
+
+	atomic_uint enqueuePos;
+
+	uint8_t pad1[CACHE_LINE_SIZE-sizeof(atomic_uint)];
+
+	atomic_uint dequeuePos;
+
+	uint8_t pad2[CACHE_LINE_SIZE-sizeof(atomic_uint)];
+} Queue_t;
+
+bool Queue_Init(Queue_t *queue, size_t stride, uint32_t capacity);
+bool Queue_Push(Queue_t *queue, const void *data);
+bool Queue_Pop(Queue_t *queue, void *data);
+uint32_t Queue_GetCount(Queue_t *queue);
+void Queue_Destroy(Queue_t *queue);
+
+#endif
@@ -0,0 +1,172 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include "../system/system.h"
+#include "bits.h"
+#include "ring.h"
+
+// Indices run freely and wrap at 2^32, the slot is index&mask and the count is head-tail
+
+// Copy count elements into the ring starting at index, split in two where it wraps
+static void copyIn(Ring_t *ring, uint32_t index, const uint8_t *data, uint32_t count)
+{
+	const uint32_t slot=index&ring->mask;
+	const uint32_t first=(ring->capacity-slot)<count?(ring->capacity-slot):count;
+
+	memcpy(ring->buffer+slot*ring->stride, data, first*ring->stride);
+
+	if(count>first)
+		memcpy(ring->buffer, data+first*ring->stride, (count-first)*ring->stride);
+}
+
+static void copyOut(Ring_t *ring, uint32_t index, uint8_t *data, uint32_t count)
+{
+	const uint32_t slot=index&ring->mask;
+	const uint32_t first=(ring->capacity-slot)<count?(ring->capacity-slot):count;
+
+	memcpy(data, ring->buffer+slot*ring->stride, first*ring->stride);
+
+	if(count>first)
+		memcpy(data+first*ring->stride, ring->buffer, (count-first)*ring->stride);
+}
+
+// Capacity is rounded up to a power of two
+bool Ring_Init(Ring_t *ring, size_t stride, uint32_t capacity)
+{
+	if(ring==NULL||stride==0||capacity==0)
+		return false;
+
+	if(capacity>(1u<<31))
+	{
+		DBGPRINTF(DEBUG_ERROR, "Ring_Init: Capacity must be at most %u.\n", 1u<<31);
+		return false;
+	}
+
+	memset(ring, 0, sizeof(Ring_t));
+
+	ring->stride=stride;
+	ring->capacity=NextPow2(capacity);
+	ring->mask=ring->capacity-1;
+	ring->buffer=(uint8_t *)Zone_Malloc(zone, stride*ring->capacity);
+
+	if(ring->buffer==NULL)
+	{
+		DBGPRINTF(DEBUG_ERROR, "Ring_Init: Unable to allocate memory.\n");
+		return false;
+	}
+
+	atomic_init(&ring->head, 0);
+	atomic_init(&ring->tail, 0);
+
+	return true;
+}
+
+// Producer only, false if the ring is full
+bool Ring_Push(Ring_t *ring, const void *data)
+{
+	const uint32_t head=atomic_load_explicit(&ring->head, memory_order_relaxed);
+
+	if(head-ring->cachedTail>=ring->capacity)
+	{
+		ring->cachedTail=atomic_load_explicit(&ring->tail, memory_order_acquire);
+
+		if(head-ring->cachedTail>=ring->capacity)
+			return false;
+	}
+
+	memcpy(ring->buffer+(head&ring->mask)*ring->stride, data, ring->stride);
+	atomic_store_explicit(&ring->head, head+1, memory_order_release);
+
+	return true;
+}
+
+// Consumer only, false if the ring is empty
+bool Ring_Pop(Ring_t *ring, void *data)
+{
+	const uint32_t tail=atomic_load_explicit(&ring->tail, memory_order_relaxed);
+
+	if(tail==ring->cachedHead)
+	{
+		ring->cachedHead=atomic_load_explicit(&ring->head, memory_order_acquire);
+
+		if(tail==ring->cachedHead)
+			return false;
+	}
+
+	memcpy(data, ring->buffer+(tail&ring->mask)*ring->stride, ring->stride);
+	atomic_store_explicit(&ring->tail, tail+1, memory_order_release);
+
+	return true;
+}
+
+// Producer only, pushes as many of count elements as fit and publishes them all at once, returns how many
+uint32_t Ring_PushBatch(Ring_t *ring, const void *data, uint32_t count)
+{
+	const uint32_t head=atomic_load_explicit(&ring->head, memory_order_relaxed);
+	uint32_t space=ring->capacity-(head-ring->cachedTail);
+
+	if(space<count)
+	{
+		ring->cachedTail=atomic_load_explicit(&ring->tail, memory_order_acquire);
+		space=ring->capacity-(head-ring->cachedTail);
+	}
+
+	if(count>space)
+		count=space;
+
+	if(count==0)
+		return 0;
+
+	copyIn(ring, head, (const uint8_t *)data, count);
+	atomic_store_explicit(&ring->head, head+count, memory_order_release);
+
+	return count;
+}
+
+// Consumer only, pops up to count elements in one go, returns how many
+uint32_t Ring_PopBatch(Ring_t *ring, void *data, uint32_t count)
+{
+	const uint32_t tail=atomic_load_explicit(&ring->tail, memory_order_relaxed);
+	uint32_t available=ring->cachedHead-tail;
+
+	if(available<count)
+	{
+		ring->cachedHead=atomic_load_explicit(&ring->head, memory_order_acquire);
+		available=ring->cachedHead-tail;
+	}
+
+	if(count>available)
+		count=available;
+
+	if(count==0)
+		return 0;
+
+	copyOut(ring, tail, (uint8_t *)data, count);
+	atomic_store_explicit(&ring->tail, tail+count, memory_order_release);
+
+	return count;
+}
+
+// Only exact from the producer or consumer thread, anyone else gets a snapshot that may already be stale
+uint32_t Ring_GetCount(Ring_t *ring)
+{
+	if(ring==NULL)
+		return 0;
+
+	const uint32_t tail=atomic_load_explicit(&ring->tail, memory_order_acquire);
+	const uint32_t head=atomic_load_explicit(&ring->head, memory_order_acquire);
+
+	return head-tail;
+}
+
+void Ring_Destroy(Ring_t *ring)
+{
+	if(ring==NULL)
+		return;
+
+	if(ring->buffer)
+		Zone_Free(zone, ring->buffer);
+
+	memset(ring, 0, sizeof(Ring_t));
+}
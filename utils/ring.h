@@ -0,0 +1,49 @@
+#ifndef __RING_H__
+#define __RING_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdatomic.h>
+
+// Single producer, single consumer ring buffer of fixed size elements, lock-free.
+// Exactly one thread may push and exactly one thread may pop, they can be different threads.
+// Head and tail each get their own cache line, and each side keeps a cached copy of the other side's index
+//     so it only touches the other line when the ring looks full (or empty).
+
+#ifndef CACHE_LINE_SIZE
+#define CACHE_LINE_SIZE 64
+#endif
+
+typedef struct
+{
+	// Read-only after init
+	size_t stride;
+	uint32_t capacity;			// Power of two
+	uint32_t mask;
+	uint8_t *buffer;
+
+	uint8_t pad0[CACHE_LINE_SIZE];
+
+	// Producer's line
+	atomic_uint head;
+	uint32_t cachedTail;
+
+	uint8_t pad1[CACHE_LINE_SIZE-sizeof(atomic_uint)-sizeof(uint32_t)];
+
+	// Consumer's line
+	atomic_uint tail;
+	uint32_t cachedHead;
+
+	uint8_t pad2[CACHE_LINE_SIZE-sizeof(atomic_uint)-sizeof(uint32_t)];
+} Ring_t;
+
+bool Ring_Init(Ring_t *ring, size_t stride, uint32_t capacity);
+bool Ring_Push(Ring_t *ring, const void *data);
+bool Ring_Pop(Ring_t *ring, void *data);
+uint32_t Ring_PushBatch(Ring_t *ring, const void *data, uint32_t count);
+uint32_t Ring_PopBatch(Ring_t *ring, void *data, uint32_t count);
+uint32_t Ring_GetCount(Ring_t *ring);
+void Ring_Destroy(Ring_t *ring);
+
+#endif
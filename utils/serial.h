@@ -60,4 +60,49 @@ static inline vec4 Deserialize_vec4(uint8_t **buffer)
 	return val;
 }
 
+// Packet schema generation:
+//
+// A schema is an X-macro listing fields as X(type, name), where type is one of the serializable
+//     types above (uint32, float, vec3, vec4), for example:
+//
+//     #define EXAMPLE_SCHEMA(X) X(uint32, magic) X(vec3, position)
+//
+// Longer schemas put one field per line with line continuations, see netpacket.h.
+//
+//     SERIAL_DEFINE_PACKET(Example, EXAMPLE_SCHEMA)
+//
+// Which generates:
+//     Example_t            Struct with the fields.
+//     Example_SIZE         Exact wire size in bytes (compile time constant).
+//     Example_Encode()     Writes the fields in order and advances the buffer pointer.
+//     Example_Decode()     Reads the fields in order and advances the buffer pointer.
+
+// Wire sizes, these are what goes on the wire, not necessarily sizeof() the C type
+#define SERIAL_SIZE_uint32 4
+#define SERIAL_SIZE_float 4
+#define SERIAL_SIZE_vec3 12
+#define SERIAL_SIZE_vec4 16
+
+#define SERIAL_TYPE_uint32 uint32_t
+#define SERIAL_TYPE_float float
+#define SERIAL_TYPE_vec3 vec3
+#define SERIAL_TYPE_vec4 vec4
+
+// Serializers copy the C types directly, make sure nothing got padded
+_Static_assert(sizeof(uint32_t)==SERIAL_SIZE_uint32, "uint32 wire size mismatch");
+_Static_assert(sizeof(float)==SERIAL_SIZE_float, "float wire size mismatch");
+_Static_assert(sizeof(vec3)==SERIAL_SIZE_vec3, "vec3 wire size mismatch");
+_Static_assert(sizeof(vec4)==SERIAL_SIZE_vec4, "vec4 wire size mismatch");
+
+#define SERIAL_FIELD_DECLARE(type, name) SERIAL_TYPE_##type name;
+#define SERIAL_FIELD_SIZE(type, name) +SERIAL_SIZE_##type
+#define SERIAL_FIELD_ENCODE(type, name) Serialize_##type(buffer, packet->name);
+#define SERIAL_FIELD_DECODE(type, name) packet->name=Deserialize_##type(buffer);
+
+#define SERIAL_DEFINE_PACKET(name, schema) \
+	typedef struct { schema(SERIAL_FIELD_DECLARE) } name##_t; \
+	enum { name##_SIZE=0 schema(SERIAL_FIELD_SIZE) }; \
+	static inline void name##_Encode(uint8_t **buffer, const name##_t *packet) { schema(SERIAL_FIELD_ENCODE) } \
+	static inline void name##_Decode(uint8_t **buffer, name##_t *packet) { schema(SERIAL_FIELD_DECODE) }
+
 #endif
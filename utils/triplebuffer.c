@@ -0,0 +1,76 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include "../system/system.h"
+#include "triplebuffer.h"
+
+// Buffers start out zeroed, the reader sees that until the first publish
+bool TripleBuffer_Init(TripleBuffer_t *tb, size_t size)
+{
+	if(tb==NULL||size==0)
+		return false;
+
+	memset(tb, 0, sizeof(TripleBuffer_t));
+
+	// Own cache lines, so the writer filling its buffer never bounces a line the reader is on
+	tb->stride=(size+CACHE_LINE_SIZE-1)&~(size_t)(CACHE_LINE_SIZE-1);
+	tb->buffers=(uint8_t *)Zone_MallocAligned(zone, tb->stride*3, CACHE_LINE_SIZE);
+
+	if(tb->buffers==NULL)
+	{
+		DBGPRINTF(DEBUG_ERROR, "TripleBuffer_Init: Unable to allocate memory.\n");
+		return false;
+	}
+
+	memset(tb->buffers, 0, tb->stride*3);
+
+	tb->writeIndex=0;
+	atomic_init(&tb->middle, 1);
+	tb->readIndex=2;
+
+	return true;
+}
+
+// Writer only, the buffer to fill for the next publish. It holds some older version (or nothing),
+//     so the writer has to fill all of it, not just what changed.
+void *TripleBuffer_GetWrite(TripleBuffer_t *tb)
+{
+	return tb->buffers+tb->writeIndex*tb->stride;
+}
+
+// Writer only, makes the write buffer the latest version and takes the old middle buffer to write next
+void TripleBuffer_Publish(TripleBuffer_t *tb)
+{
+	// Release the contents, acquire the buffer back from a reader that may have just handed it over
+	const uint32_t old=atomic_exchange_explicit(&tb->middle, tb->writeIndex|TRIPLEBUFFER_FRESH, memory_order_acq_rel);
+
+	tb->writeIndex=old&TRIPLEBUFFER_INDEX_MASK;
+}
+
+// Reader only, the latest published version. Stays valid and unchanged until the next read on this side.
+// Fresh (optional) is set if it's a newer version than the last read returned.
+const void *TripleBuffer_Read(TripleBuffer_t *tb, bool *fresh)
+{
+	const bool newer=(atomic_load_explicit(&tb->middle, memory_order_relaxed)&TRIPLEBUFFER_FRESH)!=0;
+
+	// Only the reader clears the fresh bit, so if it's set here it stays set until this exchange
+	if(newer)
+		tb->readIndex=atomic_exchange_explicit(&tb->middle, tb->readIndex, memory_order_acq_rel)&TRIPLEBUFFER_INDEX_MASK;
+
+	if(fresh)
+		*fresh=newer;
+
+	return tb->buffers+tb->readIndex*tb->stride;
+}
+
+void TripleBuffer_Destroy(TripleBuffer_t *tb)
+{
+	if(tb==NULL)
+		return;
+
+	if(tb->buffers)
+		Zone_Free(zone, tb->buffers);
+
+	memset(tb, 0, sizeof(TripleBuffer_t));
+}
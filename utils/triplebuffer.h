@@ -0,0 +1,51 @@
+#ifndef __TRIPLEBUFFER_H__
+#define __TRIPLEBUFFER_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdatomic.h>
+
+// Latest-value handoff between one writer and one reader, lock-free and wait-free on both sides.
+// Of the three buffers the writer owns one, the reader owns one and the third sits in the middle holding
+//     the most recent publish. Publishing swaps the writer's buffer into the middle, reading swaps the middle
+//     out if it's newer than what the reader has. Neither side ever waits on or copies for the other,
+//     a slow reader just skips versions, and a buffer stays put for the reader until it reads again.
+
+#ifndef CACHE_LINE_SIZE
+#define CACHE_LINE_SIZE 64
+#endif
+
+#define TRIPLEBUFFER_INDEX_MASK 0x3
+#define TRIPLEBUFFER_FRESH 0x4			// Middle buffer was published since the reader last took it
+
+typedef struct
+{
+	// Read-only after init
+	size_t stride;					// Rounded up to a cache line
+	uint8_t *buffers;
+
+	uint8_t pad0[CACHE_LINE_SIZE];
+
+	atomic_uint middle;
+
+	uint8_t pad1[CACHE_LINE_SIZE-sizeof(atomic_uint)];
+
+	// Writer's line
+	uint32_t writeIndex;
+
+	uint8_t pad2[CACHE_LINE_SIZE-sizeof(uint32_t)];
+
+	// Reader's line
+	uint32_t readIndex;
+
+	uint8_t pad3[CACHE_LINE_SIZE-sizeof(uint32_t)];
+} TripleBuffer_t;
+
+bool TripleBuffer_Init(TripleBuffer_t *tb, size_t size);
+void *TripleBuffer_GetWrite(TripleBuffer_t *tb);
+void TripleBuffer_Publish(TripleBuffer_t *tb);
+const void *TripleBuffer_Read(TripleBuffer_t *tb, bool *fresh);
+void TripleBuffer_Destroy(TripleBuffer_t *tb);
+
+#endif
@@ -13,26 +13,96 @@
 #include <stdbool.h>
 #include <string.h>
 #include "system/system.h"
+#include "system/pool.h"
+#include "system/threads.h"
 #include "math/math.h"
 #include "utils/list.h"
+#include "utils/hashmap.h"
+#include "utils/triplebuffer.h"
 #include "utils/lz4.h"
 #include "utils/serial.h"
 #include "math/math.h"
 #include "network/network.h"
 #include "physics/physics.h"
+#include "physics/spatialhash.h"
+#include "network/interest.h"
+#include "network/priority.h"
+#include "network/bandwidth.h"
+#include "world/chunkfield.h"
 #include "netpacket.h"
 
 MemZone_t *zone;
 
-#define NUM_ASTEROIDS 1000
+// Zone telemetry, sampled every tick so memory pressure shows up before allocations start failing
+#define ZONE_LOW_HEADROOM 0.1f			// Warn when less than this fraction of the zone's cap is left
+#define ZONE_HIGH_FRAGMENTATION 0.9f	// Or when free space is this fragmented
+ZoneStats_t zoneStats;
+bool zoneWarned=false;
+
+// Compact relocatable zone blocks with idle time left before the next tick, up to this long per pass
+#define ZONE_COMPACT_BUDGET 0.001
+
+// Per-tick scratch memory, reset at the end of every pass through the main loop.
+// A client's tick takes interest query scratch, 12 bytes per body near the camera (the exit sphere is about a chunk
+//     across, so call it 2x2x2 chunks' worth), and the priority schedule's order, 4 bytes per relevant entity.
+// The main thread helps run tick jobs, so any one sub-arena might end up with every client.
+#define FRAME_ARENA_CLIENT_SIZE (8*CHUNK_MAX_BODIES*(2*sizeof(uint32_t)+sizeof(float))+INTEREST_MAX_RELEVANT*sizeof(uint32_t))
+#define FRAME_ARENA_SIZE (MAX_CLIENTS*FRAME_ARENA_CLIENT_SIZE)
+#define FRAME_ARENA_THREADS 4
+FrameArena_t frameArena;
+
+// Asteroid field streamed in chunks around the client cameras, each resident chunk owns a fixed range of asteroids.
+// Enough slots for every client to be off on its own somewhere.
+#define FIELD_MAX_CHUNKS (MAX_CLIENTS*CHUNK_MAX_PER_CAMERA)
+#define NUM_ASTEROIDS (FIELD_MAX_CHUNKS*CHUNK_MAX_BODIES)
 RigidBody_t asteroids[NUM_ASTEROIDS];
+ChunkField_t chunkField;
 
-uint32_t connectedClients=0;
-Client_t clients[MAX_CLIENTS];
+// Spatial index over the asteroids, rebuilt before each field update for client relevance queries
+SpatialHash_t asteroidHash;
+
+// Same over the live asteroids, rebuilt every physics step for collision tests
+#define PHYSICS_MAX_CONTACTS 32				// Asteroids checked against any one asteroid per step
+SpatialHash_t physicsHash;
+
+// Collision response accumulated per asteroid since the last field update, boosts send priority
+float collisionBoost[NUM_ASTEROIDS];
+
+// Asteroid state as of the end of a physics step, published for anything that reads the field off the sim's thread.
+// Field updates read the latest one while the next physics step runs on the live asteroids.
+typedef struct
+{
+	uint64_t tick;
+	uint32_t numBodies;					// Nothing past this is in use
+	RigidBody_t asteroids[NUM_ASTEROIDS];
+	float boost[NUM_ASTEROIDS];			// Collision response since the previous publish
+} FieldState_t;
+
+TripleBuffer_t fieldStates;
+uint64_t fieldTick=0;
+
+// Tick jobs run on these, the main thread helps while it waits so every thread gets a frame sub-arena
+#define TICK_THREADS (FRAME_ARENA_THREADS-1)
+#define TICK_QUEUE_SIZE (MAX_CLIENTS+4)		// Room for every node in a tick
+ThreadPool_t threadPool;
+
+// Connected clients, a client's slot index is its client ID
+Pool_t clientPool;
+
+// Client ID by address and port, so packets find their client without trusting the ID they carry
+HashMap_t clientAddresses;
+
+static inline uint64_t clientAddressKey(uint32_t address, uint16_t port)
+{
+	return ((uint64_t)address<<16)|port;
+}
 
 // Current random seed to keep all random numbers on clients the same.
 uint32_t currentSeed=0;
 
+// World generation's own generator, seeded from currentSeed so a seed always gives the same field
+Random_t worldRandom;
+
 Socket_t serverSocket;
 
 // Get current time with best possible precision
@@ -88,127 +158,381 @@ int _kbhit(void)
 }
 #endif
 
-// Add address/port to client list, return clientID
-uint32_t addClient(uint32_t address, uint16_t port)
+// Add address/port to client list, return client, or NULL if the lobby is full
+Client_t *addClient(uint32_t address, uint16_t port)
 {
-	// Lobby is full, can't add more clients
-	if(connectedClients>=MAX_CLIENTS)
-		return false;
+	Client_t *client=(Client_t *)Pool_Alloc(&clientPool);
 
-	int newClientID=0;
+	if(client==NULL)
+		return NULL;
 
-	// Assign client ID based on first available slot
-	for(uint32_t i=0;i<MAX_CLIENTS;i++)
+	memset(client, 0, sizeof(Client_t));
+
+	client->clientID=Pool_GetIndex(&clientPool, client);
+	client->socket=Network_CreateSocket();
+	client->address=address;
+	client->port=port;
+	client->isConnected=true;
+	client->TTL=GetClock()+30.0;
+
+	if(!HashMap_Set(&clientAddresses, clientAddressKey(address, port), &client->clientID))
 	{
-		if(!clients[i].isConnected)
-		{
-			newClientID=i;
-			break;
-		}
+		DBGPRINTF(DEBUG_ERROR, "addClient: Unable to register address for client %d.\n", client->clientID);
+		Network_SocketClose(client->socket);
+		Pool_Free(&clientPool, client);
+		return NULL;
 	}
 
-	clients[newClientID].clientID=newClientID;
-	clients[newClientID].socket=Network_CreateSocket();
-	clients[newClientID].address=address;
-	clients[newClientID].port=port;
-	clients[newClientID].isConnected=true;
-	clients[newClientID].TTL=GetClock()+30.0;
+	// Destroy is safe on a zeroed set or accumulator, so it doesn't matter which one failed
+	if(!Interest_Init(&client->interest, INTEREST_MAX_RELEVANT)||!Priority_Init(&client->priority, INTEREST_MAX_RELEVANT))
+	{
+		DBGPRINTF(DEBUG_ERROR, "addClient: Unable to set up interest state for client %d.\n", client->clientID);
+		HashMap_Remove(&clientAddresses, clientAddressKey(address, port));
+		Network_SocketClose(client->socket);
+		Interest_Destroy(&client->interest);
+		Priority_Destroy(&client->priority);
+		Pool_Free(&clientPool, client);
+		return NULL;
+	}
 
-	// Increment the connected client count
-	connectedClients++;
+	Bandwidth_Init(&client->bandwidth, GetClock());
 
-	return newClientID;
+	return client;
+}
+
+// Connected client by ID, NULL if there isn't one
+Client_t *getClient(uint32_t ID)
+{
+	return (Client_t *)Pool_GetAt(&clientPool, ID);
+}
+
+// Connected client at an address and port, NULL if there isn't one
+Client_t *getClientByAddress(uint32_t address, uint16_t port)
+{
+	uint32_t *ID=(uint32_t *)HashMap_Get(&clientAddresses, clientAddressKey(address, port));
+
+	return ID?getClient(*ID):NULL;
 }
 
 // Remove client ID from client list
 void delClient(uint32_t ID)
 {
-	if(ID>=MAX_CLIENTS)
+	Client_t *client=getClient(ID);
+
+	if(client==NULL)
 		return;
 
-	Network_SocketClose(clients[ID].socket);
+	HashMap_Remove(&clientAddresses, clientAddressKey(client->address, client->port));
+	Network_SocketClose(client->socket);
+	Interest_Destroy(&client->interest);
+	Priority_Destroy(&client->priority);
 
-	memset(&clients[ID], 0, sizeof(Client_t));
-	connectedClients--;
+	memset(client, 0, sizeof(Client_t));
+	Pool_Free(&clientPool, client);
 }
 
-// Build up random data for skybox and asteroid field
-void GenerateWorld(void)
-{
-	// Set up rigid body reps for asteroids
-	const float asteroidFieldMinRadius=50.0f;
-	const float asteroidFieldMaxRadius=1000.0f;
-	const float asteroidMinRadius=0.05f;
-	const float asteroidMaxRadius=40.0f;
+double statusSendTime=0.0;
+double physicsTime=0.0;
+
+uint8_t receiveBuffer[CLIENT_PACKET_MAX_SIZE];
 
-	uint32_t i=0, tries=0;
+// Outgoing packet buffers, each send takes one and gives it back once the packet is out
+#define PACKET_BUFFER_SIZE FIELD_PACKET_MAX_SIZE
+#define PACKET_BUFFERS_PER_SLAB 4
+#define MAX_PACKET_BUFFERS (MAX_CLIENTS*2)
+_Static_assert(PACKET_BUFFER_SIZE>=STATUS_PACKET_MAX_SIZE&&PACKET_BUFFER_SIZE>=ConnectReply_SIZE, "Packet buffers must fit every outgoing packet");
 
-	memset(asteroids, 0, sizeof(RigidBody_t)*NUM_ASTEROIDS);
+Pool_t packetPool;
+
+// Number of field snapshots left to record to disk (for offline compression benchmarking)
+uint32_t recordFieldFrames=0;
+uint32_t recordFieldCount=0;
+
+// Dump a field snapshot to "field_XXXX.snap" in the working directory
+void RecordFieldSnapshot(const uint8_t *buffer, size_t size)
+{
+	char filename[64];
+	snprintf(filename, sizeof(filename), "field_%04u.snap", recordFieldCount++);
 
-	// Randomly place asteroids in a sphere without any otherlapping.
-	while(i<NUM_ASTEROIDS)
+	FILE *stream=fopen(filename, "wb");
+
+	if(stream==NULL)
 	{
-		vec3 randomDirection=Vec3(RandFloat()*2.0f-1.0f, RandFloat()*2.0f-1.0f, RandFloat()*2.0f-1.0f);
-		Vec3_Normalize(&randomDirection);
+		DBGPRINTF(DEBUG_ERROR, "RecordFieldSnapshot: Unable to open %s for writing.\n", filename);
+		return;
+	}
+
+	fwrite(buffer, 1, size, stream);
+	fclose(stream);
+}
+
+// Publish the live asteroids and the boosts they've picked up as the latest field state.
+// Only one thread publishes at a time, the tick's publish job or the main thread between ticks.
+void PublishField(void)
+{
+	FieldState_t *state=(FieldState_t *)TripleBuffer_GetWrite(&fieldStates);
+
+	// Only the resident part of the field, so this costs what the players are near and not the whole slot range
+	state->tick=fieldTick++;
+	state->numBodies=chunkField.numBodies;
+	memcpy(state->asteroids, asteroids, sizeof(RigidBody_t)*state->numBodies);
+	memcpy(state->boost, collisionBoost, sizeof(float)*state->numBodies);
 
-		RigidBody_t asteroid={ 0 };
+	// Boosts are handed out with the state they came from, nothing past the resident part picks any up
+	memset(collisionBoost, 0, sizeof(float)*state->numBodies);
+
+	TripleBuffer_Publish(&fieldStates);
+}
 
-		asteroid.position=Vec3(
-			randomDirection.x*RandFloatRange(asteroidFieldMinRadius, asteroidFieldMaxRadius),
-			randomDirection.y*RandFloatRange(asteroidFieldMinRadius, asteroidFieldMaxRadius),
-			randomDirection.z*RandFloatRange(asteroidFieldMinRadius, asteroidFieldMaxRadius)
-		);
-		asteroid.radius=RandFloatRange(asteroidMinRadius, asteroidMaxRadius);
+// Chunks are generated on their own thread, so the tick never waits on one
+ThreadWorker_t worldWorker;
+
+// Asteroid indices in freed chunk slots will be reused for other asteroids, clients start over on them
+void ForgetFreedChunks(void)
+{
+	for(uint32_t i=0;i<chunkField.numFreed;i++)
+	{
+		const uint32_t first=chunkField.freed[i]*CHUNK_MAX_BODIES;
 
-		bool overlapping=false;
+		memset(&collisionBoost[first], 0, sizeof(float)*CHUNK_MAX_BODIES);
 
-		for(uint32_t j=0;j<i;j++)
+		for(uint32_t j=0;j<MAX_CLIENTS;j++)
 		{
-			if(Vec3_Distance(asteroid.position, asteroids[j].position)<asteroid.radius+asteroids[j].radius)
-				overlapping=true;
+			Client_t *client=getClient(j);
+
+			if(client)
+			{
+				Interest_Remove(&client->interest, first, CHUNK_MAX_BODIES);
+				Priority_Remove(&client->priority, first, CHUNK_MAX_BODIES);
+			}
 		}
+	}
+}
 
-		if(!overlapping)
-			asteroids[i++]=asteroid;
+// Load, wake and hibernate chunks for where the cameras are now, only between ticks
+void UpdateChunks(double time)
+{
+	vec3 cameras[MAX_CLIENTS];
+	uint32_t numCameras=0;
 
-		tries++;
+	for(uint32_t i=0;i<MAX_CLIENTS;i++)
+	{
+		Client_t *client=getClient(i);
 
-		if(tries>NUM_ASTEROIDS*NUM_ASTEROIDS)
-			break;
+		if(client)
+			cameras[numCameras++]=client->camera.body.position;
 	}
-	//////
 
-	for(uint32_t i=0;i<NUM_ASTEROIDS;i++)
+	ChunkField_Update(&chunkField, cameras, numCameras, time);
+	ForgetFreedChunks();
+}
+
+// Start over with a new field, chunks come back around the cameras as they're generated from the new seed
+void RegenerateWorld(void)
+{
+	ChunkField_Reset(&chunkField, Random_Next(&worldRandom));
+	ForgetFreedChunks();
+	PublishField();
+}
+
+// One tick as a job graph:
+//     hash -> field send per client (reads the latest published field state)
+//     physics -> publish (advances the live asteroids, then publishes them for the next tick)
+// The two chains don't touch the same data, so sending tick N's state overlaps tick N+1's physics.
+typedef struct
+{
+	Client_t *client;
+	vec3 position;			// Camera position at the start of the tick, physics moves the live one
+	uint8_t *packet;		// Taken from the packet pool up front, the pool isn't thread safe
+	uint32_t size;			// Bytes sent, zero if nothing went out
+	ThreadNode_t node;
+} FieldSend_t;
+
+FieldSend_t fieldSends[MAX_CLIENTS];
+ThreadGroup_t tickGroup;
+ThreadNode_t hashNode, physicsNode, publishNode;
+const FieldState_t *field=NULL;			// What this tick sends, stays put while the next state is published
+double tickTime=0.0;
+float tickDelta=0.0f;
+
+void BuildFieldHash(void *arg)
+{
+	(void)arg;
+
+	SpatialHash_Build(&asteroidHash, field->asteroids, field->numBodies);
+}
+
+void SendField(void *arg)
+{
+	FieldSend_t *send=(FieldSend_t *)arg;
+	Client_t *client=send->client;
+	const RigidBody_t *bodies=field->asteroids;
+
+	Interest_Update(&client->interest, &asteroidHash, bodies, send->position);
+	Priority_Accumulate(&client->priority, &client->interest, bodies, field->boost, send->position, tickDelta);
+
+	// Congested clients get updates less often
+	if(send->packet==NULL||!Bandwidth_ShouldSend(&client->bandwidth, tickTime))
+		return;
+
+	// Pick what fits in this client's budget
+	uint32_t *selected=NULL;
+	uint32_t numSelected=Priority_Schedule(&client->priority, FieldEntry_SIZE, client->bandwidth.byteBudget-FieldHeader_SIZE, &selected);
+
+	const uint32_t fieldSize=FieldHeader_SIZE+(FieldEntry_SIZE*numSelected);
+
+	FieldHeader_t header={ FIELD_PACKETMAGIC, Bandwidth_OnSend(&client->bandwidth, fieldSize, tickTime), numSelected };
+
+	uint8_t *pBuffer=send->packet;
+	FieldHeader_Encode(&pBuffer, &header);
+
+	for(uint32_t j=0;j<numSelected;j++)
+	{
+		const uint32_t index=selected[j];
+
+		FieldEntry_t entry=
+		{
+			index,
+			bodies[index].position,
+			bodies[index].velocity,
+			bodies[index].orientation,
+			bodies[index].radius
+		};
+
+		FieldEntry_Encode(&pBuffer, &entry);
+	}
+
+	Network_SocketSend(client->socket, send->packet, fieldSize, client->address, client->port);
+	send->size=fieldSize;
+}
+
+void StepPhysics(void *arg)
+{
+	(void)arg;
+
+	// Near bodies step every tick, mid ones take turns, far and idle ones are left to catch up later
+	const uint32_t numStep=ChunkField_Slice(&chunkField, tickDelta);
+
+	// Run physics integration on the asteroids
+	for(uint32_t i=0;i<numStep;i++)
+		PhysicsIntegrate(&asteroids[chunkField.step[i]], chunkField.stepDelta[i]);
+
+	ChunkField_Contain(&chunkField);
+
+	SpatialHash_Build(&physicsHash, asteroids, chunkField.numBodies);
+
+	// Check/resolve collisions
+	for(uint32_t s=0;s<numStep;s++)
 	{
-		vec3 randomDirection=Vec3(
-			RandFloatRange(-1.0f, 1.0f),
-			RandFloatRange(-1.0f, 1.0f),
-			RandFloatRange(-1.0f, 1.0f)
-		);
-		Vec3_Normalize(&randomDirection);
+		const uint32_t i=chunkField.step[s];
+
+		uint32_t touching[PHYSICS_MAX_CONTACTS];
+		const uint32_t numTouching=SpatialHash_QuerySphere(&physicsHash, asteroids, asteroids[i].position, asteroids[i].radius, touching, PHYSICS_MAX_CONTACTS);
+
+		// Check asteroids against other asteroids, each pair once, from the lower index when both stepped
+		for(uint32_t j=0;j<numTouching;j++)
+		{
+			const uint32_t other=touching[j];
+
+			if(other==i||!ChunkField_IsSimulated(&chunkField, other)||(other<i&&ChunkField_IsStepped(&chunkField, other)))
+				continue;
 
-		asteroids[i].velocity=Vec3_Muls(randomDirection, RandFloat());
-		asteroids[i].force=Vec3b(0.0f);
+			const float response=PhysicsSphereToSphereCollisionResponse(&asteroids[i], &asteroids[other]);
 
-		asteroids[i].orientation=Vec4(0.0f, 0.0f, 0.0f, 1.0f);
-		asteroids[i].angularVelocity=Vec3_Muls(randomDirection, RandFloat());
+			collisionBoost[i]+=response;
+			collisionBoost[other]+=response;
+		}
+
+		for(uint32_t j=0;j<MAX_CLIENTS;j++)
+		{
+			Client_t *client=getClient(j);
 
-		asteroids[i].mass=(1.0f/3000.0f)*(1.33333333f*PI*asteroids[i].radius);
-		asteroids[i].invMass=1.0f/asteroids[i].mass;
+			if(client)
+				collisionBoost[i]+=PhysicsSphereToSphereCollisionResponse(&client->camera.body, &asteroids[i]);
+		}
 
-		asteroids[i].inertia=0.4f*asteroids[i].mass*(asteroids[i].radius*asteroids[i].radius);
-		asteroids[i].invInertia=1.0f/asteroids[i].inertia;
+		// Check asteroids against projectile particles
+		// Emitter '0' on the particle system contains particles that drive the projectile physics
+		//ParticleEmitter_t *Emitter=List_GetPointer(&ParticleSystem.Emitters, 0);
+		// Loop through all the possible particles
+		//for(uint32_t j=0;j<Emitter->NumParticles;j++)
+		//{
+		//	// If the particle ID matches with the projectile ID, then check collision and respond
+		//	if(Emitter->Particles[j].ID!=Emitter->ID)
+		//		PhysicsParticleToSphereCollisionResponse(&Emitter->Particles[j], &Asteroids[i]);
+		//}
 	}
 	//////
 }
-//////
 
-double statusSendTime=0.0;
-double fieldSendTime=0.0;
-double physicsTime=0.0;
+void PublishStep(void *arg)
+{
+	(void)arg;
+
+	PublishField();
+}
+
+// Build this tick's graph and run it, returns once everything in it is done
+void RunTick(double time, float dt)
+{
+	tickTime=time;
+	tickDelta=dt;
+
+	// Main thread is the field state's only reader, the jobs share what it got
+	field=(const FieldState_t *)TripleBuffer_Read(&fieldStates, NULL);
+
+	ThreadGroup_Init(&tickGroup);
 
-uint8_t fieldBuffer[65536];
-uint8_t statusBuffer[1024];
+	ThreadNode_Init(&hashNode, BuildFieldHash, NULL, &tickGroup);
+	ThreadNode_Init(&physicsNode, StepPhysics, NULL, &tickGroup);
+	ThreadNode_Init(&publishNode, PublishStep, NULL, &tickGroup);
+	ThreadNode_Precede(&physicsNode, &publishNode);
+
+	uint32_t numSends=0;
+
+	for(uint32_t i=0;i<MAX_CLIENTS;i++)
+	{
+		Client_t *client=getClient(i);
+
+		if(client==NULL)
+			continue;
+
+		FieldSend_t *send=&fieldSends[numSends++];
+
+		send->client=client;
+		send->position=client->camera.body.position;
+		send->packet=(uint8_t *)Pool_Alloc(&packetPool);
+		send->size=0;
+
+		ThreadNode_Init(&send->node, SendField, send, &tickGroup);
+		ThreadNode_Precede(&hashNode, &send->node);
+	}
+
+	// Physics is the long pole, get it going first
+	ThreadNode_Submit(&threadPool, &physicsNode);
+	ThreadNode_Submit(&threadPool, &publishNode);
+
+	for(uint32_t i=0;i<numSends;i++)
+		ThreadNode_Submit(&threadPool, &fieldSends[i].node);
+
+	ThreadNode_Submit(&threadPool, &hashNode);
+
+	ThreadGroup_Wait(&threadPool, &tickGroup);
+
+	for(uint32_t i=0;i<numSends;i++)
+	{
+		if(fieldSends[i].packet==NULL)
+			continue;
+
+		if(recordFieldFrames&&fieldSends[i].size)
+			RecordFieldSnapshot(fieldSends[i].packet, fieldSends[i].size);
+
+		Pool_Free(&packetPool, fieldSends[i].packet);
+	}
+
+	if(recordFieldFrames)
+		recordFieldFrames--;
+}
 
 int main(int argc, char **argv)
 {
@@ -227,15 +551,57 @@ int main(int argc, char **argv)
 	currentSeed=getpid();
 #endif
 	DBGPRINTF(DEBUG_INFO, "\033[25;0fAllocating zone memory...\n");
-	zone=Zone_Init(8*1000*1000);
+	// Start small and grow as clients join, huge pages cut TLB misses over the hot entity data
+	zone=Zone_InitEx(8*1000*1000, 256*1000*1000, ZONE_HUGEPAGES|ZONE_PREFAULT);
+
+	if(zone==NULL)
+		return 1;
+
+	if(!FrameArena_Init(&frameArena, FRAME_ARENA_SIZE, FRAME_ARENA_THREADS))
+		return 1;
 
 	// Set seed
-	srand(currentSeed);
+	Random_Init(&worldRandom, currentSeed, 0);
 
-	GenerateWorld();
+	if(!SpatialHash_Init(&asteroidHash, 100.0f, 4096, NUM_ASTEROIDS))
+		return 1;
 
-	// Clear client list
-	memset(&clients, 0, sizeof(Client_t)*MAX_CLIENTS);
+	if(!SpatialHash_Init(&physicsHash, 100.0f, 4096, NUM_ASTEROIDS))
+		return 1;
+
+	if(!TripleBuffer_Init(&fieldStates, sizeof(FieldState_t)))
+		return 1;
+
+	if(!ThreadPool_Init(&threadPool, TICK_THREADS, TICK_QUEUE_SIZE))
+		return 1;
+
+#ifdef PIN_THREADS
+	// With a CPU each, keep the main thread and the tick workers from migrating and sharing cores.
+	// Opt in, on a shared machine it's better to let the scheduler move them off busy cores.
+	if(Thread_GetCPUCount()>TICK_THREADS)
+	{
+		Thread_SetAffinity(thrd_current(), Thread_GetCPU(0));
+		ThreadPool_SetAffinity(&threadPool, 1);
+	}
+#endif
+
+	if(!Thread_Init(&worldWorker)||!Thread_Start(&worldWorker))
+		return 1;
+
+	if(!ChunkField_Init(&chunkField, asteroids, FIELD_MAX_CHUNKS, &worldWorker, Random_Next(&worldRandom)))
+		return 1;
+
+	PublishField();
+
+	// Set up client list and outgoing packet buffers
+	if(!Pool_Init(&clientPool, sizeof(Client_t), MAX_CLIENTS, MAX_CLIENTS, false))
+		return 1;
+
+	if(!HashMap_Init(&clientAddresses, sizeof(uint32_t), MAX_CLIENTS))
+		return 1;
+
+	if(!Pool_Init(&packetPool, PACKET_BUFFER_SIZE, PACKET_BUFFERS_PER_SLAB, MAX_PACKET_BUFFERS, false))
+		return 1;
 
 	// Start up network
 	Network_Init();
@@ -267,59 +633,100 @@ int main(int argc, char **argv)
 			if(ch==0x1B)
 				done=true;
 			else if(ch=='p')
-				GenerateWorld();
+				RegenerateWorld();
+			else if(ch=='r')
+				recordFieldFrames=60;
+			else if(ch=='m')
+			{
+				FrameArena_Print(&frameArena);
+				Zone_PrintStats(zone);
+				ChunkField_PrintStats(&chunkField);
+				ThreadPool_PrintStats(&threadPool);
+			}
 		}
 
 		uint8_t *pBuffer=NULL;
 		uint32_t address=0;
 		uint16_t port=0;
 
-		memset(statusBuffer, 0, sizeof(statusBuffer));
-		pBuffer=statusBuffer;
+		int32_t bytesRec=Network_SocketReceive(serverSocket, receiveBuffer, sizeof(receiveBuffer), &address, &port);
 
-		int32_t bytesRec=Network_SocketReceive(serverSocket, statusBuffer, sizeof(statusBuffer), &address, &port);
-
-		if(bytesRec>0)
+		if(bytesRec>=(int32_t)sizeof(uint32_t))
 		{
-			// Handle incoming connections
+			// Peek the magic, each packet decodes it again with the rest of its fields
+			pBuffer=receiveBuffer;
 			uint32_t magic=Deserialize_uint32(&pBuffer);
+			pBuffer=receiveBuffer;
 
+			// Handle incoming connections
 			if(magic==CONNECT_PACKETMAGIC)
 			{
 				DBGPRINTF(DEBUG_WARNING, "\033[25;0H\033[KConnect from: %X port %d", address, port);
 
-				uint32_t clientID=addClient(address, port);
+				// A repeated connect (lost reply) gets the client it already has, not a second slot
+				Client_t *client=getClientByAddress(address, port);
 
-				memset(statusBuffer, 0, sizeof(statusBuffer));
-				pBuffer=statusBuffer;
+				if(client)
+					client->TTL=GetClock()+30.0;
+				else
+					client=addClient(address, port);
+
+				uint8_t *packet=client?(uint8_t *)Pool_Alloc(&packetPool):NULL;
 
-				Serialize_uint32(&pBuffer, CONNECT_PACKETMAGIC);
-				Serialize_uint32(&pBuffer, clientID);
-				Serialize_uint32(&pBuffer, currentSeed);
-				Serialize_uint32(&pBuffer, port);
+				// Lobby full, no reply and the client will time out
+				if(packet)
+				{
+					ConnectReply_t reply={ CONNECT_PACKETMAGIC, client->clientID, currentSeed, port };
 
-				Network_SocketSend(clients[clientID].socket, statusBuffer, sizeof(uint32_t)*4, address, port);
+					pBuffer=packet;
+					ConnectReply_Encode(&pBuffer, &reply);
+
+					Network_SocketSend(client->socket, packet, ConnectReply_SIZE, address, port);
+					Pool_Free(&packetPool, packet);
+				}
 			}
 			// Handle disconnections
-			else if(magic==DISCONNECT_PACKETMAGIC)
+			else if(magic==DISCONNECT_PACKETMAGIC&&bytesRec>=Disconnect_SIZE)
 			{
-				uint32_t clientID=Deserialize_uint32(&pBuffer);
+				Disconnect_t disconnect;
+				Disconnect_Decode(&pBuffer, &disconnect);
+
+				// The sender's own client if it has one, older clients may send from another port
+				Client_t *client=getClientByAddress(address, port);
+
+				if(client)
+					disconnect.clientID=client->clientID;
 
-				delClient(clientID);
-				DBGPRINTF(DEBUG_WARNING, "\033[%d;0H\033[KDisconnect from: #%d %X:%d", clientID+1, clientID, address, port);
+				delClient(disconnect.clientID);
+				DBGPRINTF(DEBUG_WARNING, "\033[%d;0H\033[KDisconnect from: #%d %X:%d", disconnect.clientID+1, disconnect.clientID, address, port);
 			}
 			// Handle status reports
-			else if(magic==STATUS_PACKETMAGIC)
+			else if(magic==STATUS_PACKETMAGIC&&bytesRec>=ClientStatus_SIZE)
 			{
-				uint32_t clientID=Deserialize_uint32(&pBuffer);
-				Client_t *client=&clients[clientID];
+				ClientStatus_t status;
+				ClientStatus_Decode(&pBuffer, &status);
 
-				if(client->isConnected)
+				Client_t *client=getClientByAddress(address, port);
+
+				if(client==NULL)
+					client=getClient(status.clientID);
+
+				if(client&&client->isConnected)
 				{
 					// Copy camera from packet to client's camera.
-					client->camera.body.position=Deserialize_vec3(&pBuffer);
-					client->camera.body.velocity=Deserialize_vec3(&pBuffer);
-					client->camera.body.orientation=Deserialize_vec4(&pBuffer);
+					client->camera.body.position=status.position;
+					client->camera.body.velocity=status.velocity;
+					client->camera.body.orientation=status.orientation;
+
+					// Newer clients append their sequence and ack of ours
+					if(bytesRec>=ClientStatus_SIZE+ClientAck_SIZE)
+					{
+						ClientAck_t ack;
+						ClientAck_Decode(&pBuffer, &ack);
+
+						Bandwidth_OnReceive(&client->bandwidth, ack.sequence);
+						Bandwidth_OnAck(&client->bandwidth, ack.ack, ack.ackBits, GetClock());
+					}
 
 					// Update time to live for client "last time heard" (current time +30 seconds).
 					client->TTL=GetClock()+30.0;
@@ -336,32 +743,22 @@ int main(int argc, char **argv)
 		{
 			statusSendTime=currentTime+sixty;
 
-			// Clear buffer
-			memset(statusBuffer, 0, sizeof(statusBuffer));
-			pBuffer=statusBuffer;
-
-			// Serialize data
-			Serialize_uint32(&pBuffer, STATUS_PACKETMAGIC); // Magic being sent back to clients is also "status"
-			Serialize_uint32(&pBuffer, connectedClients); // Send current connected client count
-
 			for(uint32_t i=0;i<MAX_CLIENTS;i++)
 			{
-				Client_t *client=&clients[i];
+				Client_t *client=getClient(i);
 
-				if(client->isConnected)
+				if(client)
 				{
-					Serialize_uint32(&pBuffer, client->clientID); // Client's ID
-					Serialize_vec3(&pBuffer, client->camera.body.position); // Client camera position
-					Serialize_vec3(&pBuffer, client->camera.body.velocity); // Client camera velocity
-					Serialize_vec4(&pBuffer, client->camera.body.orientation); // Client camera orientation
+					Bandwidth_Update(&client->bandwidth, currentTime);
 
 					// Report status to console
-					DBGPRINTF(DEBUG_WARNING, "\033[%d;0H\033[KStatus from %X:%d (ID %d) pos: %0.1f, %0.1f, %0.1f vel: %0.1f, %0.1f, %0.1f orientation: %0.1f %0.1f %0.1f %0.1f",
+					DBGPRINTF(DEBUG_WARNING, "\033[%d;0H\033[KStatus from %X:%d (ID %d) pos: %0.1f, %0.1f, %0.1f vel: %0.1f, %0.1f, %0.1f orientation: %0.1f %0.1f %0.1f %0.1f rtt: %0.1fms loss: %0.1f%% rate: %0.1fKB/s",
 							  client->clientID+1,
 							  client->address, client->port, client->clientID,
 							  client->camera.body.position.x, client->camera.body.position.y, client->camera.body.position.z,
 							  client->camera.body.velocity.x, client->camera.body.velocity.y, client->camera.body.velocity.z,
-							  client->camera.body.orientation.x, client->camera.body.orientation.y, client->camera.body.orientation.z, client->camera.body.orientation.w
+							  client->camera.body.orientation.x, client->camera.body.orientation.y, client->camera.body.orientation.z, client->camera.body.orientation.w,
+							  client->bandwidth.rtt*1000.0f, client->bandwidth.loss*100.0f, client->bandwidth.targetRate/1000.0f
 					);
 
 					// If current time has past last hard time, then client has timed out... So remove it.
@@ -373,103 +770,116 @@ int main(int argc, char **argv)
 				}
 			}
 
-			// Blast collected connected client data back to all connected clients
+			// Send each connected client the cameras of the clients that are relevant to it
 			for(uint32_t i=0;i<MAX_CLIENTS;i++)
 			{
-				if(clients[i].isConnected)
-					Network_SocketSend(clients[i].socket, statusBuffer, (sizeof(uint32_t)*2)+((sizeof(uint32_t)+sizeof(vec3)+sizeof(vec3)+sizeof(vec4))*connectedClients), clients[i].address, clients[i].port);
-			}
-		}
+				Client_t *receiver=getClient(i);
 
-		// Update the whole asteroid field at 60FPS? Probably a bad idea, works on loopback network at least.
-		if(currentTime>fieldSendTime)
-		{
-			fieldSendTime=currentTime+sixty;
+				if(receiver==NULL)
+					continue;
 
-			memset(fieldBuffer, 0, sizeof(fieldBuffer));
-			pBuffer=fieldBuffer;
+				// Gather the relevant clients first, so the header can be written with the final count and size
+				Client_t *relevant[MAX_CLIENTS];
+				uint32_t count=0;
 
-			Serialize_uint32(&pBuffer, FIELD_PACKETMAGIC);
-			Serialize_uint32(&pBuffer, NUM_ASTEROIDS);
+				for(uint32_t j=0;j<MAX_CLIENTS;j++)
+				{
+					Client_t *client=getClient(j);
+					const uint32_t bit=1u<<j;
 
-			for(uint32_t i=0;i<NUM_ASTEROIDS;i++)
-			{
-				Serialize_vec3(&pBuffer, asteroids[i].position);
-				Serialize_vec3(&pBuffer, asteroids[i].velocity);
-				Serialize_vec4(&pBuffer, asteroids[i].orientation);
-				Serialize_float(&pBuffer, asteroids[i].radius);
-			}
+					if(client==NULL)
+					{
+						receiver->interest.clientMask&=~bit;
+						continue;
+					}
 
-			for(uint32_t i=0;i<MAX_CLIENTS;i++)
-			{
-				if(clients[i].isConnected)
-					Network_SocketSend(clients[i].socket, fieldBuffer, (sizeof(uint32_t)*2)+(((sizeof(vec3)*2)+sizeof(vec4)+sizeof(float))*NUM_ASTEROIDS), clients[i].address, clients[i].port);
-			}
-		}
+					const float distance=Vec3_Distance(receiver->camera.body.position, client->camera.body.position)-client->camera.body.radius;
 
-		// Run physics stuff
-		{
-			const float dt=(float)sixty;//fTimeStep;
+					if(j!=i&&!Interest_Hysteresis((receiver->interest.clientMask&bit)!=0, distance))
+					{
+						receiver->interest.clientMask&=~bit;
+						continue;
+					}
 
-			// If current time has elapsed last set time, then run code
-			if(currentTime>physicsTime)
-			{
-				// reset time to current time + time until next run
-				physicsTime=currentTime+sixty;
-
-				// Get a pointer to the emitter that's providing the positions
-				//ParticleEmitter_t *Emitter=List_GetPointer(&ParticleSystem.Emitters, 0);
-
-				//for(uint32_t i=0;i<Emitter->NumParticles;i++)
-				//{
-				//	if(Emitter->Particles[i].ID!=Emitter->ID)
-				//	{
-				//		// Get those positions and set the other emitter's positions to those
-				//		ParticleSystem_SetEmitterPosition(&ParticleSystem, Emitter->Particles[i].ID, Emitter->Particles[i].pos);
-
-				//		// If this particle is dead, delete that emitter and reset it's ID 
-				//		if(Emitter->Particles[i].life<0.0f)
-				//		{
-				//			ParticleSystem_DeleteEmitter(&ParticleSystem, Emitter->Particles[i].ID);
-				//			Emitter->Particles[i].ID=0;
-				//		}
-				//	}
-				//}
-
-				//ParticleSystem_Step(&ParticleSystem, dt);
-
-				// Loop through objects, integrate and check/resolve collisions
-				for(int i=0;i<NUM_ASTEROIDS;i++)
+					receiver->interest.clientMask|=bit;
+					relevant[count++]=client;
+				}
+
+				const uint32_t statusSize=StatusHeader_SIZE+(StatusEntry_SIZE*count);
+
+				uint8_t *packet=(uint8_t *)Pool_Alloc(&packetPool);
+
+				if(packet==NULL)
+					continue;
+
+				// Magic being sent back to clients is also "status"
+				StatusHeader_t header={ STATUS_PACKETMAGIC, Bandwidth_OnSend(&receiver->bandwidth, statusSize, currentTime), count };
+
+				pBuffer=packet;
+				StatusHeader_Encode(&pBuffer, &header);
+
+				for(uint32_t j=0;j<count;j++)
 				{
-					// Run physics integration on the asteroids
-					PhysicsIntegrate(&asteroids[i], dt);
-
-					// Check asteroids against other asteroids
-					for(int j=i+1;j<NUM_ASTEROIDS;j++)
-						PhysicsSphereToSphereCollisionResponse(&asteroids[i], &asteroids[j]);
-
-					for(uint32_t j=0;j<connectedClients;j++)
-						PhysicsSphereToSphereCollisionResponse(&clients[j].camera.body, &asteroids[i]);
-
-					// Check asteroids against projectile particles
-					// Emitter '0' on the particle system contains particles that drive the projectile physics
-					//ParticleEmitter_t *Emitter=List_GetPointer(&ParticleSystem.Emitters, 0);
-					// Loop through all the possible particles
-					//for(uint32_t j=0;j<Emitter->NumParticles;j++)
-					//{
-					//	// If the particle ID matches with the projectile ID, then check collision and respond
-					//	if(Emitter->Particles[j].ID!=Emitter->ID)
-					//		PhysicsParticleToSphereCollisionResponse(&Emitter->Particles[j], &Asteroids[i]);
-					//}
+					StatusEntry_t entry=
+					{
+						relevant[j]->clientID,
+						relevant[j]->camera.body.position,
+						relevant[j]->camera.body.velocity,
+						relevant[j]->camera.body.orientation
+					};
+
+					StatusEntry_Encode(&pBuffer, &entry);
 				}
-				//////
+
+				Network_SocketSend(receiver->socket, packet, statusSize, receiver->address, receiver->port);
+				Pool_Free(&packetPool, packet);
 			}
 		}
-	}
 
-	//for(uint32_t i=0;i<connectedClients;i++)
+		// Step physics and send the asteroid field at 60FPS? Probably a bad idea, works on loopback network at least.
+		// If current time has elapsed last set time, then run code
+		if(currentTime>physicsTime)
+		{
+			// Chunks loaded since the last tick join in from here, ones left behind drop out
+			UpdateChunks(currentTime);
+
+			// reset time to current time + time until next run
+			physicsTime=currentTime+sixty;
+
+			RunTick(currentTime, (float)sixty);
+		}
+
+		// Tick is done, drop all the scratch memory
+		FrameArena_Reset(&frameArena);
+
+		// Sample the zone, warn once each time it goes from healthy to under pressure
+		const size_t lastFailures=zoneStats.failures;
+		Zone_GetStats(zone, &zoneStats);
+
+		const bool lowHeadroom=(float)(zoneStats.maxSize-zoneStats.bytesInUse)<(float)zoneStats.maxSize*ZONE_LOW_HEADROOM;
+		// Fragmentation only matters once the zone can't grow its way out of it
+		const bool fragmented=zoneStats.fragmentation>ZONE_HIGH_FRAGMENTATION&&zoneStats.size>=zoneStats.maxSize;
+		const bool zonePressure=lowHeadroom||fragmented||zoneStats.failures!=lastFailures;
+
+		if(zonePressure&&!zoneWarned)
+			DBGPRINTF(DEBUG_WARNING, "\033[26;0H\033[KZone under pressure: %0.2fMB of %0.2fMB in use, largest free %0.2fMB, fragmentation %0.1f%%, %d failed allocations",
+					  (float)zoneStats.bytesInUse/1000.0f/1000.0f, (float)zoneStats.maxSize/1000.0f/1000.0f, (float)zoneStats.largestFree/1000.0f/1000.0f, zoneStats.fragmentation*100.0f, (uint32_t)zoneStats.failures);
+
+		zoneWarned=zonePressure;
+
+		// Use half of any idle time before the next tick is due to close up free space
+		const double idleTime=(statusSendTime<physicsTime?statusSendTime:physicsTime)-GetClock();
+
+		if(idleTime>0.0)
+			Zone_Compact(zone, fmin(idleTime*0.5, ZONE_COMPACT_BUDGET));
+	}
 
 	// Done, close sockets and shutdown
+	Thread_Destroy(&worldWorker);
+	ChunkField_Destroy(&chunkField);
+	ThreadPool_Destroy(&threadPool);
+	TripleBuffer_Destroy(&fieldStates);
+
 	Network_SocketClose(serverSocket);
 	Network_Destroy();
 
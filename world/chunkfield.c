@@ -0,0 +1,751 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include "../system/system.h"
+#include "../math/math.h"
+#include "scatter.h"
+#include "chunkfield.h"
+
+// Chunk coordinates are packed 21 bits each into the key, enough for +/-1M chunks along every axis
+#define CHUNK_COORD_BITS 21
+#define CHUNK_COORD_MASK ((1u<<CHUNK_COORD_BITS)-1)
+
+static inline uint64_t chunkKey(int32_t x, int32_t y, int32_t z)
+{
+	return ((uint64_t)((uint32_t)x&CHUNK_COORD_MASK))|
+		((uint64_t)((uint32_t)y&CHUNK_COORD_MASK)<<CHUNK_COORD_BITS)|
+		((uint64_t)((uint32_t)z&CHUNK_COORD_MASK)<<(CHUNK_COORD_BITS*2));
+}
+
+static inline RigidBody_t *chunkBodies(ChunkField_t *field, uint32_t chunk)
+{
+	return &field->bodies[chunk*CHUNK_MAX_BODIES];
+}
+
+// Distance from point to the closest point of the chunk's box, zero inside it
+static float chunkDistance(int32_t x, int32_t y, int32_t z, vec3 point)
+{
+	const vec3 min=Vec3(x*CHUNK_SIZE, y*CHUNK_SIZE, z*CHUNK_SIZE);
+
+	return Vec3_Distance(point, Vec3_Clampv(point, min, Vec3_Adds(min, CHUNK_SIZE)));
+}
+
+// Everything about a body that follows from its radius
+static void bodyDerive(RigidBody_t *body)
+{
+	body->mass=(1.0f/3000.0f)*(1.33333333f*PI*body->radius);
+	body->invMass=1.0f/body->mass;
+
+	body->inertia=0.4f*body->mass*(body->radius*body->radius);
+	body->invInertia=1.0f/body->inertia;
+}
+
+// Keep a body inside one axis of its chunk's box, [low, high] being where its center can go.
+// Anything past a face is mirrored back in and sent away from that face.
+static void bounceAxis(float *position, float *velocity, float low, float high)
+{
+	if(*position<low)
+	{
+		*position=fminf(2.0f*low-*position, high);
+		*velocity=fabsf(*velocity);
+	}
+	else if(*position>high)
+	{
+		*position=fmaxf(2.0f*high-*position, low);
+		*velocity=-fabsf(*velocity);
+	}
+}
+
+// Same for a body that's gone straight from inside for a while, however many times it would have bounced:
+//     the straight path folded back and forth over the box, the velocity flipped for an odd number of bounces.
+static void foldAxis(float *position, float *velocity, float low, float high)
+{
+	if(*position>=low&&*position<=high)
+		return;
+
+	const float length=high-low;
+	float offset=fmodf(*position-low, 2.0f*length);
+
+	if(offset<0.0f)
+		offset+=2.0f*length;
+
+	if(offset<=length)
+		*position=low+offset;
+	else
+	{
+		*position=high-(offset-length);
+		*velocity=-*velocity;
+	}
+}
+
+static void chunkBox(const Chunk_t *chunk, float radius, vec3 *low, vec3 *high)
+{
+	*low=Vec3_Adds(Vec3(chunk->x*CHUNK_SIZE, chunk->y*CHUNK_SIZE, chunk->z*CHUNK_SIZE), radius);
+	*high=Vec3_Adds(*low, CHUNK_SIZE-2.0f*radius);
+}
+
+// Catch a body up by dt in closed form, staying inside its chunk
+static void coastBody(ChunkField_t *field, uint32_t index, float dt)
+{
+	RigidBody_t *body=&field->bodies[index];
+	vec3 low, high;
+
+	PhysicsCoast(body, dt);
+
+	chunkBox(&field->chunks[index/CHUNK_MAX_BODIES], body->radius, &low, &high);
+	foldAxis(&body->position.x, &body->velocity.x, low.x, high.x);
+	foldAxis(&body->position.y, &body->velocity.y, low.y, high.y);
+	foldAxis(&body->position.z, &body->velocity.z, low.z, high.z);
+}
+
+// Build up random data for the chunk's asteroids, the same seed and coordinates always give the same chunk
+static uint32_t generateChunk(int32_t x, int32_t y, int32_t z, uint64_t seed, RigidBody_t *bodies)
+{
+	Random_t random;
+	Random_Init(&random, seed, chunkKey(x, y, z));
+
+	const uint64_t seedHigh=Random_Next(&random);
+	const uint64_t seedLow=Random_Next(&random);
+	const uint32_t numBodies=(uint32_t)Random_Range(&random, CHUNK_MIN_BODIES, CHUNK_MAX_BODIES);
+
+	// Kept a radius in from the faces, so bodies from neighbouring chunks can't start out overlapping
+	const vec3 base=Vec3(x*CHUNK_SIZE, y*CHUNK_SIZE, z*CHUNK_SIZE);
+	const ScatterParams_t params=
+	{
+		.boxMin=Vec3_Adds(base, CHUNK_BODY_MAX_RADIUS),
+		.boxMax=Vec3_Adds(base, CHUNK_SIZE-CHUNK_BODY_MAX_RADIUS),
+		.center=Vec3b(0.0f),
+		.innerRadius=CHUNK_SPAWN_CLEARANCE,
+		.outerRadius=INFINITY,
+		.minRadius=CHUNK_BODY_MIN_RADIUS,
+		.maxRadius=CHUNK_BODY_MAX_RADIUS,
+		.seed=(seedHigh<<32)|seedLow,
+		.maxAttempts=64
+	};
+
+	// Serial, a chunk is too few bodies to be worth splitting and this is already off the tick on the world worker
+	const uint32_t numPlaced=Scatter_Generate(NULL, &params, bodies, numBodies);
+
+	for(uint32_t i=0;i<numPlaced;i++)
+	{
+		vec3 randomDirection=Vec3(
+			Random_FloatRange(&random, -1.0f, 1.0f),
+			Random_FloatRange(&random, -1.0f, 1.0f),
+			Random_FloatRange(&random, -1.0f, 1.0f)
+		);
+		Vec3_Normalize(&randomDirection);
+
+		bodies[i].velocity=Vec3_Muls(randomDirection, Random_Float(&random));
+		bodies[i].force=Vec3b(0.0f);
+
+		bodies[i].orientation=Vec4(0.0f, 0.0f, 0.0f, 1.0f);
+		bodies[i].angularVelocity=Vec3_Muls(randomDirection, Random_Float(&random));
+
+		bodyDerive(&bodies[i]);
+	}
+
+	return numPlaced;
+}
+
+static void generateJob(void *arg)
+{
+	ChunkJob_t *job=(ChunkJob_t *)arg;
+
+	job->numBodies=generateChunk(job->x, job->y, job->z, job->seed, job->bodies);
+	atomic_store(&job->done, true);
+}
+
+static uint32_t findSleeper(ChunkField_t *field, uint64_t key)
+{
+	const uint32_t *sleeper=(const uint32_t *)HashMap_Get(&field->sleeping, key);
+
+	return sleeper?*sleeper:UINT32_MAX;
+}
+
+// Last sleeper moves into the gap
+static void dropSleeper(ChunkField_t *field, uint32_t index)
+{
+	if(field->sleepers[index].bodies)
+		Zone_Free(zone, field->sleepers[index].bodies);
+
+	HashMap_Remove(&field->sleeping, field->sleepers[index].key);
+
+	if(index!=--field->numSleepers)
+	{
+		field->sleepers[index]=field->sleepers[field->numSleepers];
+		HashMap_Set(&field->sleeping, field->sleepers[index].key, &index);
+	}
+}
+
+static void freeChunk(ChunkField_t *field, uint32_t chunk)
+{
+	HashMap_Remove(&field->resident, field->chunks[chunk].key);
+
+	if(field->numFreed<field->maxChunks)
+		field->freed[field->numFreed++]=chunk;
+
+	memset(chunkBodies(field, chunk), 0, sizeof(RigidBody_t)*CHUNK_MAX_BODIES);
+	memset(&field->lod[chunk*CHUNK_MAX_BODIES], CHUNK_LOD_FAR, CHUNK_MAX_BODIES);
+	memset(&field->lag[chunk*CHUNK_MAX_BODIES], 0, sizeof(float)*CHUNK_MAX_BODIES);
+	memset(&field->chunks[chunk], 0, sizeof(Chunk_t));
+
+	field->fullWarned=false;
+}
+
+// Pack the chunk's bodies away and give up its slot
+static void hibernateChunk(ChunkField_t *field, uint32_t chunk, double time)
+{
+	const Chunk_t *resident=&field->chunks[chunk];
+	const RigidBody_t *bodies=chunkBodies(field, chunk);
+	ChunkBody_t *packed=NULL;
+
+	if(resident->numBodies)
+	{
+		packed=(ChunkBody_t *)Zone_Malloc(zone, sizeof(ChunkBody_t)*resident->numBodies);
+
+		// It'll just come back as generated
+		if(packed==NULL)
+		{
+			DBGPRINTF(DEBUG_WARNING, "ChunkField_Update: Unable to allocate memory to hibernate chunk %d,%d,%d, dropping it.\n", resident->x, resident->y, resident->z);
+			freeChunk(field, chunk);
+			return;
+		}
+	}
+
+	// Caught up first, so the packed state is as of when it went to sleep
+	for(uint32_t i=0;i<resident->numBodies;i++)
+	{
+		coastBody(field, chunk*CHUNK_MAX_BODIES+i, field->lag[chunk*CHUNK_MAX_BODIES+i]);
+		packed[i]=(ChunkBody_t){ bodies[i].position, bodies[i].velocity, bodies[i].orientation, bodies[i].angularVelocity, bodies[i].radius };
+	}
+
+	// Out of room, drop whoever has been asleep longest
+	if(field->numSleepers>=CHUNK_MAX_HIBERNATED)
+	{
+		uint32_t oldest=0;
+
+		for(uint32_t i=1;i<field->numSleepers;i++)
+		{
+			if(field->sleepers[i].time<field->sleepers[oldest].time)
+				oldest=i;
+		}
+
+		dropSleeper(field, oldest);
+	}
+
+	const uint32_t sleeper=field->numSleepers;
+
+	if(!HashMap_Set(&field->sleeping, resident->key, &sleeper))
+	{
+		DBGPRINTF(DEBUG_WARNING, "ChunkField_Update: Unable to track hibernated chunk %d,%d,%d, dropping it.\n", resident->x, resident->y, resident->z);
+
+		if(packed)
+			Zone_Free(zone, packed);
+
+		freeChunk(field, chunk);
+		return;
+	}
+
+	field->sleepers[field->numSleepers++]=(ChunkSleeper_t){ resident->key, resident->numBodies, time, packed };
+
+	freeChunk(field, chunk);
+}
+
+// Unpack a hibernated chunk into a resident slot, it's behind by however long it slept
+static uint32_t wakeChunk(ChunkField_t *field, uint32_t sleeper, uint32_t chunk, double time)
+{
+	const ChunkSleeper_t *packed=&field->sleepers[sleeper];
+	RigidBody_t *bodies=chunkBodies(field, chunk);
+	float *lag=&field->lag[chunk*CHUNK_MAX_BODIES];
+	const uint32_t numBodies=packed->numBodies;
+	const float slept=(float)(time-packed->time);
+
+	for(uint32_t i=0;i<numBodies;i++)
+	{
+		memset(&bodies[i], 0, sizeof(RigidBody_t));
+
+		bodies[i].position=packed->bodies[i].position;
+		bodies[i].velocity=packed->bodies[i].velocity;
+		bodies[i].orientation=packed->bodies[i].orientation;
+		bodies[i].angularVelocity=packed->bodies[i].angularVelocity;
+		bodies[i].radius=packed->bodies[i].radius;
+
+		bodyDerive(&bodies[i]);
+
+		lag[i]=slept;
+	}
+
+	dropSleeper(field, sleeper);
+
+	return numBodies;
+}
+
+static ChunkJob_t *freeJob(ChunkField_t *field)
+{
+	for(uint32_t i=0;i<CHUNK_MAX_PENDING;i++)
+	{
+		if(!field->jobs[i].busy)
+			return &field->jobs[i];
+	}
+
+	return NULL;
+}
+
+// Lowest free slot, keeps the bodies in use packed towards the front.
+// If they're all taken, the chunk that's been idle longest is hibernated early to make room.
+static uint32_t claimSlot(ChunkField_t *field, double time)
+{
+	uint32_t idle=UINT32_MAX;
+
+	for(uint32_t i=0;i<field->maxChunks;i++)
+	{
+		const Chunk_t *chunk=&field->chunks[i];
+
+		if(chunk->state==CHUNK_FREE)
+			return i;
+
+		if(chunk->state==CHUNK_IDLE&&(idle==UINT32_MAX||chunk->nearTime<field->chunks[idle].nearTime))
+			idle=i;
+	}
+
+	if(idle!=UINT32_MAX)
+		hibernateChunk(field, idle, time);
+
+	return idle;
+}
+
+// Give the chunk a resident slot and either wake it or start generating it, false if it has to wait for a later update
+static bool loadChunk(ChunkField_t *field, int32_t x, int32_t y, int32_t z, double time)
+{
+	const uint64_t key=chunkKey(x, y, z);
+	const uint32_t chunk=claimSlot(field, time);
+
+	if(chunk==UINT32_MAX)
+	{
+		if(!field->fullWarned)
+			DBGPRINTF(DEBUG_WARNING, "ChunkField_Update: All %d chunk slots in use, not loading any more.\n", field->maxChunks);
+
+		field->fullWarned=true;
+		return false;
+	}
+
+	// Tracked before anything is committed to the slot, so a chunk can't end up resident without being findable
+	if(!HashMap_Set(&field->resident, key, &chunk))
+	{
+		DBGPRINTF(DEBUG_WARNING, "ChunkField_Update: Unable to track chunk %d,%d,%d, not loading it.\n", x, y, z);
+		return false;
+	}
+
+	Chunk_t resident={ CHUNK_ACTIVE, x, y, z, key, 0, time };
+	const uint32_t sleeper=findSleeper(field, key);
+
+	if(sleeper!=UINT32_MAX)
+		resident.numBodies=wakeChunk(field, sleeper, chunk, time);
+	else if(field->worker==NULL)
+		resident.numBodies=generateChunk(x, y, z, field->seed, chunkBodies(field, chunk));
+	else
+	{
+		ChunkJob_t *job=freeJob(field);
+
+		if(job==NULL)
+		{
+			HashMap_Remove(&field->resident, key);
+			return false;
+		}
+
+		job->chunk=chunk;
+		job->x=x;
+		job->y=y;
+		job->z=z;
+		job->key=key;
+		job->seed=field->seed;
+		job->numBodies=0;
+		atomic_store(&job->done, false);
+
+		if(!Thread_AddJob(field->worker, generateJob, job))
+		{
+			HashMap_Remove(&field->resident, key);
+			return false;
+		}
+
+		job->busy=true;
+		resident.state=CHUNK_LOADING;
+	}
+
+	field->chunks[chunk]=resident;
+
+	return true;
+}
+
+// Closest chunk to camera that should be loaded and isn't, false if there's none.
+// Without a generate job free only hibernated chunks can come in, they just need waking.
+static bool nearestMissing(ChunkField_t *field, vec3 camera, int32_t *nearX, int32_t *nearY, int32_t *nearZ)
+{
+	const bool canGenerate=field->worker==NULL||freeJob(field)!=NULL;
+	const int32_t cx=(int32_t)floorf(camera.x/CHUNK_SIZE);
+	const int32_t cy=(int32_t)floorf(camera.y/CHUNK_SIZE);
+	const int32_t cz=(int32_t)floorf(camera.z/CHUNK_SIZE);
+	float nearest=INFINITY;
+
+	// Outputs are always written, the camera's own chunk when nothing turns up
+	*nearX=cx;
+	*nearY=cy;
+	*nearZ=cz;
+
+	for(int32_t z=cz-CHUNK_LOAD_REACH;z<=cz+CHUNK_LOAD_REACH;z++)
+	{
+		for(int32_t y=cy-CHUNK_LOAD_REACH;y<=cy+CHUNK_LOAD_REACH;y++)
+		{
+			for(int32_t x=cx-CHUNK_LOAD_REACH;x<=cx+CHUNK_LOAD_REACH;x++)
+			{
+				const float distance=chunkDistance(x, y, z, camera);
+				const uint64_t key=chunkKey(x, y, z);
+
+				if(distance>CHUNK_LOAD_DISTANCE||distance>=nearest||HashMap_Get(&field->resident, key))
+					continue;
+
+				if(!canGenerate&&findSleeper(field, key)==UINT32_MAX)
+					continue;
+
+				nearest=distance;
+				*nearX=x;
+				*nearY=y;
+				*nearZ=z;
+			}
+		}
+	}
+
+	return nearest!=INFINITY;
+}
+
+// Bodies go in the caller's array, which needs room for maxChunks*CHUNK_MAX_BODIES.
+// Chunks are generated as jobs on worker if there is one, otherwise right away in ChunkField_Update.
+bool ChunkField_Init(ChunkField_t *field, RigidBody_t *bodies, uint32_t maxChunks, ThreadWorker_t *worker, uint64_t seed)
+{
+	if(field==NULL||bodies==NULL||maxChunks==0)
+		return false;
+
+	memset(field, 0, sizeof(ChunkField_t));
+
+	field->seed=seed;
+	field->worker=worker;
+	field->maxChunks=maxChunks;
+	field->bodies=bodies;
+
+	for(uint32_t i=0;i<CHUNK_MAX_PENDING;i++)
+		atomic_init(&field->jobs[i].done, false);
+
+	const uint32_t maxBodies=maxChunks*CHUNK_MAX_BODIES;
+
+	field->chunks=(Chunk_t *)Zone_Malloc(zone, sizeof(Chunk_t)*maxChunks);
+	field->lod=(uint8_t *)Zone_Malloc(zone, sizeof(uint8_t)*maxBodies);
+	field->lag=(float *)Zone_Malloc(zone, sizeof(float)*maxBodies);
+	field->step=(uint32_t *)Zone_Malloc(zone, sizeof(uint32_t)*maxBodies);
+	field->stepDelta=(float *)Zone_Malloc(zone, sizeof(float)*maxBodies);
+	field->freed=(uint32_t *)Zone_Malloc(zone, sizeof(uint32_t)*maxChunks);
+
+	if(field->chunks==NULL||field->lod==NULL||field->lag==NULL||field->step==NULL||field->stepDelta==NULL||field->freed==NULL||
+	   !HashMap_Init(&field->resident, sizeof(uint32_t), maxChunks)||!HashMap_Init(&field->sleeping, sizeof(uint32_t), CHUNK_MAX_HIBERNATED))
+	{
+		DBGPRINTF(DEBUG_ERROR, "ChunkField_Init: Unable to allocate memory.\n");
+		ChunkField_Destroy(field);
+		return false;
+	}
+
+	memset(field->chunks, 0, sizeof(Chunk_t)*maxChunks);
+	memset(bodies, 0, sizeof(RigidBody_t)*maxBodies);
+	memset(field->lod, CHUNK_LOD_FAR, sizeof(uint8_t)*maxBodies);
+	memset(field->lag, 0, sizeof(float)*maxBodies);
+
+	return true;
+}
+
+// Bring the resident set up to date with where the cameras are now.
+// Must not run while anything else is using the field's bodies.
+void ChunkField_Update(ChunkField_t *field, const vec3 *cameras, uint32_t numCameras, double time)
+{
+	if(field==NULL||field->chunks==NULL)
+		return;
+
+	field->numFreed=0;
+
+	// Finished generate jobs, anything started before a reset or for a chunk that's gone since is thrown away
+	for(uint32_t i=0;i<CHUNK_MAX_PENDING;i++)
+	{
+		ChunkJob_t *job=&field->jobs[i];
+
+		if(!job->busy||!atomic_load(&job->done))
+			continue;
+
+		Chunk_t *chunk=&field->chunks[job->chunk];
+
+		if(job->seed==field->seed&&chunk->state==CHUNK_LOADING&&chunk->key==job->key)
+		{
+			memcpy(chunkBodies(field, job->chunk), job->bodies, sizeof(RigidBody_t)*job->numBodies);
+
+			chunk->numBodies=job->numBodies;
+			chunk->state=CHUNK_ACTIVE;
+			chunk->nearTime=time;
+		}
+
+		job->busy=false;
+	}
+
+	// Which resident chunks still have someone near
+	for(uint32_t i=0;i<field->maxChunks;i++)
+	{
+		Chunk_t *chunk=&field->chunks[i];
+
+		if(chunk->state!=CHUNK_ACTIVE&&chunk->state!=CHUNK_IDLE)
+			continue;
+
+		bool near=false;
+
+		for(uint32_t j=0;j<numCameras&&!near;j++)
+			near=chunkDistance(chunk->x, chunk->y, chunk->z, cameras[j])<=CHUNK_ACTIVE_DISTANCE;
+
+		if(near)
+		{
+			chunk->state=CHUNK_ACTIVE;
+			chunk->nearTime=time;
+		}
+		else if(time-chunk->nearTime>=CHUNK_HIBERNATE_DELAY)
+			hibernateChunk(field, i, time);
+		else
+			chunk->state=CHUNK_IDLE;
+	}
+
+	// Bring in what's missing around the cameras, nearest first. Each camera gets one chunk per round, so running
+	//     short of slots or jobs is shared out between them, and who goes first in a round rotates every update.
+	for(uint32_t round=0;round<CHUNK_MAX_PER_CAMERA&&numCameras;round++)
+	{
+		bool loading=false;
+
+		for(uint32_t i=0;i<numCameras;i++)
+		{
+			int32_t x, y, z;
+
+			if(!nearestMissing(field, cameras[(field->cameraCursor+i)%numCameras], &x, &y, &z))
+				continue;
+
+			// Out of slots, or something went wrong, nobody else will do any better this update
+			if(!loadChunk(field, x, y, z, time))
+			{
+				loading=false;
+				break;
+			}
+
+			loading=true;
+		}
+
+		if(!loading)
+			break;
+	}
+
+	field->cameraCursor++;
+
+	field->numBodies=0;
+
+	for(uint32_t i=field->maxChunks;i-->0;)
+	{
+		if(field->chunks[i].state!=CHUNK_FREE)
+		{
+			field->numBodies=(i+1)*CHUNK_MAX_BODIES;
+			break;
+		}
+	}
+
+	// Level of detail for everything resident, by the closest any camera gets to the body's surface
+	memset(field->numLod, 0, sizeof(field->numLod));
+
+	for(uint32_t c=0;c<field->numBodies/CHUNK_MAX_BODIES;c++)
+	{
+		const Chunk_t *chunk=&field->chunks[c];
+		const RigidBody_t *bodies=chunkBodies(field, c);
+		uint8_t *lod=&field->lod[c*CHUNK_MAX_BODIES];
+
+		for(uint32_t i=0;i<CHUNK_MAX_BODIES;i++)
+		{
+			if(chunk->state!=CHUNK_ACTIVE||i>=chunk->numBodies)
+			{
+				lod[i]=CHUNK_LOD_FAR;
+				continue;
+			}
+
+			float distance=INFINITY;
+
+			for(uint32_t j=0;j<numCameras;j++)
+				distance=fminf(distance, Vec3_Distance(bodies[i].position, cameras[j])-bodies[i].radius);
+
+			if(distance<=CHUNK_LOD_NEAR_DISTANCE)
+				lod[i]=CHUNK_LOD_NEAR;
+			else if(distance<=CHUNK_LOD_MID_DISTANCE)
+				lod[i]=CHUNK_LOD_MID;
+			else
+				lod[i]=CHUNK_LOD_FAR;
+
+			field->numLod[lod[i]]++;
+		}
+	}
+}
+
+// Mark a body for stepping in this slice, by however far it's behind.
+// Past CHUNK_LOD_MAX_STEP it's coasted up to that first, one big integration step would be too coarse.
+static void sliceBody(ChunkField_t *field, uint32_t index)
+{
+	float lag=field->lag[index];
+
+	if(lag>CHUNK_LOD_MAX_STEP)
+	{
+		coastBody(field, index, lag-CHUNK_LOD_MAX_STEP);
+		lag=CHUNK_LOD_MAX_STEP;
+	}
+
+	field->step[field->numStep]=index;
+	field->stepDelta[field->numStep]=lag;
+	field->numStep++;
+
+	field->lag[index]=0.0f;
+	field->lod[index]|=CHUNK_LOD_STEPPED;
+}
+
+// Advance the field's clock by dt and pick which bodies step this tick: every near body, and the next
+//     1/CHUNK_LOD_MID_INTERVAL of the mid ones, round robin so the cost is the same every tick.
+// The slice is left in step and stepDelta, the caller integrates step[i] by stepDelta[i] and resolves contacts.
+// Everything else just falls further behind. Runs as part of the tick, after ChunkField_Update.
+uint32_t ChunkField_Slice(ChunkField_t *field, float dt)
+{
+	if(field==NULL||field->chunks==NULL)
+		return 0;
+
+	field->numStep=0;
+
+	for(uint32_t c=0;c<field->numBodies/CHUNK_MAX_BODIES;c++)
+	{
+		const Chunk_t *chunk=&field->chunks[c];
+
+		if(chunk->state!=CHUNK_ACTIVE&&chunk->state!=CHUNK_IDLE)
+			continue;
+
+		for(uint32_t i=c*CHUNK_MAX_BODIES;i<c*CHUNK_MAX_BODIES+chunk->numBodies;i++)
+		{
+			field->lod[i]&=~CHUNK_LOD_STEPPED;
+			field->lag[i]+=dt;
+
+			if(field->lod[i]==CHUNK_LOD_NEAR)
+				sliceBody(field, i);
+		}
+	}
+
+	uint32_t numMid=(field->numLod[CHUNK_LOD_MID]+CHUNK_LOD_MID_INTERVAL-1)/CHUNK_LOD_MID_INTERVAL;
+
+	if(field->midCursor>=field->numBodies)
+		field->midCursor=0;
+
+	for(uint32_t i=0;i<field->numBodies&&numMid;i++)
+	{
+		const uint32_t index=field->midCursor;
+
+		field->midCursor=index+1<field->numBodies?index+1:0;
+
+		if(field->lod[index]==CHUNK_LOD_MID)
+		{
+			sliceBody(field, index);
+			numMid--;
+		}
+	}
+
+	return field->numStep;
+}
+
+// Bounce anything the slice moved out of its chunk back in, after it's been integrated
+void ChunkField_Contain(ChunkField_t *field)
+{
+	if(field==NULL||field->chunks==NULL)
+		return;
+
+	for(uint32_t i=0;i<field->numStep;i++)
+	{
+		RigidBody_t *body=&field->bodies[field->step[i]];
+		vec3 low, high;
+
+		chunkBox(&field->chunks[field->step[i]/CHUNK_MAX_BODIES], body->radius, &low, &high);
+		bounceAxis(&body->position.x, &body->velocity.x, low.x, high.x);
+		bounceAxis(&body->position.y, &body->velocity.y, low.y, high.y);
+		bounceAxis(&body->position.z, &body->velocity.z, low.z, high.z);
+	}
+}
+
+void ChunkField_PrintStats(ChunkField_t *field)
+{
+	if(field==NULL||field->chunks==NULL)
+		return;
+
+	uint32_t numState[4]={ 0 };
+
+	for(uint32_t i=0;i<field->maxChunks;i++)
+		numState[field->chunks[i].state]++;
+
+	DBGPRINTF(DEBUG_WARNING, "Chunks: %d active, %d idle, %d loading, %d free, %d hibernated\n",
+			  numState[CHUNK_ACTIVE], numState[CHUNK_IDLE], numState[CHUNK_LOADING], numState[CHUNK_FREE], field->numSleepers);
+	DBGPRINTF(DEBUG_WARNING, "\tBodies: %d near, %d mid, %d far, %d stepped last tick\n",
+			  field->numLod[CHUNK_LOD_NEAR], field->numLod[CHUNK_LOD_MID], field->numLod[CHUNK_LOD_FAR], field->numStep);
+}
+
+// Throw away every chunk, resident or hibernated, and start over from a new seed.
+// Jobs still running finish in the background and get discarded.
+void ChunkField_Reset(ChunkField_t *field, uint64_t seed)
+{
+	if(field==NULL||field->chunks==NULL)
+		return;
+
+	field->numFreed=0;
+
+	for(uint32_t i=0;i<field->maxChunks;i++)
+	{
+		if(field->chunks[i].state!=CHUNK_FREE)
+			freeChunk(field, i);
+	}
+
+	while(field->numSleepers)
+		dropSleeper(field, field->numSleepers-1);
+
+	field->seed=seed;
+	field->numBodies=0;
+	field->numStep=0;
+	field->midCursor=0;
+	memset(field->numLod, 0, sizeof(field->numLod));
+}
+
+// The worker has to be stopped first, its jobs write into the field
+void ChunkField_Destroy(ChunkField_t *field)
+{
+	if(field==NULL)
+		return;
+
+	while(field->numSleepers)
+		dropSleeper(field, field->numSleepers-1);
+
+	if(field->chunks)
+		Zone_Free(zone, field->chunks);
+
+	if(field->lod)
+		Zone_Free(zone, field->lod);
+
+	if(field->lag)
+		Zone_Free(zone, field->lag);
+
+	if(field->step)
+		Zone_Free(zone, field->step);
+
+	if(field->stepDelta)
+		Zone_Free(zone, field->stepDelta);
+
+	if(field->freed)
+		Zone_Free(zone, field->freed);
+
+	HashMap_Destroy(&field->resident);
+	HashMap_Destroy(&field->sleeping);
+
+	memset(field, 0, sizeof(ChunkField_t));
+}
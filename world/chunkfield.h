@@ -0,0 +1,175 @@
+#ifndef __CHUNKFIELD_H__
+#define __CHUNKFIELD_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include "../math/math.h"
+#include "../physics/physics.h"
+#include "../system/threads.h"
+#include "../utils/hashmap.h"
+#include "../network/interest.h"
+
+// Unbounded asteroid field made of cubic chunks, each one generated from the field seed and its coordinates.
+// Only chunks near a camera are kept in memory, so memory and simulation cost follow where the players are,
+//     not how big the world is.
+//
+// Chunk lifecycle:
+//     A camera comes within CHUNK_LOAD_DISTANCE, the chunk gets a resident slot and is generated on the worker
+//         thread (or woken straight back up if it's hibernating).
+//     While any camera is within CHUNK_ACTIVE_DISTANCE it's active, and gets simulated.
+//     Once none are it goes idle, still resident but left alone, in case they come back.
+//     Idle for CHUNK_HIBERNATE_DELAY, it's hibernated: bodies are packed down to what can't be derived and the
+//         slot is freed. Past CHUNK_MAX_HIBERNATED, the longest sleeping chunks are dropped entirely,
+//         they come back as freshly generated from the seed.
+//
+// Active chunks are simulated at a level of detail set per body by its distance to the nearest camera:
+//     Near, anything a client could have in its interest set, steps every tick.
+//     Mid steps in round-robin slices, 1/CHUNK_LOD_MID_INTERVAL of them each tick, by however long it's been waiting.
+//     Far isn't stepped at all, and neither is anything in an idle or hibernated chunk. They fall behind and get
+//         coasted in closed form (PhysicsCoast) to catch up once they're needed again.
+//
+// Resident chunk N owns bodies [N*CHUNK_MAX_BODIES, (N+1)*CHUNK_MAX_BODIES), unused bodies in the range have zero radius.
+// A body keeps its index for as long as its chunk stays resident, that index is what goes out to clients.
+//     Freed slots are listed after each update and reset, so whoever handed those indices out can forget them.
+// Bodies stay inside their own chunk's box, bouncing off its faces, so whatever is decided per chunk holds for
+//     every body in it.
+// Everything but the generate jobs and ChunkField_Slice runs on the thread calling ChunkField_Update, between ticks.
+
+#define CHUNK_SIZE 1000.0f
+#define CHUNK_MIN_BODIES 64
+#define CHUNK_MAX_BODIES 128
+#define CHUNK_BODY_MIN_RADIUS 0.05f
+#define CHUNK_BODY_MAX_RADIUS 40.0f
+#define CHUNK_SPAWN_CLEARANCE 50.0f						// Kept empty around the origin, where cameras start
+
+// Load far enough out that a chunk is usually ready before anything in it could become relevant
+#define CHUNK_LOAD_DISTANCE (INTEREST_EXIT_RADIUS+200.0f)
+#define CHUNK_ACTIVE_DISTANCE (CHUNK_LOAD_DISTANCE+200.0f)
+
+// Chunks out from a camera's own along each axis that can be within CHUNK_ACTIVE_DISTANCE (kept to at most
+//     CHUNK_LOAD_REACH*CHUNK_SIZE), so one camera never holds more than CHUNK_MAX_PER_CAMERA chunks active.
+// Idle chunks are hibernated early when slots run out, so that many per camera is enough slots.
+#define CHUNK_LOAD_REACH 1
+#define CHUNK_MAX_PER_CAMERA ((2*CHUNK_LOAD_REACH+1)*(2*CHUNK_LOAD_REACH+1)*(2*CHUNK_LOAD_REACH+1))
+#define CHUNK_HIBERNATE_DELAY 5.0						// Seconds idle before hibernating
+
+#define CHUNK_LOD_NEAR_DISTANCE (INTEREST_EXIT_RADIUS+100.0f)
+#define CHUNK_LOD_MID_DISTANCE (CHUNK_LOD_NEAR_DISTANCE+600.0f)
+#define CHUNK_LOD_MID_INTERVAL 4
+#define CHUNK_LOD_MAX_STEP (1.0f/15.0f)					// Anything further behind than this coasts the rest of the way first
+
+#define CHUNK_MAX_PENDING 16							// Generate jobs in flight
+#define CHUNK_MAX_HIBERNATED 1024
+
+typedef enum
+{
+	CHUNK_FREE=0,
+	CHUNK_LOADING,		// Waiting on its generate job
+	CHUNK_ACTIVE,		// A camera is near, simulated
+	CHUNK_IDLE			// Nobody near, resident but left alone
+} ChunkState_e;
+
+typedef enum
+{
+	CHUNK_LOD_NEAR=0,
+	CHUNK_LOD_MID,
+	CHUNK_LOD_FAR
+} ChunkLod_e;
+
+#define CHUNK_LOD_STEPPED 0x80		// Flag on a body's LOD, stepped in the current slice
+
+typedef struct
+{
+	ChunkState_e state;
+	int32_t x, y, z;
+	uint64_t key;
+	uint32_t numBodies;
+	double nearTime;		// Last time a camera was within CHUNK_ACTIVE_DISTANCE
+} Chunk_t;
+
+// What a hibernated chunk keeps per body, mass and inertia come back from the radius
+typedef struct
+{
+	vec3 position, velocity;
+	vec4 orientation;
+	vec3 angularVelocity;
+	float radius;
+} ChunkBody_t;
+
+typedef struct
+{
+	uint64_t key;
+	uint32_t numBodies;
+	double time;			// When it went to sleep, longest asleep is dropped first
+	ChunkBody_t *bodies;
+} ChunkSleeper_t;
+
+typedef struct
+{
+	bool busy;
+	atomic_bool done;
+	uint32_t chunk;			// Resident slot it's generating for
+	int32_t x, y, z;
+	uint64_t key, seed;
+	uint32_t numBodies;
+	RigidBody_t bodies[CHUNK_MAX_BODIES];
+} ChunkJob_t;
+
+typedef struct
+{
+	uint64_t seed;
+	ThreadWorker_t *worker;
+
+	uint32_t maxChunks;
+	Chunk_t *chunks;
+	RigidBody_t *bodies;	// CHUNK_MAX_BODIES per resident slot
+	uint32_t numBodies;		// Bodies past this all belong to free slots, nothing needs to look at them
+	HashMap_t resident;		// Chunk key to resident slot
+
+	uint32_t numFreed;
+	uint32_t *freed;		// Slots freed by the last update or reset, maxChunks of them at most
+
+	uint32_t cameraCursor;	// Camera that gets first pick of slots and jobs in the next update
+
+	// Per body, same indexing as bodies
+	uint8_t *lod;			// ChunkLod_e, plus CHUNK_LOD_STEPPED
+	float *lag;				// Seconds its state is behind the simulation
+
+	// The current slice, bodies to step and how far to step each one
+	uint32_t numStep;
+	uint32_t *step;
+	float *stepDelta;
+
+	uint32_t midCursor;		// Where the next mid slice starts
+	uint32_t numLod[3];		// Bodies per LOD as of the last update
+
+	ChunkJob_t jobs[CHUNK_MAX_PENDING];
+
+	uint32_t numSleepers;
+	ChunkSleeper_t sleepers[CHUNK_MAX_HIBERNATED];
+	HashMap_t sleeping;		// Chunk key to index in sleepers
+
+	bool fullWarned;
+} ChunkField_t;
+
+bool ChunkField_Init(ChunkField_t *field, RigidBody_t *bodies, uint32_t maxChunks, ThreadWorker_t *worker, uint64_t seed);
+void ChunkField_Update(ChunkField_t *field, const vec3 *cameras, uint32_t numCameras, double time);
+uint32_t ChunkField_Slice(ChunkField_t *field, float dt);
+void ChunkField_Contain(ChunkField_t *field);
+void ChunkField_Reset(ChunkField_t *field, uint64_t seed);
+void ChunkField_PrintStats(ChunkField_t *field);
+void ChunkField_Destroy(ChunkField_t *field);
+
+// Whether contacts with body index get resolved at all, it's in an active chunk and not far
+static inline bool ChunkField_IsSimulated(const ChunkField_t *field, uint32_t index)
+{
+	return (field->lod[index]&~CHUNK_LOD_STEPPED)!=CHUNK_LOD_FAR;
+}
+
+static inline bool ChunkField_IsStepped(const ChunkField_t *field, uint32_t index)
+{
+	return (field->lod[index]&CHUNK_LOD_STEPPED)!=0;
+}
+
+#endif
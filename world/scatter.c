@@ -0,0 +1,251 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include "../system/system.h"
+#include "../math/math.h"
+#include "scatter.h"
+
+#define SCATTER_WEIGHT_SAMPLES 4		// Per axis, for estimating how much of a cell is inside the region
+#define SCATTER_GRAIN 16				// Cells per job
+
+typedef struct
+{
+	const ScatterParams_t *params;
+	RigidBody_t *bodies;
+
+	uint32_t dims[3];
+	float cellSize;
+
+	uint32_t *quota;				// Bodies each cell should place
+	uint32_t *offset;				// Where each cell's bodies start in the body array
+	uint32_t *placed;				// How many it managed
+
+	uint32_t parity;				// Pass being run, bit per axis
+	uint32_t parityDims[3];			// Cells of that parity along each axis
+} Scatter_t;
+
+static bool insideRegion(const ScatterParams_t *params, vec3 point)
+{
+	if(point.x<params->boxMin.x||point.y<params->boxMin.y||point.z<params->boxMin.z||
+	   point.x>=params->boxMax.x||point.y>=params->boxMax.y||point.z>=params->boxMax.z)
+		return false;
+
+	if(params->outerRadius<=0.0f)
+		return true;
+
+	const vec3 d=Vec3_Subv(point, params->center);
+	const float distanceSq=Vec3_Dot(d, d);
+
+	return distanceSq>=params->innerRadius*params->innerRadius&&distanceSq<params->outerRadius*params->outerRadius;
+}
+
+static inline vec3 cellMin(const Scatter_t *scatter, uint32_t x, uint32_t y, uint32_t z)
+{
+	return Vec3_Addv(scatter->params->boxMin, Vec3(x*scatter->cellSize, y*scatter->cellSize, z*scatter->cellSize));
+}
+
+// Points on a regular lattice through the cell that land inside the region, out of SCATTER_WEIGHT_SAMPLES^3
+static void weighCells(uint32_t begin, uint32_t end, void *arg)
+{
+	Scatter_t *scatter=(Scatter_t *)arg;
+	const float step=scatter->cellSize/SCATTER_WEIGHT_SAMPLES;
+
+	for(uint32_t i=begin;i<end;i++)
+	{
+		const uint32_t x=i%scatter->dims[0], y=(i/scatter->dims[0])%scatter->dims[1], z=i/(scatter->dims[0]*scatter->dims[1]);
+		const vec3 base=cellMin(scatter, x, y, z);
+		uint32_t inside=0;
+
+		for(uint32_t sz=0;sz<SCATTER_WEIGHT_SAMPLES;sz++)
+		{
+			for(uint32_t sy=0;sy<SCATTER_WEIGHT_SAMPLES;sy++)
+			{
+				for(uint32_t sx=0;sx<SCATTER_WEIGHT_SAMPLES;sx++)
+					inside+=insideRegion(scatter->params, Vec3_Addv(base, Vec3((sx+0.5f)*step, (sy+0.5f)*step, (sz+0.5f)*step)));
+			}
+		}
+
+		// Weight goes in quota for now, the share is worked out once every cell is weighed
+		scatter->quota[i]=inside;
+	}
+}
+
+static bool overlapsNeighbours(const Scatter_t *scatter, uint32_t x, uint32_t y, uint32_t z, vec3 position, float radius)
+{
+	for(int32_t dz=-1;dz<=1;dz++)
+	{
+		const int32_t nz=(int32_t)z+dz;
+
+		if(nz<0||nz>=(int32_t)scatter->dims[2])
+			continue;
+
+		for(int32_t dy=-1;dy<=1;dy++)
+		{
+			const int32_t ny=(int32_t)y+dy;
+
+			if(ny<0||ny>=(int32_t)scatter->dims[1])
+				continue;
+
+			for(int32_t dx=-1;dx<=1;dx++)
+			{
+				const int32_t nx=(int32_t)x+dx;
+
+				if(nx<0||nx>=(int32_t)scatter->dims[0])
+					continue;
+
+				const uint32_t cell=nx+scatter->dims[0]*(ny+scatter->dims[1]*nz);
+				const RigidBody_t *body=&scatter->bodies[scatter->offset[cell]];
+
+				for(uint32_t i=0;i<scatter->placed[cell];i++, body++)
+				{
+					const vec3 d=Vec3_Subv(position, body->position);
+					const float minDistance=radius+body->radius;
+
+					if(Vec3_Dot(d, d)<minDistance*minDistance)
+						return true;
+				}
+			}
+		}
+	}
+
+	return false;
+}
+
+// One pass worth of cells, none of them neighbours of each other
+static void fillCells(uint32_t begin, uint32_t end, void *arg)
+{
+	Scatter_t *scatter=(Scatter_t *)arg;
+	const ScatterParams_t *params=scatter->params;
+
+	for(uint32_t i=begin;i<end;i++)
+	{
+		const uint32_t x=((scatter->parity>>0)&1)+2*(i%scatter->parityDims[0]);
+		const uint32_t y=((scatter->parity>>1)&1)+2*((i/scatter->parityDims[0])%scatter->parityDims[1]);
+		const uint32_t z=((scatter->parity>>2)&1)+2*(i/(scatter->parityDims[0]*scatter->parityDims[1]));
+		const uint32_t cell=x+scatter->dims[0]*(y+scatter->dims[1]*z);
+
+		if(scatter->quota[cell]==0)
+			continue;
+
+		const vec3 base=cellMin(scatter, x, y, z);
+		const vec3 extent=Vec3(
+			fminf(scatter->cellSize, params->boxMax.x-base.x),
+			fminf(scatter->cellSize, params->boxMax.y-base.y),
+			fminf(scatter->cellSize, params->boxMax.z-base.z)
+		);
+
+		Random_t random;
+		Random_Init(&random, params->seed, cell);
+
+		RigidBody_t *bodies=&scatter->bodies[scatter->offset[cell]];
+		uint32_t attempts=0;
+
+		while(scatter->placed[cell]<scatter->quota[cell]&&attempts<params->maxAttempts*scatter->quota[cell])
+		{
+			attempts++;
+
+			const vec3 position=Vec3(
+				base.x+Random_Float(&random)*extent.x,
+				base.y+Random_Float(&random)*extent.y,
+				base.z+Random_Float(&random)*extent.z
+			);
+			const float radius=Random_FloatRange(&random, params->minRadius, params->maxRadius);
+
+			if(!insideRegion(params, position)||overlapsNeighbours(scatter, x, y, z, position, radius))
+				continue;
+
+			RigidBody_t *body=&bodies[scatter->placed[cell]++];
+
+			memset(body, 0, sizeof(RigidBody_t));
+			body->position=position;
+			body->radius=radius;
+		}
+	}
+}
+
+// Fills bodies with up to numBodies non-overlapping spheres (position and radius, everything else zeroed), spread evenly
+//     through the region. Returns how many were placed, fewer only if the region is too crowded to fit them.
+// Runs across the pool's workers if there is one, and can be called from a job or a thread outside the pool.
+uint32_t Scatter_Generate(ThreadPool_t *pool, const ScatterParams_t *params, RigidBody_t *bodies, uint32_t numBodies)
+{
+	if(params==NULL||bodies==NULL||numBodies==0||params->maxRadius<=0.0f)
+		return 0;
+
+	Scatter_t scatter={ .params=params, .bodies=bodies };
+	const vec3 size=Vec3_Subv(params->boxMax, params->boxMin);
+
+	if(size.x<=0.0f||size.y<=0.0f||size.z<=0.0f)
+		return 0;
+
+	// At least a diameter across, and no more cells than there are bodies to put in them
+	scatter.cellSize=fmaxf(params->maxRadius*2.0f, cbrtf(size.x*size.y*size.z/numBodies));
+	scatter.dims[0]=(uint32_t)ceilf(size.x/scatter.cellSize);
+	scatter.dims[1]=(uint32_t)ceilf(size.y/scatter.cellSize);
+	scatter.dims[2]=(uint32_t)ceilf(size.z/scatter.cellSize);
+
+	const uint32_t numCells=scatter.dims[0]*scatter.dims[1]*scatter.dims[2];
+
+	scatter.quota=(uint32_t *)Zone_Malloc(zone, sizeof(uint32_t)*numCells*3);
+
+	if(scatter.quota==NULL)
+	{
+		DBGPRINTF(DEBUG_ERROR, "Scatter_Generate: Unable to allocate memory.\n");
+		return 0;
+	}
+
+	scatter.offset=scatter.quota+numCells;
+	scatter.placed=scatter.offset+numCells;
+
+	memset(scatter.placed, 0, sizeof(uint32_t)*numCells);
+
+	Thread_ParallelFor(pool, 0, numCells, SCATTER_GRAIN, weighCells, &scatter);
+
+	// Each cell's share of the bodies by systematic sampling over the running weight, adds up to exactly numBodies
+	uint64_t totalWeight=0;
+
+	for(uint32_t i=0;i<numCells;i++)
+		totalWeight+=scatter.quota[i];
+
+	if(totalWeight==0)
+	{
+		Zone_Free(zone, scatter.quota);
+		return 0;
+	}
+
+	uint64_t runningWeight=0;
+	uint32_t offset=0;
+
+	for(uint32_t i=0;i<numCells;i++)
+	{
+		const uint32_t first=(uint32_t)(runningWeight*numBodies/totalWeight);
+
+		runningWeight+=scatter.quota[i];
+
+		scatter.quota[i]=(uint32_t)(runningWeight*numBodies/totalWeight)-first;
+		scatter.offset[i]=offset;
+		offset+=scatter.quota[i];
+	}
+
+	for(scatter.parity=0;scatter.parity<8;scatter.parity++)
+	{
+		for(uint32_t axis=0;axis<3;axis++)
+			scatter.parityDims[axis]=(scatter.dims[axis]+1-((scatter.parity>>axis)&1))/2;
+
+		Thread_ParallelFor(pool, 0, scatter.parityDims[0]*scatter.parityDims[1]*scatter.parityDims[2], SCATTER_GRAIN, fillCells, &scatter);
+	}
+
+	// Close up the gaps left by any cell that came up short, bodies only ever move down
+	uint32_t numPlaced=0;
+
+	for(uint32_t i=0;i<numCells;i++)
+	{
+		if(numPlaced!=scatter.offset[i])
+			memmove(&bodies[numPlaced], &bodies[scatter.offset[i]], sizeof(RigidBody_t)*scatter.placed[i]);
+
+		numPlaced+=scatter.placed[i];
+	}
+
+	Zone_Free(zone, scatter.quota);
+
+	return numPlaced;
+}
@@ -0,0 +1,30 @@
+#ifndef __SCATTER_H__
+#define __SCATTER_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "../math/math.h"
+#include "../physics/physics.h"
+#include "../system/threads.h"
+
+// Non-overlapping placement of spheres with varying radii (dart throwing, Poisson-disk style).
+// The region is split into grid cells at least one body diameter across, so a body can only touch bodies
+//     in its own and the 26 neighbouring cells. Cells are filled in eight passes by coordinate parity,
+//     cells of the same parity are never neighbours, so each pass runs its cells in parallel.
+// Every cell draws from its own random stream (seed, cell index) and gets a share of the bodies
+//     proportional to how much of it is inside the region, so the result depends only on the parameters,
+//     not on thread count or timing.
+
+typedef struct
+{
+	vec3 boxMin, boxMax;			// Region is this box...
+	vec3 center;					// ...cut down to the spherical shell around center, if outerRadius isn't zero
+	float innerRadius, outerRadius;
+	float minRadius, maxRadius;		// Body radii, uniform between these
+	uint64_t seed;
+	uint32_t maxAttempts;			// Darts per body before its cell gives up on it
+} ScatterParams_t;
+
+uint32_t Scatter_Generate(ThreadPool_t *pool, const ScatterParams_t *params, RigidBody_t *bodies, uint32_t numBodies);
+
+#endif